@@ -0,0 +1,235 @@
+/**
+ * @file ApplianceDescriptor.hpp
+ * @brief Compile-time description of the appliance selected by DONE_MATTER_DEVICE
+ *
+ * One constexpr descriptor per appliance lists its Matter device type and server
+ * clusters, its sensors, actuators and UI screens, and its control limits.
+ * Appliance::Current is the one picked in Kconfig. Code tests it with
+ * `if constexpr`, or specializes templates on Appliance::Kind, so paths for the
+ * other appliances are never instantiated and do not reach the image. Everything
+ * here is evaluated at compile time; nothing is stored in RAM.
+ *
+ * @code
+ * if constexpr (Appliance::Current.HasCluster(MatterCluster::OvenMode)) {
+ *     // only compiled into oven builds
+ * }
+ * @endcode
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "sdkconfig.h"
+
+enum class ApplianceKind : uint8_t
+{
+    CoffeeMaker,
+    AirFryer,
+    Oven,
+    Refrigerator,
+};
+
+/**
+ * @brief Matter cluster IDs used by the appliances
+ */
+namespace MatterCluster
+{
+constexpr uint32_t OnOff = 0x0006;
+constexpr uint32_t OvenCavityOperationalState = 0x0048;
+constexpr uint32_t OvenMode = 0x0049;
+constexpr uint32_t ModeSelect = 0x0050;
+constexpr uint32_t RefrigeratorAndTemperatureControlledCabinetMode = 0x0052;
+constexpr uint32_t TemperatureControl = 0x0056;
+constexpr uint32_t RefrigeratorAlarm = 0x0057;
+constexpr uint32_t OperationalState = 0x0060;
+constexpr uint32_t TemperatureMeasurement = 0x0402;
+}
+
+struct ApplianceDescriptor
+{
+    static constexpr uint8_t mMaxClusters = 8;
+
+    enum Sensor : uint16_t
+    {
+        SENSOR_CAVITY_TEMP = 1 << 0,
+        SENSOR_FOOD_PROBE = 1 << 1,
+        SENSOR_DOOR = 1 << 2,
+        SENSOR_WATER_LEVEL = 1 << 3,
+        SENSOR_BOILER_TEMP = 1 << 4,
+        SENSOR_CABINET_TEMP = 1 << 5,
+    };
+
+    enum Actuator : uint16_t
+    {
+        ACTUATOR_HEATER = 1 << 0,
+        ACTUATOR_TOP_HEATER = 1 << 1,
+        ACTUATOR_BOTTOM_HEATER = 1 << 2,
+        ACTUATOR_FAN = 1 << 3,
+        ACTUATOR_LAMP = 1 << 4,
+        ACTUATOR_PUMP = 1 << 5,
+        ACTUATOR_GRINDER = 1 << 6,
+        ACTUATOR_COMPRESSOR = 1 << 7,
+    };
+
+    enum Screen : uint16_t
+    {
+        SCREEN_HOME = 1 << 0,
+        SCREEN_RECIPES = 1 << 1,
+        SCREEN_COOK_PROGRESS = 1 << 2,
+        SCREEN_TEMPERATURE = 1 << 3,
+        SCREEN_TIMER = 1 << 4,
+        SCREEN_SETTINGS = 1 << 5,
+    };
+
+    struct ControlLimits
+    {
+        int16_t MinTempC;
+        int16_t MaxTempC;
+        uint8_t TempStepC;
+        uint8_t MaxProgramStages;   ///< 0 when the appliance runs no cook programs
+        uint16_t MaxProgramMinutes;
+    };
+
+    ApplianceKind Kind;
+    const char *Name;
+    uint16_t MatterDeviceType;      ///< 0 when Matter defines no device type for it
+    uint32_t Clusters[mMaxClusters];///< Server clusters of the appliance endpoint, 0 terminated
+    uint16_t Sensors;
+    uint16_t Actuators;
+    uint16_t Screens;
+    ControlLimits Limits;
+
+    constexpr bool HasCluster(uint32_t cluster) const
+    {
+        for (uint32_t id : Clusters) {
+            if (id == cluster) {
+                return cluster != 0;
+            }
+        }
+        return false;
+    }
+
+    constexpr bool HasSensor(uint16_t sensor) const { return (Sensors & sensor) == sensor; }
+    constexpr bool HasActuator(uint16_t actuator) const { return (Actuators & actuator) == actuator; }
+    constexpr bool HasScreen(uint16_t screen) const { return (Screens & screen) == screen; }
+    constexpr bool RunsPrograms() const { return Limits.MaxProgramStages > 0; }
+
+    constexpr uint8_t ClusterCount() const
+    {
+        uint8_t count = 0;
+        while (count < mMaxClusters && Clusters[count] != 0) {
+            count++;
+        }
+        return count;
+    }
+
+    /**
+     * @brief Checked by static_assert, so a broken descriptor fails the build
+     */
+    constexpr bool IsValid() const
+    {
+        if (Limits.MinTempC >= Limits.MaxTempC || Limits.TempStepC == 0) {
+            return false;
+        }
+        if (RunsPrograms() != HasScreen(SCREEN_RECIPES)) {
+            return false;
+        }
+        // A Matter device type needs at least one cluster and no cluster twice
+        if (MatterDeviceType != 0 && ClusterCount() == 0) {
+            return false;
+        }
+        for (uint8_t i = 0; i < ClusterCount(); i++) {
+            for (uint8_t j = i + 1; j < ClusterCount(); j++) {
+                if (Clusters[i] == Clusters[j]) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+template <ApplianceKind Kind>
+struct ApplianceTraits;
+
+template <>
+struct ApplianceTraits<ApplianceKind::CoffeeMaker>
+{
+    // Matter has no coffee maker device type
+    static constexpr ApplianceDescriptor Descriptor = {
+        ApplianceKind::CoffeeMaker, "Coffee Maker", 0,
+        { MatterCluster::OnOff, MatterCluster::ModeSelect, MatterCluster::OperationalState },
+        ApplianceDescriptor::SENSOR_WATER_LEVEL | ApplianceDescriptor::SENSOR_BOILER_TEMP,
+        ApplianceDescriptor::ACTUATOR_HEATER | ApplianceDescriptor::ACTUATOR_PUMP |
+            ApplianceDescriptor::ACTUATOR_GRINDER,
+        ApplianceDescriptor::SCREEN_HOME | ApplianceDescriptor::SCREEN_RECIPES |
+            ApplianceDescriptor::SCREEN_COOK_PROGRESS | ApplianceDescriptor::SCREEN_SETTINGS,
+        { 85, 96, 1, 4, 10 },
+    };
+};
+
+template <>
+struct ApplianceTraits<ApplianceKind::AirFryer>
+{
+    static constexpr ApplianceDescriptor Descriptor = {
+        ApplianceKind::AirFryer, "Air Fryer", 0,
+        { MatterCluster::OnOff, MatterCluster::ModeSelect, MatterCluster::OperationalState,
+          MatterCluster::TemperatureControl },
+        ApplianceDescriptor::SENSOR_CAVITY_TEMP,
+        ApplianceDescriptor::ACTUATOR_HEATER | ApplianceDescriptor::ACTUATOR_FAN,
+        ApplianceDescriptor::SCREEN_HOME | ApplianceDescriptor::SCREEN_RECIPES |
+            ApplianceDescriptor::SCREEN_COOK_PROGRESS | ApplianceDescriptor::SCREEN_TEMPERATURE |
+            ApplianceDescriptor::SCREEN_TIMER | ApplianceDescriptor::SCREEN_SETTINGS,
+        { 80, 200, 5, 4, 60 },
+    };
+};
+
+template <>
+struct ApplianceTraits<ApplianceKind::Oven>
+{
+    static constexpr ApplianceDescriptor Descriptor = {
+        ApplianceKind::Oven, "Oven", 0x007B,
+        { MatterCluster::OvenCavityOperationalState, MatterCluster::OvenMode,
+          MatterCluster::TemperatureControl, MatterCluster::TemperatureMeasurement, MatterCluster::OnOff },
+        ApplianceDescriptor::SENSOR_CAVITY_TEMP | ApplianceDescriptor::SENSOR_FOOD_PROBE |
+            ApplianceDescriptor::SENSOR_DOOR,
+        ApplianceDescriptor::ACTUATOR_TOP_HEATER | ApplianceDescriptor::ACTUATOR_BOTTOM_HEATER |
+            ApplianceDescriptor::ACTUATOR_FAN | ApplianceDescriptor::ACTUATOR_LAMP,
+        ApplianceDescriptor::SCREEN_HOME | ApplianceDescriptor::SCREEN_RECIPES |
+            ApplianceDescriptor::SCREEN_COOK_PROGRESS | ApplianceDescriptor::SCREEN_TEMPERATURE |
+            ApplianceDescriptor::SCREEN_TIMER | ApplianceDescriptor::SCREEN_SETTINGS,
+        { 30, 250, 5, 8, 720 },
+    };
+};
+
+template <>
+struct ApplianceTraits<ApplianceKind::Refrigerator>
+{
+    static constexpr ApplianceDescriptor Descriptor = {
+        ApplianceKind::Refrigerator, "Refrigerator", 0x0070,
+        { MatterCluster::RefrigeratorAndTemperatureControlledCabinetMode, MatterCluster::RefrigeratorAlarm,
+          MatterCluster::TemperatureControl, MatterCluster::TemperatureMeasurement },
+        ApplianceDescriptor::SENSOR_CABINET_TEMP | ApplianceDescriptor::SENSOR_DOOR,
+        ApplianceDescriptor::ACTUATOR_COMPRESSOR | ApplianceDescriptor::ACTUATOR_LAMP,
+        ApplianceDescriptor::SCREEN_HOME | ApplianceDescriptor::SCREEN_TEMPERATURE |
+            ApplianceDescriptor::SCREEN_SETTINGS,
+        { -24, 8, 1, 0, 0 },
+    };
+};
+
+namespace Appliance
+{
+#if defined(CONFIG_DONE_MATTER_DEVICE_OVEN)
+constexpr ApplianceKind Kind = ApplianceKind::Oven;
+#elif defined(CONFIG_DONE_MATTER_DEVICE_AIRFRYER)
+constexpr ApplianceKind Kind = ApplianceKind::AirFryer;
+#elif defined(CONFIG_DONE_MATTER_DEVICE_REFRIGERATOR)
+constexpr ApplianceKind Kind = ApplianceKind::Refrigerator;
+#else
+constexpr ApplianceKind Kind = ApplianceKind::CoffeeMaker;
+#endif
+
+constexpr const ApplianceDescriptor &Current = ApplianceTraits<Kind>::Descriptor;
+
+static_assert(Current.IsValid(), "appliance descriptor is inconsistent");
+}
@@ -0,0 +1,611 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_COMPRESSED_OTA
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_console.h"
+#include "esp_http_client.h"
+#ifdef CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+#include "esp_crt_bundle.h"
+#endif
+#include "CompressedOta.hpp"
+#ifdef CONFIG_DONE_POWER_MANAGER
+#include "PowerManager.hpp"
+#endif
+
+static const char *TAG = "CompressedOta";
+
+static constexpr uint32_t BLOCK_SIZE = 4096;
+static constexpr uint32_t BLOCKS_PER_STAGE = CONFIG_DONE_COMPRESSED_OTA_BLOCKS;
+static constexpr uint32_t DECODE_STACK_SIZE = 2048;
+static constexpr uint32_t FLASH_STACK_SIZE = 4096;
+static constexpr uint32_t HTTP_READ_SIZE = 1460;
+// Decoding and flash writes on different cores, so neither waits on the other
+static constexpr BaseType_t FLASH_CORE = 0;
+static constexpr BaseType_t DECODE_CORE = portNUM_PROCESSORS - 1;
+
+#ifdef CONFIG_DONE_POWER_MANAGER
+/**
+ * @brief PM owner held from Begin() to End(), so the pipeline never waits on a wake-up
+ */
+static PowerManager::Owner PmOwner()
+{
+    static const PowerManager::Owner owner = PowerManager::RegisterOwner("OTA");
+    return owner;
+}
+#endif
+
+CompressedOta::CompressedOta() :
+    mFreeIn(nullptr),
+    mFullIn(nullptr),
+    mFreeOut(nullptr),
+    mFullOut(nullptr),
+    mDecodeTask(nullptr),
+    mFlashTask(nullptr),
+    mWaiter(nullptr),
+    mArena(nullptr),
+    mBlocks(nullptr),
+    mFillIn(nullptr),
+    mFillOut(nullptr),
+    mHeader(),
+    mHeaderFill(0),
+    mState(DecodeState::Header),
+    mWindow(nullptr),
+    mWindowMask(0),
+    mWindowPos(0),
+    mBits(0),
+    mBitCount(0),
+    mOffset(0),
+    mCount(0),
+    mProduced(0),
+    mTarget(nullptr),
+    mOtaHandle(0),
+    mError(ESP_OK),
+    mStartUs(0),
+    mStallUs(0),
+    mDecodeUs(0),
+    mFlashUs(0),
+    mFreeHeapAtBegin(0),
+    mMinFreeHeap(0),
+    mStats()
+{
+}
+
+CompressedOta::~CompressedOta()
+{
+    if (mDecodeTask != nullptr) {
+        Abort();
+    }
+    FreeBuffers();
+}
+
+esp_err_t CompressedOta::Begin()
+{
+    if (mDecodeTask != nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    mTarget = esp_ota_get_next_update_partition(nullptr);
+    if (mTarget == nullptr) {
+        ESP_LOGE(TAG, "no inactive app slot in this partition table");
+        return ESP_ERR_NOT_FOUND;
+    }
+    mFreeHeapAtBegin = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    mMinFreeHeap = mFreeHeapAtBegin;
+
+    mArena = static_cast<uint8_t *>(heap_caps_malloc(2 * BLOCKS_PER_STAGE * BLOCK_SIZE,
+                                                     MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    mBlocks = static_cast<Block *>(heap_caps_calloc(2 * BLOCKS_PER_STAGE, sizeof(Block), MALLOC_CAP_INTERNAL));
+    mFreeIn = xQueueCreate(BLOCKS_PER_STAGE, sizeof(Block *));
+    mFullIn = xQueueCreate(BLOCKS_PER_STAGE, sizeof(Block *));
+    mFreeOut = xQueueCreate(BLOCKS_PER_STAGE, sizeof(Block *));
+    mFullOut = xQueueCreate(BLOCKS_PER_STAGE, sizeof(Block *));
+    if (mArena == nullptr || mBlocks == nullptr || mFreeIn == nullptr || mFullIn == nullptr ||
+        mFreeOut == nullptr || mFullOut == nullptr) {
+        FreeBuffers();
+        return ESP_ERR_NO_MEM;
+    }
+    for (uint32_t i = 0; i < 2 * BLOCKS_PER_STAGE; i++) {
+        Block *block = &mBlocks[i];
+        block->Data = mArena + i * BLOCK_SIZE;
+        block->Length = 0;
+        xQueueSend((i < BLOCKS_PER_STAGE) ? mFreeIn : mFreeOut, &block, 0);
+    }
+
+    esp_err_t err = esp_ota_begin(mTarget, OTA_WITH_SEQUENTIAL_WRITES, &mOtaHandle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin: %s", esp_err_to_name(err));
+        FreeBuffers();
+        return err;
+    }
+
+    mFillIn = nullptr;
+    mFillOut = nullptr;
+    mHeaderFill = 0;
+    mState = DecodeState::Header;
+    mWindowPos = 0;
+    mBits = 0;
+    mBitCount = 0;
+    mProduced = 0;
+    mError = ESP_OK;
+    mStallUs = 0;
+    mDecodeUs = 0;
+    mFlashUs = 0;
+    memset(&mStats, 0, sizeof(mStats));
+    mStartUs = esp_timer_get_time();
+
+    if (xTaskCreatePinnedToCore(FlashTask, "OtaFlash", FLASH_STACK_SIZE, this,
+                                tskIDLE_PRIORITY + 3, &mFlashTask, FLASH_CORE) != pdPASS) {
+        esp_ota_abort(mOtaHandle);
+        FreeBuffers();
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(DecodeTask, "OtaDecode", DECODE_STACK_SIZE, this,
+                                tskIDLE_PRIORITY + 3, &mDecodeTask, DECODE_CORE) != pdPASS) {
+        // The flash task exits on the end-of-stream block
+        Block *end = nullptr;
+        xQueueReceive(mFreeOut, &end, portMAX_DELAY);
+        end->Length = 0;
+        mWaiter = xTaskGetCurrentTaskHandle();
+        xQueueSend(mFullOut, &end, portMAX_DELAY);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        mFlashTask = nullptr;
+        esp_ota_abort(mOtaHandle);
+        FreeBuffers();
+        return ESP_ERR_NO_MEM;
+    }
+#ifdef CONFIG_DONE_POWER_MANAGER
+    PowerManager::Acquire(PmOwner());
+#endif
+    return ESP_OK;
+}
+
+esp_err_t CompressedOta::Write(const uint8_t *data, size_t length)
+{
+    if (mDecodeTask == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    mStats.CompressedBytes += length;
+    while (length > 0)
+    {
+        const esp_err_t err = mError;
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (mFillIn == nullptr) {
+            const int64_t waitStartUs = esp_timer_get_time();
+            xQueueReceive(mFreeIn, &mFillIn, portMAX_DELAY);
+            mStallUs += esp_timer_get_time() - waitStartUs;
+            mFillIn->Length = 0;
+        }
+        const size_t take = std::min<size_t>(length, BLOCK_SIZE - mFillIn->Length);
+        memcpy(mFillIn->Data + mFillIn->Length, data, take);
+        mFillIn->Length += take;
+        data += take;
+        length -= take;
+        if (mFillIn->Length == BLOCK_SIZE) {
+            xQueueSend(mFullIn, &mFillIn, portMAX_DELAY);
+            mFillIn = nullptr;
+        }
+    }
+    return ESP_OK;
+}
+
+void CompressedOta::StopTasks()
+{
+    if (mFillIn != nullptr && mFillIn->Length > 0) {
+        xQueueSend(mFullIn, &mFillIn, portMAX_DELAY);
+        mFillIn = nullptr;
+    }
+    if (mFillIn == nullptr) {
+        xQueueReceive(mFreeIn, &mFillIn, portMAX_DELAY);
+    }
+    mFillIn->Length = 0;
+    mWaiter = xTaskGetCurrentTaskHandle();
+    xQueueSend(mFullIn, &mFillIn, portMAX_DELAY);
+    mFillIn = nullptr;
+
+    // Each task notifies as the last thing it does with this object and its queues, then
+    // deletes itself; the flash task alone is not enough, the decoder may still be in xQueueSend()
+    for (uint32_t ended = 0; ended < 2;) {
+        ended += ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    mDecodeTask = nullptr;
+    mFlashTask = nullptr;
+#ifdef CONFIG_DONE_POWER_MANAGER
+    PowerManager::Release(PmOwner());
+#endif
+}
+
+esp_err_t CompressedOta::End()
+{
+    if (mDecodeTask == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    StopTasks();
+    SampleHeap();
+
+    esp_err_t err = mError;
+    if (err == ESP_OK) {
+        // Checks the image header and the appended SHA-256
+        err = esp_ota_end(mOtaHandle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "image rejected: %s", esp_err_to_name(err));
+        }
+    } else {
+        esp_ota_abort(mOtaHandle);
+    }
+
+    const int64_t totalUs = esp_timer_get_time() - mStartUs;
+    mStats.ImageBytes = mProduced;
+    mStats.TotalMs = totalUs / 1000;
+    mStats.ReceiveStallMs = mStallUs / 1000;
+    mStats.DecodeBusyMs = mDecodeUs / 1000;
+    mStats.FlashBusyMs = mFlashUs / 1000;
+    mStats.PipelineBytes = 2 * BLOCKS_PER_STAGE * (BLOCK_SIZE + sizeof(Block)) +
+                           ((mWindow != nullptr) ? (mWindowMask + 1) : 0) +
+                           DECODE_STACK_SIZE + FLASH_STACK_SIZE;
+    mStats.PeakHeapBytes = mFreeHeapAtBegin - mMinFreeHeap;
+    FreeBuffers();
+
+    ESP_LOGI(TAG, "%lu -> %lu bytes in %lu ms (%lu KB/s of image), heap peak %lu bytes (pipeline %lu)",
+             static_cast<unsigned long>(mStats.CompressedBytes),
+             static_cast<unsigned long>(mStats.ImageBytes),
+             static_cast<unsigned long>(mStats.TotalMs),
+             static_cast<unsigned long>((totalUs > 0) ? (mStats.ImageBytes * 1000ULL / totalUs) : 0),
+             static_cast<unsigned long>(mStats.PeakHeapBytes),
+             static_cast<unsigned long>(mStats.PipelineBytes));
+    ESP_LOGI(TAG, "busy: decode %lu ms, flash %lu ms (%lu KB/s while writing), receive stalled %lu ms",
+             static_cast<unsigned long>(mStats.DecodeBusyMs),
+             static_cast<unsigned long>(mStats.FlashBusyMs),
+             static_cast<unsigned long>((mFlashUs > 0) ? (mStats.ImageBytes * 1000ULL / mFlashUs) : 0),
+             static_cast<unsigned long>(mStats.ReceiveStallMs));
+
+    if (err != ESP_OK) {
+        return err;
+    }
+    return esp_ota_set_boot_partition(mTarget);
+}
+
+void CompressedOta::Abort()
+{
+    if (mDecodeTask == nullptr) {
+        return;
+    }
+    Fail(ESP_ERR_INVALID_STATE);
+    StopTasks();
+    esp_ota_abort(mOtaHandle);
+    FreeBuffers();
+}
+
+void CompressedOta::Fail(esp_err_t err)
+{
+    esp_err_t expected = ESP_OK;
+    if (mError.compare_exchange_strong(expected, err) && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "update failed at image offset %lu: %s",
+                 static_cast<unsigned long>(mProduced), esp_err_to_name(err));
+    }
+}
+
+void CompressedOta::SampleHeap()
+{
+    const size_t freeHeap = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    if (freeHeap < mMinFreeHeap) {
+        mMinFreeHeap = freeHeap;
+    }
+}
+
+void CompressedOta::FreeBuffers()
+{
+    heap_caps_free(mWindow);
+    heap_caps_free(mBlocks);
+    heap_caps_free(mArena);
+    mWindow = nullptr;
+    mBlocks = nullptr;
+    mArena = nullptr;
+    for (QueueHandle_t *queue : { &mFreeIn, &mFullIn, &mFreeOut, &mFullOut }) {
+        if (*queue != nullptr) {
+            vQueueDelete(*queue);
+            *queue = nullptr;
+        }
+    }
+}
+
+void CompressedOta::DecodeTask(void *arg)
+{
+    CompressedOta *self = static_cast<CompressedOta *>(arg);
+    while (true)
+    {
+        Block *block = nullptr;
+        xQueueReceive(self->mFullIn, &block, portMAX_DELAY);
+        if (block->Length == 0) {
+            break;
+        }
+        // After a failure keep draining, so Write() never blocks forever
+        if (self->mError == ESP_OK) {
+            const int64_t startUs = esp_timer_get_time();
+            self->Decode(block->Data, block->Length);
+            self->mDecodeUs += esp_timer_get_time() - startUs;
+        }
+        xQueueSend(self->mFreeIn, &block, portMAX_DELAY);
+    }
+
+    if (self->mError == ESP_OK && self->mState != DecodeState::Done) {
+        self->Fail(ESP_ERR_INVALID_SIZE);
+    }
+    self->PassOutput(true);
+    xTaskNotifyGive(self->mWaiter);
+    vTaskDelete(nullptr);
+}
+
+void CompressedOta::FlashTask(void *arg)
+{
+    CompressedOta *self = static_cast<CompressedOta *>(arg);
+    while (true)
+    {
+        Block *block = nullptr;
+        xQueueReceive(self->mFullOut, &block, portMAX_DELAY);
+        if (block->Length == 0) {
+            break;
+        }
+        if (self->mError == ESP_OK) {
+            const int64_t startUs = esp_timer_get_time();
+            const esp_err_t err = esp_ota_write(self->mOtaHandle, block->Data, block->Length);
+            self->mFlashUs += esp_timer_get_time() - startUs;
+            if (err != ESP_OK) {
+                self->Fail(err);
+            }
+            // Everything is allocated by now, the decoder window included
+            self->SampleHeap();
+        }
+        xQueueSend(self->mFreeOut, &block, portMAX_DELAY);
+    }
+    xTaskNotifyGive(self->mWaiter);
+    vTaskDelete(nullptr);
+}
+
+void CompressedOta::PassOutput(bool last)
+{
+    if (mFillOut != nullptr && mFillOut->Length > 0) {
+        xQueueSend(mFullOut, &mFillOut, portMAX_DELAY);
+        mFillOut = nullptr;
+    }
+    if (last) {
+        if (mFillOut == nullptr) {
+            xQueueReceive(mFreeOut, &mFillOut, portMAX_DELAY);
+        }
+        mFillOut->Length = 0;
+        xQueueSend(mFullOut, &mFillOut, portMAX_DELAY);
+        mFillOut = nullptr;
+    }
+}
+
+void CompressedOta::EmitByte(uint8_t value)
+{
+    if (mWindow != nullptr) {
+        mWindow[mWindowPos++ & mWindowMask] = value;
+    }
+    if (mFillOut == nullptr) {
+        // Waiting on the flash task is not decode time
+        const int64_t waitStartUs = esp_timer_get_time();
+        xQueueReceive(mFreeOut, &mFillOut, portMAX_DELAY);
+        mDecodeUs -= esp_timer_get_time() - waitStartUs;
+        mFillOut->Length = 0;
+    }
+    mFillOut->Data[mFillOut->Length++] = value;
+    mProduced++;
+    if (mFillOut->Length == BLOCK_SIZE) {
+        PassOutput(false);
+    }
+}
+
+bool CompressedOta::ReadBits(const uint8_t *&data, size_t &length, uint8_t count, uint32_t &value)
+{
+    while (mBitCount < count)
+    {
+        if (length == 0) {
+            return false;
+        }
+        mBits = (mBits << 8) | *data++;
+        length--;
+        mBitCount += 8;
+    }
+    mBitCount -= count;
+    value = (mBits >> mBitCount) & ((1UL << count) - 1);
+    mBits &= (1UL << mBitCount) - 1;
+    return true;
+}
+
+void CompressedOta::Decode(const uint8_t *data, size_t length)
+{
+    uint32_t value = 0;
+    while (true)
+    {
+        switch (mState) {
+        case DecodeState::Header: {
+            if (length == 0) {
+                return;
+            }
+            const size_t take = std::min<size_t>(length, sizeof(Header) - mHeaderFill);
+            memcpy(reinterpret_cast<uint8_t *>(&mHeader) + mHeaderFill, data, take);
+            data += take;
+            length -= take;
+            mHeaderFill += take;
+            if (mHeaderFill < sizeof(Header)) {
+                return;
+            }
+            const bool stored = (mHeader.WindowBits == 0) && (mHeader.LookaheadBits == 0);
+            if (memcmp(mHeader.Magic, "DHSZ", sizeof(mHeader.Magic)) != 0 ||
+                (!stored && (mHeader.WindowBits < 4 || mHeader.WindowBits > 15 ||
+                             mHeader.LookaheadBits < 3 || mHeader.LookaheadBits >= mHeader.WindowBits))) {
+                ESP_LOGE(TAG, "not a compressed image");
+                Fail(ESP_ERR_INVALID_ARG);
+                return;
+            }
+            if (mHeader.ImageSize == 0 || mHeader.ImageSize > mTarget->size) {
+                Fail(ESP_ERR_INVALID_SIZE);
+                return;
+            }
+            if (stored) {
+                // compress_ota.py could not shrink the image, the body is the image itself
+                mState = DecodeState::Stored;
+                break;
+            }
+            // heatshrink starts from a zeroed window
+            mWindow = static_cast<uint8_t *>(heap_caps_calloc(1, 1UL << mHeader.WindowBits,
+                                                              MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+            if (mWindow == nullptr) {
+                Fail(ESP_ERR_NO_MEM);
+                return;
+            }
+            mWindowMask = (1UL << mHeader.WindowBits) - 1;
+            mState = DecodeState::Tag;
+            break;
+        }
+        case DecodeState::Tag:
+            if (mProduced == mHeader.ImageSize) {
+                // Whatever follows is padding of the last byte
+                mState = DecodeState::Done;
+                break;
+            }
+            if (!ReadBits(data, length, 1, value)) {
+                return;
+            }
+            mState = (value != 0) ? DecodeState::Literal : DecodeState::Offset;
+            break;
+        case DecodeState::Literal:
+            if (!ReadBits(data, length, 8, value)) {
+                return;
+            }
+            EmitByte(static_cast<uint8_t>(value));
+            mState = DecodeState::Tag;
+            break;
+        case DecodeState::Offset:
+            if (!ReadBits(data, length, mHeader.WindowBits, value)) {
+                return;
+            }
+            mOffset = value + 1;
+            mState = DecodeState::Count;
+            break;
+        case DecodeState::Count:
+            if (!ReadBits(data, length, mHeader.LookaheadBits, value)) {
+                return;
+            }
+            mCount = std::min(value + 1, mHeader.ImageSize - mProduced);
+            mState = DecodeState::Copy;
+            break;
+        case DecodeState::Copy:
+            for (; mCount > 0; mCount--) {
+                EmitByte(mWindow[(mWindowPos - mOffset) & mWindowMask]);
+            }
+            mState = DecodeState::Tag;
+            break;
+        case DecodeState::Stored:
+            while (length > 0 && mProduced < mHeader.ImageSize) {
+                EmitByte(*data++);
+                length--;
+            }
+            if (mProduced < mHeader.ImageSize) {
+                return;
+            }
+            mState = DecodeState::Done;
+            break;
+        case DecodeState::Done:
+            return;
+        }
+    }
+}
+
+esp_err_t CompressedOta::Download(const char *url, Stats *stats)
+{
+#ifndef CONFIG_SECURE_SIGNED_ON_UPDATE
+    // Nothing checks who built the image, so at least check who sent it
+    if (strncmp(url, "https://", 8) != 0) {
+        ESP_LOGE(TAG, "%s: https required, app signatures are not verified on update", url);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+    esp_http_client_config_t config = {};
+    config.url = url;
+    config.timeout_ms = 10000;
+    config.buffer_size = HTTP_READ_SIZE;
+#ifdef CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+    config.crt_bundle_attach = esp_crt_bundle_attach;
+#endif
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: %s", url, esp_err_to_name(err));
+        esp_http_client_cleanup(client);
+        return err;
+    }
+    esp_http_client_fetch_headers(client);
+    if (esp_http_client_get_status_code(client) != 200) {
+        ESP_LOGE(TAG, "%s: HTTP %d", url, esp_http_client_get_status_code(client));
+        esp_http_client_cleanup(client);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint8_t *buffer = static_cast<uint8_t *>(heap_caps_malloc(HTTP_READ_SIZE, MALLOC_CAP_INTERNAL));
+    CompressedOta ota;
+    err = (buffer != nullptr) ? ota.Begin() : ESP_ERR_NO_MEM;
+    while (err == ESP_OK)
+    {
+        const int read = esp_http_client_read(client, reinterpret_cast<char *>(buffer), HTTP_READ_SIZE);
+        if (read < 0) {
+            err = ESP_FAIL;
+        } else if (read == 0) {
+            break;
+        } else {
+            err = ota.Write(buffer, read);
+        }
+    }
+    if (err == ESP_OK && !esp_http_client_is_complete_data_received(client)) {
+        ESP_LOGE(TAG, "connection closed early");
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK) {
+        err = ota.End();
+        if (stats != nullptr) {
+            *stats = ota.GetStats();
+        }
+    } else {
+        ota.Abort();
+    }
+
+    heap_caps_free(buffer);
+    esp_http_client_cleanup(client);
+    return err;
+}
+
+static int OtaCommand(int argc, char **argv)
+{
+    if (argc != 2) {
+        printf("usage: ota_z https://<host>/<file>\n");
+        return 1;
+    }
+    const esp_err_t err = CompressedOta::Download(argv[1]);
+    printf("ota_z: %s%s\n", esp_err_to_name(err), (err == ESP_OK) ? ", restart to boot it" : "");
+    return (err == ESP_OK) ? 0 : 1;
+}
+
+esp_err_t CompressedOta::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "ota_z",
+        .help = "Install a compressed image from tools/compress_ota.py: ota_z https://<host>/<file>",
+        .hint = nullptr,
+        .func = &OtaCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_COMPRESSED_OTA
@@ -0,0 +1,157 @@
+/**
+ * @file CompressedOta.hpp
+ * @brief Pipelined OTA of heatshrink-compressed app images
+ *
+ * Images are compressed on the host by tools/compress_ota.py. Download,
+ * decompression and flash writes overlap: the caller's Write() fills input
+ * blocks, a decoder task on the second core expands them into output blocks,
+ * and a flash task on the first core writes those with esp_ota_write(). The
+ * stages hand blocks over through queues, so a slow stage stalls the one
+ * before it instead of growing a buffer. RAM use is fixed: the blocks, the
+ * decoder window and two task stacks.
+ *
+ * The image is not authenticated here, so Download() only takes https URLs
+ * unless the bootloader config verifies app signatures on update
+ * (CONFIG_SECURE_SIGNED_ON_UPDATE), in which case esp_ota_end() rejects
+ * unsigned images. compressed_ota_test runs the pipeline on host threads.
+ *
+ * Stream format (little endian):
+ *   header: "DHSZ" u8 windowBits u8 lookaheadBits u16 reserved u32 imageSize
+ *   body:   heatshrink bitstream, MSB first; tag 1 + 8 bit literal, or
+ *           tag 0 + (windowBits) offset-1 + (lookaheadBits) count-1
+ *           With windowBits and lookaheadBits 0 the body is the image stored
+ *           as is, for images compression does not shrink.
+ *
+ * @note Only available when CONFIG_DONE_COMPRESSED_OTA is enabled.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_err.h"
+#include "esp_ota_ops.h"
+
+class CompressedOta
+{
+public:
+    struct Stats
+    {
+        uint32_t CompressedBytes;
+        uint32_t ImageBytes;
+        uint32_t TotalMs;        ///< Begin() to End()
+        uint32_t ReceiveStallMs; ///< Write() waiting for a free input block
+        uint32_t DecodeBusyMs;
+        uint32_t FlashBusyMs;
+        uint32_t PipelineBytes;  ///< Blocks, decoder window and task stacks, as planned
+        uint32_t PeakHeapBytes;  ///< Internal heap taken from Begin() to End(), measured; includes other tasks
+    };
+
+    CompressedOta();
+    ~CompressedOta();
+
+    CompressedOta(const CompressedOta &) = delete;
+    CompressedOta &operator=(const CompressedOta &) = delete;
+
+    /**
+     * @brief Allocate the pipeline, start its tasks and open the inactive app slot
+     */
+    esp_err_t Begin();
+
+    /**
+     * @brief Feed compressed bytes in order; blocks while the pipeline is full
+     */
+    esp_err_t Write(const uint8_t *data, size_t length);
+
+    /**
+     * @brief Drain the pipeline, validate the image and select it as boot partition
+     */
+    esp_err_t End();
+
+    /**
+     * @brief Stop the pipeline and discard the partial image
+     */
+    void Abort();
+
+    const Stats &GetStats() const { return mStats; }
+
+    /**
+     * @brief Fetch a compressed image over HTTPS and install it
+     * @param stats Filled with the pipeline statistics when not null
+     */
+    static esp_err_t Download(const char *url, Stats *stats = nullptr);
+
+    /**
+     * @brief Register the `ota_z <url>` console command
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+    struct Block
+    {
+        uint8_t *Data;
+        uint32_t Length; ///< 0 marks the end of the stream
+    };
+
+    enum class DecodeState : uint8_t { Header, Tag, Literal, Offset, Count, Copy, Stored, Done };
+
+    struct __attribute__((packed)) Header
+    {
+        char Magic[4];
+        uint8_t WindowBits;
+        uint8_t LookaheadBits;
+        uint16_t Reserved;
+        uint32_t ImageSize;
+    };
+
+    static void DecodeTask(void *arg);
+    static void FlashTask(void *arg);
+    void Decode(const uint8_t *data, size_t length);
+    bool ReadBits(const uint8_t *&data, size_t &length, uint8_t count, uint32_t &value);
+    void EmitByte(uint8_t value);
+    void PassOutput(bool last);
+    void Fail(esp_err_t err);
+    void StopTasks();
+    void FreeBuffers();
+    void SampleHeap();
+
+    QueueHandle_t mFreeIn;
+    QueueHandle_t mFullIn;
+    QueueHandle_t mFreeOut;
+    QueueHandle_t mFullOut;
+    TaskHandle_t mDecodeTask;
+    TaskHandle_t mFlashTask;
+    TaskHandle_t mWaiter;   ///< Notified by each task once it is done with the pipeline
+    uint8_t *mArena;        ///< All input and output blocks in one allocation
+    Block *mBlocks;
+    Block *mFillIn;         ///< Input block being filled by Write()
+    Block *mFillOut;        ///< Output block being filled by the decoder
+
+    // Decoder, only touched by the decode task
+    Header mHeader;
+    uint8_t mHeaderFill;
+    DecodeState mState;
+    uint8_t *mWindow;
+    uint32_t mWindowMask;
+    uint32_t mWindowPos;
+    uint32_t mBits;
+    uint8_t mBitCount;
+    uint32_t mOffset;
+    uint32_t mCount;
+    uint32_t mProduced;
+
+    const esp_partition_t *mTarget;
+    esp_ota_handle_t mOtaHandle;
+    std::atomic<esp_err_t> mError;
+    int64_t mStartUs;
+    int64_t mStallUs;
+    int64_t mDecodeUs;
+    int64_t mFlashUs;
+    size_t mFreeHeapAtBegin;
+    size_t mMinFreeHeap;    ///< Sampled by the flash task, then by End()
+    Stats mStats;
+};
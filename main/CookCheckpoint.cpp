@@ -0,0 +1,160 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_COOK_CHECKPOINT
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include "bootloader_common.h"
+#include "esp_log.h"
+#include "esp_console.h"
+#include "esp_rom_crc.h"
+#include "FastBoot.hpp"
+#include "CookCheckpoint.hpp"
+
+static const char *TAG = "CookCheckpoint";
+
+static_assert(sizeof(CookCheckpoint::Session) == 20, "keep the checkpoint compact, it is written every tick");
+
+// The bootloader reserves this at the top of RTC fast memory and neither loads nor clears it on a reset
+CookCheckpoint::Slot (&CookCheckpoint::mSlots)[2] =
+    *reinterpret_cast<CookCheckpoint::Slot (*)[2]>(bootloader_common_get_rtc_retain_mem()->custom);
+uint32_t CookCheckpoint::mSequence = 0;
+uint8_t CookCheckpoint::mNext = 0;
+bool CookCheckpoint::mActive = false;
+bool CookCheckpoint::mRecovered = false;
+CookCheckpoint::Session CookCheckpoint::mRecoveredSession = {};
+
+uint32_t CookCheckpoint::SlotCrc(const Slot &slot)
+{
+    return esp_rom_crc32_le(mMagic, reinterpret_cast<const uint8_t *>(&slot), offsetof(Slot, Crc));
+}
+
+int CookCheckpoint::Latest()
+{
+    const bool valid0 = mSlots[0].Crc == SlotCrc(mSlots[0]);
+    const bool valid1 = mSlots[1].Crc == SlotCrc(mSlots[1]);
+    if (valid0 && valid1) {
+        // Serial number arithmetic, the sequence may wrap
+        return (static_cast<int32_t>(mSlots[1].Sequence - mSlots[0].Sequence) > 0) ? 1 : 0;
+    }
+    return valid0 ? 0 : (valid1 ? 1 : -1);
+}
+
+bool CookCheckpoint::Restore()
+{
+    mRecovered = false;
+    const int latest = Latest();
+    if (latest < 0) {
+        // Power-on, or both slots torn: start over from slot 0
+        mSequence = 0;
+        mNext = 0;
+        mActive = false;
+        return false;
+    }
+
+    const Slot &slot = mSlots[latest];
+    mSequence = slot.Sequence;
+    mNext = static_cast<uint8_t>(latest ^ 1);
+    mActive = slot.Data.ProgramId != 0;
+    if (!mActive) {
+        return false;
+    }
+
+    if (!FastBoot::IsWarmBoot()) {
+        ESP_LOGW(TAG, "cold boot, program %u at stage %u is not resumed",
+                 slot.Data.ProgramId, slot.Data.Stage);
+        Clear();
+        return false;
+    }
+    mRecoveredSession = slot.Data;
+    mRecovered = true;
+    ESP_LOGW(TAG, "resuming program %u stage %u, %lu s in, target %d (0.1 C)",
+             slot.Data.ProgramId, slot.Data.Stage,
+             static_cast<unsigned long>(slot.Data.TotalElapsedMs / 1000), slot.Data.TargetDeciC);
+    return true;
+}
+
+bool CookCheckpoint::TakeRecovered(Session &session)
+{
+    if (!mRecovered) {
+        return false;
+    }
+    session = mRecoveredSession;
+    mRecovered = false;
+    return true;
+}
+
+void CookCheckpoint::Write(const Session &session)
+{
+    Slot slot;
+    slot.Sequence = mSequence + 1;
+    slot.Data = session;
+    slot.Crc = SlotCrc(slot);
+
+    // Overwrite the older slot, CRC last. Invalidating it first means a torn slot
+    // never holds a valid CRC, not even one a torn earlier write left behind, so
+    // Restore() sees either this checkpoint complete or the previous one.
+    Slot &target = mSlots[mNext];
+    target.Crc = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    target.Sequence = slot.Sequence;
+    target.Data = slot.Data;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    target.Crc = slot.Crc;
+    mSequence = slot.Sequence;
+    mNext ^= 1;
+
+    // After the checkpoint, so a warm boot always finds one
+    const bool active = session.ProgramId != 0;
+    if (active != mActive) {
+        mActive = active;
+        FastBoot::SetCookActive(active);
+    }
+}
+
+void CookCheckpoint::Clear()
+{
+    // An idle checkpoint rather than erasing both slots, which a reset could interrupt half way
+    const Session idle = {};
+    Write(idle);
+}
+
+int CookCheckpoint::ConsoleCommand(int argc, char **argv)
+{
+    (void)argv;
+    if (argc != 1) {
+        printf("usage: checkpoint\n");
+        return 1;
+    }
+    const int latest = Latest();
+    if (latest < 0) {
+        printf("no checkpoint\n");
+        return 0;
+    }
+    const Session &data = mSlots[latest].Data;
+    printf("slot %d, sequence %lu: ", latest, static_cast<unsigned long>(mSlots[latest].Sequence));
+    if (data.ProgramId == 0) {
+        printf("idle\n");
+        return 0;
+    }
+    printf("program %u stage %u flags 0x%02x actuators 0x%04x target %d probe %d (0.1 C), stage %lu ms, total %lu ms\n",
+           data.ProgramId, data.Stage, data.Flags, data.Actuators, data.TargetDeciC, data.ProbeTargetDeciC,
+           static_cast<unsigned long>(data.StageElapsedMs), static_cast<unsigned long>(data.TotalElapsedMs));
+    return 0;
+}
+
+esp_err_t CookCheckpoint::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "checkpoint",
+        .help = "Print the cook session checkpoint kept in RTC memory",
+        .hint = nullptr,
+        .func = &ConsoleCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_COOK_CHECKPOINT
@@ -0,0 +1,113 @@
+/**
+ * @file CookCheckpoint.hpp
+ * @brief Crash-safe checkpoint of the running cook session in RTC memory
+ *
+ * The session (program, stage, targets, elapsed times) is written whenever
+ * it changes, through OvenState: every OvenState::Update() that changes one of
+ * its fields writes it, under the OvenState lock. It goes into one of two slots
+ * in the RTC fast memory the bootloader reserves with
+ * CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC; the bootloader neither loads nor
+ * clears it on a reset, so it survives watchdog, panic and software resets.
+ * Only these 56 bytes move to fast memory, the other RTC data stays in RTC
+ * slow memory. Each slot carries a sequence number and a CRC. A write always
+ * goes to the slot that does not hold the latest checkpoint. It clears that
+ * slot's CRC first and stores the new CRC last, so a reset in the middle of a
+ * write leaves the previous checkpoint as the latest valid one. A write costs
+ * a 28-byte copy and a ROM CRC.
+ *
+ * app_main calls Restore() right after FastBoot::Begin(), before any service
+ * starts. On a warm boot (see FastBoot.hpp) the latest running session is kept
+ * and OvenState::ResumeCook() takes it with TakeRecovered() and puts it back
+ * into the snapshot, where the cook control picks it up. The time spent in the
+ * reset itself is not counted as elapsed. On a cold boot the session is closed
+ * instead.
+ *
+ * Write() and Clear() are not thread-safe; OvenState calls them with its lock
+ * held. Write() also sets FastBoot::SetCookActive(). test/CookCheckpointTest.cpp
+ * resets the board in every step of a write.
+ *
+ * @note Only available when CONFIG_DONE_COOK_CHECKPOINT is enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+class CookCheckpoint
+{
+public:
+    struct Session
+    {
+        uint16_t ProgramId;         ///< 0 when no cook runs
+        uint8_t Stage;
+        uint8_t Flags;              ///< FLAG_* below
+        uint16_t Actuators;         ///< ApplianceDescriptor::Actuator bits switched on
+        int16_t TargetDeciC;        ///< Cavity target in 0.1 degC
+        int16_t ProbeTargetDeciC;   ///< Food probe target in 0.1 degC, 0 without a probe
+        uint16_t Reserved;
+        uint32_t StageElapsedMs;
+        uint32_t TotalElapsedMs;
+    };
+
+    enum : uint8_t
+    {
+        FLAG_PREHEATING = 1 << 0,
+        FLAG_PAUSED = 1 << 1,
+        FLAG_DOOR_OPEN = 1 << 2,
+    };
+
+    /**
+     * @brief Find the latest checkpoint; keep it for the control on a warm boot
+     * @return true when a cook was interrupted and is to be resumed
+     * @note Call right after FastBoot::Begin(), before any service starts
+     */
+    static bool Restore();
+
+    /**
+     * @brief Hand the session restored at boot to the cook control, once
+     */
+    static bool TakeRecovered(Session &session);
+
+    /**
+     * @brief Checkpoint the running session
+     */
+    static void Write(const Session &session);
+
+    /**
+     * @brief Close the session when the cook ends or is cancelled
+     */
+    static void Clear();
+
+    /**
+     * @brief Register the `checkpoint` console command
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+    friend class CookCheckpointTest;    ///< test/CookCheckpointTest.cpp tears writes at every store
+
+    struct Slot
+    {
+        uint32_t Sequence;
+        Session Data;
+        uint32_t Crc;
+    };
+
+    static constexpr uint32_t mMagic = 0x434B5031; // "CKP1", seeds the CRC
+
+    static uint32_t SlotCrc(const Slot &slot);
+    static int Latest();
+    static int ConsoleCommand(int argc, char **argv);
+
+    static_assert(sizeof(Slot[2]) <= CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE,
+                  "CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE must hold both slots");
+
+    static Slot (&mSlots)[2];   ///< In the bootloader's custom reserved RTC fast memory
+    static uint32_t mSequence;
+    static uint8_t mNext;
+    static bool mActive;
+    static bool mRecovered;
+    static Session mRecoveredSession;
+};
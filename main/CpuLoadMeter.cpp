@@ -0,0 +1,56 @@
+#include "sdkconfig.h"
+#include <memory>
+#include "CpuLoadMeter.hpp"
+
+bool CpuLoadMeter::Sample(uint8_t (&loadPercent)[portNUM_PROCESSORS])
+{
+#if defined(CONFIG_FREERTOS_USE_TRACE_FACILITY) && defined(CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS)
+    // A few spare slots for tasks created while we are sampling
+    const UBaseType_t capacity = uxTaskGetNumberOfTasks() + 4;
+    std::unique_ptr<TaskStatus_t[]> tasks(new (std::nothrow) TaskStatus_t[capacity]);
+    if (!tasks) {
+        return false;
+    }
+
+    uint32_t totalRunTime = 0;
+    const UBaseType_t count = uxTaskGetSystemState(tasks.get(), capacity, &totalRunTime);
+    if (count == 0) {
+        return false;
+    }
+
+    uint32_t idleRunTime[portNUM_PROCESSORS] = {};
+    for (BaseType_t core = 0; core < portNUM_PROCESSORS; core++) {
+        const TaskHandle_t idle = xTaskGetIdleTaskHandleForCore(core);
+        for (UBaseType_t i = 0; i < count; i++) {
+            if (tasks[i].xHandle == idle) {
+                idleRunTime[core] = tasks[i].ulRunTimeCounter;
+                break;
+            }
+        }
+    }
+
+    const bool valid = mPrimed && (totalRunTime != mLastTotalRunTime);
+    if (valid) {
+        // The run-time counter is wall-clock time, so it is the per-core budget
+        const uint32_t elapsed = totalRunTime - mLastTotalRunTime;
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            uint32_t idle = idleRunTime[core] - mLastIdleRunTime[core];
+            if (idle > elapsed) {
+                idle = elapsed;
+            }
+            loadPercent[core] = static_cast<uint8_t>(
+                100 - (static_cast<uint64_t>(idle) * 100) / elapsed);
+        }
+    }
+
+    mLastTotalRunTime = totalRunTime;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        mLastIdleRunTime[core] = idleRunTime[core];
+    }
+    mPrimed = true;
+    return valid;
+#else
+    (void)loadPercent;
+    return false;
+#endif
+}
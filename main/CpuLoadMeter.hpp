@@ -0,0 +1,33 @@
+/**
+ * @file CpuLoadMeter.hpp
+ * @brief Per-core CPU load derived from the idle tasks' run-time counters
+ *
+ * Each call to Sample() reports the load of every core since the previous call.
+ *
+ * @note Needs CONFIG_FREERTOS_USE_TRACE_FACILITY and
+ *       CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS, otherwise Sample() fails.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+class CpuLoadMeter
+{
+public:
+    CpuLoadMeter() = default;
+
+    /**
+     * @brief Compute per-core load since the previous call
+     * @param loadPercent filled with one value per core (0..100)
+     * @return false if run-time stats are unavailable or on the first call
+     */
+    bool Sample(uint8_t (&loadPercent)[portNUM_PROCESSORS]);
+
+private:
+    uint32_t mLastTotalRunTime = 0;
+    uint32_t mLastIdleRunTime[portNUM_PROCESSORS] = {};
+    bool mPrimed = false;
+};
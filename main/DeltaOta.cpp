@@ -0,0 +1,453 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_DELTA_OTA
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_console.h"
+#include "esp_http_client.h"
+#include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
+#include "NvsWriteCache.hpp"
+#include "DeltaOta.hpp"
+
+static const char *TAG = "DeltaOta";
+static const char *NVS_NAMESPACE = "delta_ota";
+static const char *NVS_KEY_STATE = "state";
+
+static constexpr uint32_t STATE_MAGIC = 0x44544131; // "DTA1"
+static constexpr uint16_t PATCH_VERSION = 1;
+static constexpr uint32_t HTTP_READ_SIZE = 1460;
+
+DeltaOta::DeltaOta() :
+    mSource(nullptr),
+    mTarget(nullptr),
+    mSector(nullptr),
+    mSectorFill(0),
+    mSectorsSinceSave(0),
+    mStartUs(0),
+    mStartPatchOffset(0),
+    mState()
+{
+}
+
+DeltaOta::~DeltaOta()
+{
+    heap_caps_free(mSector);
+}
+
+esp_err_t DeltaOta::Begin()
+{
+    mSource = esp_ota_get_running_partition();
+    mTarget = esp_ota_get_next_update_partition(nullptr);
+    if (mSource == nullptr || mTarget == nullptr) {
+        ESP_LOGE(TAG, "no inactive app slot in this partition table");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (mSector == nullptr) {
+        mSector = static_cast<uint8_t *>(heap_caps_malloc(mSectorSize, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+        if (mSector == nullptr) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    mSectorFill = 0;
+    mSectorsSinceSave = 0;
+
+    size_t length = sizeof(mState);
+    const esp_err_t err = NvsWriteCache::GetBlob(NVS_NAMESPACE, NVS_KEY_STATE, &mState, length);
+    if (err == ESP_OK && length == sizeof(mState) && mState.Magic == STATE_MAGIC &&
+        mState.TargetAddress == mTarget->address && mState.CurrentStage != Stage::Done) {
+        ESP_LOGI(TAG, "resuming at patch offset %lu, %lu/%lu bytes written",
+                 static_cast<unsigned long>(mState.PatchOffset),
+                 static_cast<unsigned long>(mState.OutputOffset),
+                 static_cast<unsigned long>(mState.PatchHeader.TargetSize));
+    } else {
+        memset(&mState, 0, sizeof(mState));
+        mState.Magic = STATE_MAGIC;
+        mState.TargetAddress = mTarget->address;
+        mState.CurrentStage = Stage::Header;
+    }
+
+    mStartUs = esp_timer_get_time();
+    mStartPatchOffset = mState.PatchOffset;
+    return ESP_OK;
+}
+
+uint32_t DeltaOta::ReadU32(const uint8_t *bytes)
+{
+    return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+           (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+esp_err_t DeltaOta::Write(const uint8_t *data, size_t length)
+{
+    if (mSector == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    while (true)
+    {
+        // COPY produces output without consuming patch bytes
+        const bool copyPending = (mState.CurrentStage == Stage::OpData) &&
+                                 (mState.CurrentOp == Op::Copy) && (mState.Remaining > 0);
+        if (length == 0 && !copyPending) {
+            return ESP_OK;
+        }
+
+        esp_err_t err = ESP_OK;
+        switch (mState.CurrentStage) {
+        case Stage::Header: {
+            uint8_t *header = reinterpret_cast<uint8_t *>(&mState.PatchHeader);
+            const size_t take = std::min(length, sizeof(Header) - mState.PatchOffset);
+            memcpy(header + mState.PatchOffset, data, take);
+            data += take;
+            length -= take;
+            mState.PatchOffset += take;
+            if (mState.PatchOffset == sizeof(Header)) {
+                err = HeaderComplete();
+            }
+            break;
+        }
+        case Stage::OpCode:
+            mState.CurrentOp = static_cast<Op>(*data);
+            data++;
+            length--;
+            mState.PatchOffset++;
+            if (mState.CurrentOp != Op::Copy && mState.CurrentOp != Op::Add &&
+                mState.CurrentOp != Op::Insert) {
+                ESP_LOGE(TAG, "bad op 0x%02x at %lu", static_cast<unsigned>(mState.CurrentOp),
+                         static_cast<unsigned long>(mState.PatchOffset - 1));
+                return ESP_ERR_INVALID_ARG;
+            }
+            mState.ArgsLength = 0;
+            mState.CurrentStage = Stage::OpArgs;
+            break;
+        case Stage::OpArgs: {
+            const uint8_t needed = (mState.CurrentOp == Op::Insert) ? 4 : 8;
+            const size_t take = std::min<size_t>(length, needed - mState.ArgsLength);
+            memcpy(mState.Args + mState.ArgsLength, data, take);
+            data += take;
+            length -= take;
+            mState.PatchOffset += take;
+            mState.ArgsLength += take;
+            if (mState.ArgsLength == needed) {
+                err = ArgsComplete();
+            }
+            break;
+        }
+        case Stage::OpData:
+            err = ProduceOpData(data, length);
+            break;
+        case Stage::Done:
+            ESP_LOGE(TAG, "%u bytes past the end of the patch", static_cast<unsigned>(length));
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+}
+
+esp_err_t DeltaOta::HeaderComplete()
+{
+    const Header &header = mState.PatchHeader;
+    if (memcmp(header.Magic, "DDLT", sizeof(header.Magic)) != 0 || header.Version != PATCH_VERSION) {
+        ESP_LOGE(TAG, "not a delta patch");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (header.SourceSize > mSource->size || header.TargetSize > mTarget->size || header.TargetSize == 0) {
+        ESP_LOGE(TAG, "patch does not fit the app slots");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t sha[32];
+    esp_err_t err = HashPartition(mSource, header.SourceSize, sha);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (memcmp(sha, header.SourceSha, sizeof(sha)) != 0) {
+        ESP_LOGE(TAG, "patch was made against a different image");
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    mState.CurrentStage = Stage::OpCode;
+    return SaveState();
+}
+
+esp_err_t DeltaOta::ArgsComplete()
+{
+    if (mState.CurrentOp == Op::Insert) {
+        mState.SourceOffset = 0;
+        mState.Remaining = ReadU32(mState.Args);
+    } else {
+        mState.SourceOffset = ReadU32(mState.Args);
+        mState.Remaining = ReadU32(mState.Args + 4);
+        if (mState.SourceOffset > mState.PatchHeader.SourceSize ||
+            mState.Remaining > mState.PatchHeader.SourceSize - mState.SourceOffset) {
+            ESP_LOGE(TAG, "op reads past the source image");
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    const uint32_t produced = mState.OutputOffset + mSectorFill;
+    if (mState.Remaining > mState.PatchHeader.TargetSize - produced) {
+        ESP_LOGE(TAG, "op writes past the target image");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    mState.CurrentStage = (mState.Remaining > 0) ? Stage::OpData : Stage::OpCode;
+    return ESP_OK;
+}
+
+esp_err_t DeltaOta::ProduceOpData(const uint8_t *&data, size_t &length)
+{
+    // Never cross a sector boundary, so the state saved after a flush is exact
+    size_t chunk = std::min<size_t>(mState.Remaining, mSectorSize - mSectorFill);
+    if (mState.CurrentOp != Op::Copy) {
+        chunk = std::min(chunk, length);
+    }
+    uint8_t *out = mSector + mSectorFill;
+
+    if (mState.CurrentOp == Op::Insert) {
+        memcpy(out, data, chunk);
+    } else {
+        esp_err_t err = esp_partition_read(mSource, mState.SourceOffset, out, chunk);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (mState.CurrentOp == Op::Add) {
+            for (size_t i = 0; i < chunk; i++) {
+                out[i] += data[i];
+            }
+        }
+        mState.SourceOffset += chunk;
+    }
+    if (mState.CurrentOp != Op::Copy) {
+        data += chunk;
+        length -= chunk;
+        mState.PatchOffset += chunk;
+    }
+
+    mSectorFill += chunk;
+    mState.Remaining -= chunk;
+    if (mState.Remaining == 0) {
+        mState.CurrentStage = Stage::OpCode;
+    }
+    if (mState.OutputOffset + mSectorFill == mState.PatchHeader.TargetSize &&
+        mState.CurrentStage == Stage::OpCode) {
+        mState.CurrentStage = Stage::Done;
+    }
+
+    if (mSectorFill == mSectorSize) {
+        return FlushSector();
+    }
+    return ESP_OK;
+}
+
+esp_err_t DeltaOta::FlushSector()
+{
+    if (mSectorFill == 0) {
+        return ESP_OK;
+    }
+    esp_err_t err = esp_partition_erase_range(mTarget, mState.OutputOffset, mSectorSize);
+    if (err == ESP_OK) {
+        err = esp_partition_write(mTarget, mState.OutputOffset, mSector, mSectorFill);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "flash write at %lu: %s", static_cast<unsigned long>(mState.OutputOffset),
+                 esp_err_to_name(err));
+        return err;
+    }
+    mState.OutputOffset += mSectorFill;
+    mSectorFill = 0;
+
+    if (++mSectorsSinceSave >= CONFIG_DONE_DELTA_OTA_CHECKPOINT_SECTORS) {
+        mSectorsSinceSave = 0;
+        return SaveState();
+    }
+    return ESP_OK;
+}
+
+esp_err_t DeltaOta::SaveState()
+{
+    return NvsWriteCache::SetBlob(NVS_NAMESPACE, NVS_KEY_STATE, &mState, sizeof(mState),
+                                  NvsWriteCache::Flush::Now);
+}
+
+esp_err_t DeltaOta::HashPartition(const esp_partition_t *partition, uint32_t size, uint8_t (&sha)[32])
+{
+    // mSector is free here: called before the first output byte and after the last flush
+    mbedtls_sha256_context context;
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_starts(&context, 0);
+    esp_err_t err = ESP_OK;
+    for (uint32_t offset = 0; offset < size && err == ESP_OK; offset += mSectorSize) {
+        const uint32_t chunk = std::min(mSectorSize, size - offset);
+        err = esp_partition_read(partition, offset, mSector, chunk);
+        if (err == ESP_OK) {
+            mbedtls_sha256_update(&context, mSector, chunk);
+        }
+    }
+    mbedtls_sha256_finish(&context, sha);
+    mbedtls_sha256_free(&context);
+    return err;
+}
+
+esp_err_t DeltaOta::End()
+{
+    if (mSector == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (mState.CurrentStage != Stage::Done) {
+        // The last checkpoint in NVS stays valid, Begin() resumes from there
+        ESP_LOGE(TAG, "patch incomplete, %lu/%lu bytes",
+                 static_cast<unsigned long>(mState.OutputOffset + mSectorFill),
+                 static_cast<unsigned long>(mState.PatchHeader.TargetSize));
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = FlushSector();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    uint8_t sha[32];
+    err = HashPartition(mTarget, mState.PatchHeader.TargetSize, sha);
+    if (err == ESP_OK && memcmp(sha, mState.PatchHeader.TargetSha, sizeof(sha)) != 0) {
+        ESP_LOGE(TAG, "reconstructed image does not match the target hash");
+        err = ESP_ERR_INVALID_CRC;
+    }
+    if (err != ESP_OK) {
+        Abort();
+        return err;
+    }
+
+    const int64_t elapsedUs = esp_timer_get_time() - mStartUs;
+    const uint32_t patchBytes = mState.PatchOffset - mStartPatchOffset;
+    ESP_LOGI(TAG, "%lu byte image from %lu patch bytes in %lld ms (%lu KB/s of patch)",
+             static_cast<unsigned long>(mState.PatchHeader.TargetSize),
+             static_cast<unsigned long>(patchBytes),
+             static_cast<long long>(elapsedUs / 1000),
+             static_cast<unsigned long>((elapsedUs > 0) ? (patchBytes * 1000ULL / elapsedUs) : 0));
+
+    Abort();
+    return esp_ota_set_boot_partition(mTarget);
+}
+
+void DeltaOta::Abort()
+{
+    memset(&mState, 0, sizeof(mState));
+    mState.CurrentStage = Stage::Done;
+    NvsWriteCache::SetBlob(NVS_NAMESPACE, NVS_KEY_STATE, &mState, sizeof(mState),
+                           NvsWriteCache::Flush::Now);
+}
+
+/**
+ * @brief Open the patch at the given offset; a server ignoring the Range header sends it all
+ */
+static esp_http_client_handle_t OpenPatch(const char *url, uint32_t offset, bool &fromStart)
+{
+    esp_http_client_config_t config = {};
+    config.url = url;
+    config.timeout_ms = 10000;
+    config.buffer_size = HTTP_READ_SIZE;
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == nullptr) {
+        return nullptr;
+    }
+    if (offset > 0) {
+        char range[24];
+        snprintf(range, sizeof(range), "bytes=%lu-", static_cast<unsigned long>(offset));
+        esp_http_client_set_header(client, "Range", range);
+    }
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: %s", url, esp_err_to_name(err));
+        esp_http_client_cleanup(client);
+        return nullptr;
+    }
+    esp_http_client_fetch_headers(client);
+    const int status = esp_http_client_get_status_code(client);
+    if (status != 200 && !(status == 206 && offset > 0)) {
+        ESP_LOGE(TAG, "%s: HTTP %d", url, status);
+        esp_http_client_cleanup(client);
+        return nullptr;
+    }
+    fromStart = (status == 200);
+    return client;
+}
+
+esp_err_t DeltaOta::Download(const char *url)
+{
+    DeltaOta ota;
+    esp_err_t err = ota.Begin();
+    if (err != ESP_OK) {
+        return err;
+    }
+    bool fromStart = true;
+    esp_http_client_handle_t client = OpenPatch(url, ota.ResumeOffset(), fromStart);
+    if (client == nullptr) {
+        return ESP_FAIL;
+    }
+    if (fromStart && ota.ResumeOffset() > 0) {
+        ESP_LOGW(TAG, "server ignored the Range request, starting over");
+        ota.Abort();
+        err = ota.Begin();
+    }
+
+    uint8_t *buffer = static_cast<uint8_t *>(heap_caps_malloc(HTTP_READ_SIZE, MALLOC_CAP_INTERNAL));
+    if (buffer == nullptr) {
+        err = ESP_ERR_NO_MEM;
+    }
+    while (err == ESP_OK)
+    {
+        const int read = esp_http_client_read(client, reinterpret_cast<char *>(buffer), HTTP_READ_SIZE);
+        if (read < 0) {
+            err = ESP_FAIL;
+        } else if (read == 0) {
+            break;
+        } else {
+            err = ota.Write(buffer, read);
+        }
+    }
+    // An interrupted download keeps its checkpoint, the next one resumes there
+    if (err == ESP_OK && !esp_http_client_is_complete_data_received(client)) {
+        ESP_LOGE(TAG, "connection closed early at patch offset %lu",
+                 static_cast<unsigned long>(ota.ResumeOffset()));
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK) {
+        err = ota.End();
+    }
+
+    heap_caps_free(buffer);
+    esp_http_client_cleanup(client);
+    return err;
+}
+
+static int OtaCommand(int argc, char **argv)
+{
+    if (argc != 2) {
+        printf("usage: ota_delta <url>\n");
+        return 1;
+    }
+    const esp_err_t err = DeltaOta::Download(argv[1]);
+    printf("ota_delta: %s%s\n", esp_err_to_name(err), (err == ESP_OK) ? ", restart to boot it" : "");
+    return (err == ESP_OK) ? 0 : 1;
+}
+
+esp_err_t DeltaOta::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "ota_delta",
+        .help = "Install a patch from tools/make_delta.py against the running image: ota_delta <url>",
+        .hint = nullptr,
+        .func = &OtaCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_DELTA_OTA
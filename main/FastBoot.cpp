@@ -0,0 +1,238 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_FAST_BOOT
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "esp_private/esp_clk.h"
+#include "FastBoot.hpp"
+
+static const char *TAG = "FastBoot";
+
+RTC_NOINIT_ATTR FastBoot::State FastBoot::mState;
+bool FastBoot::mWarm = false;
+bool FastBoot::mResumed = false;
+uint64_t FastBoot::mResetRtcUs = 0;
+portMUX_TYPE FastBoot::mLock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t StateCrc(const void *state, size_t length)
+{
+    return esp_rom_crc32_le(0, static_cast<const uint8_t *>(state), length);
+}
+
+bool FastBoot::IsValid()
+{
+    return (mState.Magic == mMagic) && (mState.Crc == StateCrc(&mState, offsetof(State, Crc)));
+}
+
+void FastBoot::Save()
+{
+    mState.Crc = StateCrc(&mState, offsetof(State, Crc));
+}
+
+uint32_t FastBoot::SinceResetMs()
+{
+    if (mResetRtcUs == 0) {
+        return 0;
+    }
+    return static_cast<uint32_t>((esp_clk_rtc_time() - mResetRtcUs) / 1000);
+}
+
+void FastBoot::Begin()
+{
+    const bool valid = IsValid();
+    if (!valid) {
+        // Power-on: RTC memory holds garbage
+        memset(&mState, 0, sizeof(mState));
+        mState.Magic = mMagic;
+    }
+
+    const esp_reset_reason_t reason = esp_reset_reason();
+    // Not after a brownout: the heater may be what pulled the supply down
+    const bool afterFault = (reason == ESP_RST_SW) || (reason == ESP_RST_PANIC) ||
+                            (reason == ESP_RST_INT_WDT) || (reason == ESP_RST_TASK_WDT) ||
+                            (reason == ESP_RST_WDT);
+    const Simulate pending = mState.Pending;
+    mWarm = afterFault && (pending != Simulate::Cold) &&
+            ((mState.CookActive != 0) || (pending == Simulate::Warm));
+    mResetRtcUs = (pending != Simulate::None) ? mState.ResetRtcUs : 0;
+
+    mState.Pending = Simulate::None;
+    mState.ResetRtcUs = 0;
+    if (!mWarm) {
+        // A cook is only resumed across the reset that interrupted it
+        mState.CookActive = 0;
+    }
+    memset(&mState.Last, 0, sizeof(mState.Last));
+    mState.Last.Reason = reason;
+    mState.Last.Warm = mWarm ? 1 : 0;
+    Save();
+
+    if (mWarm) {
+        ESP_LOGW(TAG, "warm boot after reset reason %d, resuming control first", reason);
+        esp_log_level_set("*", ESP_LOG_WARN);
+    } else {
+#ifdef CONFIG_DONE_FAST_BOOT_PSRAM_TEST
+        TestPsram();
+#endif
+    }
+}
+
+void FastBoot::Resume()
+{
+    if (mResumed) {
+        return;
+    }
+    mResumed = true;
+    portENTER_CRITICAL(&mLock);
+    mState.Last.ResumedMs = SinceResetMs();
+    mState.Last.ResumedAppMs = static_cast<uint32_t>(esp_timer_get_time() / 1000);
+    Save();
+    portEXIT_CRITICAL(&mLock);
+
+    if (mWarm) {
+        esp_log_level_set("*", static_cast<esp_log_level_t>(CONFIG_LOG_DEFAULT_LEVEL));
+        ESP_LOGI(TAG, "control resumed %lu ms after app start", static_cast<unsigned long>(mState.Last.ResumedAppMs));
+    }
+}
+
+void FastBoot::Ready()
+{
+    portENTER_CRITICAL(&mLock);
+    mState.Last.ReadyMs = SinceResetMs();
+    mState.Last.ReadyAppMs = static_cast<uint32_t>(esp_timer_get_time() / 1000);
+    Save();
+    portEXIT_CRITICAL(&mLock);
+    ESP_LOGI(TAG, "%s boot, init done %lu ms after app start", mWarm ? "warm" : "cold",
+             static_cast<unsigned long>(mState.Last.ReadyAppMs));
+}
+
+void FastBoot::SetCookActive(bool active)
+{
+    portENTER_CRITICAL(&mLock);
+    mState.CookActive = active ? 1 : 0;
+    Save();
+    portEXIT_CRITICAL(&mLock);
+}
+
+bool FastBoot::TestBlock(uint32_t *words, size_t count)
+{
+    // Each word's own address, then its complement: catches stuck and shorted address and data lines
+    for (size_t i = 0; i < count; i++) {
+        words[i] = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&words[i]));
+    }
+    for (size_t i = 0; i < count; i++) {
+        const uint32_t expected = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&words[i]));
+        if (words[i] != expected) {
+            return false;
+        }
+        words[i] = ~expected;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (words[i] != ~static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&words[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FastBoot::TestPsram()
+{
+    if (heap_caps_get_total_size(MALLOC_CAP_SPIRAM) == 0) {
+        return;
+    }
+    const int64_t start = esp_timer_get_time();
+
+    // Take every free block, chained through its first word, then give them all back
+    void *blocks = nullptr;
+    size_t tested = 0;
+    bool ok = true;
+    while (ok) {
+        const size_t size = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+        if (size < mPsramMinBlock) {
+            break;
+        }
+        uint32_t *block = static_cast<uint32_t *>(heap_caps_malloc(size, MALLOC_CAP_SPIRAM));
+        if (block == nullptr) {
+            break;
+        }
+        ok = TestBlock(block, size / sizeof(uint32_t));
+        tested += size;
+        *reinterpret_cast<void **>(block) = blocks;
+        blocks = block;
+    }
+    while (blocks != nullptr) {
+        void *next = *static_cast<void **>(blocks);
+        heap_caps_free(blocks);
+        blocks = next;
+    }
+
+    if (!ok) {
+        ESP_LOGE(TAG, "PSRAM failed the memory test");
+        abort();
+    }
+    ESP_LOGI(TAG, "PSRAM test: %lu KB in %lu ms", static_cast<unsigned long>(tested / 1024),
+             static_cast<unsigned long>((esp_timer_get_time() - start) / 1000));
+}
+
+int FastBoot::ConsoleCommand(int argc, char **argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "reset") == 0) {
+        const char *kind = (argc >= 3) ? argv[2] : "warm";
+        const bool cold = strcmp(kind, "cold") == 0;
+        const bool panic = strcmp(kind, "panic") == 0;
+        if (!cold && !panic && strcmp(kind, "warm") != 0) {
+            printf("usage: fastboot reset [warm|cold|panic]\n");
+            return 1;
+        }
+        portENTER_CRITICAL(&mLock);
+        mState.Pending = cold ? Simulate::Cold : Simulate::Warm;
+        mState.ResetRtcUs = esp_clk_rtc_time();
+        Save();
+        portEXIT_CRITICAL(&mLock);
+        if (panic) {
+            abort();
+        }
+        esp_restart();
+    }
+    if (argc != 1) {
+        printf("usage: fastboot [reset [warm|cold|panic]]\n");
+        return 1;
+    }
+
+    const Timing &last = mState.Last;
+    printf("%s boot, reset reason %ld, cook %s\n", last.Warm ? "warm" : "cold",
+           static_cast<long>(last.Reason), mState.CookActive ? "active" : "idle");
+    printf("control resumed: %lu ms after app start", static_cast<unsigned long>(last.ResumedAppMs));
+    if (last.ResumedMs != 0) {
+        printf(", %lu ms after reset", static_cast<unsigned long>(last.ResumedMs));
+    }
+    printf("\ninit done:       %lu ms after app start", static_cast<unsigned long>(last.ReadyAppMs));
+    if (last.ReadyMs != 0) {
+        printf(", %lu ms after reset", static_cast<unsigned long>(last.ReadyMs));
+    }
+    printf("\n");
+    return 0;
+}
+
+esp_err_t FastBoot::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "fastboot",
+        .help = "Boot timing; `fastboot reset [warm|cold|panic]` simulates a reset and times the next boot",
+        .hint = nullptr,
+        .func = &ConsoleCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_FAST_BOOT
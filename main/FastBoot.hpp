@@ -0,0 +1,114 @@
+/**
+ * @file FastBoot.hpp
+ * @brief Warm-boot fast path: resume heating before the rest of the firmware starts
+ *
+ * A flag in RTC memory is set while a cook runs (SetCookActive(), called by
+ * the cook checkpoint when OvenState shows a program running or ending).
+ * If the chip then resets on a watchdog, panic or software reset, the flag is
+ * still there and the boot is warm. On a warm boot app_main restores the cook
+ * checkpoint and calls Resume() right after reserving the task stacks, ahead of
+ * power management, the NVS cache, the timer wheel, the job executor, flows and
+ * ServiceMngr. With CONFIG_DONE_LAZY_SERVICES the UI, Matter and MQTT services
+ * are not built by ServiceMngr on a warm boot: RegisterServices() registers
+ * them as lazy services and StartDeferredServices() builds them after Ready().
+ * Logging is kept at WARN from Begin() to Resume(), so the UART does not slow
+ * down that path. The SystemMonitor post-mortem dump waits until after Resume().
+ *
+ * CONFIG_SPIRAM_MEMTEST tests all of PSRAM on every boot, warm ones included,
+ * before app code runs, where no RTC flag can skip it. It stays on by default.
+ * A build that turns it off to shorten warm boots can test the free PSRAM heap
+ * on cold boots only instead (CONFIG_DONE_FAST_BOOT_PSRAM_TEST).
+ *
+ * `fastboot` prints how long the last boot took from reset to Resume() and to
+ * Ready(). `fastboot reset [warm|cold|panic]` simulates a reset and stamps its
+ * time with the RTC timer, which keeps running across the reset, so ROM,
+ * bootloader and startup time are included.
+ *
+ * @note Only available when CONFIG_DONE_FAST_BOOT is enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "esp_err.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+
+class FastBoot
+{
+public:
+    /**
+     * @brief Decide between a warm and a cold boot
+     * @note Call first thing in app_main
+     */
+    static void Begin();
+
+    /**
+     * @brief True when this boot interrupted a cook and control is to be resumed first
+     */
+    static bool IsWarmBoot() { return mWarm; }
+
+    /**
+     * @brief Mark control as resumed; the rest of the init follows this call
+     */
+    static void Resume();
+
+    /**
+     * @brief Mark the whole init as done
+     */
+    static void Ready();
+
+    /**
+     * @brief Called by CookCheckpoint::Write() when a cook starts and ends
+     */
+    static void SetCookActive(bool active);
+
+    /**
+     * @brief Register the `fastboot` console command
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+    enum class Simulate : uint8_t
+    {
+        None,
+        Warm,
+        Cold,
+    };
+
+    struct Timing
+    {
+        uint32_t ResumedMs;     ///< From reset, 0 when the reset time is unknown
+        uint32_t ReadyMs;
+        uint32_t ResumedAppMs;  ///< From app start
+        uint32_t ReadyAppMs;
+        int32_t Reason;         ///< esp_reset_reason_t
+        uint8_t Warm;
+    };
+
+    struct State
+    {
+        uint32_t Magic;
+        uint8_t CookActive;
+        Simulate Pending;       ///< Set by `fastboot reset`, read by the next Begin()
+        uint64_t ResetRtcUs;    ///< RTC time of that simulated reset
+        Timing Last;
+        uint32_t Crc;
+    };
+
+    static constexpr uint32_t mMagic = 0x46535442; // "FSTB"
+    static constexpr size_t mPsramMinBlock = 1024;
+
+    static bool IsValid();
+    static void Save();
+    static uint32_t SinceResetMs();
+    static void TestPsram();
+    static bool TestBlock(uint32_t *words, size_t count);
+    static int ConsoleCommand(int argc, char **argv);
+
+    static State mState;
+    static bool mWarm;
+    static bool mResumed;
+    static uint64_t mResetRtcUs;
+    static portMUX_TYPE mLock;
+};
@@ -0,0 +1,261 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_FLOWS
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "TaskPlan.hpp"
+#include "Flow.hpp"
+#include "TraceRecorder.hpp"
+
+static const char *TAG = "Flow";
+
+Flow *FlowScheduler::mFlows = nullptr;
+Flow *FlowScheduler::mReadyHead = nullptr;
+Flow *FlowScheduler::mReadyTail = nullptr;
+TaskHandle_t FlowScheduler::mTask = nullptr;
+JobExecutor::JobClass FlowScheduler::mJobClass = JobExecutor::mInvalidClass;
+FlowScheduler::Stats FlowScheduler::mStats = {};
+portMUX_TYPE FlowScheduler::mLock = portMUX_INITIALIZER_UNLOCKED;
+
+void Flow::AwaitTimer(uint32_t delayMs, uint32_t slackMs)
+{
+    mWokenBy = 0;
+    mDeadlineUs = esp_timer_get_time() + delayMs * 1000LL;
+    portENTER_CRITICAL(&FlowScheduler::mLock);
+    mAwaiting = WAKE_TIMER;
+    portEXIT_CRITICAL(&FlowScheduler::mLock);
+    TimerWheel::Arm(mTimer, delayMs, 0, slackMs);
+}
+
+void Flow::AwaitMessage(uint16_t type, uint32_t timeoutMs)
+{
+    mWokenBy = 0;
+    mDeadlineUs = esp_timer_get_time() + timeoutMs * 1000LL;
+    portENTER_CRITICAL(&FlowScheduler::mLock);
+    mAwaitType = type;
+    mAwaiting = WAKE_MESSAGE | ((timeoutMs > 0) ? WAKE_TIMER : 0);
+    portEXIT_CRITICAL(&FlowScheduler::mLock);
+    if (timeoutMs > 0) {
+        TimerWheel::Arm(mTimer, timeoutMs);
+    }
+}
+
+void Flow::AwaitJob(JobFunction function, void *arg)
+{
+    mWokenBy = 0;
+    mJob = function;
+    mJobArg = arg;
+    portENTER_CRITICAL(&FlowScheduler::mLock);
+    mAwaiting = WAKE_JOB;
+    portEXIT_CRITICAL(&FlowScheduler::mLock);
+    // May block on flash: queued with the long jobs, away from the core of the short ones
+    const esp_err_t err = JobExecutor::Post(FlowScheduler::mJobClass, RunJob, this, 1);
+    if (err != ESP_OK) {
+        mJobResult = err;
+        FlowScheduler::Wake(*this, WAKE_JOB);
+    }
+}
+
+void Flow::TimerExpired(void *arg)
+{
+    Flow &flow = *static_cast<Flow *>(arg);
+    // An expiry left over from an earlier await, dispatched after the flow moved on
+    if (esp_timer_get_time() + CONFIG_DONE_TIMER_WHEEL_TICK_MS * 1000LL < flow.mDeadlineUs) {
+        return;
+    }
+    FlowScheduler::Wake(flow, WAKE_TIMER);
+}
+
+void Flow::RunJob(void *arg)
+{
+    Flow &flow = *static_cast<Flow *>(arg);
+    flow.mJobResult = flow.mJob(flow.mJobArg);
+    FlowScheduler::Wake(flow, WAKE_JOB);
+}
+
+esp_err_t FlowScheduler::Start()
+{
+    if (mTask != nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    mJobClass = JobExecutor::RegisterClass("flow-io");
+    mTask = TaskPlan::Create(TaskPlan::FLOWS, SchedulerTask, nullptr);
+    if (mTask == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t FlowScheduler::Spawn(Flow &flow)
+{
+    portENTER_CRITICAL(&mLock);
+    bool listed = false;
+    for (const Flow *other = mFlows; other != nullptr; other = other->mNext) {
+        listed = listed || (other == &flow);
+    }
+    if (listed && !flow.IsDone()) {
+        portEXIT_CRITICAL(&mLock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!listed) {
+        TimerWheel::Init(flow.mTimer, Flow::TimerExpired, &flow);
+        flow.mNext = mFlows;
+        mFlows = &flow;
+    }
+    flow.mLine = 0;
+    flow.mAwaiting = 0;
+    flow.mWokenBy = 0;
+    QueueLocked(flow);
+    portEXIT_CRITICAL(&mLock);
+
+    if (mTask != nullptr) {
+        xTaskNotifyGive(mTask);
+    }
+    return ESP_OK;
+}
+
+void FlowScheduler::QueueLocked(Flow &flow)
+{
+    if (flow.mQueued) {
+        return;
+    }
+    flow.mQueued = true;
+    flow.mNextReady = nullptr;
+    if (mReadyTail != nullptr) {
+        mReadyTail->mNextReady = &flow;
+    } else {
+        mReadyHead = &flow;
+    }
+    mReadyTail = &flow;
+}
+
+bool FlowScheduler::WakeLocked(Flow &flow, uint8_t source)
+{
+    // Only the first source resumes the flow, a late timeout or a stale expiry is dropped
+    if ((flow.mAwaiting & source) == 0) {
+        return false;
+    }
+    flow.mAwaiting = 0;
+    flow.mWokenBy = source;
+    QueueLocked(flow);
+    return true;
+}
+
+void FlowScheduler::Wake(Flow &flow, uint8_t source)
+{
+    portENTER_CRITICAL(&mLock);
+    const bool woken = WakeLocked(flow, source);
+    portEXIT_CRITICAL(&mLock);
+    if (woken && mTask != nullptr) {
+        xTaskNotifyGive(mTask);
+    }
+}
+
+void FlowScheduler::Deliver(const Flow::Message &message)
+{
+    bool woken = false;
+    portENTER_CRITICAL(&mLock);
+    mStats.Messages++;
+    for (Flow *flow = mFlows; flow != nullptr; flow = flow->mNext) {
+        if ((flow->mAwaiting & Flow::WAKE_MESSAGE) != 0 && flow->mAwaitType == message.Type) {
+            flow->mMessage = message;
+            woken = WakeLocked(*flow, Flow::WAKE_MESSAGE) || woken;
+        }
+    }
+    portEXIT_CRITICAL(&mLock);
+    if (woken && mTask != nullptr) {
+        xTaskNotifyGive(mTask);
+    }
+}
+
+void FlowScheduler::SchedulerTask(void *arg)
+{
+    (void)arg;
+    while (true)
+    {
+        portENTER_CRITICAL(&mLock);
+        Flow *flow = mReadyHead;
+        if (flow != nullptr) {
+            mReadyHead = flow->mNextReady;
+            if (mReadyHead == nullptr) {
+                mReadyTail = nullptr;
+            }
+            flow->mQueued = false;
+        }
+        portEXIT_CRITICAL(&mLock);
+
+        if (flow == nullptr) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (flow->mWokenBy != Flow::WAKE_TIMER) {
+            // The message or job came first, the timeout is not needed any more
+            TimerWheel::Cancel(flow->mTimer);
+        }
+        const int64_t startUs = esp_timer_get_time();
+        {
+            // Arg1 is the await line the flow resumes from
+            DONE_TRACE_SCOPE(mTraceTag, flow->mLine);
+            flow->Run();
+        }
+        const uint32_t runUs = static_cast<uint32_t>(esp_timer_get_time() - startUs);
+
+        portENTER_CRITICAL(&mLock);
+        mStats.Resumes++;
+        if (runUs > mStats.MaxRunUs) {
+            mStats.MaxRunUs = runUs;
+        }
+        // Returned without awaiting anything: FLOW_YIELD(), run it again after the others
+        if (!flow->IsDone() && flow->mAwaiting == 0 && !flow->mQueued) {
+            flow->mWokenBy = 0;
+            QueueLocked(*flow);
+        }
+        portEXIT_CRITICAL(&mLock);
+    }
+}
+
+void FlowScheduler::Report()
+{
+    portENTER_CRITICAL(&mLock);
+    const Stats stats = mStats;
+    portEXIT_CRITICAL(&mLock);
+    ESP_LOGI(TAG, "%lu resumes, %lu messages, longest step %lu us",
+             static_cast<unsigned long>(stats.Resumes), static_cast<unsigned long>(stats.Messages),
+             static_cast<unsigned long>(stats.MaxRunUs));
+
+    // Flows are never unlinked, so walking the list without the lock is safe
+    for (const Flow *flow = mFlows; flow != nullptr; flow = flow->mNext) {
+        const uint8_t awaiting = flow->mAwaiting;
+        const char *state = flow->IsDone() ? "done" :
+                            flow->mQueued ? "ready" :
+                            (awaiting & Flow::WAKE_MESSAGE) ? "message" :
+                            (awaiting & Flow::WAKE_JOB) ? "job" :
+                            (awaiting & Flow::WAKE_TIMER) ? "timer" : "running";
+        ESP_LOGI(TAG, "  %-14s %-8s line %u", flow->Name(), state, static_cast<unsigned>(flow->mLine));
+    }
+}
+
+int FlowScheduler::ConsoleCommand(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    Report();
+    return 0;
+}
+
+esp_err_t FlowScheduler::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "flows",
+        .help = "List flows and what each one awaits",
+        .hint = nullptr,
+        .func = &ConsoleCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_FLOWS
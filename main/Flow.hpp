@@ -0,0 +1,213 @@
+/**
+ * @file Flow.hpp
+ * @brief Stackless flows: multi-step service logic without a task per flow
+ *
+ * A flow is written as straight-line code with await points (wait for a
+ * message, a timer or a job) but keeps no stack while it waits. Run()
+ * returns at each await and is re-entered from the top when the flow
+ * resumes. The FLOW_* macros jump back to the await point, like a
+ * protothread. All flows run on one FlowScheduler task, so a waiting flow
+ * costs sizeof(the flow) instead of a task stack.
+ *
+ * The build is C++17 (Matter), so these are switch-based resumable
+ * functions rather than C++20 coroutines. Two rules follow:
+ * - Locals do not survive an await. State that must is a member of the flow.
+ * - Only one await per source line, and no await inside a nested switch.
+ *
+ * A flow step must not block, every flow runs on the scheduler task. Blocking
+ * work is awaited as a job, and only if its blocking is bounded: a flash write
+ * or an NVS commit, which holds a JobExecutor worker for up to a page erase.
+ * Waiting for the network, a queue or another task has no bound; the service
+ * that does it reports back with a message the flow awaits.
+ *
+ * Messages reach flows through Deliver(). SharedBus is a submodule, so its
+ * dispatch has to forward them; after queueing a message for its target it
+ * calls:
+ *
+ *     FlowScheduler::Deliver({ message.Type, message.Source, message.Value });
+ *
+ * @code
+ * class ReconnectFlow : public Flow
+ * {
+ * public:
+ *     ReconnectFlow() : Flow("reconnect") {}
+ * protected:
+ *     void Run() override
+ *     {
+ *         FLOW_BEGIN();
+ *         for (mAttempt = 0; mAttempt < 5; mAttempt++) {
+ *             Connect();
+ *             FLOW_AWAIT_MESSAGE(MSG_CONNECTED, 10000);
+ *             if (!TimedOut()) {
+ *                 break;
+ *             }
+ *             FLOW_AWAIT_TIMER(1000U << mAttempt, 500);
+ *         }
+ *         FLOW_END();
+ *     }
+ * private:
+ *     uint8_t mAttempt;
+ * };
+ * @endcode
+ *
+ * @note Only available when CONFIG_DONE_FLOWS is enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "TimerWheel.hpp"
+#include "JobExecutor.hpp"
+
+#define FLOW_BEGIN() switch (mLine) { case 0:
+
+#define FLOW_SUSPEND_() mLine = __LINE__; return; case __LINE__:
+
+/**
+ * @brief Wait for (delayMs [, slackMs]) on the timer wheel
+ */
+#define FLOW_AWAIT_TIMER(...) do { AwaitTimer(__VA_ARGS__); FLOW_SUSPEND_(); } while (0)
+
+/**
+ * @brief Wait for a message of (type [, timeoutMs]); check TimedOut() after
+ */
+#define FLOW_AWAIT_MESSAGE(...) do { AwaitMessage(__VA_ARGS__); FLOW_SUSPEND_(); } while (0)
+
+/**
+ * @brief Run function(arg) on a JobExecutor worker and wait for it; check JobResult() after
+ * @note function may block on flash, not on anything unbounded
+ */
+#define FLOW_AWAIT_JOB(function, arg) do { AwaitJob(function, arg); FLOW_SUSPEND_(); } while (0)
+
+/**
+ * @brief Let the other ready flows run first
+ */
+#define FLOW_YIELD() do { FLOW_SUSPEND_(); } while (0)
+
+#define FLOW_END() } mLine = Flow::mDoneLine
+
+class Flow
+{
+public:
+    /**
+     * @brief What a flow can await; SharedBus messages are delivered as type, source and one value
+     */
+    struct Message
+    {
+        uint16_t Type;
+        uint16_t Source;
+        uint32_t Value;
+    };
+
+    using JobFunction = esp_err_t (*)(void *arg);
+
+    static constexpr uint16_t mDoneLine = 0xFFFF;
+
+    explicit Flow(const char *name) : mName(name) {}
+    virtual ~Flow() = default;
+    Flow(const Flow &) = delete;
+    Flow &operator=(const Flow &) = delete;
+
+    const char *Name() const { return mName; }
+    bool IsDone() const { return mLine == mDoneLine; }
+
+protected:
+    /**
+     * @brief Flow body, FLOW_BEGIN() ... FLOW_END()
+     */
+    virtual void Run() = 0;
+
+    void AwaitTimer(uint32_t delayMs, uint32_t slackMs = 0);
+    void AwaitMessage(uint16_t type, uint32_t timeoutMs = 0);
+    void AwaitJob(JobFunction function, void *arg);
+
+    bool TimedOut() const { return mWokenBy == WAKE_TIMER; }
+    const Message &LastMessage() const { return mMessage; }
+    esp_err_t JobResult() const { return mJobResult; }
+
+    uint16_t mLine = 0;     ///< Resume point, the source line of the last await
+
+private:
+    friend class FlowScheduler;
+
+    enum : uint8_t
+    {
+        WAKE_TIMER = 1 << 0,
+        WAKE_MESSAGE = 1 << 1,
+        WAKE_JOB = 1 << 2,
+    };
+
+    static void TimerExpired(void *arg);
+    static void RunJob(void *arg);
+
+    const char *mName;
+    Flow *mNext = nullptr;          ///< All spawned flows
+    Flow *mNextReady = nullptr;
+    TimerWheel::Timer mTimer = {};
+    Message mMessage = {};
+    JobFunction mJob = nullptr;
+    void *mJobArg = nullptr;
+    esp_err_t mJobResult = ESP_OK;
+    int64_t mDeadlineUs = 0;        ///< Of the timer or timeout awaited
+    uint16_t mAwaitType = 0;
+    uint8_t mAwaiting = 0;          ///< WAKE_* sources that resume the flow
+    uint8_t mWokenBy = 0;
+    bool mQueued = false;
+};
+
+class FlowScheduler
+{
+public:
+    struct Stats
+    {
+        uint32_t Resumes;
+        uint32_t Messages;
+        uint32_t MaxRunUs;
+    };
+
+    /**
+     * @brief Create the scheduler task planned in TaskPlan
+     */
+    static esp_err_t Start();
+
+    /**
+     * @brief Start a flow, or restart it once done
+     * @note The flow must outlive the scheduler, in practice it is static
+     */
+    static esp_err_t Spawn(Flow &flow);
+
+    /**
+     * @brief Resume the flows awaiting this message type, from any task
+     * @note Nothing in this tree calls it yet; see the SharedBus hook above
+     */
+    static void Deliver(const Flow::Message &message);
+
+    static void Report();
+
+    /**
+     * @brief Register the `flows` console command
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+    friend class Flow;
+
+    static void QueueLocked(Flow &flow);
+    static bool WakeLocked(Flow &flow, uint8_t source);
+    static void Wake(Flow &flow, uint8_t source);
+    static void SchedulerTask(void *arg);
+    static int ConsoleCommand(int argc, char **argv);
+
+    static constexpr uint16_t mTraceTag = 0x0400;   ///< Dispatch tag in the event trace
+
+    static Flow *mFlows;
+    static Flow *mReadyHead;
+    static Flow *mReadyTail;
+    static TaskHandle_t mTask;
+    static JobExecutor::JobClass mJobClass;
+    static Stats mStats;
+    static portMUX_TYPE mLock;
+};
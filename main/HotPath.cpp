@@ -0,0 +1,116 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_HOT_PATHS_BENCH
+
+#include <cstdio>
+#include "esp_cpu.h"
+#include "esp_console.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "HotPath.hpp"
+#ifdef CONFIG_IDF_TARGET_ESP32S3
+#include "esp32s3/rom/cache.h"
+#endif
+#ifdef CONFIG_DONE_TIMER_WHEEL
+#include "TimerWheel.hpp"
+#endif
+#ifdef CONFIG_DONE_JOB_EXECUTOR
+#include "JobExecutor.hpp"
+#endif
+
+static constexpr uint32_t WARM_RUNS = 256;
+static constexpr uint32_t COLD_RUNS = 16;
+
+struct Measurement
+{
+    uint32_t ColdCycles;    ///< Average, instruction cache invalidated before each call
+    uint32_t WarmCycles;    ///< Minimum over WARM_RUNS back-to-back calls
+};
+
+/**
+ * @brief Cycles of one step(), which times itself, cold and warm
+ * @note An interrupt during a run inflates it; the warm figure is the minimum for that reason
+ */
+template <typename Step>
+static Measurement Measure(Step step)
+{
+    uint64_t cold = 0;
+    for (uint32_t run = 0; run < COLD_RUNS; run++) {
+#ifdef CONFIG_IDF_TARGET_ESP32S3
+        Cache_Invalidate_ICache_All();
+#endif
+        cold += step();
+    }
+    uint32_t warm = UINT32_MAX;
+    for (uint32_t run = 0; run < WARM_RUNS; run++) {
+        const uint32_t cycles = step();
+        warm = (cycles < warm) ? cycles : warm;
+    }
+    return { static_cast<uint32_t>(cold / COLD_RUNS), warm };
+}
+
+static void Print(const char *name, const Measurement &measurement)
+{
+    printf("  %-22s cold %6lu  warm %6lu cycles\n", name,
+           static_cast<unsigned long>(measurement.ColdCycles),
+           static_cast<unsigned long>(measurement.WarmCycles));
+}
+
+#if defined(CONFIG_DONE_TIMER_WHEEL) || defined(CONFIG_DONE_JOB_EXECUTOR)
+static void Nothing(void *arg)
+{
+    (void)arg;
+}
+#endif
+
+int HotPath::ConsoleCommand(int argc, char **argv)
+{
+#if defined(CONFIG_DONE_HOT_PATHS_IRAM)
+    printf("hotpaths: -O2, IRAM\n");
+#elif defined(CONFIG_DONE_HOT_PATHS)
+    printf("hotpaths: -O2, flash\n");
+#else
+    printf("hotpaths: -Os, flash (untagged)\n");
+#endif
+
+#ifdef CONFIG_DONE_TIMER_WHEEL
+    // Far enough out that the timer never fires between Arm and Cancel
+    static TimerWheel::Timer timer;
+    TimerWheel::Init(timer, Nothing, nullptr);
+    Print("timer arm+cancel", Measure([] {
+        const uint32_t start = esp_cpu_get_cycle_count();
+        TimerWheel::Arm(timer, 60000);
+        TimerWheel::Cancel(timer);
+        return esp_cpu_get_cycle_count() - start;
+    }));
+#endif
+
+#ifdef CONFIG_DONE_JOB_EXECUTOR
+    static JobExecutor::JobClass jobClass = JobExecutor::RegisterClass("hotpaths");
+    // The worker woken by the post runs once the scheduler resumes, outside the measurement,
+    // and drains the deque before the next post
+    Print("job post", Measure([] {
+        vTaskSuspendAll();
+        const uint32_t start = esp_cpu_get_cycle_count();
+        JobExecutor::Post(jobClass, Nothing, nullptr);
+        const uint32_t cycles = esp_cpu_get_cycle_count() - start;
+        xTaskResumeAll();
+        return cycles;
+    }));
+#endif
+    return 0;
+}
+
+esp_err_t HotPath::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "hotpaths",
+        .help = "Cold and warm cycles per call of the DONE_HOT paths",
+        .hint = nullptr,
+        .func = &ConsoleCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_HOT_PATHS_BENCH
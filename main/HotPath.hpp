@@ -0,0 +1,61 @@
+/**
+ * @file HotPath.hpp
+ * @brief -O2 and IRAM islands inside the -Os build
+ *
+ * The project is built at -Os. Code on a hot path can be tagged to be built
+ * at -O2 instead and, with CONFIG_DONE_HOT_PATHS_IRAM, to run from IRAM. From
+ * IRAM it does not compete with UI, Matter and MQTT code for the 16 KB
+ * instruction cache. Nothing is tagged yet: a function or source is tagged
+ * once the instruction cache profiler (ICacheProfiler.hpp) shows it missing
+ * on a board, not on a guess.
+ * - A function: put DONE_HOT where IRAM_ATTR would go.
+ * - A whole source file: done_hot_sources() in its component's CMakeLists.txt
+ *   (see main/project_include.cmake).
+ *
+ * The iram_report build target (`cmake --build build --target iram_report`)
+ * lists what the hot paths put in IRAM and checks it against
+ * CONFIG_DONE_HOT_PATHS_IRAM_BUDGET. The `hotpaths` console command
+ * (CONFIG_DONE_HOT_PATHS_BENCH) prints cold and warm cycles per call of the
+ * timer and job paths; once they are tagged, build with and without
+ * CONFIG_DONE_HOT_PATHS to compare.
+ * Timings of the same code on a host (x86) only compare -O2 with -Os code
+ * generation. They say nothing about IRAM placement, whose gain is the flash
+ * cache misses it avoids on the Xtensa core; only the board shows that.
+ * The job deques are deliberately not tagged: -O2 made them slower.
+ *
+ * DONE_HOT functions must not be inline or defined in headers: each copy would
+ * get its own IRAM section.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+
+#define DONE_HOT_STRINGIFY_(x) #x
+#define DONE_HOT_SECTION_(counter) __attribute__((section(".iram1.hot." DONE_HOT_STRINGIFY_(counter))))
+
+#if defined(CONFIG_DONE_HOT_PATHS_IRAM)
+#define DONE_HOT __attribute__((hot, optimize("O2"))) DONE_HOT_SECTION_(__COUNTER__)
+#elif defined(CONFIG_DONE_HOT_PATHS)
+#define DONE_HOT __attribute__((hot, optimize("O2")))
+#else
+#define DONE_HOT
+#endif
+
+#ifdef CONFIG_DONE_HOT_PATHS_BENCH
+
+#include "esp_err.h"
+
+class HotPath
+{
+public:
+    /**
+     * @brief Register the `hotpaths` console command
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+    static int ConsoleCommand(int argc, char **argv);
+};
+
+#endif // CONFIG_DONE_HOT_PATHS_BENCH
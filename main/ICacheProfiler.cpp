@@ -0,0 +1,233 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_ICACHE_PROFILER
+
+#include <cstdio>
+#include <cstring>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_console.h"
+#include "esp_ipc.h"
+#include "esp_freertos_hooks.h"
+#include "freertos/task.h"
+#include "xtensa_context.h"
+#include "eri.h"
+#include "perfmon.h"
+#include "ICacheProfiler.hpp"
+
+static const char *TAG = "ICacheProfiler";
+
+// ERI address of performance counter 0; counter n is 4 * n bytes further
+static constexpr int PERFMON_PM0 = 0x101080;
+static constexpr int COUNTER_EVENT = 0;
+static constexpr int COUNTER_INSTRUCTIONS = 1;
+
+ICacheProfiler::Line ICacheProfiler::mTable[ICacheProfiler::mLines];
+ICacheProfiler::CoreState ICacheProfiler::mCores[ICacheProfiler::mCoreCount];
+uint32_t ICacheProfiler::mDropped = 0;
+ICacheProfiler::Event ICacheProfiler::mEvent = ICacheProfiler::Event::CacheMiss;
+volatile bool ICacheProfiler::mRunning = false;
+bool ICacheProfiler::mHooked = false;
+portMUX_TYPE ICacheProfiler::mLock = portMUX_INITIALIZER_UNLOCKED;
+
+void ICacheProfiler::SetupCore(void *arg)
+{
+    // The counters are per core, so this runs on each core through esp_ipc
+    const Event event = *static_cast<const Event *>(arg);
+    xtensa_perfmon_stop();
+    if (event == Event::CacheMiss) {
+        xtensa_perfmon_init(COUNTER_EVENT, XTPERF_CNT_I_MEM, XTPERF_MASK_I_MEM_CACHE_MISS, 0, -1);
+    } else {
+        xtensa_perfmon_init(COUNTER_EVENT, XTPERF_CNT_I_STALL, XTPERF_MASK_I_STALL_CACHE_MISS, 0, -1);
+    }
+    xtensa_perfmon_init(COUNTER_INSTRUCTIONS, XTPERF_CNT_INSN, XTPERF_MASK_INSN_ALL, 0, -1);
+    xtensa_perfmon_reset(COUNTER_EVENT);
+    xtensa_perfmon_reset(COUNTER_INSTRUCTIONS);
+    xtensa_perfmon_start();
+}
+
+void ICacheProfiler::StopCore(void *arg)
+{
+    (void)arg;
+    xtensa_perfmon_stop();
+}
+
+esp_err_t ICacheProfiler::Start(Event event)
+{
+    if (!mHooked) {
+        for (uint8_t core = 0; core < mCoreCount; core++) {
+            const esp_err_t err = esp_register_freertos_tick_hook_for_cpu(TickHook, core);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "tick hook on core %u: %s", static_cast<unsigned>(core), esp_err_to_name(err));
+                return err;
+            }
+        }
+        mHooked = true;
+    }
+
+    mRunning = false;
+    mEvent = event;
+    for (uint8_t core = 0; core < mCoreCount; core++) {
+        const esp_err_t err = esp_ipc_call_blocking(core, SetupCore, &event);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    portENTER_CRITICAL(&mLock);
+    for (CoreState &state : mCores) {
+        state.Primed = false;
+    }
+    portEXIT_CRITICAL(&mLock);
+    mRunning = true;
+    return ESP_OK;
+}
+
+void ICacheProfiler::Stop()
+{
+    mRunning = false;
+    for (uint8_t core = 0; core < mCoreCount; core++) {
+        esp_ipc_call_blocking(core, StopCore, nullptr);
+    }
+}
+
+void ICacheProfiler::Clear()
+{
+    portENTER_CRITICAL(&mLock);
+    memset(mTable, 0, sizeof(mTable));
+    memset(mCores, 0, sizeof(mCores));
+    mDropped = 0;
+    portEXIT_CRITICAL(&mLock);
+}
+
+void IRAM_ATTR ICacheProfiler::Charge(uint32_t pc, uint32_t events, uint32_t instructions)
+{
+    const uint32_t address = pc & ~((1UL << mLineBits) - 1);
+    const uint32_t home = ((address >> mLineBits) * 2654435761UL) % mLines;
+    for (uint32_t probe = 0; probe < mMaxProbes; probe++) {
+        Line &line = mTable[(home + probe) % mLines];
+        if (line.Address == 0) {
+            line.Address = address;
+        } else if (line.Address != address) {
+            continue;
+        }
+        line.Samples++;
+        line.Events += events;
+        line.Instructions += instructions;
+        return;
+    }
+    mDropped++;
+}
+
+void IRAM_ATTR ICacheProfiler::TickHook()
+{
+    if (!mRunning) {
+        return;
+    }
+    const uint32_t events = eri_read(PERFMON_PM0 + COUNTER_EVENT * 4);
+    const uint32_t instructions = eri_read(PERFMON_PM0 + COUNTER_INSTRUCTIONS * 4);
+    // pxTopOfStack, the first member of the TCB, points at the frame the tick interrupt saved
+    const XtExcFrame *frame = *reinterpret_cast<XtExcFrame *const *>(xTaskGetCurrentTaskHandle());
+    CoreState &state = mCores[xPortGetCoreID()];
+
+    portENTER_CRITICAL_ISR(&mLock);
+    if (state.Primed) {
+        // 32-bit counters, the differences stay right across a wrap
+        const uint32_t newEvents = events - state.LastEvents;
+        const uint32_t newInstructions = instructions - state.LastInstructions;
+        state.Events += newEvents;
+        state.Instructions += newInstructions;
+        state.Samples++;
+        Charge(static_cast<uint32_t>(frame->pc), newEvents, newInstructions);
+    }
+    state.LastEvents = events;
+    state.LastInstructions = instructions;
+    state.Primed = true;
+    portEXIT_CRITICAL_ISR(&mLock);
+}
+
+void ICacheProfiler::Dump()
+{
+    const bool wasRunning = mRunning;
+    mRunning = false;
+    // Let a tick hook that already passed the running check finish
+    vTaskDelay(2);
+
+    uint32_t used = 0;
+    for (const Line &line : mTable) {
+        used += (line.Address != 0) ? 1 : 0;
+    }
+    // Plain printf: the host tool parses these lines, log prefixes would get in the way
+    printf("DONE_ICACHE_BEGIN %s %lu %lu\n", (mEvent == Event::CacheMiss) ? "miss" : "stall",
+           static_cast<unsigned long>(used), static_cast<unsigned long>(mDropped));
+    for (uint8_t core = 0; core < mCoreCount; core++) {
+        const CoreState &state = mCores[core];
+        printf("IC_CORE,%u,%lu,%llu,%llu\n", static_cast<unsigned>(core),
+               static_cast<unsigned long>(state.Samples),
+               static_cast<unsigned long long>(state.Events),
+               static_cast<unsigned long long>(state.Instructions));
+    }
+    for (const Line &line : mTable) {
+        if (line.Address != 0) {
+            printf("IC,%08lx,%lu,%lu,%lu\n", static_cast<unsigned long>(line.Address),
+                   static_cast<unsigned long>(line.Samples), static_cast<unsigned long>(line.Events),
+                   static_cast<unsigned long>(line.Instructions));
+        }
+    }
+    printf("DONE_ICACHE_END\n");
+    fflush(stdout);
+
+    // The counters kept running during the dump; do not charge that to the next sample
+    portENTER_CRITICAL(&mLock);
+    for (CoreState &state : mCores) {
+        state.Primed = false;
+    }
+    portEXIT_CRITICAL(&mLock);
+    mRunning = wasRunning;
+}
+
+int ICacheProfiler::ConsoleCommand(int argc, char **argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "start") == 0) {
+        const Event event = (argc >= 3 && strcmp(argv[2], "stall") == 0) ? Event::FetchStall : Event::CacheMiss;
+        const esp_err_t err = Start(event);
+        if (err != ESP_OK) {
+            printf("icache: %s\n", esp_err_to_name(err));
+            return 1;
+        }
+    } else if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        Stop();
+    } else if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+        Clear();
+    } else if (argc == 2 && strcmp(argv[1], "dump") == 0) {
+        Dump();
+    } else if (argc == 1) {
+        for (uint8_t core = 0; core < mCoreCount; core++) {
+            portENTER_CRITICAL(&mLock);
+            const CoreState state = mCores[core];
+            portEXIT_CRITICAL(&mLock);
+            const uint64_t perThousand = (state.Instructions > 0) ? state.Events * 1000 / state.Instructions : 0;
+            printf("core %u: %lu samples, %llu %s per 1000 instructions\n", static_cast<unsigned>(core),
+                   static_cast<unsigned long>(state.Samples), static_cast<unsigned long long>(perThousand),
+                   (mEvent == Event::CacheMiss) ? "misses" : "stall cycles");
+        }
+        printf("%s, %lu samples dropped (table full)\n", mRunning ? "running" : "stopped", static_cast<unsigned long>(mDropped));
+    } else {
+        printf("usage: icache [start [miss|stall] | stop | clear | dump]\n");
+        return 1;
+    }
+    return 0;
+}
+
+esp_err_t ICacheProfiler::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "icache",
+        .help = "Instruction cache miss profile: icache [start [miss|stall] | stop | clear | dump]",
+        .hint = nullptr,
+        .func = &ConsoleCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_ICACHE_PROFILER
@@ -0,0 +1,105 @@
+/**
+ * @file ICacheProfiler.hpp
+ * @brief Instruction cache miss profiler for the flash/PSRAM code cache
+ *
+ * Code runs from flash (or PSRAM with SPIRAM_FETCH_INSTRUCTIONS) through a
+ * 16 KB instruction cache shared by UI, Matter and MQTT. This profiler shows
+ * which code misses in it, to decide what moves to IRAM (DONE_HOT, see
+ * HotPath.hpp) or whether a 32 KB cache is worth its RAM.
+ *
+ * Performance counter 0 counts the selected event: instruction cache misses,
+ * or instruction fetch stall cycles. Counter 1 counts retired instructions.
+ * On every FreeRTOS tick each core samples the PC of the task it interrupted.
+ * The sample is charged with the events and instructions since that core's
+ * previous sample, into a fixed table keyed by 32-byte code line. Attribution
+ * is statistical: code that runs for a larger share of the time between
+ * ticks gets that share of the misses on average.
+ *
+ * `icache start [miss|stall]`, `icache stop`, `icache dump` and `icache clear`
+ * drive it. tools/icache_report.py maps the dump to functions and components
+ * using the ELF and the linker map.
+ *
+ * @note Experimental: not yet run on a board. The performance counter setup
+ *       and the attribution are unconfirmed until a dump has been checked
+ *       against a known workload.
+ *
+ * @note Only available when CONFIG_DONE_ICACHE_PROFILER is enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+class ICacheProfiler
+{
+public:
+    enum class Event : uint8_t
+    {
+        CacheMiss,      ///< Instruction fetches that missed the cache
+        FetchStall,     ///< Cycles stalled on instruction fetch, misses weighted by their cost
+    };
+
+    /**
+     * @brief Program the counters on every core and start sampling
+     */
+    static esp_err_t Start(Event event);
+
+    static void Stop();
+
+    static void Clear();
+
+    /**
+     * @brief Print the table for tools/icache_report.py; sampling pauses meanwhile
+     */
+    static void Dump();
+
+    /**
+     * @brief Register the `icache` console command
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+#ifdef CONFIG_FREERTOS_UNICORE
+    static constexpr uint8_t mCoreCount = 1;
+#else
+    static constexpr uint8_t mCoreCount = 2;
+#endif
+    static constexpr uint32_t mLines = CONFIG_DONE_ICACHE_PROFILER_LINES;
+    static constexpr uint32_t mLineBits = 5;
+    static constexpr uint32_t mMaxProbes = 8;
+
+    struct Line
+    {
+        uint32_t Address;   ///< First byte of the code line, 0 when unused
+        uint32_t Samples;
+        uint32_t Events;
+        uint32_t Instructions;
+    };
+
+    struct CoreState
+    {
+        uint32_t LastEvents;
+        uint32_t LastInstructions;
+        uint64_t Events;
+        uint64_t Instructions;
+        uint32_t Samples;
+        bool Primed;            ///< Last* hold a reading taken since Start()
+    };
+
+    static void SetupCore(void *arg);
+    static void StopCore(void *arg);
+    static void TickHook();
+    static void Charge(uint32_t pc, uint32_t events, uint32_t instructions);
+    static int ConsoleCommand(int argc, char **argv);
+
+    static Line mTable[mLines];
+    static CoreState mCores[mCoreCount];
+    static uint32_t mDropped;
+    static Event mEvent;
+    static volatile bool mRunning;
+    static bool mHooked;
+    static portMUX_TYPE mLock;
+};
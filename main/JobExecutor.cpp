@@ -0,0 +1,305 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_JOB_EXECUTOR
+
+#include <cstdio>
+#include <cstring>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "TaskPlan.hpp"
+#include "JobExecutor.hpp"
+#include "TraceRecorder.hpp"
+
+static const char *TAG = "JobExecutor";
+
+JobExecutor::Worker JobExecutor::mWorkers[JobExecutor::mWorkerCount];
+JobExecutor::ClassStats JobExecutor::mClasses[JobExecutor::mMaxClasses];
+uint8_t JobExecutor::mClassCount = 0;
+bool JobExecutor::mStarted = false;
+portMUX_TYPE JobExecutor::mStatsLock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t JobExecutor::Start()
+{
+    if (mStarted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (uint8_t index = 0; index < mWorkerCount; index++) {
+        Worker &worker = mWorkers[index];
+        worker.Head = 0;
+        worker.Count = 0;
+        worker.Busy = false;
+        portMUX_INITIALIZE(&worker.Lock);
+    }
+    for (uint8_t index = 0; index < mWorkerCount; index++) {
+        const TaskPlan::Id id = static_cast<TaskPlan::Id>(TaskPlan::JOB_WORKER_0 + index);
+        mWorkers[index].Task = TaskPlan::Create(id, WorkerTask, reinterpret_cast<void *>(index));
+        if (mWorkers[index].Task == nullptr) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    mStarted = true;
+    ESP_LOGI(TAG, "%u workers, %lu jobs per deque", static_cast<unsigned>(mWorkerCount),
+             static_cast<unsigned long>(mDepth));
+    return ESP_OK;
+}
+
+JobExecutor::JobClass JobExecutor::RegisterClass(const char *name)
+{
+    portENTER_CRITICAL(&mStatsLock);
+    if (mClassCount == mMaxClasses) {
+        portEXIT_CRITICAL(&mStatsLock);
+        ESP_LOGE(TAG, "no job class slot left for %s", name);
+        return mInvalidClass;
+    }
+    const JobClass jobClass = mClassCount++;
+    mClasses[jobClass].Name = name;
+    portEXIT_CRITICAL(&mStatsLock);
+    return jobClass;
+}
+
+bool JobExecutor::Push(Worker &worker, const Job &job, bool &busy)
+{
+    portENTER_CRITICAL(&worker.Lock);
+    const bool pushed = (worker.Count < mDepth);
+    if (pushed) {
+        worker.Jobs[(worker.Head + worker.Count) % mDepth] = job;
+        worker.Count++;
+    }
+    busy = worker.Busy;
+    portEXIT_CRITICAL(&worker.Lock);
+    return pushed;
+}
+
+esp_err_t JobExecutor::Post(JobClass jobClass, Function function, void *arg, BaseType_t core, bool pinned)
+{
+    if (!mStarted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (jobClass >= mClassCount || function == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const Job job = { function, arg, esp_timer_get_time(), jobClass, pinned && (core != tskNO_AFFINITY) };
+
+    uint8_t first;
+    if (core != tskNO_AFFINITY) {
+        first = static_cast<uint8_t>(core) % mWorkerCount;
+    } else {
+        // Less loaded worker; on a tie the caller's core, whose cache already holds the arguments
+        first = static_cast<uint8_t>(xPortGetCoreID()) % mWorkerCount;
+        for (uint8_t index = 0; index < mWorkerCount; index++) {
+            const Worker &worker = mWorkers[index];
+            const Worker &best = mWorkers[first];
+            if (worker.Count + worker.Busy < best.Count + best.Busy) {
+                first = index;
+            }
+        }
+    }
+
+    for (uint8_t attempt = 0; attempt < mWorkerCount; attempt++) {
+        const uint8_t index = (first + attempt) % mWorkerCount;
+        bool busy = false;
+        if (!Push(mWorkers[index], job, busy)) {
+            if (job.Pinned) {
+                break;
+            }
+            continue;
+        }
+        xTaskNotifyGive(mWorkers[index].Task);
+        if (busy && !job.Pinned) {
+            // Let an idle worker steal it rather than wait for the busy one
+            for (uint8_t other = 0; other < mWorkerCount; other++) {
+                if (other != index && !mWorkers[other].Busy) {
+                    xTaskNotifyGive(mWorkers[other].Task);
+                    break;
+                }
+            }
+        }
+        return ESP_OK;
+    }
+
+    portENTER_CRITICAL(&mStatsLock);
+    mClasses[jobClass].Rejected++;
+    portEXIT_CRITICAL(&mStatsLock);
+    return ESP_ERR_NO_MEM;
+}
+
+bool JobExecutor::TakeOwn(Worker &worker, Job &job)
+{
+    portENTER_CRITICAL(&worker.Lock);
+    const bool taken = (worker.Count > 0);
+    if (taken) {
+        job = worker.Jobs[worker.Head];
+        worker.Head = (worker.Head + 1) % mDepth;
+        worker.Count--;
+    }
+    worker.Busy = taken;
+    portEXIT_CRITICAL(&worker.Lock);
+    return taken;
+}
+
+bool JobExecutor::Steal(Worker &victim, Worker &thief, Job &job)
+{
+    portENTER_CRITICAL(&victim.Lock);
+    bool stolen = false;
+    // The newest job that may move: the oldest is the one the owner takes next
+    for (uint32_t offset = victim.Count; offset-- > 0;) {
+        const Job &candidate = victim.Jobs[(victim.Head + offset) % mDepth];
+        if (candidate.Pinned) {
+            continue;
+        }
+        job = candidate;
+        // Close the gap; the newer jobs are pinned and keep their order
+        for (uint32_t next = offset + 1; next < victim.Count; next++) {
+            victim.Jobs[(victim.Head + next - 1) % mDepth] = victim.Jobs[(victim.Head + next) % mDepth];
+        }
+        victim.Count--;
+        stolen = true;
+        break;
+    }
+    portEXIT_CRITICAL(&victim.Lock);
+
+    if (stolen) {
+        portENTER_CRITICAL(&thief.Lock);
+        thief.Busy = true;
+        portEXIT_CRITICAL(&thief.Lock);
+    }
+    return stolen;
+}
+
+void JobExecutor::Record(const Job &job, bool stolen, int64_t startUs, int64_t endUs)
+{
+    const uint32_t waitUs = static_cast<uint32_t>(startUs - job.PostedUs);
+    const uint32_t runUs = static_cast<uint32_t>(endUs - startUs);
+    portENTER_CRITICAL(&mStatsLock);
+    ClassStats &stats = mClasses[job.Class];
+    stats.Jobs++;
+    if (stolen) {
+        stats.Stolen++;
+    }
+#ifdef CONFIG_DONE_JOB_EXECUTOR_LATENCY
+    stats.WaitUs.Record(waitUs);
+#else
+    stats.WaitUs += waitUs;
+    if (waitUs > stats.MaxWaitUs) {
+        stats.MaxWaitUs = waitUs;
+    }
+#endif
+    stats.RunUs += runUs;
+    if (runUs > stats.MaxRunUs) {
+        stats.MaxRunUs = runUs;
+    }
+    portEXIT_CRITICAL(&mStatsLock);
+}
+
+void JobExecutor::WorkerTask(void *arg)
+{
+    const uint8_t index = static_cast<uint8_t>(reinterpret_cast<uintptr_t>(arg));
+    Worker &self = mWorkers[index];
+    while (true)
+    {
+        Job job;
+        bool stolen = false;
+        if (!TakeOwn(self, job)) {
+            for (uint8_t other = 0; other < mWorkerCount && !stolen; other++) {
+                if (other != index) {
+                    stolen = Steal(mWorkers[other], self, job);
+                }
+            }
+            if (!stolen) {
+                // A post between the checks above and here leaves a notification pending
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                continue;
+            }
+        }
+        const int64_t startUs = esp_timer_get_time();
+        {
+            DONE_TRACE_SCOPE(mTraceTag, job.Class);
+            job.Work(job.Arg);
+        }
+        Record(job, stolen, startUs, esp_timer_get_time());
+    }
+}
+
+void JobExecutor::Report()
+{
+    uint32_t queued = 0;
+    for (const Worker &worker : mWorkers) {
+        queued += worker.Count;
+    }
+    ESP_LOGI(TAG, "%u workers, %lu jobs queued", static_cast<unsigned>(mWorkerCount),
+             static_cast<unsigned long>(queued));
+
+    for (uint8_t jobClass = 0; jobClass < mClassCount; jobClass++) {
+        portENTER_CRITICAL(&mStatsLock);
+        const ClassStats stats = mClasses[jobClass];
+        portEXIT_CRITICAL(&mStatsLock);
+#ifdef CONFIG_DONE_JOB_EXECUTOR_LATENCY
+        ESP_LOGI(TAG, "  %-12s %6lu jobs %5lu stolen %4lu rejected | wait p50 %lu p99 %lu max %lu us"
+                 " | run avg %lu max %lu us", stats.Name,
+                 static_cast<unsigned long>(stats.Jobs),
+                 static_cast<unsigned long>(stats.Stolen),
+                 static_cast<unsigned long>(stats.Rejected),
+                 static_cast<unsigned long>(stats.WaitUs.Percentile(500)),
+                 static_cast<unsigned long>(stats.WaitUs.Percentile(990)),
+                 static_cast<unsigned long>(stats.WaitUs.Max()),
+                 static_cast<unsigned long>((stats.Jobs > 0) ? stats.RunUs / stats.Jobs : 0),
+                 static_cast<unsigned long>(stats.MaxRunUs));
+#else
+        ESP_LOGI(TAG, "  %-12s %6lu jobs %5lu stolen %4lu rejected | wait avg %lu max %lu us"
+                 " | run avg %lu max %lu us", stats.Name,
+                 static_cast<unsigned long>(stats.Jobs),
+                 static_cast<unsigned long>(stats.Stolen),
+                 static_cast<unsigned long>(stats.Rejected),
+                 static_cast<unsigned long>((stats.Jobs > 0) ? stats.WaitUs / stats.Jobs : 0),
+                 static_cast<unsigned long>(stats.MaxWaitUs),
+                 static_cast<unsigned long>((stats.Jobs > 0) ? stats.RunUs / stats.Jobs : 0),
+                 static_cast<unsigned long>(stats.MaxRunUs));
+#endif
+    }
+}
+
+void JobExecutor::Reset()
+{
+    for (uint8_t jobClass = 0; jobClass < mClassCount; jobClass++) {
+        portENTER_CRITICAL(&mStatsLock);
+        ClassStats &stats = mClasses[jobClass];
+        stats.Jobs = 0;
+        stats.Stolen = 0;
+        stats.Rejected = 0;
+        stats.MaxRunUs = 0;
+        stats.RunUs = 0;
+#ifdef CONFIG_DONE_JOB_EXECUTOR_LATENCY
+        stats.WaitUs.Reset();
+#else
+        stats.WaitUs = 0;
+        stats.MaxWaitUs = 0;
+#endif
+        portEXIT_CRITICAL(&mStatsLock);
+    }
+}
+
+int JobExecutor::ConsoleCommand(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        Reset();
+        printf("jobs: statistics cleared\n");
+        return 0;
+    }
+    Report();
+    return 0;
+}
+
+esp_err_t JobExecutor::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "jobs",
+        .help = "Jobs, steals and wait/run time per job class: jobs [reset]",
+        .hint = nullptr,
+        .func = &ConsoleCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_JOB_EXECUTOR
@@ -0,0 +1,137 @@
+/**
+ * @file JobExecutor.hpp
+ * @brief Work-stealing pool with one worker per core for short service jobs
+ *
+ * Services post short jobs (JSON encode, image decode, recipe compile) instead
+ * of owning a task, and its stack, for work that only comes in bursts. Each
+ * core has one worker with its own bounded deque. A job goes to the deque of
+ * the core it hints at, or else to the less loaded one. A worker that runs
+ * out of jobs steals the newest job from the other deque, so one core does
+ * not idle while the other has a backlog. Pinned jobs are never stolen; a
+ * thief skips them and takes the newest job that is not pinned.
+ *
+ * Jobs are counted per job class: time spent waiting for a worker (a histogram
+ * with CONFIG_DONE_JOB_EXECUTOR_LATENCY, else average and maximum), run time,
+ * and how many were stolen or rejected. The `jobs` console command prints them.
+ *
+ * Jobs run to completion on a shared worker and delay every job queued behind
+ * them. A job may block only for a bounded time: a flash write or an NVS
+ * commit, as flows do with FLOW_AWAIT_JOB. Waiting for the network, a queue or
+ * another task has no bound and belongs in a service task. Hint long jobs
+ * (image decode, flash writes) at one core and short ones at the other: an
+ * idle worker still steals either kind, but short jobs seldom queue behind a
+ * long one.
+ *
+ * @note Only available when CONFIG_DONE_JOB_EXECUTOR is enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#ifdef CONFIG_DONE_JOB_EXECUTOR_LATENCY
+#include "LatencyHistogram.hpp"
+#endif
+
+class JobExecutor
+{
+public:
+    using Function = void (*)(void *arg);
+    using JobClass = uint8_t;
+    static constexpr JobClass mInvalidClass = 0xFF;
+
+    /**
+     * @brief Create the workers planned in TaskPlan
+     */
+    static esp_err_t Start();
+
+    /**
+     * @brief Name a kind of job for the metrics; call once per kind at startup
+     * @return mInvalidClass when all class slots are used
+     */
+    static JobClass RegisterClass(const char *name);
+
+    /**
+     * @brief Queue a job, callable from any task
+     * @param core preferred core, tskNO_AFFINITY to take the less loaded one
+     * @param pinned only run on the preferred core, never stolen
+     * @return ESP_ERR_NO_MEM if the deques are full, ESP_ERR_INVALID_STATE before Start()
+     */
+    static esp_err_t Post(JobClass jobClass, Function function, void *arg,
+                          BaseType_t core = tskNO_AFFINITY, bool pinned = false);
+
+    /**
+     * @brief Log wait and run time per job class
+     */
+    static void Report();
+
+    /**
+     * @brief Register the `jobs [reset]` console command
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+#ifdef CONFIG_FREERTOS_UNICORE
+    static constexpr uint8_t mWorkerCount = 1;
+#else
+    static constexpr uint8_t mWorkerCount = 2;
+#endif
+    static constexpr uint32_t mDepth = CONFIG_DONE_JOB_EXECUTOR_DEPTH;
+    static constexpr uint8_t mMaxClasses = CONFIG_DONE_JOB_EXECUTOR_CLASSES;
+    static constexpr uint16_t mTraceTag = 0x0300;   ///< Dispatch tag in the event trace
+
+    struct Job
+    {
+        Function Work;
+        void *Arg;
+        int64_t PostedUs;
+        JobClass Class;
+        bool Pinned;
+    };
+
+    /**
+     * @brief Ring used as a deque: the owner takes the oldest job, thieves the newest
+     */
+    struct Worker
+    {
+        Job Jobs[mDepth];
+        uint32_t Head;
+        uint32_t Count;
+        bool Busy;
+        TaskHandle_t Task;
+        portMUX_TYPE Lock;
+    };
+
+    struct ClassStats
+    {
+        const char *Name;
+        uint32_t Jobs;
+        uint32_t Stolen;
+        uint32_t Rejected;
+        uint32_t MaxRunUs;
+        uint64_t RunUs;
+#ifdef CONFIG_DONE_JOB_EXECUTOR_LATENCY
+        LatencyHistogram WaitUs;
+#else
+        uint64_t WaitUs;
+        uint32_t MaxWaitUs;
+#endif
+    };
+
+    static bool Push(Worker &worker, const Job &job, bool &busy);
+    static bool TakeOwn(Worker &worker, Job &job);
+    static bool Steal(Worker &victim, Worker &thief, Job &job);
+    static void Record(const Job &job, bool stolen, int64_t startUs, int64_t endUs);
+    static void WorkerTask(void *arg);
+    static int ConsoleCommand(int argc, char **argv);
+    static void Reset();
+
+    static Worker mWorkers[mWorkerCount];
+    static ClassStats mClasses[mMaxClasses];
+    static uint8_t mClassCount;
+    static bool mStarted;
+    static portMUX_TYPE mStatsLock;
+};
@@ -0,0 +1,98 @@
+/**
+ * @file LatencyHistogram.hpp
+ * @brief Fixed-memory, HDR-style log-linear latency histogram
+ *
+ * Values are bucketed by their power of two and then into mSubBuckets linear
+ * sub-buckets, so every recorded value is kept with at most 1/mSubBuckets relative
+ * error over the whole range (1 us .. ~16 s) in under 1 KB.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+class LatencyHistogram
+{
+public:
+    static constexpr int mSubBucketBits = 3;
+    static constexpr int mSubBuckets = 1 << mSubBucketBits;
+    static constexpr int mMagnitudes = 24 - mSubBucketBits + 1;
+    static constexpr int mBucketCount = mMagnitudes * mSubBuckets;
+
+    LatencyHistogram() { Reset(); }
+
+    void Reset()
+    {
+        memset(mCounts, 0, sizeof(mCounts));
+        mTotal = 0;
+        mMax = 0;
+    }
+
+    void Record(uint32_t valueUs)
+    {
+        mCounts[BucketOf(valueUs)]++;
+        mTotal++;
+        if (valueUs > mMax) {
+            mMax = valueUs;
+        }
+    }
+
+    uint32_t Count() const { return mTotal; }
+
+    uint32_t Max() const { return mMax; }
+
+    /**
+     * @brief Value at a percentile, reported as the upper bound of its bucket
+     * @param permille percentile in 1/1000 (500 = p50, 999 = p99.9)
+     */
+    uint32_t Percentile(uint32_t permille) const
+    {
+        if (mTotal == 0) {
+            return 0;
+        }
+        const uint64_t rank = (static_cast<uint64_t>(mTotal) * permille + 999) / 1000;
+        uint64_t seen = 0;
+        for (int bucket = 0; bucket < mBucketCount; bucket++) {
+            seen += mCounts[bucket];
+            if (seen >= rank && seen != 0) {
+                if (bucket == mBucketCount - 1) {
+                    return mMax;    // overflow bucket
+                }
+                const uint32_t upper = UpperBoundOf(bucket);
+                return (upper < mMax) ? upper : mMax;
+            }
+        }
+        return mMax;
+    }
+
+private:
+    static int BucketOf(uint32_t value)
+    {
+        if (value < mSubBuckets) {
+            return static_cast<int>(value);
+        }
+        // Magnitude 1 covers [8, 16) with step 1, magnitude 2 covers [16, 32) with step 2, ...
+        const int magnitude = (31 - __builtin_clz(value)) - mSubBucketBits + 1;
+        if (magnitude >= mMagnitudes) {
+            return mBucketCount - 1;
+        }
+        const int sub = static_cast<int>(value >> (magnitude - 1)) & (mSubBuckets - 1);
+        return magnitude * mSubBuckets + sub;
+    }
+
+    static uint32_t UpperBoundOf(int bucket)
+    {
+        const int magnitude = bucket / mSubBuckets;
+        const uint32_t sub = bucket % mSubBuckets;
+        if (magnitude == 0) {
+            return sub;
+        }
+        const uint32_t step = 1u << (magnitude - 1);
+        return ((mSubBuckets + sub) << (magnitude - 1)) + step - 1;
+    }
+
+    uint32_t mCounts[mBucketCount];
+    uint32_t mTotal;
+    uint32_t mMax;
+};
@@ -0,0 +1,161 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_LATENCY_MONITOR
+
+#include <cstdio>
+#include <cstring>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "LatencyMonitor.hpp"
+
+static const char *TAG = "LatencyMonitor";
+
+LatencyMonitor::Slot LatencyMonitor::mSlots[CONFIG_DONE_LATENCY_SLOTS];
+uint32_t LatencyMonitor::mDropped = 0;
+portMUX_TYPE LatencyMonitor::mLock = portMUX_INITIALIZER_UNLOCKED;
+LatencyMonitor::Publisher LatencyMonitor::mPublisher = nullptr;
+void *LatencyMonitor::mPublisherArg = nullptr;
+
+esp_err_t LatencyMonitor::Start()
+{
+    const esp_timer_create_args_t timerArgs = {
+        .callback = &ReportTimerCallback,
+        .arg = nullptr,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "LatencyReport",
+        .skip_unhandled_events = true
+    };
+    esp_timer_handle_t timer = nullptr;
+    esp_err_t err = esp_timer_create(&timerArgs, &timer);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = esp_timer_start_periodic(timer, CONFIG_DONE_LATENCY_REPORT_PERIOD_S * 1000000ULL);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    const esp_console_cmd_t command = {
+        .command = "latency",
+        .help = "SharedBus latency percentiles: latency [reset]",
+        .hint = nullptr,
+        .func = &ConsoleCommand,
+        .argtable = nullptr
+    };
+    if (esp_console_cmd_register(&command) != ESP_OK) {
+        ESP_LOGW(TAG, "console command not registered");
+    }
+    return ESP_OK;
+}
+
+void LatencyMonitor::Record(uint16_t messageType, uint16_t sourceId, int64_t originUs)
+{
+    const int64_t latency = esp_timer_get_time() - originUs;
+    const uint32_t latencyUs = (latency < 0) ? 0 :
+                               (latency > UINT32_MAX) ? UINT32_MAX : static_cast<uint32_t>(latency);
+
+    portENTER_CRITICAL(&mLock);
+    Slot *freeSlot = nullptr;
+    for (Slot &slot : mSlots) {
+        if (slot.Used) {
+            if (slot.MessageType == messageType && slot.SourceId == sourceId) {
+                slot.Histogram.Record(latencyUs);
+                portEXIT_CRITICAL(&mLock);
+                return;
+            }
+        } else if (freeSlot == nullptr) {
+            freeSlot = &slot;
+        }
+    }
+    if (freeSlot != nullptr) {
+        freeSlot->Used = true;
+        freeSlot->MessageType = messageType;
+        freeSlot->SourceId = sourceId;
+        freeSlot->Histogram.Reset();
+        freeSlot->Histogram.Record(latencyUs);
+    } else {
+        mDropped++;
+    }
+    portEXIT_CRITICAL(&mLock);
+}
+
+void LatencyMonitor::SetPublisher(Publisher publisher, void *arg)
+{
+    mPublisherArg = arg;
+    mPublisher = publisher;
+}
+
+void LatencyMonitor::Report()
+{
+    for (Slot &slot : mSlots) {
+        // Copy the buckets out so the percentile scans run with interrupts enabled
+        LatencyHistogram histogram;
+        Summary summary;
+        portENTER_CRITICAL(&mLock);
+        const bool used = slot.Used;
+        if (used) {
+            summary.MessageType = slot.MessageType;
+            summary.SourceId = slot.SourceId;
+            histogram = slot.Histogram;
+        }
+        portEXIT_CRITICAL(&mLock);
+        if (!used) {
+            continue;
+        }
+        summary.Count = histogram.Count();
+        summary.P50Us = histogram.Percentile(500);
+        summary.P90Us = histogram.Percentile(900);
+        summary.P99Us = histogram.Percentile(990);
+        summary.P999Us = histogram.Percentile(999);
+        summary.MaxUs = histogram.Max();
+
+        ESP_LOGI(TAG, "type %u from %u: n=%lu p50 %lu p90 %lu p99 %lu p99.9 %lu max %lu us",
+                 summary.MessageType, summary.SourceId,
+                 static_cast<unsigned long>(summary.Count),
+                 static_cast<unsigned long>(summary.P50Us),
+                 static_cast<unsigned long>(summary.P90Us),
+                 static_cast<unsigned long>(summary.P99Us),
+                 static_cast<unsigned long>(summary.P999Us),
+                 static_cast<unsigned long>(summary.MaxUs));
+        if (mPublisher != nullptr) {
+            mPublisher(summary, mPublisherArg);
+        }
+    }
+    if (mDropped != 0) {
+        ESP_LOGW(TAG, "%lu samples dropped, raise CONFIG_DONE_LATENCY_SLOTS",
+                 static_cast<unsigned long>(mDropped));
+    }
+}
+
+void LatencyMonitor::Reset()
+{
+    portENTER_CRITICAL(&mLock);
+    for (Slot &slot : mSlots) {
+        slot.Used = false;
+    }
+    mDropped = 0;
+    portEXIT_CRITICAL(&mLock);
+}
+
+void LatencyMonitor::ReportTimerCallback(void *arg)
+{
+    (void)arg;
+    Report();
+}
+
+int LatencyMonitor::ConsoleCommand(int argc, char **argv)
+{
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        Reset();
+        return 0;
+    }
+    if (argc != 1) {
+        printf("usage: latency [reset]\n");
+        return 1;
+    }
+    Report();
+    return 0;
+}
+
+#endif // CONFIG_DONE_LATENCY_MONITOR
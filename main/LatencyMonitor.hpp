@@ -0,0 +1,81 @@
+/**
+ * @file LatencyMonitor.hpp
+ * @brief End-to-end SharedBus latency per message type and source ServiceID
+ *
+ * Producers stamp a message with esp_timer_get_time() at its origin, consumers call
+ * Record() when they act on it. Each (message type, source) pair gets its own
+ * LatencyHistogram from a fixed pool of CONFIG_DONE_LATENCY_SLOTS, so memory use is
+ * known at build time. Percentiles are logged every CONFIG_DONE_LATENCY_REPORT_PERIOD_S,
+ * handed to an optional publisher (MQTT) and printed by the `latency` console command.
+ *
+ * Nothing in main calls Record(): the SharedBus receive loop lives in the Utilities
+ * component and has to call it for messages that carry an origin timestamp.
+ *
+ * @note Only available when CONFIG_DONE_LATENCY_MONITOR is enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "LatencyHistogram.hpp"
+
+class LatencyMonitor
+{
+public:
+    struct Summary
+    {
+        uint16_t MessageType;
+        uint16_t SourceId;
+        uint32_t Count;
+        uint32_t P50Us;
+        uint32_t P90Us;
+        uint32_t P99Us;
+        uint32_t P999Us;
+        uint32_t MaxUs;
+    };
+
+    using Publisher = void (*)(const Summary &summary, void *arg);
+
+    /**
+     * @brief Start the periodic report and register the console command
+     */
+    static esp_err_t Start();
+
+    /**
+     * @brief Record the latency of one message
+     * @param messageType SharedBus message type
+     * @param sourceId ServiceID that originated the message
+     * @param originUs esp_timer_get_time() stamped at the origin
+     */
+    static void Record(uint16_t messageType, uint16_t sourceId, int64_t originUs);
+
+    static void SetPublisher(Publisher publisher, void *arg);
+
+    /**
+     * @brief Log all histograms and forward them to the publisher
+     */
+    static void Report();
+
+    static void Reset();
+
+private:
+    struct Slot
+    {
+        bool Used;
+        uint16_t MessageType;
+        uint16_t SourceId;
+        LatencyHistogram Histogram;
+    };
+
+    static void ReportTimerCallback(void *arg);
+    static int ConsoleCommand(int argc, char **argv);
+
+    static Slot mSlots[CONFIG_DONE_LATENCY_SLOTS];
+    static uint32_t mDropped;
+    static portMUX_TYPE mLock;
+    static Publisher mPublisher;
+    static void *mPublisherArg;
+};
@@ -0,0 +1,227 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_LAZY_SERVICES
+
+#include <cstdio>
+#include <cstring>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_console.h"
+#include "LazyServices.hpp"
+
+static const char *TAG = "LazyServices";
+
+// Constructors of network services (MQTT) need more than the 2304 byte event loop stack
+static constexpr uint32_t START_STACK_SIZE = 4096;
+
+LazyServices::Entry LazyServices::mEntries[LazyServices::mMaxServices];
+uint8_t LazyServices::mCount = 0;
+SemaphoreHandle_t LazyServices::mLock = nullptr;
+SemaphoreHandle_t LazyServices::mHeldLock = nullptr;
+LazyServices::HeldMessage LazyServices::mHeld[LazyServices::mHeldSlots];
+uint8_t LazyServices::mHeldCount = 0;
+uint32_t LazyServices::mDropped = 0;
+LazyServices::Replay LazyServices::mReplay = nullptr;
+static StaticSemaphore_t sLockBuffer;
+static StaticSemaphore_t sHeldLockBuffer;
+
+esp_err_t LazyServices::Register(SharedBus::ServiceID id, Factory factory)
+{
+    // Static mutex: RegisterServices() may run from a constructor, before app_main
+    if (mLock == nullptr) {
+        mLock = xSemaphoreCreateMutexStatic(&sLockBuffer);
+        mHeldLock = xSemaphoreCreateMutexStatic(&sHeldLockBuffer);
+    }
+    if (Find(id) != nullptr) {
+        return ESP_OK;
+    }
+    if (mCount == mMaxServices) {
+        return ESP_ERR_NO_MEM;
+    }
+    Entry &entry = mEntries[mCount];
+    entry.Id = id;
+    entry.Create = factory;
+    entry.Built = false;
+    entry.Starting = false;
+    entry.Direct = false;
+    entry.Held = 0;
+    mCount++;
+    return ESP_OK;
+}
+
+LazyServices::Entry *LazyServices::Find(SharedBus::ServiceID id)
+{
+    for (uint8_t i = 0; i < mCount; i++) {
+        if (mEntries[i].Id == id) {
+            return &mEntries[i];
+        }
+    }
+    return nullptr;
+}
+
+bool LazyServices::Touch(SharedBus::ServiceID id)
+{
+    Entry *entry = Find(id);
+    if (entry == nullptr) {
+        return false;
+    }
+    if (entry->Direct.load(std::memory_order_acquire)) {
+        return true;
+    }
+
+    xSemaphoreTake(mLock, portMAX_DELAY);
+    if (!entry->Built.load(std::memory_order_relaxed)) {
+        const char *name = ServiceMngr::mServiceName[id];
+        const uint32_t heapBefore = esp_get_free_heap_size();
+        const int64_t startUs = esp_timer_get_time();
+        entry->Create(name, id);
+        const int64_t endUs = esp_timer_get_time();
+        entry->BuiltAtMs = endUs / 1000;
+        entry->ConstructUs = endUs - startUs;
+        entry->HeapBytes = static_cast<int32_t>(heapBefore - esp_get_free_heap_size());
+        entry->Built.store(true, std::memory_order_release);
+        ESP_LOGI(TAG, "%s started on first use at %lu ms (%lu us, ~%ld bytes heap)", name,
+                 static_cast<unsigned long>(entry->BuiltAtMs),
+                 static_cast<unsigned long>(entry->ConstructUs),
+                 static_cast<long>(entry->HeapBytes));
+    }
+    xSemaphoreGive(mLock);
+    ReleaseHeld(*entry);
+    return true;
+}
+
+void LazyServices::ReleaseHeld(Entry &entry)
+{
+    // Replayed in arrival order; Hold() keeps holding until all are out, so none overtakes them
+    uint32_t dropped = 0;
+    xSemaphoreTake(mHeldLock, portMAX_DELAY);
+    if (!entry.Direct.load(std::memory_order_relaxed)) {
+        uint8_t kept = 0;
+        for (uint8_t i = 0; i < mHeldCount; i++) {
+            if (mHeld[i].Id != entry.Id) {
+                mHeld[kept++] = mHeld[i];
+            } else if (mReplay != nullptr) {
+                mReplay(entry.Id, mHeld[i].Data, mHeld[i].Length);
+            } else {
+                dropped++;
+            }
+        }
+        mHeldCount = kept;
+        mDropped += dropped;
+        entry.Direct.store(true, std::memory_order_release);
+    }
+    xSemaphoreGive(mHeldLock);
+    if (dropped > 0) {
+        ESP_LOGW(TAG, "%s started, %lu held messages dropped: no replay set", ServiceMngr::mServiceName[entry.Id],
+                 static_cast<unsigned long>(dropped));
+    }
+}
+
+void LazyServices::StartTask(void *arg)
+{
+    Entry *entry = static_cast<Entry *>(arg);
+    Touch(entry->Id);
+    entry->Starting = false;
+    vTaskDelete(nullptr);
+}
+
+void LazyServices::TouchLater(SharedBus::ServiceID id)
+{
+    Entry *entry = Find(id);
+    if (entry == nullptr || entry->Direct.load(std::memory_order_acquire) || entry->Starting.exchange(true)) {
+        return;
+    }
+    if (xTaskCreate(&StartTask, "LazyStart", START_STACK_SIZE, entry, tskIDLE_PRIORITY + 2, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "no memory to start %s", ServiceMngr::mServiceName[id]);
+        entry->Starting = false;
+    }
+}
+
+bool LazyServices::Hold(SharedBus::ServiceID id, const void *message, size_t length)
+{
+    Entry *entry = Find(id);
+    if (entry == nullptr || entry->Direct.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    xSemaphoreTake(mHeldLock, portMAX_DELAY);
+    if (entry->Direct.load(std::memory_order_relaxed)) {
+        xSemaphoreGive(mHeldLock);
+        return false;
+    }
+    if (length > mHeldSize || mHeldCount == mHeldSlots) {
+        mDropped++;
+        ESP_LOGW(TAG, "%s not started yet, message dropped (%u bytes)", ServiceMngr::mServiceName[id],
+                 static_cast<unsigned>(length));
+    } else {
+        HeldMessage &held = mHeld[mHeldCount++];
+        held.Id = id;
+        held.Length = static_cast<uint8_t>(length);
+        memcpy(held.Data, message, length);
+        entry->Held++;
+    }
+    xSemaphoreGive(mHeldLock);
+
+    TouchLater(id);
+    return true;
+}
+
+void LazyServices::SetReplay(Replay replay)
+{
+    mReplay = replay;
+}
+
+void LazyServices::EventHandler(void *arg, esp_event_base_t base, int32_t eventId, void *data)
+{
+    // Runs on the default event loop task, too small a stack for a constructor
+    TouchLater(static_cast<SharedBus::ServiceID>(reinterpret_cast<uintptr_t>(arg)));
+}
+
+esp_err_t LazyServices::TouchOn(SharedBus::ServiceID id, esp_event_base_t base, int32_t eventId)
+{
+    if (Find(id) == nullptr) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return esp_event_handler_register(base, eventId, &EventHandler,
+                                      reinterpret_cast<void *>(static_cast<uintptr_t>(id)));
+}
+
+void LazyServices::Report()
+{
+    for (uint8_t i = 0; i < mCount; i++) {
+        const Entry &entry = mEntries[i];
+        const char *name = ServiceMngr::mServiceName[entry.Id];
+        if (entry.Built) {
+            ESP_LOGI(TAG, "%-12s started at %lu ms, %lu us, ~%ld bytes heap, %u messages held", name,
+                     static_cast<unsigned long>(entry.BuiltAtMs),
+                     static_cast<unsigned long>(entry.ConstructUs),
+                     static_cast<long>(entry.HeapBytes), static_cast<unsigned>(entry.Held));
+        } else {
+            ESP_LOGI(TAG, "%-12s not started, %u messages held", name, static_cast<unsigned>(entry.Held));
+        }
+    }
+    if (mDropped > 0) {
+        ESP_LOGW(TAG, "%lu messages for lazy services dropped", static_cast<unsigned long>(mDropped));
+    }
+}
+
+int LazyServices::ConsoleCommand(int argc, char **argv)
+{
+    Report();
+    return 0;
+}
+
+esp_err_t LazyServices::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "services",
+        .help = "Lazy services and when they were started",
+        .hint = nullptr,
+        .func = &ConsoleCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_LAZY_SERVICES
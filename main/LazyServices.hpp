@@ -0,0 +1,141 @@
+/**
+ * @file LazyServices.hpp
+ * @brief Services that are registered at boot but only constructed on first use
+ *
+ * A lazy service is left out of the ServiceFactory registrations, so ServiceMngr
+ * does not build it at boot. Instead it is registered here with a factory and
+ * constructed the first time Touch() is called for its ServiceID, or on a
+ * short-lived task started by TouchLater(): when an ESP-IDF event bound with
+ * TouchOn() is posted (e.g. MQTT once WiFi has an address), or when a message
+ * targets it. Constructors never run on the small stack of the default event
+ * loop or of the SharedBus dispatch.
+ *
+ * Messages for a lazy service that does not exist yet are held and replayed
+ * once it does. The SharedBus dispatch calls, before queueing a message for its
+ * target:
+ *
+ *     if (LazyServices::Hold(target, &message, sizeof(message))) {
+ *         return;     // held, replayed once the service is built
+ *     }
+ *
+ * and sets SetReplay() to a function that queues the message for the target
+ * without going through Hold() again.
+ *
+ * Every materialization is logged with its time since boot, how long the
+ * constructor ran and the heap it took; `services` prints the same table.
+ *
+ * @note Only available when CONFIG_DONE_LAZY_SERVICES is enabled.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "ServiceMngr.hpp"
+#include "Singleton.hpp"
+
+class LazyServices
+{
+public:
+    using Factory = void (*)(const char *name, SharedBus::ServiceID id);
+    using Replay = void (*)(SharedBus::ServiceID id, const void *message, size_t length);
+
+    /**
+     * @brief Factory building a service the same way ServiceMngr is built in app_main
+     */
+    template <typename T>
+    static void Construct(const char *name, SharedBus::ServiceID id)
+    {
+        Singleton<T, const char *, SharedBus::ServiceID>::GetInstance(name, id);
+    }
+
+    /**
+     * @brief Register a service to be constructed on first use
+     */
+    static esp_err_t Register(SharedBus::ServiceID id, Factory factory);
+
+    /**
+     * @brief Construct the service now if it is lazy and not built yet
+     * @return true once the service exists, false if it is not a lazy service
+     * @note Cheap after the first call, safe to call on every bus message
+     */
+    static bool Touch(SharedBus::ServiceID id);
+
+    /**
+     * @brief Construct the service on a short-lived task, for callers on a small stack
+     */
+    static void TouchLater(SharedBus::ServiceID id);
+
+    /**
+     * @brief TouchLater() the service when the given ESP-IDF event is posted
+     */
+    static esp_err_t TouchOn(SharedBus::ServiceID id, esp_event_base_t base, int32_t eventId);
+
+    /**
+     * @brief Keep a message for a lazy service until it is built, and start building it
+     * @return false if the service exists or is not lazy: dispatch the message as usual
+     * @note Messages that do not fit the held slots are dropped and counted
+     */
+    static bool Hold(SharedBus::ServiceID id, const void *message, size_t length);
+
+    /**
+     * @brief Where held messages go once their service exists
+     * @note Without one, held messages are dropped when their service starts, counted and logged
+     */
+    static void SetReplay(Replay replay);
+
+    /**
+     * @brief Log which lazy services were built, when and at what cost
+     */
+    static void Report();
+
+    /**
+     * @brief Register the `services` console command
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+    static constexpr uint8_t mMaxServices = 8;
+    static constexpr uint8_t mHeldSlots = 8;
+    static constexpr uint8_t mHeldSize = 64;
+
+    struct Entry
+    {
+        SharedBus::ServiceID Id;
+        Factory Create;
+        std::atomic<bool> Built;
+        std::atomic<bool> Starting;     ///< TouchLater() task running
+        std::atomic<bool> Direct;       ///< Built and held messages replayed
+        uint32_t BuiltAtMs;
+        uint32_t ConstructUs;
+        int32_t HeapBytes;
+        uint16_t Held;                  ///< Messages held before it was built
+    };
+
+    struct HeldMessage
+    {
+        SharedBus::ServiceID Id;
+        uint8_t Length;
+        uint8_t Data[mHeldSize];
+    };
+
+    static Entry *Find(SharedBus::ServiceID id);
+    static void ReleaseHeld(Entry &entry);
+    static void StartTask(void *arg);
+    static void EventHandler(void *arg, esp_event_base_t base, int32_t eventId, void *data);
+    static int ConsoleCommand(int argc, char **argv);
+
+    static Entry mEntries[mMaxServices];
+    static uint8_t mCount;
+    static SemaphoreHandle_t mLock;
+    static SemaphoreHandle_t mHeldLock;
+    static HeldMessage mHeld[mHeldSlots];
+    static uint8_t mHeldCount;
+    static uint32_t mDropped;
+    static Replay mReplay;
+};
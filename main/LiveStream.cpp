@@ -0,0 +1,431 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_LIVE_STREAM
+
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "LocalApi.hpp"
+#include "LiveStream.hpp"
+
+static const char *TAG = "LiveStream";
+static const char *TXRX_TAG = "httpd_txrx";
+
+LiveStream::Client LiveStream::mClients[LiveStream::mMaxClients];
+LiveStream::Frame LiveStream::mFrames[LiveStream::mMaxFrames];
+LiveStream::Frame *LiveStream::mDelta = nullptr;
+LiveStream::Frame *LiveStream::mFull = nullptr;
+OvenState::Snapshot LiveStream::mState = {};
+bool LiveStream::mHaveState = false;
+uint32_t LiveStream::mUpdates = 0;
+uint32_t LiveStream::mFlushes = 0;
+uint32_t LiveStream::mRefused = 0;
+esp_log_level_t LiveStream::mTxrxLevel = ESP_LOG_ERROR;
+TimerWheel::Timer LiveStream::mTimer;
+TimerWheel::Timer LiveStream::mRetryTimer;
+std::atomic<bool> LiveStream::mScheduled{false};
+std::atomic<bool> LiveStream::mRetryArmed{false};
+std::atomic<uint8_t> LiveStream::mClientCount{0};
+std::atomic<uint32_t> LiveStream::mLastDueMs{0};
+
+uint32_t LiveStream::NowMs()
+{
+    return static_cast<uint32_t>(esp_timer_get_time() / 1000);
+}
+
+LiveStream::Frame *LiveStream::Acquire()
+{
+    for (Frame &frame : mFrames) {
+        if (frame.Refs == 0) {
+            frame.Refs = 1;
+            return &frame;
+        }
+    }
+    return nullptr;
+}
+
+void LiveStream::Release(Frame *&frame)
+{
+    if (frame != nullptr) {
+        frame->Refs--;
+        frame = nullptr;
+    }
+}
+
+void LiveStream::Seal(Frame &frame, size_t payload)
+{
+    // Server frames are not masked: FIN + text opcode, then a 7 or 7+16 bit length
+    if (payload < 126) {
+        frame.Start = mMaxHeader - 2;
+        frame.Data[2] = 0x81;
+        frame.Data[3] = static_cast<uint8_t>(payload);
+    } else {
+        frame.Start = 0;
+        frame.Data[0] = 0x81;
+        frame.Data[1] = 126;
+        frame.Data[2] = static_cast<uint8_t>(payload >> 8);
+        frame.Data[3] = static_cast<uint8_t>(payload);
+    }
+    frame.Length = static_cast<uint16_t>(mMaxHeader - frame.Start + payload);
+}
+
+LiveStream::Frame *LiveStream::FullFrame()
+{
+    if (mFull == nullptr) {
+        Frame *frame = Acquire();
+        if (frame == nullptr) {
+            return nullptr;
+        }
+        const size_t payload = OvenState::ToJson(mState, reinterpret_cast<char *>(frame->Data + mMaxHeader),
+                                                 OvenState::mMaxJson);
+        if (payload == 0) {
+            Release(frame);
+            return nullptr;
+        }
+        Seal(*frame, payload);
+        frame->Version = mState.Version;
+        frame->Base = mState.Version;
+        frame->Full = true;
+        mFull = frame;
+    }
+    return mFull;
+}
+
+void LiveStream::Refresh()
+{
+    if (mHaveState && OvenState::Version() == mState.Version) {
+        return;
+    }
+    const OvenState::Snapshot next = OvenState::Get();
+    Release(mDelta);
+    Release(mFull);
+    if (mHaveState) {
+        Frame *frame = Acquire();
+        const size_t payload = (frame == nullptr) ? 0 :
+            OvenState::DeltaToJson(mState, next, reinterpret_cast<char *>(frame->Data + mMaxHeader),
+                                   OvenState::mMaxJson);
+        if (payload != 0) {
+            Seal(*frame, payload);
+            frame->Version = next.Version;
+            frame->Base = mState.Version;
+            frame->Full = false;
+            mDelta = frame;
+        } else {
+            // Clients fall back to the full state
+            Release(frame);
+        }
+    }
+    mState = next;
+    mHaveState = true;
+    mUpdates++;
+}
+
+LiveStream::Io LiveStream::Write(const Client &client, const uint8_t *data, uint16_t length, uint16_t &offset)
+{
+    while (offset < length) {
+        const int sent = httpd_socket_send(LocalApi::Server(), client.Fd, reinterpret_cast<const char *>(data + offset),
+                                           length - offset, MSG_DONTWAIT);
+        if (sent == HTTPD_SOCK_ERR_TIMEOUT || sent == 0) {
+            return Io::Blocked;
+        }
+        if (sent < 0) {
+            return Io::Failed;
+        }
+        offset = static_cast<uint16_t>(offset + sent);
+    }
+    return Io::Done;
+}
+
+void LiveStream::Drop(Client &client)
+{
+    client.Closing = true;
+    Release(client.Sending);
+    client.ControlLength = 0;
+    httpd_sess_trigger_close(LocalApi::Server(), client.Fd);
+}
+
+bool LiveStream::Service(Client &client)
+{
+    while (!client.Closing) {
+        Io io = Io::Done;
+        if (client.Sending != nullptr) {
+            const Frame &frame = *client.Sending;
+            io = Write(client, frame.Data + frame.Start, frame.Length, client.Offset);
+            if (io == Io::Done) {
+                client.SentVersion = frame.Version;
+                client.Synced = true;
+                client.Frames++;
+                Release(client.Sending);
+            }
+        } else if (client.ControlLength != 0) {
+            // Only between frames, never inside one
+            uint16_t offset = client.ControlOffset;
+            io = Write(client, client.Control, client.ControlLength, offset);
+            client.ControlOffset = static_cast<uint8_t>(offset);
+            if (io == Io::Done) {
+                client.ControlLength = 0;
+            }
+        } else if (!client.Synced || client.SentVersion != mState.Version) {
+            Frame *next = nullptr;
+            if (client.Synced && mDelta != nullptr && mDelta->Base == client.SentVersion) {
+                next = mDelta;
+            } else {
+                if (client.Synced) {
+                    client.Resyncs++;
+                }
+                next = FullFrame();
+            }
+            if (next == nullptr) {
+                ESP_LOGE(TAG, "no frame for fd %d", client.Fd);
+                return true;
+            }
+            next->Refs++;
+            client.Sending = next;
+            client.Offset = 0;
+        } else {
+            return true;
+        }
+
+        if (io == Io::Blocked) {
+            client.Blocked++;
+            return false;
+        }
+        if (io == Io::Failed) {
+            Drop(client);
+        }
+    }
+    return true;
+}
+
+void LiveStream::Flush(void *arg)
+{
+    (void)arg;
+    mScheduled.store(false);
+    mFlushes++;
+    Refresh();
+
+    bool blocked = false;
+    for (Client &client : mClients) {
+        if (client.Fd >= 0 && !Service(client)) {
+            blocked = true;
+        }
+    }
+    if (blocked) {
+        RetryLater();
+    }
+}
+
+void LiveStream::QueueFlush()
+{
+    httpd_handle_t server = LocalApi::Server();
+    if (server == nullptr) {
+        mScheduled.store(false);
+    } else if (httpd_queue_work(server, &Flush, nullptr) != ESP_OK) {
+        // httpd's control queue is full; still scheduled, try again shortly
+        TimerWheel::Arm(mTimer, mRetryMs);
+    }
+}
+
+void LiveStream::OnTimer(void *arg)
+{
+    (void)arg;
+    QueueFlush();
+}
+
+void LiveStream::OnRetry(void *arg)
+{
+    (void)arg;
+    mRetryArmed.store(false);
+    httpd_handle_t server = LocalApi::Server();
+    if (server != nullptr && httpd_queue_work(server, &Flush, nullptr) != ESP_OK) {
+        RetryLater();
+    }
+}
+
+void LiveStream::RetryLater()
+{
+    // Own timer, so a blocked client never holds back updates for the others
+    if (!mRetryArmed.exchange(true)) {
+        TimerWheel::Arm(mRetryTimer, mRetryMs);
+    }
+}
+
+void LiveStream::Schedule()
+{
+    if (mScheduled.exchange(true)) {
+        return;
+    }
+    // Paced from when the last update was due, not when it went out, so timer
+    // lateness does not add up when changes come exactly one interval apart
+    const uint32_t now = NowMs();
+    const uint32_t due = mLastDueMs.load(std::memory_order_relaxed) + CONFIG_DONE_LIVE_STREAM_INTERVAL_MS;
+    if (static_cast<int32_t>(due - now) <= 0) {
+        mLastDueMs.store(now, std::memory_order_relaxed);
+        QueueFlush();
+    } else {
+        mLastDueMs.store(due, std::memory_order_relaxed);
+        TimerWheel::Arm(mTimer, due - now);
+    }
+}
+
+void LiveStream::OnStateChanged(const OvenState::Snapshot &snapshot, void *arg)
+{
+    (void)snapshot;
+    (void)arg;
+    if (mClientCount.load(std::memory_order_relaxed) != 0) {
+        Schedule();
+    }
+}
+
+void LiveStream::OnClosed(void *ctx)
+{
+    Client &client = *static_cast<Client *>(ctx);
+    Release(client.Sending);
+    memset(&client, 0, sizeof(client));
+    client.Fd = -1;
+    if (--mClientCount == 0) {
+        esp_log_level_set(TXRX_TAG, mTxrxLevel);
+    }
+}
+
+esp_err_t LiveStream::Open(httpd_req_t *req)
+{
+    // httpd has answered the upgrade; from here the socket is ours to write
+    if (!LocalApi::IsSameOrigin(req)) {
+        // A cross-site page or a rebound DNS name; closed before anything is sent
+        mRefused++;
+        ESP_LOGW(TAG, "stream from a foreign host or origin refused");
+        return ESP_FAIL;
+    }
+    Client *client = nullptr;
+    for (Client &slot : mClients) {
+        if (slot.Fd < 0) {
+            client = &slot;
+            break;
+        }
+    }
+    if (client == nullptr) {
+        mRefused++;
+        ESP_LOGW(TAG, "all %u stream slots in use", mMaxClients);
+        return ESP_FAIL;
+    }
+    memset(client, 0, sizeof(*client));
+    client->Fd = httpd_req_to_sockfd(req);
+    // Called by httpd when the session ends, however it ends
+    req->sess_ctx = client;
+    req->free_ctx = &OnClosed;
+    if (mClientCount++ == 0) {
+        // httpd warns on every send that would block, which is routine for a slow
+        // client here. Quieted only while clients are connected, so the warnings
+        // of LocalApi requests still show the rest of the time.
+        mTxrxLevel = esp_log_level_get(TXRX_TAG);
+        if (mTxrxLevel > ESP_LOG_ERROR) {
+            esp_log_level_set(TXRX_TAG, ESP_LOG_ERROR);
+        }
+    }
+
+    Refresh();
+    if (!Service(*client)) {
+        RetryLater();
+    }
+    return ESP_OK;
+}
+
+esp_err_t LiveStream::Handle(httpd_req_t *req)
+{
+    if (req->method == HTTP_GET) {
+        return Open(req);
+    }
+
+    Client *client = static_cast<Client *>(req->sess_ctx);
+    uint8_t payload[mMaxPing];
+    httpd_ws_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    if (httpd_ws_recv_frame(req, &frame, 0) != ESP_OK || frame.len > sizeof(payload)) {
+        // Clients have nothing to say beyond pings; anything longer ends the session
+        return ESP_FAIL;
+    }
+    frame.payload = payload;
+    if (frame.len != 0 && httpd_ws_recv_frame(req, &frame, frame.len) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    switch (frame.type) {
+    case HTTPD_WS_TYPE_PING:
+        if (client != nullptr && !client->Closing) {
+            // Answered by us rather than httpd, so the pong never lands inside a frame
+            client->Control[0] = 0x8A;
+            client->Control[1] = static_cast<uint8_t>(frame.len);
+            memcpy(&client->Control[2], payload, frame.len);
+            client->ControlLength = static_cast<uint8_t>(2 + frame.len);
+            client->ControlOffset = 0;
+            if (!Service(*client)) {
+                RetryLater();
+            }
+        }
+        return ESP_OK;
+    case HTTPD_WS_TYPE_CLOSE:
+        return ESP_FAIL;
+    default:
+        return ESP_OK;
+    }
+}
+
+esp_err_t LiveStream::Start()
+{
+    for (Client &client : mClients) {
+        client.Fd = -1;
+    }
+    TimerWheel::Init(mTimer, &OnTimer, nullptr);
+    TimerWheel::Init(mRetryTimer, &OnRetry, nullptr);
+    OvenState::SetPublisher(&OnStateChanged, nullptr);
+
+    httpd_uri_t uri = {};
+    uri.uri = "/api/v1/stream";
+    uri.method = HTTP_GET;
+    uri.handler = &Handle;
+    uri.is_websocket = true;
+    uri.handle_ws_control_frames = true;
+    return LocalApi::AddUriHandler(uri);
+}
+
+int LiveStream::ConsoleCommand(int argc, char **argv)
+{
+    (void)argv;
+    if (argc != 1) {
+        printf("usage: stream\n");
+        return 1;
+    }
+    printf("%u/%u clients, %lu updates in %lu flushes, %lu refused, interval %d ms\n",
+           mClientCount.load(), mMaxClients, static_cast<unsigned long>(mUpdates),
+           static_cast<unsigned long>(mFlushes), static_cast<unsigned long>(mRefused),
+           CONFIG_DONE_LIVE_STREAM_INTERVAL_MS);
+    // Read from the console task while httpd writes; a torn line is fine here
+    for (const Client &client : mClients) {
+        if (client.Fd < 0) {
+            continue;
+        }
+        printf("  fd %2d: %6lu frames, %4lu resyncs, %4lu blocked, version %lu%s\n", client.Fd,
+               static_cast<unsigned long>(client.Frames), static_cast<unsigned long>(client.Resyncs),
+               static_cast<unsigned long>(client.Blocked), static_cast<unsigned long>(client.SentVersion),
+               (client.Sending != nullptr) ? ", sending" : "");
+    }
+    return 0;
+}
+
+esp_err_t LiveStream::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "stream",
+        .help = "Live stream clients, frames sent and updates dropped for slow ones",
+        .hint = nullptr,
+        .func = &ConsoleCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_LIVE_STREAM
@@ -0,0 +1,137 @@
+/**
+ * @file LiveStream.hpp
+ * @brief Live oven state pushed to LAN dashboards over WebSocket
+ *
+ * Clients open ws://<device>/api/v1/stream on the LocalApi server. The first
+ * message is the whole OvenState snapshot (OvenState::ToJson()). After that
+ * each change arrives as a delta with "version", "base" (the version it
+ * applies to) and only the fields that changed.
+ *
+ * Every update is encoded once, as a ready WebSocket frame, and the same
+ * frame is written to every client that is up to date. All sends run on the
+ * httpd task and never block it. A client whose socket is full keeps its
+ * place in the frame it is writing, and the rest is retried on a timer wheel
+ * tick. Meanwhile the updates it missed are dropped. Once the frame is out,
+ * the client gets the latest state in full, also encoded once for all the
+ * clients that fell behind. A slow client therefore costs nothing extra and
+ * does not delay the others.
+ *
+ * Stream clients hold LocalApi connections, so they come out of the same
+ * few sockets (see CONFIG_DONE_LOCAL_API_CLIENTS). Beyond
+ * CONFIG_DONE_LIVE_STREAM_CLIENTS the upgrade is refused, as it is when
+ * Host or Origin do not name the device (LocalApi::IsSameOrigin()).
+ *
+ * Changes are coalesced to at most one update per
+ * CONFIG_DONE_LIVE_STREAM_INTERVAL_MS. `stream` lists the clients with the
+ * frames each was sent and how often it fell behind. While clients are
+ * connected, httpd's warnings about sends that would block are turned off.
+ *
+ * @note Only available when CONFIG_DONE_LIVE_STREAM is enabled.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "OvenState.hpp"
+#include "TimerWheel.hpp"
+
+class LiveStream
+{
+public:
+    /**
+     * @brief Add the stream URI to LocalApi and follow OvenState
+     * @note Call before LocalApi::Start()
+     */
+    static esp_err_t Start();
+
+    /**
+     * @brief Register the `stream` console command
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+    static constexpr uint8_t mMaxClients = CONFIG_DONE_LIVE_STREAM_CLIENTS;
+    static constexpr uint8_t mMaxFrames = mMaxClients + 2;  ///< One per client, the latest delta and full
+    static constexpr size_t mMaxHeader = 4;
+    static constexpr size_t mMaxPing = 32;
+    static constexpr uint32_t mRetryMs = 20;
+
+    struct Frame
+    {
+        uint32_t Version;
+        uint32_t Base;              ///< Version a delta applies to
+        uint16_t Length;            ///< Header and payload, from Data + Start
+        uint8_t Start;
+        uint8_t Refs;
+        bool Full;
+        uint8_t Data[mMaxHeader + OvenState::mMaxJson];
+    };
+
+    struct Client
+    {
+        int Fd;                     ///< -1 when the slot is free
+        bool Synced;                ///< SentVersion holds a version the client has in full
+        bool Closing;
+        uint32_t SentVersion;
+        Frame *Sending;             ///< Frame being written, nullptr when idle
+        uint16_t Offset;
+        uint8_t ControlLength;      ///< Pong waiting for the frame in progress
+        uint8_t ControlOffset;
+        uint8_t Control[2 + mMaxPing];
+        uint32_t Frames;
+        uint32_t Resyncs;           ///< Updates dropped, then sent the full state
+        uint32_t Blocked;           ///< Times its socket was full
+    };
+
+    enum class Io : uint8_t
+    {
+        Done,
+        Blocked,
+        Failed,
+    };
+
+    static esp_err_t Handle(httpd_req_t *req);
+    static esp_err_t Open(httpd_req_t *req);
+    static void OnClosed(void *ctx);
+    static void OnStateChanged(const OvenState::Snapshot &snapshot, void *arg);
+    static void OnTimer(void *arg);
+    static void OnRetry(void *arg);
+    static void Schedule();
+    static void RetryLater();
+    static void QueueFlush();
+    static void Flush(void *arg);
+    static void Refresh();
+    static bool Service(Client &client);
+    static Io Write(const Client &client, const uint8_t *data, uint16_t length, uint16_t &offset);
+    static void Drop(Client &client);
+    static Frame *Acquire();
+    static void Release(Frame *&frame);
+    static void Seal(Frame &frame, size_t payload);
+    static Frame *FullFrame();
+    static uint32_t NowMs();
+    static int ConsoleCommand(int argc, char **argv);
+
+    // Touched only on the httpd task
+    static Client mClients[mMaxClients];
+    static Frame mFrames[mMaxFrames];
+    static Frame *mDelta;           ///< Latest version as a delta from the one before
+    static Frame *mFull;            ///< Latest version in full, encoded when a client needs it
+    static OvenState::Snapshot mState;
+    static bool mHaveState;
+    static uint32_t mUpdates;
+    static uint32_t mFlushes;
+    static uint32_t mRefused;
+    static esp_log_level_t mTxrxLevel;     ///< httpd_txrx level before the first client connected
+
+    static TimerWheel::Timer mTimer;       ///< Next update, CONFIG_DONE_LIVE_STREAM_INTERVAL_MS after the last
+    static TimerWheel::Timer mRetryTimer;  ///< Clients whose socket was full
+    static std::atomic<bool> mScheduled;
+    static std::atomic<bool> mRetryArmed;
+    static std::atomic<uint8_t> mClientCount;
+    static std::atomic<uint32_t> mLastDueMs;
+};
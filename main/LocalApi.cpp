@@ -0,0 +1,513 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_LOCAL_API
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "esp_netif.h"
+#include "esp_random.h"
+#include "nvs.h"
+#include "ApplianceDescriptor.hpp"
+#include "LocalApi.hpp"
+
+static const char *TAG = "LocalApi";
+static const char *NVS_NAMESPACE = "local_api";
+static const char *NVS_KEY_TOKEN = "token";
+
+// LWIP_MAX_SOCKETS also holds MQTT (1), an OTA download (1) and Matter (up to 3)
+static constexpr int OTHER_SOCKETS = 5;
+// httpd_start() wants three sockets of its own next to the clients
+static_assert(CONFIG_DONE_LOCAL_API_CLIENTS + 3 + OTHER_SOCKETS <= CONFIG_LWIP_MAX_SOCKETS,
+              "API clients would take sockets MQTT and Matter need");
+
+httpd_handle_t LocalApi::mServer = nullptr;
+LocalApi::CommandHandler LocalApi::mHandler = nullptr;
+void *LocalApi::mHandlerArg = nullptr;
+portMUX_TYPE LocalApi::mLock = portMUX_INITIALIZER_UNLOCKED;
+char LocalApi::mBody[OvenState::mMaxJson];
+size_t LocalApi::mBodyLength = 0;
+uint32_t LocalApi::mBodyVersion = 0;
+char LocalApi::mEtag[12];
+uint32_t LocalApi::mRequests = 0;
+uint32_t LocalApi::mNotModified = 0;
+uint32_t LocalApi::mEncodes = 0;
+uint32_t LocalApi::mCommands = 0;
+uint32_t LocalApi::mRejected = 0;
+uint32_t LocalApi::mForeign = 0;
+uint32_t LocalApi::mUnauthorized = 0;
+char LocalApi::mToken[LocalApi::mTokenLength + 1];
+LatencyHistogram LocalApi::mLatency;
+httpd_uri_t LocalApi::mExtraUris[LocalApi::mMaxExtraUris];
+uint8_t LocalApi::mExtraUriCount = 0;
+
+/**
+ * @brief Parse "185" or "185.5" into 0.1 degC
+ */
+static bool ParseDeci(const char *text, int16_t &deci)
+{
+    char *end = nullptr;
+    const long whole = strtol(text, &end, 10);
+    long tenths = 0;
+    if (*end == '.') {
+        if (end[1] < '0' || end[1] > '9') {
+            return false;
+        }
+        tenths = end[1] - '0';
+        end += 2;
+    }
+    if (end == text || *end != '\0' || whole < -3000 || whole > 3000) {
+        return false;
+    }
+    deci = static_cast<int16_t>(whole * 10 + ((text[0] == '-') ? -tenths : tenths));
+    return true;
+}
+
+/**
+ * @brief The address the client connected to, as a Host header would name it
+ */
+static bool LocalAddress(int fd, char (&out)[48])
+{
+    sockaddr_storage addr = {};
+    socklen_t length = sizeof(addr);
+    if (getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length) != 0) {
+        return false;
+    }
+    if (addr.ss_family == AF_INET) {
+        return inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in &>(addr).sin_addr, out, sizeof(out)) != nullptr;
+    }
+#ifdef CONFIG_LWIP_IPV6
+    if (addr.ss_family == AF_INET6) {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&reinterpret_cast<sockaddr_in6 &>(addr).sin6_addr);
+        static const uint8_t MAPPED[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+        if (memcmp(bytes, MAPPED, sizeof(MAPPED)) == 0) {
+            // An IPv4 client on httpd's dual-stack socket
+            return inet_ntop(AF_INET, bytes + sizeof(MAPPED), out, sizeof(out)) != nullptr;
+        }
+        out[0] = '[';
+        if (inet_ntop(AF_INET6, bytes, out + 1, sizeof(out) - 2) == nullptr) {
+            return false;
+        }
+        strcat(out, "]");
+        return true;
+    }
+#endif
+    return false;
+}
+
+/**
+ * @brief Whether a Host header, or an Origin without its scheme, names this device on the API port
+ */
+static bool IsDeviceHost(int fd, const char *host)
+{
+    // The port may only be left out when it is the default one
+    const char *colon = strrchr(host, ':');
+    if (colon != nullptr && strchr(colon, ']') != nullptr) {
+        // Inside an IPv6 literal
+        colon = nullptr;
+    }
+    if (colon != nullptr) {
+        char *end = nullptr;
+        if (strtol(colon + 1, &end, 10) != CONFIG_DONE_LOCAL_API_PORT || end == colon + 1 || *end != '\0') {
+            return false;
+        }
+    } else if (CONFIG_DONE_LOCAL_API_PORT != 80) {
+        return false;
+    }
+    const size_t nameLength = (colon != nullptr) ? static_cast<size_t>(colon - host) : strlen(host);
+
+    char address[48];
+    if (LocalAddress(fd, address) && strlen(address) == nameLength && strncmp(host, address, nameLength) == 0) {
+        return true;
+    }
+    // The name the device has on the LAN, bare or under .local
+    const char *hostname = nullptr;
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    if (netif == nullptr || esp_netif_get_hostname(netif, &hostname) != ESP_OK || hostname == nullptr) {
+        return false;
+    }
+    const size_t length = strlen(hostname);
+    return (nameLength == length || (nameLength == length + 6 && strncasecmp(host + length, ".local", 6) == 0)) &&
+           strncasecmp(host, hostname, length) == 0;
+}
+
+void LocalApi::Refresh()
+{
+    if (mBodyLength != 0 && OvenState::Version() == mBodyVersion) {
+        return;
+    }
+    const OvenState::Snapshot state = OvenState::Get();
+    mBodyLength = OvenState::ToJson(state, mBody, sizeof(mBody));
+    mBodyVersion = state.Version;
+    snprintf(mEtag, sizeof(mEtag), "\"%08lx\"", static_cast<unsigned long>(state.Version));
+    mEncodes++;
+}
+
+esp_err_t LocalApi::SendStatus(httpd_req_t *req, const char *status, const char *body)
+{
+    // A JSON body rather than httpd_resp_send_err(), so the connection stays open
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, body, HTTPD_RESP_USE_STRLEN);
+}
+
+bool LocalApi::IsSameOrigin(httpd_req_t *req)
+{
+    const int fd = httpd_req_to_sockfd(req);
+    char host[64];
+    if (httpd_req_get_hdr_value_str(req, "Host", host, sizeof(host)) != ESP_OK || !IsDeviceHost(fd, host)) {
+        return false;
+    }
+    // Browsers send Origin with every cross-site POST and WebSocket upgrade; other clients may leave it out
+    char origin[72];
+    const size_t originLength = httpd_req_get_hdr_value_len(req, "Origin");
+    if (originLength == 0) {
+        return true;
+    }
+    return originLength < sizeof(origin) &&
+           httpd_req_get_hdr_value_str(req, "Origin", origin, sizeof(origin)) == ESP_OK &&
+           strncmp(origin, "http://", 7) == 0 && IsDeviceHost(fd, origin + 7);
+}
+
+bool LocalApi::IsPaired(httpd_req_t *req)
+{
+    char header[8 + mTokenLength + 1];
+    if (httpd_req_get_hdr_value_str(req, "Authorization", header, sizeof(header)) != ESP_OK ||
+        strncmp(header, "Bearer ", 7) != 0 || strlen(header + 7) != mTokenLength) {
+        return false;
+    }
+    char token[sizeof(mToken)];
+    portENTER_CRITICAL(&mLock);
+    memcpy(token, mToken, sizeof(token));
+    portEXIT_CRITICAL(&mLock);
+    if (token[0] == '\0') {
+        return false;
+    }
+    // Every byte, so the response time does not give the token away one byte at a time
+    uint8_t differ = 0;
+    for (size_t i = 0; i < mTokenLength; i++) {
+        differ |= static_cast<uint8_t>(header[7 + i] ^ token[i]);
+    }
+    return differ == 0;
+}
+
+esp_err_t LocalApi::GetState(httpd_req_t *req)
+{
+    const int64_t start = esp_timer_get_time();
+    mRequests++;
+    if (!IsSameOrigin(req)) {
+        mForeign++;
+        return SendStatus(req, "403 Forbidden", "{\"error\":\"foreign host\"}");
+    }
+    Refresh();
+
+    esp_err_t err;
+    char match[sizeof(mEtag)];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", match, sizeof(match)) == ESP_OK &&
+        strcmp(match, mEtag) == 0) {
+        mNotModified++;
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_set_hdr(req, "ETag", mEtag);
+        err = httpd_resp_send(req, nullptr, 0);
+    } else if (mBodyLength == 0) {
+        err = SendStatus(req, HTTPD_500, "{\"error\":\"encode\"}");
+    } else {
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_set_hdr(req, "ETag", mEtag);
+        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+        err = httpd_resp_send(req, mBody, static_cast<ssize_t>(mBodyLength));
+    }
+    mLatency.Record(static_cast<uint32_t>(esp_timer_get_time() - start));
+    return err;
+}
+
+esp_err_t LocalApi::ParseCommand(httpd_req_t *req, Command &command)
+{
+    char query[mMaxQuery];
+    char action[12];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "action", action, sizeof(action)) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(&command, 0, sizeof(command));
+    if (strcmp(action, "start") == 0) {
+        command.Kind = Action::Start;
+        if (httpd_query_key_value(query, "program", value, sizeof(value)) != ESP_OK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        const long program = strtol(value, nullptr, 10);
+        if (program <= 0 || program > UINT16_MAX) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        command.ProgramId = static_cast<uint16_t>(program);
+        if (httpd_query_key_value(query, "target", value, sizeof(value)) == ESP_OK) {
+            if (!ParseDeci(value, command.TargetDeciC)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            command.HasTarget = 1;
+        }
+    } else if (strcmp(action, "stop") == 0) {
+        command.Kind = Action::Stop;
+    } else if (strcmp(action, "pause") == 0) {
+        command.Kind = Action::Pause;
+    } else if (strcmp(action, "resume") == 0) {
+        command.Kind = Action::Resume;
+    } else if (strcmp(action, "target") == 0) {
+        command.Kind = Action::SetTarget;
+        if (httpd_query_key_value(query, "value", value, sizeof(value)) != ESP_OK ||
+            !ParseDeci(value, command.TargetDeciC)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        command.HasTarget = 1;
+    } else if (strcmp(action, "light") == 0) {
+        command.Kind = Action::Light;
+        if (httpd_query_key_value(query, "on", value, sizeof(value)) != ESP_OK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        command.On = (strcmp(value, "1") == 0 || strcmp(value, "true") == 0) ? 1 : 0;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (command.HasTarget) {
+        constexpr ApplianceDescriptor::ControlLimits limits = Appliance::Current.Limits;
+        if (command.TargetDeciC < limits.MinTempC * 10 || command.TargetDeciC > limits.MaxTempC * 10) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t LocalApi::PostCommand(httpd_req_t *req)
+{
+    const int64_t start = esp_timer_get_time();
+    mRequests++;
+
+    Command command;
+    esp_err_t err;
+    if (!IsSameOrigin(req)) {
+        mForeign++;
+        err = SendStatus(req, "403 Forbidden", "{\"error\":\"foreign host\"}");
+    } else if (!IsPaired(req)) {
+        mUnauthorized++;
+        httpd_resp_set_hdr(req, "WWW-Authenticate", "Bearer");
+        err = SendStatus(req, "401 Unauthorized", "{\"error\":\"not paired\"}");
+    } else if (ParseCommand(req, command) != ESP_OK) {
+        mRejected++;
+        err = SendStatus(req, HTTPD_400, "{\"error\":\"bad command\"}");
+    } else {
+        portENTER_CRITICAL(&mLock);
+        const CommandHandler handler = mHandler;
+        void *arg = mHandlerArg;
+        portEXIT_CRITICAL(&mLock);
+
+        const esp_err_t result = (handler != nullptr) ? handler(command, arg) : ESP_ERR_NOT_FOUND;
+        if (result == ESP_OK) {
+            mCommands++;
+            err = SendStatus(req, "202 Accepted", "{\"accepted\":true}");
+        } else {
+            mRejected++;
+            err = (result == ESP_ERR_INVALID_STATE) ?
+                  SendStatus(req, "409 Conflict", "{\"error\":\"not now\"}") :
+                  SendStatus(req, "503 Service Unavailable", "{\"error\":\"control unavailable\"}");
+        }
+    }
+    mLatency.Record(static_cast<uint32_t>(esp_timer_get_time() - start));
+    return err;
+}
+
+esp_err_t LocalApi::StartServer()
+{
+    if (mServer != nullptr) {
+        return ESP_OK;
+    }
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = CONFIG_DONE_LOCAL_API_PORT;
+    config.max_open_sockets = CONFIG_DONE_LOCAL_API_CLIENTS;
+    config.lru_purge_enable = true;
+    // Dead LAN clients are dropped by TCP keep-alive instead of holding a socket
+    config.keep_alive_enable = true;
+
+    esp_err_t err = httpd_start(&mServer, &config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "httpd start failed: %s", esp_err_to_name(err));
+        mServer = nullptr;
+        return err;
+    }
+
+    // Member by member, the WebSocket fields only exist with CONFIG_HTTPD_WS_SUPPORT
+    httpd_uri_t state = {};
+    state.uri = "/api/v1/state";
+    state.method = HTTP_GET;
+    state.handler = &GetState;
+    httpd_uri_t command = {};
+    command.uri = "/api/v1/command";
+    command.method = HTTP_POST;
+    command.handler = &PostCommand;
+    httpd_register_uri_handler(mServer, &state);
+    httpd_register_uri_handler(mServer, &command);
+    for (uint8_t i = 0; i < mExtraUriCount; i++) {
+        httpd_register_uri_handler(mServer, &mExtraUris[i]);
+    }
+    ESP_LOGI(TAG, "listening on port %d", CONFIG_DONE_LOCAL_API_PORT);
+    return ESP_OK;
+}
+
+void LocalApi::OnGotIp(void *arg, esp_event_base_t base, int32_t eventId, void *data)
+{
+    (void)arg;
+    (void)base;
+    (void)eventId;
+    (void)data;
+    StartServer();
+}
+
+void LocalApi::LoadToken()
+{
+    char token[sizeof(mToken)] = {};
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        size_t length = sizeof(token);
+        if (nvs_get_str(handle, NVS_KEY_TOKEN, token, &length) != ESP_OK || strlen(token) != mTokenLength) {
+            token[0] = '\0';
+        }
+        nvs_close(handle);
+    }
+    portENTER_CRITICAL(&mLock);
+    memcpy(mToken, token, sizeof(mToken));
+    portEXIT_CRITICAL(&mLock);
+    if (token[0] == '\0') {
+        ESP_LOGW(TAG, "not paired, commands are refused until `api pair`");
+    }
+}
+
+esp_err_t LocalApi::Pair(char (&token)[mTokenLength + 1])
+{
+    uint8_t secret[mTokenLength / 2];
+    esp_fill_random(secret, sizeof(secret));
+    for (size_t i = 0; i < sizeof(secret); i++) {
+        snprintf(&token[i * 2], 3, "%02x", secret[i]);
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_str(handle, NVS_KEY_TOKEN, token);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (err == ESP_OK) {
+        portENTER_CRITICAL(&mLock);
+        memcpy(mToken, token, sizeof(mToken));
+        portEXIT_CRITICAL(&mLock);
+    }
+    return err;
+}
+
+esp_err_t LocalApi::Unpair()
+{
+    portENTER_CRITICAL(&mLock);
+    mToken[0] = '\0';
+    portEXIT_CRITICAL(&mLock);
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_erase_key(handle, NVS_KEY_TOKEN);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+esp_err_t LocalApi::Start()
+{
+    LoadToken();
+    if (esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &OnGotIp, nullptr) != ESP_OK) {
+        // No event loop yet; the listening socket is bound to any address, so start now
+        return StartServer();
+    }
+    return ESP_OK;
+}
+
+esp_err_t LocalApi::AddUriHandler(const httpd_uri_t &uri)
+{
+    if (mExtraUriCount >= mMaxExtraUris) {
+        return ESP_ERR_NO_MEM;
+    }
+    mExtraUris[mExtraUriCount++] = uri;
+    return ESP_OK;
+}
+
+void LocalApi::SetCommandHandler(CommandHandler handler, void *arg)
+{
+    portENTER_CRITICAL(&mLock);
+    mHandler = handler;
+    mHandlerArg = arg;
+    portEXIT_CRITICAL(&mLock);
+}
+
+int LocalApi::ConsoleCommand(int argc, char **argv)
+{
+    if (argc == 2 && strcmp(argv[1], "pair") == 0) {
+        char token[mTokenLength + 1];
+        const esp_err_t err = Pair(token);
+        if (err != ESP_OK) {
+            printf("pairing failed: %s\n", esp_err_to_name(err));
+            return 1;
+        }
+        // Shown once, on the console only; pairing again replaces it
+        printf("paired, send \"Authorization: Bearer %s\" with commands\n", token);
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "unpair") == 0) {
+        const esp_err_t err = Unpair();
+        printf("%s\n", (err == ESP_OK) ? "unpaired, commands are refused" : esp_err_to_name(err));
+        return (err == ESP_OK) ? 0 : 1;
+    }
+    if (argc != 1) {
+        printf("usage: api [pair|unpair]\n");
+        return 1;
+    }
+    portENTER_CRITICAL(&mLock);
+    const bool paired = mToken[0] != '\0';
+    portEXIT_CRITICAL(&mLock);
+    printf("%s, port %d, %s\n", (mServer != nullptr) ? "listening" : "not started", CONFIG_DONE_LOCAL_API_PORT,
+           paired ? "paired" : "not paired");
+    printf("requests %lu (304 %lu), state encodes %lu, commands %lu accepted %lu rejected\n",
+           static_cast<unsigned long>(mRequests), static_cast<unsigned long>(mNotModified),
+           static_cast<unsigned long>(mEncodes), static_cast<unsigned long>(mCommands),
+           static_cast<unsigned long>(mRejected));
+    printf("refused: %lu foreign Host or Origin, %lu without the paired token\n",
+           static_cast<unsigned long>(mForeign), static_cast<unsigned long>(mUnauthorized));
+    printf("handler us: p50 %lu p99 %lu max %lu\n",
+           static_cast<unsigned long>(mLatency.Percentile(500)), static_cast<unsigned long>(mLatency.Percentile(990)),
+           static_cast<unsigned long>(mLatency.Max()));
+    return 0;
+}
+
+esp_err_t LocalApi::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "api",
+        .help = "Local API requests and latency; `api pair` makes a new command token, `api unpair` drops it",
+        .hint = nullptr,
+        .func = &ConsoleCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_LOCAL_API
@@ -0,0 +1,162 @@
+/**
+ * @file LocalApi.hpp
+ * @brief Local HTTP control API for LAN integrations, next to the cloud path over MQTT
+ *
+ * esp_http_server is started once WiFi has an address, the same way the lazy
+ * MQTT service is. It serves:
+ *
+ *   GET  /api/v1/state     the OvenState snapshot as JSON, with an ETag;
+ *                          If-None-Match with the current ETag answers 304
+ *   POST /api/v1/command?action=start&program=3[&target=180]
+ *                          action=stop|pause|resume, action=target&value=185.5,
+ *                          action=light&on=1; answers 202 once the command
+ *                          handler has taken it
+ *
+ * The state JSON is encoded once per OvenState version, into one buffer, with
+ * OvenState::ToJson(); there is no JSON DOM. Requests between two changes send
+ * that buffer as it is, straight from the handler. httpd runs every handler on
+ * its one task, so the buffer needs no lock. Connections are kept alive, and LRU purging hands
+ * the oldest idle connection to a new client when all sockets are in use.
+ *
+ * Every request must name the device in Host: its address on the connection
+ * or its hostname, bare or under .local, on the API port. Origin, when sent,
+ * must be the same with http://. Anything else answers 403, which keeps out
+ * DNS rebinding and cross-site pages on the LAN (form POSTs, WebSockets).
+ * Commands also need "Authorization: Bearer <token>" with the token `api pair`
+ * creates on the console and keeps in NVS, checked in constant time. Without
+ * it, or before the device is paired, they answer 401.
+ *
+ * Commands are not executed here: the cook control sets a handler with
+ * SetCommandHandler() and queues them to its own task. Without a handler the
+ * API answers 503. `api` prints the request counts and handler latency.
+ *
+ * The cook control and the sensors are not in main/. Until they make these
+ * calls the state stays at version 0 and every command answers 503, which is
+ * why CONFIG_DONE_LOCAL_API defaults to n:
+ * @code
+ * // Cook control task, at start: commands are queued, never run on the httpd task
+ * LocalApi::SetCommandHandler([](const LocalApi::Command &command, void *arg) {
+ *     return (xQueueSend(static_cast<QueueHandle_t>(arg), &command, 0) == pdTRUE) ? ESP_OK : ESP_ERR_INVALID_STATE;
+ * }, commandQueue);
+ * // Every control tick, and from each sensor for the fields it owns
+ * OvenState::Update([&](OvenState::Snapshot &state) {
+ *     state.State = OvenState::Operational::Running;
+ *     state.ProgramId = session.ProgramId;
+ *     state.CavityDeciC = cavityDeciC;
+ * });
+ * @endcode
+ *
+ * @note Only available when CONFIG_DONE_LOCAL_API is enabled.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_http_server.h"
+#include "LatencyHistogram.hpp"
+#include "OvenState.hpp"
+
+class LocalApi
+{
+public:
+    enum class Action : uint8_t
+    {
+        Start,
+        Stop,
+        Pause,
+        Resume,
+        SetTarget,
+        Light,
+    };
+
+    struct Command
+    {
+        Action Kind;
+        uint8_t On;                 ///< Light
+        uint16_t ProgramId;         ///< Start
+        int16_t TargetDeciC;        ///< Start and SetTarget, when HasTarget is set
+        uint8_t HasTarget;          ///< Always set for SetTarget; Start without it keeps the program's own target
+    };
+
+    /**
+     * @brief Takes a command on the httpd task; queue it and return, do not block
+     * @return ESP_OK when accepted, ESP_ERR_INVALID_STATE when it does not apply now
+     */
+    using CommandHandler = esp_err_t (*)(const Command &command, void *arg);
+
+    /**
+     * @brief Start the server once WiFi has an address
+     * @note The default event loop exists once the network services are up
+     */
+    static esp_err_t Start();
+
+    /**
+     * @brief Serve another URI on the API server, e.g. the live stream
+     * @note Call before Start()
+     */
+    static esp_err_t AddUriHandler(const httpd_uri_t &uri);
+
+    /**
+     * @brief Set the handler that executes commands, nullptr to refuse them
+     */
+    static void SetCommandHandler(CommandHandler handler, void *arg);
+
+    /**
+     * @brief Whether Host, and Origin if sent, name this device; also for handlers added with AddUriHandler()
+     */
+    static bool IsSameOrigin(httpd_req_t *req);
+
+    /**
+     * @brief The running server, nullptr before it started
+     */
+    static httpd_handle_t Server() { return mServer; }
+
+    /**
+     * @brief Register the `api` console command
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+    static constexpr size_t mMaxQuery = 96;
+    static constexpr uint8_t mMaxExtraUris = 2;
+    static constexpr size_t mTokenLength = 32;      ///< 128 random bits in hex
+
+    static void OnGotIp(void *arg, esp_event_base_t base, int32_t eventId, void *data);
+    static esp_err_t StartServer();
+    static esp_err_t GetState(httpd_req_t *req);
+    static esp_err_t PostCommand(httpd_req_t *req);
+    static esp_err_t ParseCommand(httpd_req_t *req, Command &command);
+    static bool IsPaired(httpd_req_t *req);
+    static void LoadToken();
+    static esp_err_t Pair(char (&token)[mTokenLength + 1]);
+    static esp_err_t Unpair();
+    static esp_err_t SendStatus(httpd_req_t *req, const char *status, const char *body);
+    static void Refresh();
+    static int ConsoleCommand(int argc, char **argv);
+
+    static httpd_handle_t mServer;
+    static CommandHandler mHandler;
+    static void *mHandlerArg;
+    static portMUX_TYPE mLock;
+    static char mToken[mTokenLength + 1];   ///< Under mLock, empty when not paired
+
+    // Touched only on the httpd task
+    static char mBody[OvenState::mMaxJson];
+    static size_t mBodyLength;
+    static uint32_t mBodyVersion;
+    static char mEtag[12];
+
+    static uint32_t mRequests;
+    static uint32_t mNotModified;
+    static uint32_t mEncodes;
+    static uint32_t mCommands;
+    static uint32_t mRejected;
+    static uint32_t mForeign;
+    static uint32_t mUnauthorized;
+    static LatencyHistogram mLatency;
+    static httpd_uri_t mExtraUris[mMaxExtraUris];
+    static uint8_t mExtraUriCount;
+};
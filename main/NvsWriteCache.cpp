@@ -0,0 +1,382 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_NVS_WRITE_CACHE
+
+#include <cstring>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "TaskPlan.hpp"
+#include "NvsWriteCache.hpp"
+
+static const char *TAG = "NvsWriteCache";
+
+SemaphoreHandle_t NvsWriteCache::mMutex = nullptr;
+SemaphoreHandle_t NvsWriteCache::mFlushMutex = nullptr;
+TaskHandle_t NvsWriteCache::mFlushTask = nullptr;
+esp_timer_handle_t NvsWriteCache::mFlushTimer = nullptr;
+NvsWriteCache::PendingMap NvsWriteCache::mPending;
+NvsWriteCache::PendingMap NvsWriteCache::mInFlight;
+size_t NvsWriteCache::mPendingBytes = 0;
+NvsWriteCache::Stats NvsWriteCache::mStats = {};
+
+static std::string MakeKey(const char *nameSpace, const char *key)
+{
+    std::string fullKey(nameSpace);
+    fullKey.push_back('\0');
+    fullKey.append(key);
+    return fullKey;
+}
+
+esp_err_t NvsWriteCache::Init()
+{
+    if (mMutex != nullptr) {
+        return ESP_OK;
+    }
+    mMutex = xSemaphoreCreateMutex();
+    mFlushMutex = xSemaphoreCreateMutex();
+    if (mMutex == nullptr || mFlushMutex == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    const esp_timer_create_args_t timerArgs = {
+        .callback = &FlushTimerCallback,
+        .arg = nullptr,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "NvsFlush",
+        .skip_unhandled_events = true
+    };
+    esp_err_t err = esp_timer_create(&timerArgs, &mFlushTimer);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Erasing a page can take tens of ms; keep that off the calling services
+    mFlushTask = TaskPlan::Create(TaskPlan::NVS_FLUSH, FlushTask, nullptr);
+    if (mFlushTask == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    return esp_register_shutdown_handler(&ShutdownHandler);
+}
+
+esp_err_t NvsWriteCache::SetU32(const char *nameSpace, const char *key, uint32_t value, Flush flush)
+{
+    return Set(nameSpace, key, Type::U32, &value, sizeof(value), flush);
+}
+
+esp_err_t NvsWriteCache::SetI32(const char *nameSpace, const char *key, int32_t value, Flush flush)
+{
+    return Set(nameSpace, key, Type::I32, &value, sizeof(value), flush);
+}
+
+esp_err_t NvsWriteCache::SetU64(const char *nameSpace, const char *key, uint64_t value, Flush flush)
+{
+    return Set(nameSpace, key, Type::U64, &value, sizeof(value), flush);
+}
+
+esp_err_t NvsWriteCache::SetStr(const char *nameSpace, const char *key, const char *value, Flush flush)
+{
+    if (value == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return Set(nameSpace, key, Type::Str, value, strlen(value) + 1, flush);
+}
+
+esp_err_t NvsWriteCache::SetBlob(const char *nameSpace, const char *key, const void *value,
+                                 size_t length, Flush flush)
+{
+    return Set(nameSpace, key, Type::Blob, value, length, flush);
+}
+
+esp_err_t NvsWriteCache::Set(const char *nameSpace, const char *key, Type type,
+                             const void *value, size_t length, Flush flush)
+{
+    if (mMutex == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (nameSpace == nullptr || key == nullptr || (value == nullptr && length != 0) ||
+        strlen(nameSpace) >= NVS_KEY_NAME_MAX_SIZE || strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const uint8_t *bytes = static_cast<const uint8_t *>(value);
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    const bool wasEmpty = mPending.empty();
+    auto inserted = mPending.try_emplace(MakeKey(nameSpace, key));
+    Pending &pending = inserted.first->second;
+    mStats.SetCalls++;
+    if (!inserted.second) {
+        mStats.Coalesced++;
+        mPendingBytes -= pending.Value.size();
+    }
+    pending.ValueType = type;
+    pending.Value.assign(bytes, bytes + length);
+    mPendingBytes += length;
+    const bool overBudget = mPendingBytes >= CONFIG_DONE_NVS_WRITE_CACHE_MAX_BYTES;
+    if (wasEmpty && flush == Flush::Deferred) {
+        // Deadline counts from the first pending write, later writes do not postpone it.
+        // Armed under mMutex so FlushAll() cannot stop it after taking this write.
+        esp_timer_start_once(mFlushTimer, CONFIG_DONE_NVS_FLUSH_DELAY_MS * 1000ULL);
+    }
+    xSemaphoreGive(mMutex);
+
+    if (flush == Flush::Now) {
+        return FlushAll();
+    }
+    if (overBudget) {
+        xTaskNotifyGive(mFlushTask);
+    }
+    return ESP_OK;
+}
+
+esp_err_t NvsWriteCache::GetPending(const char *nameSpace, const char *key, Type type,
+                                    void *value, size_t &length)
+{
+    const std::string fullKey = MakeKey(nameSpace, key);
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    auto found = mPending.find(fullKey);
+    if (found == mPending.end()) {
+        found = mInFlight.find(fullKey);
+        if (found == mInFlight.end()) {
+            xSemaphoreGive(mMutex);
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+    }
+    const Pending &pending = found->second;
+    if (pending.ValueType != type) {
+        err = ESP_ERR_NVS_TYPE_MISMATCH;
+    } else if (value == nullptr) {
+        length = pending.Value.size();
+        err = ESP_OK;
+    } else if (length < pending.Value.size()) {
+        length = pending.Value.size();
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(value, pending.Value.data(), pending.Value.size());
+        length = pending.Value.size();
+        err = ESP_OK;
+    }
+    xSemaphoreGive(mMutex);
+    return err;
+}
+
+template <typename T, typename Getter>
+static esp_err_t ReadFromNvs(const char *nameSpace, const char *key, T &value, Getter getter)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(nameSpace, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = getter(handle, key, &value);
+    nvs_close(handle);
+    return err;
+}
+
+esp_err_t NvsWriteCache::GetU32(const char *nameSpace, const char *key, uint32_t &value)
+{
+    size_t length = sizeof(value);
+    const esp_err_t err = GetPending(nameSpace, key, Type::U32, &value, length);
+    return (err != ESP_ERR_NVS_NOT_FOUND) ? err : ReadFromNvs(nameSpace, key, value, nvs_get_u32);
+}
+
+esp_err_t NvsWriteCache::GetI32(const char *nameSpace, const char *key, int32_t &value)
+{
+    size_t length = sizeof(value);
+    const esp_err_t err = GetPending(nameSpace, key, Type::I32, &value, length);
+    return (err != ESP_ERR_NVS_NOT_FOUND) ? err : ReadFromNvs(nameSpace, key, value, nvs_get_i32);
+}
+
+esp_err_t NvsWriteCache::GetU64(const char *nameSpace, const char *key, uint64_t &value)
+{
+    size_t length = sizeof(value);
+    const esp_err_t err = GetPending(nameSpace, key, Type::U64, &value, length);
+    return (err != ESP_ERR_NVS_NOT_FOUND) ? err : ReadFromNvs(nameSpace, key, value, nvs_get_u64);
+}
+
+esp_err_t NvsWriteCache::GetBlob(const char *nameSpace, const char *key, void *value, size_t &length)
+{
+    const esp_err_t err = GetPending(nameSpace, key, Type::Blob, value, length);
+    if (err != ESP_ERR_NVS_NOT_FOUND) {
+        return err;
+    }
+    nvs_handle_t handle;
+    esp_err_t openErr = nvs_open(nameSpace, NVS_READONLY, &handle);
+    if (openErr != ESP_OK) {
+        return openErr;
+    }
+    openErr = nvs_get_blob(handle, key, value, &length);
+    nvs_close(handle);
+    return openErr;
+}
+
+esp_err_t NvsWriteCache::FlushAll()
+{
+    if (mMutex == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(mFlushMutex, portMAX_DELAY);
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    // The timer belongs to the writes taken here; a Set() after the swap arms it again
+    esp_timer_stop(mFlushTimer);
+    mInFlight.swap(mPending);
+    mPendingBytes = 0;
+    xSemaphoreGive(mMutex);
+
+    esp_err_t err = ESP_OK;
+    if (!mInFlight.empty()) {
+        const int64_t startUs = esp_timer_get_time();
+        err = WriteBatch(mInFlight);
+        xSemaphoreTake(mMutex, portMAX_DELAY);
+        mStats.Flushes++;
+        mStats.LastFlushUs = static_cast<uint32_t>(esp_timer_get_time() - startUs);
+        mInFlight.clear();
+        if (!mPending.empty()) {
+            // Failed keys went back to mPending; fails harmlessly if a Set() armed it already
+            esp_timer_start_once(mFlushTimer, CONFIG_DONE_NVS_FLUSH_DELAY_MS * 1000ULL);
+        }
+        xSemaphoreGive(mMutex);
+    }
+    xSemaphoreGive(mFlushMutex);
+    return err;
+}
+
+/**
+ * @brief Errors that writing the same value again cannot fix
+ */
+static bool IsPermanent(esp_err_t err)
+{
+    return err == ESP_ERR_NVS_NOT_ENOUGH_SPACE || err == ESP_ERR_NVS_INVALID_LENGTH;
+}
+
+esp_err_t NvsWriteCache::WriteBatch(PendingMap &batch)
+{
+    esp_err_t result = ESP_OK;
+    uint32_t writes = 0;
+    uint32_t commits = 0;
+    uint32_t errors = 0;
+    uint32_t dropped = 0;
+    PendingMap failed;
+
+    auto it = batch.begin();
+    while (it != batch.end()) {
+        const std::string nameSpace = it->first.substr(0, it->first.find('\0'));
+        nvs_handle_t handle;
+        esp_err_t err = nvs_open(nameSpace.c_str(), NVS_READWRITE, &handle);
+
+        // All keys of one namespace are adjacent in the sorted map
+        for (; it != batch.end() && it->first.compare(0, nameSpace.size() + 1,
+                                                      nameSpace.c_str(), nameSpace.size() + 1) == 0; ++it) {
+            if (err != ESP_OK) {
+                if (IsPermanent(err)) {
+                    ESP_LOGE(TAG, "%s/%s dropped", nameSpace.c_str(), it->first.c_str() + nameSpace.size() + 1);
+                    dropped++;
+                } else {
+                    failed.insert(*it);
+                }
+                continue;
+            }
+            const char *key = it->first.c_str() + nameSpace.size() + 1;
+            const Pending &pending = it->second;
+            esp_err_t setErr = ESP_OK;
+            switch (pending.ValueType) {
+            case Type::U32:
+                setErr = nvs_set_u32(handle, key, *reinterpret_cast<const uint32_t *>(pending.Value.data()));
+                break;
+            case Type::I32:
+                setErr = nvs_set_i32(handle, key, *reinterpret_cast<const int32_t *>(pending.Value.data()));
+                break;
+            case Type::U64:
+                setErr = nvs_set_u64(handle, key, *reinterpret_cast<const uint64_t *>(pending.Value.data()));
+                break;
+            case Type::Str:
+                setErr = nvs_set_str(handle, key, reinterpret_cast<const char *>(pending.Value.data()));
+                break;
+            case Type::Blob:
+                setErr = nvs_set_blob(handle, key, pending.Value.data(), pending.Value.size());
+                break;
+            }
+            if (setErr == ESP_OK) {
+                writes++;
+            } else if (IsPermanent(setErr)) {
+                ESP_LOGE(TAG, "%s/%s: %s, dropped", nameSpace.c_str(), key, esp_err_to_name(setErr));
+                dropped++;
+                result = setErr;
+            } else {
+                ESP_LOGE(TAG, "%s/%s: %s", nameSpace.c_str(), key, esp_err_to_name(setErr));
+                failed.insert(*it);
+                result = setErr;
+            }
+        }
+
+        if (err != ESP_OK) {
+            // Its keys are counted as failed already
+            ESP_LOGE(TAG, "namespace %s: %s", nameSpace.c_str(), esp_err_to_name(err));
+            result = err;
+            continue;
+        }
+        err = nvs_commit(handle);
+        nvs_close(handle);
+        commits++;
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "namespace %s: %s", nameSpace.c_str(), esp_err_to_name(err));
+            errors++;
+            result = err;
+        }
+    }
+
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    mStats.NvsWrites += writes;
+    mStats.Commits += commits;
+    mStats.Errors += errors + failed.size() + dropped;
+    mStats.Dropped += dropped;
+    // Retry failed keys on the next flush unless a newer value is already pending
+    for (auto &entry : failed) {
+        if (mPending.emplace(entry.first, entry.second).second) {
+            mPendingBytes += entry.second.Value.size();
+        }
+    }
+    xSemaphoreGive(mMutex);
+    return result;
+}
+
+NvsWriteCache::Stats NvsWriteCache::GetStats()
+{
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    const Stats stats = mStats;
+    xSemaphoreGive(mMutex);
+    return stats;
+}
+
+void NvsWriteCache::RequestFlush()
+{
+    if (mFlushTask != nullptr) {
+        xTaskNotifyGive(mFlushTask);
+    }
+}
+
+void NvsWriteCache::FlushTask(void *arg)
+{
+    (void)arg;
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        FlushAll();
+    }
+}
+
+void NvsWriteCache::FlushTimerCallback(void *arg)
+{
+    (void)arg;
+    xTaskNotifyGive(mFlushTask);
+}
+
+void NvsWriteCache::ShutdownHandler()
+{
+    FlushAll();
+}
+
+#endif // CONFIG_DONE_NVS_WRITE_CACHE
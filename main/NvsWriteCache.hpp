@@ -0,0 +1,116 @@
+/**
+ * @file NvsWriteCache.hpp
+ * @brief Write-behind cache in front of NVS for frequently persisted oven state
+ *
+ * Set*() only updates RAM. Repeated writes to the same key before the next flush
+ * collapse into one NVS write, and each namespace is committed once per flush.
+ * A flush happens CONFIG_DONE_NVS_FLUSH_DELAY_MS after the first pending write,
+ * when CONFIG_DONE_NVS_WRITE_CACHE_MAX_BYTES are pending, on Flush() (e.g. before
+ * light sleep) and from a shutdown handler before esp_restart().
+ *
+ * Crash consistency: NVS updates every key atomically, so after a reset each key
+ * holds either its previously flushed or its newly flushed value, never a mix.
+ * Writes made within the flush delay before an unexpected reset are lost; pass
+ * Flush::Now for state that must not be lost.
+ *
+ * @note Only available when CONFIG_DONE_NVS_WRITE_CACHE is enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "esp_err.h"
+#include "nvs.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+class NvsWriteCache
+{
+public:
+    enum class Flush : uint8_t
+    {
+        Deferred,   ///< Coalesce with other writes (default)
+        Now,        ///< Write through and commit before returning
+    };
+
+    struct Stats
+    {
+        uint32_t SetCalls;          ///< Writes requested by services
+        uint32_t Coalesced;         ///< Writes absorbed by a later write to the same key
+        uint32_t NvsWrites;         ///< nvs_set_* calls that reached flash
+        uint32_t Commits;
+        uint32_t Flushes;
+        uint32_t Errors;            ///< Keys that failed to write, plus failed commits
+        uint32_t Dropped;           ///< Keys that failed for good and were not retried
+        uint32_t LastFlushUs;
+    };
+
+    /**
+     * @brief Create the flush task and the shutdown hook
+     * @note nvs_flash_init() must have been called
+     */
+    static esp_err_t Init();
+
+    static esp_err_t SetU32(const char *nameSpace, const char *key, uint32_t value, Flush flush = Flush::Deferred);
+    static esp_err_t SetI32(const char *nameSpace, const char *key, int32_t value, Flush flush = Flush::Deferred);
+    static esp_err_t SetU64(const char *nameSpace, const char *key, uint64_t value, Flush flush = Flush::Deferred);
+    static esp_err_t SetStr(const char *nameSpace, const char *key, const char *value, Flush flush = Flush::Deferred);
+    static esp_err_t SetBlob(const char *nameSpace, const char *key, const void *value, size_t length,
+                             Flush flush = Flush::Deferred);
+
+    /**
+     * @brief Read a value, pending writes win over what is in flash
+     */
+    static esp_err_t GetU32(const char *nameSpace, const char *key, uint32_t &value);
+    static esp_err_t GetI32(const char *nameSpace, const char *key, int32_t &value);
+    static esp_err_t GetU64(const char *nameSpace, const char *key, uint64_t &value);
+    static esp_err_t GetBlob(const char *nameSpace, const char *key, void *value, size_t &length);
+
+    /**
+     * @brief Write all pending values to NVS and commit
+     */
+    static esp_err_t FlushAll();
+
+    /**
+     * @brief Have the flush task write pending values now, without waiting for the delay
+     * @note Does not block; meant for hooks such as entering standby
+     */
+    static void RequestFlush();
+
+    static Stats GetStats();
+
+private:
+    enum class Type : uint8_t { U32, I32, U64, Str, Blob };
+
+    struct Pending
+    {
+        Type ValueType;
+        std::vector<uint8_t> Value;
+    };
+
+    // "namespace" '\0' "key" -> pending value, sorted so one flush opens each namespace once
+    using PendingMap = std::map<std::string, Pending>;
+
+    static esp_err_t Set(const char *nameSpace, const char *key, Type type,
+                         const void *value, size_t length, Flush flush);
+    static esp_err_t GetPending(const char *nameSpace, const char *key, Type type,
+                                void *value, size_t &length);
+    static esp_err_t WriteBatch(PendingMap &batch);
+    static void FlushTask(void *arg);
+    static void FlushTimerCallback(void *arg);
+    static void ShutdownHandler();
+
+    static SemaphoreHandle_t mMutex;
+    static SemaphoreHandle_t mFlushMutex;
+    static TaskHandle_t mFlushTask;
+    static esp_timer_handle_t mFlushTimer;
+    static PendingMap mPending;
+    static PendingMap mInFlight;    ///< Batch being written, still visible to readers
+    static size_t mPendingBytes;
+    static Stats mStats;
+};
@@ -0,0 +1,220 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_OVEN_STATE
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include "OvenState.hpp"
+#ifdef CONFIG_DONE_COOK_CHECKPOINT
+#include "CookCheckpoint.hpp"
+#endif
+
+static_assert(sizeof(OvenState::Snapshot) == 28, "Update() compares snapshots with memcmp, keep them free of padding");
+
+OvenState::Snapshot OvenState::mState = {
+    0, OvenState::Operational::Stopped, 0, 0, 0, 0, 0, 0, 0, OvenState::mNoProbe, 0, 0, 0
+};
+std::atomic<uint32_t> OvenState::mVersion{0};
+portMUX_TYPE OvenState::mLock = portMUX_INITIALIZER_UNLOCKED;
+OvenState::Publisher OvenState::mPublisher = nullptr;
+void *OvenState::mPublisherArg = nullptr;
+
+#ifdef CONFIG_DONE_COOK_CHECKPOINT
+// Both only touched under mLock
+static CookCheckpoint::Session sCheckpoint = {};
+static uint32_t sStageStartS = 0;
+#endif
+
+static const char *OperationalName(OvenState::Operational state)
+{
+    switch (state) {
+    case OvenState::Operational::Stopped:
+        return "stopped";
+    case OvenState::Operational::Running:
+        return "running";
+    case OvenState::Operational::Paused:
+        return "paused";
+    default:
+        return "error";
+    }
+}
+
+/**
+ * @brief 0.1 degC as a JSON number, e.g. -12.5
+ */
+static const char *FormatDeci(char (&out)[8], int16_t deci)
+{
+    const int magnitude = abs(static_cast<int>(deci));
+    snprintf(out, sizeof(out), "%s%d.%d", (deci < 0) ? "-" : "", magnitude / 10, magnitude % 10);
+    return out;
+}
+
+/**
+ * @brief Append to out at used; once it overflows, used stays past size
+ */
+static void Append(char *out, size_t size, size_t &used, const char *format, ...)
+{
+    if (used >= size) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(out + used, size - used, format, args);
+    va_end(args);
+    used = (length < 0) ? size : used + static_cast<size_t>(length);
+}
+
+OvenState::Snapshot OvenState::Get()
+{
+    portENTER_CRITICAL(&mLock);
+    const Snapshot snapshot = mState;
+    portEXIT_CRITICAL(&mLock);
+    return snapshot;
+}
+
+void OvenState::SetPublisher(Publisher publisher, void *arg)
+{
+    portENTER_CRITICAL(&mLock);
+    mPublisher = publisher;
+    mPublisherArg = arg;
+    portEXIT_CRITICAL(&mLock);
+}
+
+#ifdef CONFIG_DONE_COOK_CHECKPOINT
+void OvenState::Checkpoint(const Snapshot &state)
+{
+    CookCheckpoint::Session session = {};
+    if (state.ProgramId != 0) {
+        if (state.ProgramId != sCheckpoint.ProgramId || state.Stage != sCheckpoint.Stage) {
+            sStageStartS = state.ElapsedS;
+        }
+        session.ProgramId = state.ProgramId;
+        session.Stage = state.Stage;
+        session.Flags = static_cast<uint8_t>(((state.State == Operational::Paused) ? CookCheckpoint::FLAG_PAUSED : 0) |
+                                             (state.DoorOpen ? CookCheckpoint::FLAG_DOOR_OPEN : 0));
+        session.Actuators = state.Actuators;
+        session.TargetDeciC = state.TargetDeciC;
+        session.ProbeTargetDeciC = state.ProbeTargetDeciC;
+        session.StageElapsedMs = (state.ElapsedS - sStageStartS) * 1000;
+        session.TotalElapsedMs = state.ElapsedS * 1000;
+    }
+
+    // Temperature readings are not part of the session, most of their changes write nothing
+    if (memcmp(&session, &sCheckpoint, sizeof(session)) == 0) {
+        return;
+    }
+    sCheckpoint = session;
+    if (session.ProgramId == 0) {
+        CookCheckpoint::Clear();
+    } else {
+        CookCheckpoint::Write(session);
+    }
+}
+
+bool OvenState::ResumeCook()
+{
+    CookCheckpoint::Session session;
+    if (!CookCheckpoint::TakeRecovered(session)) {
+        return false;
+    }
+    Update([&session](Snapshot &state) {
+        // As if the checkpoint had just been written, so the stage keeps its start
+        sCheckpoint = session;
+        sStageStartS = (session.TotalElapsedMs - session.StageElapsedMs) / 1000;
+        state.State = (session.Flags & CookCheckpoint::FLAG_PAUSED) ? Operational::Paused : Operational::Running;
+        state.ProgramId = session.ProgramId;
+        state.Stage = session.Stage;
+        state.Actuators = session.Actuators;
+        state.DoorOpen = (session.Flags & CookCheckpoint::FLAG_DOOR_OPEN) ? 1 : 0;
+        state.TargetDeciC = session.TargetDeciC;
+        state.ProbeTargetDeciC = session.ProbeTargetDeciC;
+        state.ElapsedS = session.TotalElapsedMs / 1000;
+    });
+    return true;
+}
+#endif
+
+uint16_t OvenState::Changed(const Snapshot &from, const Snapshot &to)
+{
+    uint16_t fields = 0;
+    fields |= (from.State != to.State) ? FIELD_STATE : 0;
+    fields |= (from.ProgramId != to.ProgramId) ? FIELD_PROGRAM : 0;
+    fields |= (from.Stage != to.Stage) ? FIELD_STAGE : 0;
+    fields |= (from.CavityDeciC != to.CavityDeciC) ? FIELD_CAVITY : 0;
+    fields |= (from.TargetDeciC != to.TargetDeciC) ? FIELD_TARGET : 0;
+    fields |= (from.ProbeDeciC != to.ProbeDeciC) ? FIELD_PROBE : 0;
+    fields |= (from.ProbeTargetDeciC != to.ProbeTargetDeciC) ? FIELD_PROBE_TARGET : 0;
+    fields |= (from.ElapsedS != to.ElapsedS) ? FIELD_ELAPSED : 0;
+    fields |= (from.RemainingS != to.RemainingS) ? FIELD_REMAINING : 0;
+    fields |= (from.DoorOpen != to.DoorOpen) ? FIELD_DOOR : 0;
+    fields |= (from.LightOn != to.LightOn) ? FIELD_LIGHT : 0;
+    fields |= (from.Actuators != to.Actuators) ? FIELD_ACTUATORS : 0;
+    return fields;
+}
+
+size_t OvenState::Encode(const Snapshot &state, uint16_t fields, const uint32_t *base, char *out, size_t size)
+{
+    char deci[8];
+    const bool hasProbe = state.ProbeDeciC != mNoProbe;
+    size_t used = 0;
+    Append(out, size, used, "{\"version\":%lu", static_cast<unsigned long>(state.Version));
+    if (base != nullptr) {
+        Append(out, size, used, ",\"base\":%lu", static_cast<unsigned long>(*base));
+    }
+    if (fields & FIELD_STATE) {
+        Append(out, size, used, ",\"state\":\"%s\"", OperationalName(state.State));
+    }
+    if (fields & FIELD_PROGRAM) {
+        Append(out, size, used, ",\"program\":%u", state.ProgramId);
+    }
+    if (fields & FIELD_STAGE) {
+        Append(out, size, used, ",\"stage\":%u", state.Stage);
+    }
+    if (fields & FIELD_CAVITY) {
+        Append(out, size, used, ",\"cavity\":%s", FormatDeci(deci, state.CavityDeciC));
+    }
+    if (fields & FIELD_TARGET) {
+        Append(out, size, used, ",\"target\":%s", FormatDeci(deci, state.TargetDeciC));
+    }
+    if (fields & FIELD_PROBE) {
+        Append(out, size, used, ",\"probe\":%s", hasProbe ? FormatDeci(deci, state.ProbeDeciC) : "null");
+    }
+    if (fields & FIELD_PROBE_TARGET) {
+        Append(out, size, used, ",\"probeTarget\":%s", hasProbe ? FormatDeci(deci, state.ProbeTargetDeciC) : "null");
+    }
+    if (fields & FIELD_ELAPSED) {
+        Append(out, size, used, ",\"elapsed\":%lu", static_cast<unsigned long>(state.ElapsedS));
+    }
+    if (fields & FIELD_REMAINING) {
+        Append(out, size, used, ",\"remaining\":%lu", static_cast<unsigned long>(state.RemainingS));
+    }
+    if (fields & FIELD_DOOR) {
+        Append(out, size, used, ",\"door\":%s", state.DoorOpen ? "true" : "false");
+    }
+    if (fields & FIELD_LIGHT) {
+        Append(out, size, used, ",\"light\":%s", state.LightOn ? "true" : "false");
+    }
+    if (fields & FIELD_ACTUATORS) {
+        Append(out, size, used, ",\"actuators\":%u", state.Actuators);
+    }
+    Append(out, size, used, "}");
+    return (used < size) ? used : 0;
+}
+
+size_t OvenState::ToJson(const Snapshot &state, char *out, size_t size)
+{
+    return Encode(state, FIELD_ALL, nullptr, out, size);
+}
+
+size_t OvenState::DeltaToJson(const Snapshot &from, const Snapshot &to, char *out, size_t size)
+{
+    uint16_t fields = Changed(from, to);
+    if (fields & (FIELD_PROBE | FIELD_PROBE_TARGET)) {
+        // Both turn null together when the probe is pulled
+        fields |= FIELD_PROBE | FIELD_PROBE_TARGET;
+    }
+    return Encode(to, fields, &from.Version, out, size);
+}
+
+#endif // CONFIG_DONE_OVEN_STATE
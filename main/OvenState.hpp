@@ -0,0 +1,173 @@
+/**
+ * @file OvenState.hpp
+ * @brief Shared snapshot of the oven attributes for the local API
+ *
+ * The cook control, the sensors and the Matter/MQTT services write the values
+ * they own (operational state, program, temperatures, times, door, light) with
+ * Update(). Readers such as LocalApi copy the whole snapshot with Get(). Every
+ * change bumps Version(), so a reader can keep its encoded copy until the
+ * version moves instead of encoding the state again for every request.
+ * ToJson() encodes the whole snapshot and DeltaToJson() only the fields that
+ * changed between two of them, both straight into the caller's buffer.
+ *
+ * Update() runs the lambda inside a critical section; it should only assign
+ * fields. The publisher is called after a change, on the task that made it.
+ * None of the writers are in main/ yet; LocalApi.hpp shows the calls they
+ * have to make.
+ *
+ * With CONFIG_DONE_COOK_CHECKPOINT, a change to the program, stage, targets,
+ * actuators, door, pause or elapsed time also writes a CookCheckpoint, and
+ * ResumeCook() puts a cook interrupted by a reset back at boot. The cook
+ * control reads the snapshot when it starts and continues a running program
+ * from it. OvenState has no preheating field, so these checkpoints never set
+ * FLAG_PREHEATING, and elapsed times are kept to the second.
+ *
+ * @note Only available when CONFIG_DONE_OVEN_STATE is enabled.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+
+class OvenState
+{
+public:
+    /**
+     * @brief Values of the Matter OperationalState attribute
+     */
+    enum class Operational : uint8_t
+    {
+        Stopped = 0,
+        Running = 1,
+        Paused = 2,
+        Error = 3,
+    };
+
+    enum Field : uint16_t
+    {
+        FIELD_STATE = 1 << 0,
+        FIELD_PROGRAM = 1 << 1,
+        FIELD_STAGE = 1 << 2,
+        FIELD_CAVITY = 1 << 3,
+        FIELD_TARGET = 1 << 4,
+        FIELD_PROBE = 1 << 5,
+        FIELD_PROBE_TARGET = 1 << 6,
+        FIELD_ELAPSED = 1 << 7,
+        FIELD_REMAINING = 1 << 8,
+        FIELD_DOOR = 1 << 9,
+        FIELD_LIGHT = 1 << 10,
+        FIELD_ACTUATORS = 1 << 11,
+        FIELD_ALL = (1 << 12) - 1,
+    };
+
+    static constexpr int16_t mNoProbe = INT16_MIN;
+    static constexpr size_t mMaxJson = 320;
+
+    struct Snapshot
+    {
+        uint32_t Version;           ///< Bumped on every change, 0 before the first one
+        Operational State;
+        uint8_t Stage;
+        uint16_t ProgramId;         ///< 0 when no cook runs
+        uint16_t Actuators;         ///< ApplianceDescriptor::Actuator bits switched on
+        uint8_t DoorOpen;
+        uint8_t LightOn;
+        int16_t CavityDeciC;        ///< Temperatures in 0.1 degC
+        int16_t TargetDeciC;
+        int16_t ProbeDeciC;         ///< mNoProbe when no probe is plugged in
+        int16_t ProbeTargetDeciC;
+        uint32_t ElapsedS;
+        uint32_t RemainingS;
+    };
+
+    using Publisher = void (*)(const Snapshot &snapshot, void *arg);
+
+    /**
+     * @brief Change some fields of the snapshot
+     * @param apply called as apply(Snapshot &) under the lock
+     * @return true when a field changed and the version was bumped
+     */
+    template <typename Apply>
+    static bool Update(Apply &&apply)
+    {
+        portENTER_CRITICAL(&mLock);
+        Snapshot next = mState;
+        apply(next);
+        next.Version = mState.Version;
+        const bool changed = memcmp(&next, &mState, sizeof(next)) != 0;
+        if (changed) {
+            next.Version = mState.Version + 1;
+            mState = next;
+            mVersion.store(next.Version, std::memory_order_release);
+#ifdef CONFIG_DONE_COOK_CHECKPOINT
+            // Under the lock, so checkpoints are written in the order of the changes
+            Checkpoint(next);
+#endif
+        }
+        const Publisher publisher = mPublisher;
+        void *arg = mPublisherArg;
+        portEXIT_CRITICAL(&mLock);
+        if (changed && publisher != nullptr) {
+            publisher(next, arg);
+        }
+        return changed;
+    }
+
+    /**
+     * @brief Copy of the current snapshot
+     */
+    static Snapshot Get();
+
+    /**
+     * @brief Version of the current snapshot, without taking the lock
+     */
+    static uint32_t Version() { return mVersion.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Set the callback told about every change
+     */
+    static void SetPublisher(Publisher publisher, void *arg);
+
+    /**
+     * @brief Fields that differ between two snapshots, Field bits
+     */
+    static uint16_t Changed(const Snapshot &from, const Snapshot &to);
+
+    /**
+     * @brief Encode the whole snapshot as a JSON object
+     * @return length written, 0 if it did not fit
+     */
+    static size_t ToJson(const Snapshot &state, char *out, size_t size);
+
+    /**
+     * @brief Encode the version, "base" (the version it applies to) and the changed fields
+     * @return length written, 0 if it did not fit
+     */
+    static size_t DeltaToJson(const Snapshot &from, const Snapshot &to, char *out, size_t size);
+
+#ifdef CONFIG_DONE_COOK_CHECKPOINT
+    /**
+     * @brief Put the cook CookCheckpoint::Restore() recovered back into the snapshot
+     * @return true when a cook was resumed
+     * @note Call once at boot, right after CookCheckpoint::Restore()
+     */
+    static bool ResumeCook();
+#endif
+
+private:
+#ifdef CONFIG_DONE_COOK_CHECKPOINT
+    static void Checkpoint(const Snapshot &state);
+#endif
+    static size_t Encode(const Snapshot &state, uint16_t fields, const uint32_t *base, char *out, size_t size);
+
+    static Snapshot mState;
+    static std::atomic<uint32_t> mVersion;
+    static portMUX_TYPE mLock;
+    static Publisher mPublisher;
+    static void *mPublisherArg;
+};
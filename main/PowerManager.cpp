@@ -0,0 +1,239 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_POWER_MANAGER
+
+#include <cstdio>
+#include <cstring>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "PowerManager.hpp"
+
+static const char *TAG = "PowerManager";
+
+PowerManager::OwnerSlot PowerManager::mOwners[PowerManager::mMaxOwners];
+uint8_t PowerManager::mOwnerCount = 0;
+uint8_t PowerManager::mHeldOwners = 0;
+PowerManager::StandbyHook PowerManager::mStandbyHook = nullptr;
+PowerManager::CauseStats PowerManager::mCauses[PowerManager::mCauseCount];
+int64_t PowerManager::mSinceUs = 0;
+portMUX_TYPE PowerManager::mLock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t PowerManager::Init()
+{
+    mSinceUs = esp_timer_get_time();
+    esp_pm_sleep_cbs_register_config_t callbacks = {};
+    callbacks.exit_cb = &SleepExitCallback;
+    return esp_pm_light_sleep_register_cbs(&callbacks);
+}
+
+PowerManager::Owner PowerManager::RegisterOwner(const char *name, esp_pm_lock_type_t type)
+{
+    portENTER_CRITICAL(&mLock);
+    if (mOwnerCount == mMaxOwners) {
+        portEXIT_CRITICAL(&mLock);
+        ESP_LOGE(TAG, "no owner slot left for %s", name);
+        return mInvalidOwner;
+    }
+    const Owner owner = mOwnerCount++;
+    portEXIT_CRITICAL(&mLock);
+
+    OwnerSlot &slot = mOwners[owner];
+    slot.Name = name;
+    if (esp_pm_lock_create(type, 0, name, &slot.Lock) != ESP_OK) {
+        ESP_LOGE(TAG, "cannot create PM lock for %s", name);
+        slot.Lock = nullptr;
+    }
+    return owner;
+}
+
+void PowerManager::Acquire(Owner owner)
+{
+    if (owner >= mOwnerCount || mOwners[owner].Lock == nullptr) {
+        return;
+    }
+    OwnerSlot &slot = mOwners[owner];
+    esp_pm_lock_acquire(slot.Lock);
+    portENTER_CRITICAL(&mLock);
+    if (slot.Depth++ == 0) {
+        slot.HeldSinceUs = esp_timer_get_time();
+        slot.Acquisitions++;
+        mHeldOwners++;
+    }
+    portEXIT_CRITICAL(&mLock);
+}
+
+void PowerManager::Release(Owner owner)
+{
+    if (owner >= mOwnerCount || mOwners[owner].Lock == nullptr) {
+        return;
+    }
+    OwnerSlot &slot = mOwners[owner];
+    bool standby = false;
+    portENTER_CRITICAL(&mLock);
+    if (slot.Depth > 0 && --slot.Depth == 0) {
+        slot.HeldUs += esp_timer_get_time() - slot.HeldSinceUs;
+        standby = (--mHeldOwners == 0);
+    }
+    const StandbyHook hook = mStandbyHook;
+    portEXIT_CRITICAL(&mLock);
+    // Before the lock goes, so the hook's work is queued ahead of the first light sleep
+    if (standby && hook != nullptr) {
+        hook();
+    }
+    esp_pm_lock_release(slot.Lock);
+}
+
+void PowerManager::SetStandbyHook(StandbyHook hook)
+{
+    portENTER_CRITICAL(&mLock);
+    mStandbyHook = hook;
+    portEXIT_CRITICAL(&mLock);
+}
+
+/**
+ * @brief Ticks from a tick count to the first wake window at least the given ticks after it
+ *
+ * Rounds the difference, never an absolute deadline that may have wrapped, so the
+ * result stays within one window of the request; the grid shifts once per wrap.
+ */
+static TickType_t TicksToWindow(TickType_t from, TickType_t ticks)
+{
+    const TickType_t window = pdMS_TO_TICKS(CONFIG_DONE_PM_WAKE_WINDOW_MS);
+    if (window == 0) {
+        return ticks;
+    }
+    // Tick counts are the same for every task, so the grid is shared
+    const TickType_t past = (from + ticks) % window;
+    return (past == 0) ? ticks : ticks + window - past;
+}
+
+void PowerManager::DelayUntilWindow(TickType_t *lastWake, uint32_t periodMs)
+{
+    TickType_t increment = TicksToWindow(*lastWake, pdMS_TO_TICKS(periodMs));
+    // Compared signed, as the timer wheel does: a deadline already passed moves to the next window from now
+    const TickType_t now = xTaskGetTickCount();
+    if (static_cast<int32_t>(now - (*lastWake + increment)) > 0) {
+        *lastWake = now;
+        increment = TicksToWindow(now, 1);
+    }
+    vTaskDelayUntil(lastWake, increment);
+}
+
+uint32_t PowerManager::DelayToWindow(uint32_t delayMs)
+{
+    return pdTICKS_TO_MS(TicksToWindow(xTaskGetTickCount(), pdMS_TO_TICKS(delayMs)));
+}
+
+// Runs in the idle task on every wake-up; kept in IRAM so it does not refill the flash cache each time
+esp_err_t IRAM_ATTR PowerManager::SleepExitCallback(int64_t sleepTimeUs, void *arg)
+{
+    uint32_t cause = static_cast<uint32_t>(esp_sleep_get_wakeup_cause());
+    if (cause >= mCauseCount) {
+        cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+    }
+    portENTER_CRITICAL_ISR(&mLock);
+    mCauses[cause].WakeUps++;
+    mCauses[cause].SleptUs += sleepTimeUs;
+    portEXIT_CRITICAL_ISR(&mLock);
+    return ESP_OK;
+}
+
+static const char *CauseName(uint32_t cause)
+{
+    switch (cause) {
+    case ESP_SLEEP_WAKEUP_TIMER: return "timer";
+    case ESP_SLEEP_WAKEUP_GPIO: return "gpio";
+    case ESP_SLEEP_WAKEUP_UART: return "uart";
+    case ESP_SLEEP_WAKEUP_WIFI: return "wifi";
+    case ESP_SLEEP_WAKEUP_BT: return "bt";
+    case ESP_SLEEP_WAKEUP_EXT0: return "ext0";
+    case ESP_SLEEP_WAKEUP_EXT1: return "ext1";
+    case ESP_SLEEP_WAKEUP_TOUCHPAD: return "touch";
+    case ESP_SLEEP_WAKEUP_ULP: return "ulp";
+    default: return "other";
+    }
+}
+
+void PowerManager::Report()
+{
+    CauseStats causes[mCauseCount];
+    OwnerSlot owners[mMaxOwners];
+    portENTER_CRITICAL(&mLock);
+    const int64_t nowUs = esp_timer_get_time();
+    const int64_t elapsedUs = nowUs - mSinceUs;
+    memcpy(causes, mCauses, sizeof(causes));
+    memcpy(owners, mOwners, sizeof(owners));
+    const uint8_t ownerCount = mOwnerCount;
+    portEXIT_CRITICAL(&mLock);
+
+    uint32_t wakeUps = 0;
+    int64_t sleptUs = 0;
+    for (const CauseStats &stats : causes) {
+        wakeUps += stats.WakeUps;
+        sleptUs += stats.SleptUs;
+    }
+    const uint32_t elapsedMs = (elapsedUs > 0) ? elapsedUs / 1000 : 1;
+    ESP_LOGI(TAG, "%lu s: asleep %lu.%lu%%, %lu.%02lu wake-ups/s",
+             static_cast<unsigned long>(elapsedMs / 1000),
+             static_cast<unsigned long>(sleptUs / 10 / elapsedMs),
+             static_cast<unsigned long>((sleptUs / elapsedMs) % 10),
+             static_cast<unsigned long>(wakeUps * 1000ULL / elapsedMs),
+             static_cast<unsigned long>((wakeUps * 100000ULL / elapsedMs) % 100));
+    for (uint32_t cause = 0; cause < mCauseCount; cause++) {
+        if (causes[cause].WakeUps == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "  woken by %-6s %6lu times, slept %lu ms",
+                 CauseName(cause), static_cast<unsigned long>(causes[cause].WakeUps),
+                 static_cast<unsigned long>(causes[cause].SleptUs / 1000));
+    }
+    for (uint8_t i = 0; i < ownerCount; i++) {
+        const OwnerSlot &slot = owners[i];
+        const int64_t heldUs = slot.HeldUs + ((slot.Depth > 0) ? nowUs - slot.HeldSinceUs : 0);
+        ESP_LOGI(TAG, "  lock %-12s held %lu ms in %lu acquisitions%s", slot.Name,
+                 static_cast<unsigned long>(heldUs / 1000),
+                 static_cast<unsigned long>(slot.Acquisitions),
+                 (slot.Depth > 0) ? ", held now" : "");
+    }
+}
+
+void PowerManager::Reset()
+{
+    portENTER_CRITICAL(&mLock);
+    const int64_t nowUs = esp_timer_get_time();
+    memset(mCauses, 0, sizeof(mCauses));
+    for (uint8_t i = 0; i < mOwnerCount; i++) {
+        mOwners[i].HeldUs = 0;
+        mOwners[i].Acquisitions = 0;
+        mOwners[i].HeldSinceUs = nowUs;
+    }
+    mSinceUs = nowUs;
+    portEXIT_CRITICAL(&mLock);
+}
+
+int PowerManager::ConsoleCommand(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        Reset();
+        printf("pm: statistics cleared\n");
+        return 0;
+    }
+    Report();
+    return 0;
+}
+
+esp_err_t PowerManager::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "pm",
+        .help = "Light sleep time, wake-ups per cause and PM lock time per owner: pm [reset]",
+        .hint = nullptr,
+        .func = &ConsoleCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_POWER_MANAGER
@@ -0,0 +1,125 @@
+/**
+ * @file PowerManager.hpp
+ * @brief Per-owner PM locks, shared wake windows and light sleep statistics
+ *
+ * Automatic light sleep only happens when no PM lock is held and the next
+ * timeout is far enough away. Owners (services, the render task, OTA) get
+ * their own named lock and hold it only while they are active, so standby
+ * is not blocked by whoever forgot to release a global one. Periodic work
+ * waits with DelayUntilWindow(), which rounds deadlines up to a common grid
+ * of CONFIG_DONE_PM_WAKE_WINDOW_MS; unrelated periodic jobs then share one
+ * wake-up instead of each waking the CPU on its own phase. When the last
+ * owner releases its lock the standby hook runs, so buffered state (the NVS
+ * write cache) reaches flash before the chip may sleep or lose power.
+ *
+ * Light sleep callbacks count wake-ups and sleep time per wake-up cause; the
+ * `pm` console command prints them with the time each owner held its lock,
+ * as a proxy for standby current.
+ *
+ * @note Only available when CONFIG_DONE_POWER_MANAGER is enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "esp_err.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+class PowerManager
+{
+public:
+    using Owner = uint8_t;
+    using StandbyHook = void (*)();
+    static constexpr Owner mInvalidOwner = 0xFF;
+
+    /**
+     * @brief Hook the light sleep callbacks; esp_pm_configure() stays in app_main
+     */
+    static esp_err_t Init();
+
+    /**
+     * @brief Create the lock of an owner; call once per owner at startup
+     * @return mInvalidOwner when all owner slots are used
+     */
+    static Owner RegisterOwner(const char *name, esp_pm_lock_type_t type = ESP_PM_NO_LIGHT_SLEEP);
+
+    static void Acquire(Owner owner);
+    static void Release(Owner owner);
+
+    /**
+     * @brief Called from the releasing task each time no owner holds its lock anymore
+     * @note Runs on the caller's stack; it should only hand work to another task
+     */
+    static void SetStandbyHook(StandbyHook hook);
+
+    /**
+     * @brief Holds the lock of an owner for the lifetime of the object
+     */
+    class Hold
+    {
+    public:
+        explicit Hold(Owner owner) : mOwner(owner) { Acquire(mOwner); }
+        ~Hold() { Release(mOwner); }
+        Hold(const Hold &) = delete;
+        Hold &operator=(const Hold &) = delete;
+
+    private:
+        Owner mOwner;
+    };
+
+    /**
+     * @brief vTaskDelayUntil() with the deadline rounded up to the next wake window
+     */
+    static void DelayUntilWindow(TickType_t *lastWake, uint32_t periodMs);
+
+    /**
+     * @brief Delay from now to the first wake window at least delayMs away, for timers that
+     *        cannot use DelayUntilWindow() (flows, the timer wheel)
+     */
+    static uint32_t DelayToWindow(uint32_t delayMs);
+
+    /**
+     * @brief Log sleep time and wake-ups per cause, and lock time per owner
+     */
+    static void Report();
+
+    /**
+     * @brief Register the `pm [reset]` console command
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+    static constexpr uint8_t mMaxOwners = 12;
+    static constexpr uint8_t mCauseCount = 16;
+
+    struct OwnerSlot
+    {
+        const char *Name;
+        esp_pm_lock_handle_t Lock;
+        uint32_t Depth;
+        uint32_t Acquisitions;
+        int64_t HeldSinceUs;
+        int64_t HeldUs;
+    };
+
+    struct CauseStats
+    {
+        uint32_t WakeUps;
+        int64_t SleptUs;
+    };
+
+    static esp_err_t SleepExitCallback(int64_t sleepTimeUs, void *arg);
+    static int ConsoleCommand(int argc, char **argv);
+    static void Reset();
+
+    static OwnerSlot mOwners[mMaxOwners];
+    static uint8_t mOwnerCount;
+    static uint8_t mHeldOwners;     ///< Owners with Depth > 0
+    static StandbyHook mStandbyHook;
+    static CauseStats mCauses[mCauseCount];
+    static int64_t mSinceUs;
+    static portMUX_TYPE mLock;
+};
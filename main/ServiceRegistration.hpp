@@ -20,9 +20,12 @@
 #include "ServiceFactory.hpp"
 #include "sdkconfig.h"
 
+#include <type_traits>
+#include "ApplianceDescriptor.hpp"
+
 // Include device-specific service headers
 #ifdef CONFIG_DONE_COMPONENT_UI2
-#include "UICoffeeMaker.hpp"  // Note: UI might still use CoffeeMaker name for Oven
+#include "UICoffeeMaker.hpp"  // Note: the Oven screens still live in UICoffeeMaker
 #endif
 
 #ifdef CONFIG_DONE_COMPONENT_MATTER
@@ -36,11 +39,115 @@
 #include "Singleton.hpp"
 #include "esp_log.h"
 
+#ifdef CONFIG_DONE_LAZY_SERVICES
+#include "LazyServices.hpp"
+#endif
+
+#ifdef CONFIG_DONE_FAST_BOOT
+#include "FastBoot.hpp"
+#endif
+
 static const char* TAG = "ServiceRegistration";
 
 // Guard to prevent duplicate registration
 static bool sServicesRegistered = false;
 
+/**
+ * @brief The services every appliance registered before they had their own
+ */
+struct BaselineServices
+{
+#ifdef CONFIG_DONE_COMPONENT_UI2
+    using UI = UICoffeeMaker;
+#else
+    using UI = void;
+#endif
+#ifdef CONFIG_DONE_COMPONENT_MATTER
+    using Matter = MatterOven;
+#else
+    using Matter = void;
+#endif
+#ifdef CONFIG_DONE_COMPONENT_MQTT
+    using Mqtt = MQTTOven;
+#else
+    using Mqtt = void;
+#endif
+};
+
+/**
+ * @brief Service implementations of an appliance, `void` where it has none
+ *
+ * An appliance with services of its own specializes this on its ApplianceKind,
+ * so only the selected appliance's services are instantiated and linked. The
+ * others get the baseline set.
+ */
+template <ApplianceKind Kind>
+struct ApplianceServices : BaselineServices
+{
+};
+
+/**
+ * @brief The Refrigerator has no Matter service yet
+ *
+ * MatterOven would put an oven endpoint (device type 0x007B) on a refrigerator,
+ * whose descriptor asks for 0x0070, so it is left out of refrigerator builds.
+ */
+template <>
+struct ApplianceServices<ApplianceKind::Refrigerator> : BaselineServices
+{
+    using Matter = void;
+};
+
+using CurrentServices = ApplianceServices<Appliance::Kind>;
+
+/**
+ * @brief Register Service under id, or nothing when the appliance has no such service
+ */
+template <typename Service>
+inline void RegisterApplianceService(SharedBus::ServiceID id)
+{
+    if constexpr (!std::is_void_v<Service>) {
+        REGISTER_SERVICE(id, Service);
+    }
+}
+
+#ifdef CONFIG_DONE_LAZY_SERVICES
+template <typename Service>
+inline void RegisterLazyApplianceService(SharedBus::ServiceID id)
+{
+    if constexpr (!std::is_void_v<Service>) {
+        LazyServices::Register(id, &LazyServices::Construct<Service>);
+    }
+}
+#endif
+
+/**
+ * @brief Whether UI and networking wait until init is done, so a warm boot resumes control sooner
+ */
+inline bool DeferUiAndNetwork()
+{
+#if defined(CONFIG_DONE_FAST_BOOT) && defined(CONFIG_DONE_LAZY_SERVICES)
+    return FastBoot::IsWarmBoot();
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Register Service to be built by ServiceMngr, or lazily when it is deferred
+ */
+template <typename Service>
+inline void RegisterDeferrableService(SharedBus::ServiceID id, bool deferred)
+{
+#ifdef CONFIG_DONE_LAZY_SERVICES
+    if (deferred) {
+        RegisterLazyApplianceService<Service>(id);
+        return;
+    }
+#endif
+    RegisterApplianceService<Service>(id);
+}
+
 /**
  * @brief Register all services for this project
  * 
@@ -64,26 +171,45 @@ inline void RegisterServices()
     
     ESP_LOGI(TAG, "Registering project services...");
 
-#ifdef CONFIG_DONE_COMPONENT_UI2
-    // Register UI Service for Oven
-    // Note: Check if UICoffeeMaker is actually used for Oven or if there's UIOven
-    REGISTER_SERVICE(SharedBus::ServiceID::UI, UICoffeeMaker);
-#endif
+    ESP_LOGI(TAG, "Appliance: %s", Appliance::Current.Name);
 
-#ifdef CONFIG_DONE_COMPONENT_MATTER
-    // Register Matter Service for Oven
-    REGISTER_SERVICE(SharedBus::ServiceID::MATTER, MatterOven);
-#endif
+    // On a warm boot these are built by StartDeferredServices(), after control has resumed
+    const bool deferred = DeferUiAndNetwork();
+    if (deferred) {
+        ESP_LOGW(TAG, "Warm boot: UI and networking start once init is done");
+    }
+    RegisterDeferrableService<CurrentServices::UI>(SharedBus::ServiceID::UI, deferred);
+    RegisterDeferrableService<CurrentServices::Matter>(SharedBus::ServiceID::MATTER, deferred);
 
-#ifdef CONFIG_DONE_COMPONENT_MQTT
-    // Register MQTT Service for Oven
-    REGISTER_SERVICE(SharedBus::ServiceID::MQTT, MQTTOven);
+    // Note: MQTT is not available on the Thread SED profile, cloud traffic goes through Matter
+#ifdef CONFIG_DONE_LAZY_MQTT
+    // Built once WiFi has an address (see app_main) or a bus message targets it
+    RegisterLazyApplianceService<CurrentServices::Mqtt>(SharedBus::ServiceID::MQTT);
+#else
+    RegisterDeferrableService<CurrentServices::Mqtt>(SharedBus::ServiceID::MQTT, deferred);
 #endif
 
     ESP_LOGI(TAG, "Service registration complete");
     sServicesRegistered = true;
 }
 
+/**
+ * @brief Build the services RegisterServices() deferred on a warm boot; call once init is done
+ */
+inline void StartDeferredServices()
+{
+    if (!DeferUiAndNetwork()) {
+        return;
+    }
+#ifdef CONFIG_DONE_LAZY_SERVICES
+    LazyServices::Touch(SharedBus::ServiceID::UI);
+    LazyServices::Touch(SharedBus::ServiceID::MATTER);
+#ifndef CONFIG_DONE_LAZY_MQTT
+    LazyServices::Touch(SharedBus::ServiceID::MQTT);
+#endif
+#endif
+}
+
 /**
  * @brief Automatic service registration using GCC/Clang constructor attribute
  * 
@@ -102,5 +228,8 @@ inline void RegisterServices()
 __attribute__((constructor))
 static void AutoRegisterServices()
 {    
+    // With fast boot only app_main registers, once FastBoot::Begin() has told a warm boot from a cold one
+#ifndef CONFIG_DONE_FAST_BOOT
     RegisterServices(); 
+#endif
 }
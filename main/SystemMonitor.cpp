@@ -0,0 +1,294 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_SYSTEM_MONITOR
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "TaskPlan.hpp"
+#ifdef CONFIG_DONE_POWER_MANAGER
+#include "PowerManager.hpp"
+#endif
+#ifdef CONFIG_DONE_SYSTEM_MONITOR_JOB
+#include "TimerWheel.hpp"
+#include "JobExecutor.hpp"
+#endif
+#include "SystemMonitor.hpp"
+
+static const char *TAG = "SystemMonitor";
+
+/**
+ * @brief Sample ring kept across resets, validated by magic and CRC
+ */
+struct SystemMonitorHistory
+{
+    uint32_t Magic;
+    uint32_t Next;
+    uint32_t Count;
+    SystemMonitor::Sample Samples[CONFIG_DONE_SYSTEM_MONITOR_HISTORY];
+    uint32_t Crc;
+};
+
+static constexpr uint32_t HISTORY_MAGIC = 0x4D4F4E31; // "MON1"
+static RTC_NOINIT_ATTR SystemMonitorHistory sHistory;
+
+#ifdef CONFIG_DONE_SYSTEM_MONITOR_JOB
+static TimerWheel::Timer sSampleTimer;
+static JobExecutor::JobClass sSampleClass = JobExecutor::mInvalidClass;
+#endif
+
+static uint32_t HistoryCrc()
+{
+    return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&sHistory),
+                            offsetof(SystemMonitorHistory, Crc));
+}
+
+TaskHandle_t SystemMonitor::mTask = nullptr;
+SystemMonitor::Publisher SystemMonitor::mPublisher = nullptr;
+void *SystemMonitor::mPublisherArg = nullptr;
+CpuLoadMeter SystemMonitor::mCpuLoad;
+std::vector<SystemMonitor::TaskRunTime> SystemMonitor::mLastRunTime;
+uint32_t SystemMonitor::mLastTotalRunTime = 0;
+uint32_t SystemMonitor::mLastUptimeMs = 0;
+uint32_t SystemMonitor::mLastFreeHeap = 0;
+
+void SystemMonitor::ReportPostMortem()
+{
+    const bool valid = (sHistory.Magic == HISTORY_MAGIC) &&
+                       (sHistory.Count <= CONFIG_DONE_SYSTEM_MONITOR_HISTORY) &&
+                       (sHistory.Crc == HistoryCrc());
+    if (!valid) {
+        memset(&sHistory, 0, sizeof(sHistory));
+        sHistory.Magic = HISTORY_MAGIC;
+        sHistory.Crc = HistoryCrc();
+        return;
+    }
+
+    const esp_reset_reason_t reason = esp_reset_reason();
+    if (reason == ESP_RST_TASK_WDT || reason == ESP_RST_INT_WDT ||
+        reason == ESP_RST_WDT || reason == ESP_RST_PANIC) {
+        ESP_LOGW(TAG, "reset reason %d, last %lu samples before reset:",
+                 reason, static_cast<unsigned long>(sHistory.Count));
+        // Oldest first
+        for (uint32_t i = 0; i < sHistory.Count; i++) {
+            const uint32_t index = (sHistory.Next + CONFIG_DONE_SYSTEM_MONITOR_HISTORY -
+                                    sHistory.Count + i) % CONFIG_DONE_SYSTEM_MONITOR_HISTORY;
+            Log("post-mortem", sHistory.Samples[index]);
+        }
+    }
+
+    sHistory.Next = 0;
+    sHistory.Count = 0;
+    sHistory.Crc = HistoryCrc();
+}
+
+esp_err_t SystemMonitor::Start()
+{
+#ifdef CONFIG_DONE_SYSTEM_MONITOR_JOB
+    if (TimerWheel::IsArmed(sSampleTimer)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sSampleClass = JobExecutor::RegisterClass("monitor");
+    if (sSampleClass == JobExecutor::mInvalidClass) {
+        return ESP_ERR_NO_MEM;
+    }
+    // The slack lets the sample share a wheel tick with other periodic work
+    TimerWheel::Init(sSampleTimer, SampleTimer, nullptr);
+    TimerWheel::Arm(sSampleTimer, CONFIG_DONE_SYSTEM_MONITOR_PERIOD_MS, CONFIG_DONE_SYSTEM_MONITOR_PERIOD_MS,
+                    CONFIG_DONE_SYSTEM_MONITOR_PERIOD_MS / 8);
+    return ESP_OK;
+#else
+    if (mTask != nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    mTask = TaskPlan::Create(TaskPlan::SYSTEM_MONITOR, MonitorTask, nullptr);
+    if (mTask == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+#endif
+}
+
+void SystemMonitor::SetPublisher(Publisher publisher, void *arg)
+{
+    mPublisherArg = arg;
+    mPublisher = publisher;
+}
+
+void SystemMonitor::MonitorTask(void *arg)
+{
+    (void)arg;
+    TickType_t lastWake = xTaskGetTickCount();
+    while (true)
+    {
+#ifdef CONFIG_DONE_POWER_MANAGER
+        PowerManager::DelayUntilWindow(&lastWake, CONFIG_DONE_SYSTEM_MONITOR_PERIOD_MS);
+#else
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(CONFIG_DONE_SYSTEM_MONITOR_PERIOD_MS));
+#endif
+        SampleOnce();
+    }
+}
+
+#ifdef CONFIG_DONE_SYSTEM_MONITOR_JOB
+void SystemMonitor::SampleTimer(void *arg)
+{
+    // Runs on the wheel task, keep it short
+    if (JobExecutor::Post(sSampleClass, SampleJob, arg) != ESP_OK) {
+        ESP_LOGW(TAG, "sample skipped, job queues full");
+    }
+}
+
+void SystemMonitor::SampleJob(void *arg)
+{
+    (void)arg;
+    SampleOnce();
+}
+#endif
+
+void SystemMonitor::SampleOnce()
+{
+    Sample sample;
+    if (!TakeSample(sample)) {
+        return;
+    }
+    Store(sample);
+    if (OverThreshold(sample)) {
+        Log("sample", sample);
+    }
+    if (mPublisher != nullptr) {
+        mPublisher(sample, mPublisherArg);
+    }
+}
+
+bool SystemMonitor::TakeSample(Sample &sample)
+{
+    memset(&sample, 0, sizeof(sample));
+    sample.UptimeMs = static_cast<uint32_t>(esp_timer_get_time() / 1000);
+    sample.FreeInternalHeap = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    sample.PeriodMs = static_cast<uint16_t>(std::min<uint32_t>(sample.UptimeMs - mLastUptimeMs, UINT16_MAX));
+    sample.FreeInternalHeapDelta = static_cast<int32_t>(sample.FreeInternalHeap - mLastFreeHeap);
+    mLastUptimeMs = sample.UptimeMs;
+    mLastFreeHeap = sample.FreeInternalHeap;
+    const bool haveCoreLoad = mCpuLoad.Sample(sample.CoreLoad);
+
+    const UBaseType_t capacity = uxTaskGetNumberOfTasks() + 4;
+    std::unique_ptr<TaskStatus_t[]> tasks(new (std::nothrow) TaskStatus_t[capacity]);
+    if (!tasks) {
+        return false;
+    }
+    uint32_t totalRunTime = 0;
+    const UBaseType_t count = uxTaskGetSystemState(tasks.get(), capacity, &totalRunTime);
+    const uint32_t elapsed = totalRunTime - mLastTotalRunTime;
+
+    struct Busy
+    {
+        const TaskStatus_t *Task;
+        uint32_t Delta;
+    };
+    std::vector<Busy> busy;
+    busy.reserve(count);
+    const TaskStatus_t *lowestStack = nullptr;
+    std::vector<TaskRunTime> runTimes;
+    runTimes.reserve(count);
+
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t &task = tasks[i];
+        if (task.eCurrentState == eReady) {
+            sample.ReadyTasks++;
+        }
+        if (lowestStack == nullptr || task.usStackHighWaterMark < lowestStack->usStackHighWaterMark) {
+            lowestStack = &task;
+        }
+
+        uint32_t previous = task.ulRunTimeCounter;  // new tasks count from now on
+        for (const TaskRunTime &last : mLastRunTime) {
+            if (last.Handle == task.xHandle) {
+                previous = last.RunTime;
+                break;
+            }
+        }
+        busy.push_back({&task, task.ulRunTimeCounter - previous});
+        runTimes.push_back({task.xHandle, task.ulRunTimeCounter});
+    }
+    sample.TaskCount = static_cast<uint8_t>(std::min<UBaseType_t>(count, UINT8_MAX));
+
+    const int top = std::min<int>(mTopTasks, static_cast<int>(busy.size()));
+    std::partial_sort(busy.begin(), busy.begin() + top, busy.end(),
+                      [](const Busy &a, const Busy &b) { return a.Delta > b.Delta; });
+
+    auto fill = [elapsed](TaskSample &out, const TaskStatus_t &task, uint32_t delta) {
+        strncpy(out.Name, task.pcTaskName, sizeof(out.Name));
+        out.CpuPercent = (elapsed != 0) ?
+            static_cast<uint8_t>(std::min<uint64_t>(100, static_cast<uint64_t>(delta) * 100 / elapsed)) : 0;
+        const BaseType_t core = xTaskGetCoreID(task.xHandle);
+        out.Core = (core == tskNO_AFFINITY) ? -1 : static_cast<int8_t>(core);
+        // The high-water mark is in bytes on ESP-IDF (StackType_t is uint8_t)
+        out.StackHighWater = static_cast<uint16_t>(std::min<uint32_t>(task.usStackHighWaterMark, UINT16_MAX));
+    };
+    for (int i = 0; i < top; i++) {
+        fill(sample.Busiest[i], *busy[i].Task, busy[i].Delta);
+    }
+    if (lowestStack != nullptr) {
+        fill(sample.LowestStack, *lowestStack, 0);
+    }
+
+    const bool valid = haveCoreLoad && !mLastRunTime.empty();
+    mLastRunTime.swap(runTimes);
+    mLastTotalRunTime = totalRunTime;
+    return valid;
+}
+
+void SystemMonitor::Store(const Sample &sample)
+{
+    sHistory.Samples[sHistory.Next] = sample;
+    sHistory.Next = (sHistory.Next + 1) % CONFIG_DONE_SYSTEM_MONITOR_HISTORY;
+    if (sHistory.Count < CONFIG_DONE_SYSTEM_MONITOR_HISTORY) {
+        sHistory.Count++;
+    }
+    sHistory.Crc = HistoryCrc();
+}
+
+bool SystemMonitor::OverThreshold(const Sample &sample)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        if (sample.CoreLoad[core] >= CONFIG_DONE_SYSTEM_MONITOR_LOG_LOAD) {
+            return true;
+        }
+    }
+    return sample.LowestStack.StackHighWater < CONFIG_DONE_SYSTEM_MONITOR_LOG_STACK;
+}
+
+void SystemMonitor::Log(const char *prefix, const Sample &sample)
+{
+    char line[160];
+    int len = snprintf(line, sizeof(line), "%s @%lu ms (%u ms): ready %u/%u, heap %lu (%+ld), load",
+                       prefix, static_cast<unsigned long>(sample.UptimeMs), sample.PeriodMs,
+                       sample.ReadyTasks, sample.TaskCount,
+                       static_cast<unsigned long>(sample.FreeInternalHeap),
+                       static_cast<long>(sample.FreeInternalHeapDelta));
+    for (int core = 0; core < portNUM_PROCESSORS && len < static_cast<int>(sizeof(line)); core++) {
+        len += snprintf(line + len, sizeof(line) - len, " %u%%", sample.CoreLoad[core]);
+    }
+    ESP_LOGI(TAG, "%s", line);
+
+    for (const TaskSample &task : sample.Busiest) {
+        if (task.Name[0] == '\0') {
+            break;
+        }
+        ESP_LOGI(TAG, "  %-*.*s core %2d cpu %3u%% stack free %u",
+                 mNameLength, mNameLength, task.Name, task.Core,
+                 task.CpuPercent, task.StackHighWater);
+    }
+    ESP_LOGI(TAG, "  lowest stack: %.*s %u bytes free", mNameLength,
+             sample.LowestStack.Name, sample.LowestStack.StackHighWater);
+}
+
+#endif // CONFIG_DONE_SYSTEM_MONITOR
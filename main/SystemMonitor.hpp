@@ -0,0 +1,105 @@
+/**
+ * @file SystemMonitor.hpp
+ * @brief Per-task CPU load, stack high-water and ready-queue monitor
+ *
+ * A low priority task samples the FreeRTOS run-time stats every
+ * CONFIG_DONE_SYSTEM_MONITOR_PERIOD_MS and keeps the busiest tasks of each period.
+ * With CONFIG_DONE_SYSTEM_MONITOR_JOB a timer wheel timer posts the sample as a
+ * JobExecutor job instead, and the monitor has no task of its own.
+ * The last CONFIG_DONE_SYSTEM_MONITOR_HISTORY samples live in RTC memory, which
+ * survives a watchdog reset, so after a reset we can tell which task starved the
+ * idle task.
+ *
+ * A sample holds what changed over its period: CPU load per core and task since
+ * the previous sample and the change in free heap, plus the stack high-water
+ * marks. It is only logged when a core is loaded above
+ * CONFIG_DONE_SYSTEM_MONITOR_LOG_LOAD or a stack has less than
+ * CONFIG_DONE_SYSTEM_MONITOR_LOG_STACK bytes free. Every sample goes to the
+ * publisher. ServiceMngr's service base and SharedBus IDs are in the Utilities
+ * component, which is not in this tree. So the monitor is not a registered
+ * service. The MQTT service sets the publisher to get the samples.
+ *
+ * @note Only available when CONFIG_DONE_SYSTEM_MONITOR is enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "CpuLoadMeter.hpp"
+
+class SystemMonitor
+{
+public:
+    static constexpr int mTopTasks = 6;
+    static constexpr int mNameLength = 12;
+
+    struct __attribute__((packed)) TaskSample
+    {
+        char Name[mNameLength];
+        uint8_t CpuPercent;         ///< Share of one core during the period
+        int8_t Core;                ///< -1 if not pinned
+        uint16_t StackHighWater;    ///< Bytes never used
+    };
+
+    /**
+     * @brief One compact sample, this is also what gets published
+     */
+    struct __attribute__((packed)) Sample
+    {
+        uint32_t UptimeMs;
+        uint16_t PeriodMs;          ///< Since the previous sample, the load figures cover this
+        uint8_t CoreLoad[portNUM_PROCESSORS];
+        uint8_t ReadyTasks;
+        uint8_t TaskCount;
+        uint32_t FreeInternalHeap;
+        int32_t FreeInternalHeapDelta;
+        TaskSample Busiest[mTopTasks];
+        TaskSample LowestStack;
+    };
+
+    using Publisher = void (*)(const Sample &sample, void *arg);
+
+    /**
+     * @brief Dump the samples saved before the last reset if it was a watchdog or panic
+     * @note Call first thing in app_main, before the history is overwritten
+     */
+    static void ReportPostMortem();
+
+    static esp_err_t Start();
+
+    /**
+     * @brief Forward every sample, e.g. to the MQTT service
+     */
+    static void SetPublisher(Publisher publisher, void *arg);
+
+private:
+    struct TaskRunTime
+    {
+        TaskHandle_t Handle;
+        uint32_t RunTime;
+    };
+
+    static void MonitorTask(void *arg);
+#ifdef CONFIG_DONE_SYSTEM_MONITOR_JOB
+    static void SampleTimer(void *arg);
+    static void SampleJob(void *arg);
+#endif
+    static void SampleOnce();
+    static bool TakeSample(Sample &sample);
+    static void Store(const Sample &sample);
+    static void Log(const char *prefix, const Sample &sample);
+    static bool OverThreshold(const Sample &sample);
+
+    static TaskHandle_t mTask;
+    static Publisher mPublisher;
+    static void *mPublisherArg;
+    static CpuLoadMeter mCpuLoad;
+    static std::vector<TaskRunTime> mLastRunTime;
+    static uint32_t mLastTotalRunTime;
+    static uint32_t mLastUptimeMs;
+    static uint32_t mLastFreeHeap;
+};
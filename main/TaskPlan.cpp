@@ -0,0 +1,138 @@
+#include "sdkconfig.h"
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+#include "TaskPlan.hpp"
+
+static const char *TAG = "TaskPlan";
+
+#ifdef CONFIG_SPIRAM_ALLOW_STACK_EXTERNAL_MEMORY
+static constexpr bool sExternalAllowed = true;
+#else
+static constexpr bool sExternalAllowed = false;
+#endif
+
+size_t TaskPlan::mFreeBeforeInit = 0;
+size_t TaskPlan::mFreeAfterInit = 0;
+uint8_t *TaskPlan::mInternalStacks = nullptr;
+uint8_t *TaskPlan::mExternalStacks = nullptr;
+TaskHandle_t TaskPlan::mHandles[TaskPlan::TASK_COUNT] = {};
+uint8_t *TaskPlan::mStacks[TaskPlan::TASK_COUNT] = {};
+
+#ifdef CONFIG_DONE_STATIC_TASKS
+static StaticTask_t sTaskBuffers[TaskPlan::TASK_COUNT];
+
+/**
+ * @brief Whether the stack of a task actually goes to PSRAM in this build
+ */
+static bool IsExternal(const TaskSpec &spec)
+{
+    return spec.ExternalStack && sExternalAllowed;
+}
+#endif
+
+esp_err_t TaskPlan::Init()
+{
+#ifdef CONFIG_DONE_STATIC_TASKS
+    if (mInternalStacks != nullptr || mExternalStacks != nullptr) {
+        return ESP_OK;
+    }
+    const uint32_t internalBytes = PlannedBytes(false) + (sExternalAllowed ? 0 : PlannedBytes(true));
+    const uint32_t externalBytes = sExternalAllowed ? PlannedBytes(true) : 0;
+    mFreeBeforeInit = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    if (internalBytes > 0) {
+        mInternalStacks = static_cast<uint8_t *>(
+            heap_caps_aligned_alloc(16, internalBytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    }
+    if (externalBytes > 0) {
+        mExternalStacks = static_cast<uint8_t *>(
+            heap_caps_aligned_alloc(16, externalBytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+    }
+    if ((internalBytes > 0 && mInternalStacks == nullptr) || (externalBytes > 0 && mExternalStacks == nullptr)) {
+        ESP_LOGE(TAG, "cannot reserve %lu + %lu bytes of task stacks",
+                 static_cast<unsigned long>(internalBytes), static_cast<unsigned long>(externalBytes));
+        return ESP_ERR_NO_MEM;
+    }
+    mFreeAfterInit = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+
+    // Hand out the stacks in table order, so the layout is the same on every boot
+    uint8_t *nextInternal = mInternalStacks;
+    uint8_t *nextExternal = mExternalStacks;
+    for (uint8_t id = 0; id < TASK_COUNT; id++) {
+        const TaskSpec &spec = mSpecs[id];
+        if (spec.StackSize == 0 || spec.Deferred) {
+            continue;
+        }
+        uint8_t *&next = IsExternal(spec) ? nextExternal : nextInternal;
+        mStacks[id] = next;
+        next += spec.StackSize;
+    }
+#endif
+    return ESP_OK;
+}
+
+TaskHandle_t TaskPlan::Create(Id id, TaskFunction_t function, void *arg)
+{
+    if (id >= TASK_COUNT || mSpecs[id].StackSize == 0 || mHandles[id] != nullptr) {
+        return nullptr;
+    }
+    const TaskSpec &spec = mSpecs[id];
+#ifdef CONFIG_DONE_STATIC_TASKS
+    if (spec.Deferred && mStacks[id] == nullptr) {
+        const uint32_t caps = IsExternal(spec) ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL;
+        mStacks[id] = static_cast<uint8_t *>(heap_caps_aligned_alloc(16, spec.StackSize, caps | MALLOC_CAP_8BIT));
+        if (mStacks[id] == nullptr) {
+            ESP_LOGE(TAG, "cannot allocate %lu bytes of stack for %s",
+                     static_cast<unsigned long>(spec.StackSize), spec.Name);
+            return nullptr;
+        }
+    }
+    if (mStacks[id] == nullptr && Init() != ESP_OK) {
+        return nullptr;
+    }
+    mHandles[id] = xTaskCreateStaticPinnedToCore(function, spec.Name, spec.StackSize, arg, spec.Priority,
+                                                 reinterpret_cast<StackType_t *>(mStacks[id]),
+                                                 &sTaskBuffers[id], spec.Core);
+#else
+    if (xTaskCreatePinnedToCore(function, spec.Name, spec.StackSize, arg, spec.Priority,
+                                &mHandles[id], spec.Core) != pdPASS) {
+        mHandles[id] = nullptr;
+    }
+#endif
+    if (mHandles[id] == nullptr) {
+        ESP_LOGE(TAG, "failed to create %s", spec.Name);
+    }
+    return mHandles[id];
+}
+
+void TaskPlan::Report()
+{
+    for (uint8_t id = 0; id < TASK_COUNT; id++) {
+        const TaskSpec &spec = mSpecs[id];
+        if (spec.StackSize == 0) {
+            continue;
+        }
+        const uint8_t *stack = mStacks[id];
+        const bool external = (stack != nullptr) && esp_ptr_external_ram(stack);
+        ESP_LOGI(TAG, "%-11s stack %5lu @ %p %-8s prio %2u core %-3s %s", spec.Name,
+                 static_cast<unsigned long>(spec.StackSize), stack,
+                 (stack == nullptr) ? "heap" : (external ? "PSRAM" : "internal"),
+                 static_cast<unsigned>(spec.Priority),
+                 (spec.Core == tskNO_AFFINITY) ? "any" : ((spec.Core == 0) ? "0" : "1"),
+                 (mHandles[id] != nullptr) ? "running" : "not started");
+        if (mHandles[id] == nullptr && stack != nullptr && !spec.Deferred) {
+            ESP_LOGW(TAG, "%s never started, %lu bytes of stack reserved for nothing", spec.Name,
+                     static_cast<unsigned long>(spec.StackSize));
+        }
+    }
+    ESP_LOGI(TAG, "planned stacks: %lu bytes internal, %lu bytes PSRAM; largest free internal block %u",
+             static_cast<unsigned long>(PlannedBytes(false) + (sExternalAllowed ? 0 : PlannedBytes(true))),
+             static_cast<unsigned long>(sExternalAllowed ? PlannedBytes(true) : 0),
+             static_cast<unsigned>(heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL)));
+#ifdef CONFIG_DONE_STATIC_TASKS
+    ESP_LOGI(TAG, "free internal heap %u before Init(), %u after, %u now",
+             static_cast<unsigned>(mFreeBeforeInit), static_cast<unsigned>(mFreeAfterInit),
+             static_cast<unsigned>(heap_caps_get_free_size(MALLOC_CAP_INTERNAL)));
+#endif
+}
@@ -0,0 +1,143 @@
+/**
+ * @file TaskPlan.hpp
+ * @brief Compile-time plan of the long-lived tasks owned by main
+ *
+ * Each task declares its stack size, priority, core and whether its stack may
+ * live in PSRAM in one constexpr table. With CONFIG_DONE_STATIC_TASKS, Init()
+ * reserves one block per memory type for all planned stacks before anything
+ * else allocates, and Create() carves stacks out of them for
+ * xTaskCreateStaticPinnedToCore(); the control blocks are static. Long-lived
+ * stacks then never interleave with short-lived heap allocations. Without it,
+ * Create() falls back to xTaskCreatePinnedToCore() with the same parameters.
+ *
+ * Tasks started outside main (by a service in a submodule) are marked
+ * Deferred: Init() does not reserve their stack, Create() allocates it when
+ * the task is actually started, so a service that never starts its task
+ * costs no RAM.
+ *
+ * A task is planned only when the feature owning it is enabled, so the
+ * reservation is what those tasks would allocate anyway. Init() records the
+ * free internal heap before and after it and Report() logs both.
+ *
+ * Only stacks and control blocks are static. None of the tasks here owns a
+ * long-lived queue, and the tasks and queues of ServiceMngr services are
+ * created in the Utilities submodule, which does not take a TaskSpec.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+struct TaskSpec
+{
+    const char *Name;
+    uint32_t StackSize;     ///< 0 when the feature owning the task is disabled
+    UBaseType_t Priority;
+    BaseType_t Core;
+    bool ExternalStack;     ///< Stack may be in PSRAM: never touches flash or runs from ISRs
+    bool Deferred;          ///< Started outside main; the stack is allocated by Create(), not Init()
+};
+
+class TaskPlan
+{
+public:
+    enum Id : uint8_t
+    {
+        NVS_FLUSH,
+        SYSTEM_MONITOR,
+        UI_RENDER,
+        TIMER_WHEEL,
+        JOB_WORKER_0,
+        JOB_WORKER_1,
+        FLOWS,
+        TASK_COUNT
+    };
+
+    static constexpr TaskSpec mSpecs[TASK_COUNT] = {
+        // NVS erases pages, its stack must stay in internal RAM while the cache is off
+#ifdef CONFIG_DONE_NVS_WRITE_CACHE
+        { "NvsFlush", 3072, tskIDLE_PRIORITY + 2, tskNO_AFFINITY, false, false },
+#else
+        { "NvsFlush", 0, 0, tskNO_AFFINITY, false, false },
+#endif
+        // With CONFIG_DONE_SYSTEM_MONITOR_JOB the samples are taken by a job worker instead
+#if defined(CONFIG_DONE_SYSTEM_MONITOR) && !defined(CONFIG_DONE_SYSTEM_MONITOR_JOB)
+        { "SysMonitor", 4096, tskIDLE_PRIORITY + 1, tskNO_AFFINITY, true, false },
+#else
+        { "SysMonitor", 0, 0, tskNO_AFFINITY, true, false },
+#endif
+        // Started by the UI service through UIFramePacer::Start()
+#ifdef CONFIG_DONE_UI_RENDER_TASK
+        { "UIRender", CONFIG_DONE_UI_RENDER_TASK_STACK_SIZE, CONFIG_DONE_UI_RENDER_TASK_PRIORITY,
+          CONFIG_DONE_UI_RENDER_CORE, false, true },
+#else
+        { "UIRender", 0, 0, tskNO_AFFINITY, false, true },
+#endif
+        // Timer callbacks may write NVS, so the stack stays internal
+#ifdef CONFIG_DONE_TIMER_WHEEL
+        { "TimerWheel", 3072, tskIDLE_PRIORITY + 4, tskNO_AFFINITY, false, false },
+#else
+        { "TimerWheel", 0, 0, tskNO_AFFINITY, false, false },
+#endif
+        // One worker per core; jobs may write NVS, so the stacks stay internal
+#ifdef CONFIG_DONE_JOB_EXECUTOR
+        { "JobWorker0", CONFIG_DONE_JOB_EXECUTOR_STACK_SIZE, tskIDLE_PRIORITY + 3, 0, false, false },
+#else
+        { "JobWorker0", 0, 0, 0, false, false },
+#endif
+#if defined(CONFIG_DONE_JOB_EXECUTOR) && !defined(CONFIG_FREERTOS_UNICORE)
+        { "JobWorker1", CONFIG_DONE_JOB_EXECUTOR_STACK_SIZE, tskIDLE_PRIORITY + 3, 1, false, false },
+#else
+        { "JobWorker1", 0, 0, 1, false, false },
+#endif
+        // Runs every flow step; blocking work is awaited as a job, not done here
+#ifdef CONFIG_DONE_FLOWS
+        { "Flows", 3072, tskIDLE_PRIORITY + 3, tskNO_AFFINITY, false, false },
+#else
+        { "Flows", 0, 0, tskNO_AFFINITY, false, false },
+#endif
+    };
+
+    /**
+     * @brief Reserve the planned stacks; call first thing in app_main
+     */
+    static esp_err_t Init();
+
+    /**
+     * @brief Create a planned task
+     * @return nullptr if the task is not planned in this build or creation failed
+     */
+    static TaskHandle_t Create(Id id, TaskFunction_t function, void *arg);
+
+    /**
+     * @brief Log where every planned task and its stack ended up
+     *
+     * Warns about stacks reserved by Init() for tasks that were never started,
+     * and logs the free internal heap before and after Init().
+     */
+    static void Report();
+
+private:
+    static constexpr uint32_t PlannedBytes(bool external)
+    {
+        uint32_t total = 0;
+        for (const TaskSpec &spec : mSpecs) {
+            if (spec.ExternalStack == external && !spec.Deferred) {
+                total += spec.StackSize;
+            }
+        }
+        return total;
+    }
+
+    static size_t mFreeBeforeInit;     ///< Free internal heap before the reservation
+    static size_t mFreeAfterInit;
+    static uint8_t *mInternalStacks;
+    static uint8_t *mExternalStacks;
+    static TaskHandle_t mHandles[TASK_COUNT];
+    static uint8_t *mStacks[TASK_COUNT];
+};
@@ -0,0 +1,287 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_TIMER_WHEEL
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "TaskPlan.hpp"
+#include "TimerWheel.hpp"
+#include "TraceRecorder.hpp"
+
+static const char *TAG = "TimerWheel";
+
+static constexpr uint32_t NO_EVENT = UINT32_MAX;
+
+/**
+ * @brief Round a wheel tick up to a multiple of a power of two
+ */
+static inline uint32_t RoundUp(uint32_t tick, uint32_t granule)
+{
+    return (tick + granule - 1) & ~(granule - 1);
+}
+
+TimerWheel::Timer *TimerWheel::mSlotHeads[TimerWheel::mLevels][TimerWheel::mSlots] = {};
+uint64_t TimerWheel::mOccupied[TimerWheel::mLevels] = {};
+uint32_t TimerWheel::mNow = 0;
+uint32_t TimerWheel::mWakeAt = 0;
+TaskHandle_t TimerWheel::mTask = nullptr;
+TimerWheel::Stats TimerWheel::mStats = {};
+portMUX_TYPE TimerWheel::mLock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t TimerWheel::Start()
+{
+    if (mTask != nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    mNow = Now();
+    mWakeAt = mNow;
+    mTask = TaskPlan::Create(TaskPlan::TIMER_WHEEL, WheelTask, nullptr);
+    if (mTask == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "%d ms ticks, range %lu s", CONFIG_DONE_TIMER_WHEEL_TICK_MS,
+             static_cast<unsigned long>(static_cast<uint64_t>(mMaxDelta) * CONFIG_DONE_TIMER_WHEEL_TICK_MS / 1000));
+    return ESP_OK;
+}
+
+uint32_t TimerWheel::Now()
+{
+    // 64-bit source, so the 32-bit wheel time wraps cleanly
+    return static_cast<uint32_t>(esp_timer_get_time() / (CONFIG_DONE_TIMER_WHEEL_TICK_MS * 1000));
+}
+
+uint32_t TimerWheel::ToTicks(uint32_t ms)
+{
+    return (ms + CONFIG_DONE_TIMER_WHEEL_TICK_MS - 1) / CONFIG_DONE_TIMER_WHEEL_TICK_MS;
+}
+
+void TimerWheel::Init(Timer &timer, Callback callback, void *arg)
+{
+    timer = {};
+    timer.Function = callback;
+    timer.Arg = arg;
+}
+
+void TimerWheel::Init(Timer &timer, QueueHandle_t queue, const void *message)
+{
+    timer = {};
+    timer.Queue = queue;
+    timer.Message = message;
+}
+
+void TimerWheel::Insert(Timer &timer, uint32_t base)
+{
+    int32_t delta = static_cast<int32_t>(timer.Expiry - base);
+    if (delta < 0) {
+        timer.Expiry = base;
+        delta = 0;
+    }
+    // Beyond the top level: park at its far end and re-sort when cascaded
+    const uint32_t placed = (static_cast<uint32_t>(delta) > mMaxDelta) ? base + mMaxDelta : timer.Expiry;
+    const uint32_t distance = placed - base;
+    uint32_t level = 0;
+    while (level < mLevels - 1 && distance >= (1UL << (mSlotBits * (level + 1)))) {
+        level++;
+    }
+    const uint32_t slot = (placed >> (mSlotBits * level)) & mSlotMask;
+
+    Timer **head = &mSlotHeads[level][slot];
+    timer.Next = *head;
+    if (timer.Next != nullptr) {
+        timer.Next->Link = &timer.Next;
+    }
+    timer.Link = head;
+    *head = &timer;
+    mOccupied[level] |= 1ULL << slot;
+}
+
+void TimerWheel::Unlink(Timer &timer)
+{
+    Timer **link = timer.Link;
+    *link = timer.Next;
+    if (timer.Next != nullptr) {
+        timer.Next->Link = link;
+    }
+    timer.Next = nullptr;
+    timer.Link = nullptr;
+
+    // A link inside the head table means the timer was first in its slot
+    Timer **first = &mSlotHeads[0][0];
+    if (link >= first && link < first + mLevels * mSlots && *link == nullptr) {
+        const uint32_t index = link - first;
+        mOccupied[index / mSlots] &= ~(1ULL << (index % mSlots));
+    }
+}
+
+void TimerWheel::Arm(Timer &timer, uint32_t delayMs, uint32_t periodMs, uint32_t slackMs)
+{
+    const uint32_t slackTicks = slackMs / CONFIG_DONE_TIMER_WHEEL_TICK_MS;
+    const uint32_t granule = (slackTicks > 0) ? (1UL << (31 - __builtin_clz(slackTicks))) : 1;
+    const uint32_t nominal = Now() + ToTicks(delayMs);
+
+    portENTER_CRITICAL(&mLock);
+    if (timer.Link != nullptr) {
+        Unlink(timer);
+    } else {
+        mStats.Armed++;
+    }
+    timer.Nominal = nominal;
+    timer.Granule = granule;
+    timer.Period = (periodMs > 0) ? ((ToTicks(periodMs) > 0) ? ToTicks(periodMs) : 1) : 0;
+    // Rounding to a granule boundary is what makes nearby deadlines share a tick
+    timer.Expiry = RoundUp(nominal, granule);
+    if (static_cast<int32_t>(timer.Expiry - mNow) < 1) {
+        timer.Expiry = mNow + 1;
+    }
+    Insert(timer, mNow);
+    const bool earlier = static_cast<int32_t>(timer.Expiry - mWakeAt) < 0;
+    portEXIT_CRITICAL(&mLock);
+
+    if (earlier && mTask != nullptr) {
+        xTaskNotifyGive(mTask);
+    }
+}
+
+bool TimerWheel::Cancel(Timer &timer)
+{
+    portENTER_CRITICAL(&mLock);
+    const bool armed = (timer.Link != nullptr);
+    if (armed) {
+        Unlink(timer);
+        mStats.Armed--;
+    }
+    portEXIT_CRITICAL(&mLock);
+    return armed;
+}
+
+void TimerWheel::Cascade(uint32_t level, uint32_t tick)
+{
+    const uint32_t slot = (tick >> (mSlotBits * level)) & mSlotMask;
+    Timer *timer = mSlotHeads[level][slot];
+    mSlotHeads[level][slot] = nullptr;
+    mOccupied[level] &= ~(1ULL << slot);
+    while (timer != nullptr) {
+        Timer *next = timer->Next;
+        Insert(*timer, tick);
+        timer = next;
+    }
+}
+
+void TimerWheel::AdvanceTo(uint32_t target)
+{
+    portENTER_CRITICAL(&mLock);
+    while (static_cast<int32_t>(target - mNow) > 0) {
+        // Nothing due at level 0: jump to the next level 0 lap, or straight to the target
+        if (mOccupied[0] == 0) {
+            const uint32_t lap = (mNow | mSlotMask) + 1;
+            if (static_cast<int32_t>(lap - target) > 0) {
+                mNow = target;
+                break;
+            }
+            mNow = lap - 1;
+        }
+
+        const uint32_t tick = ++mNow;
+        for (uint32_t level = mLevels - 1; level > 0; level--) {
+            if ((tick & ((1UL << (mSlotBits * level)) - 1)) == 0) {
+                Cascade(level, tick);
+            }
+        }
+
+        Timer *const *head = &mSlotHeads[0][tick & mSlotMask];
+        while (*head != nullptr) {
+            Timer &timer = **head;
+            Unlink(timer);
+            if (timer.Period > 0) {
+                uint32_t next = timer.Nominal + timer.Period;
+                if (static_cast<int32_t>(next - target) <= 0) {
+                    // Woke up late: skip the missed periods instead of firing them back to back
+                    next += ((target - next) / timer.Period + 1) * timer.Period;
+                }
+                timer.Nominal = next;
+                timer.Expiry = RoundUp(next, timer.Granule);
+                Insert(timer, tick);
+            } else {
+                mStats.Armed--;
+            }
+            const Callback function = timer.Function;
+            void *const arg = timer.Arg;
+            const QueueHandle_t queue = timer.Queue;
+            const void *const message = timer.Message;
+            const uint32_t lateMs = (target - tick) * CONFIG_DONE_TIMER_WHEEL_TICK_MS;
+            mStats.Fired++;
+            if (lateMs > mStats.MaxLateMs) {
+                mStats.MaxLateMs = lateMs;
+            }
+            portEXIT_CRITICAL(&mLock);
+
+            // Outside the lock: the callback may arm or cancel timers, this one included
+            bool delivered = true;
+            DONE_TRACE_SCOPE(mTraceTag, lateMs);
+            if (queue != nullptr) {
+                delivered = (xQueueSend(queue, message, 0) == pdTRUE);
+            } else if (function != nullptr) {
+                function(arg);
+            }
+
+            portENTER_CRITICAL(&mLock);
+            if (!delivered) {
+                mStats.QueueDrops++;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&mLock);
+}
+
+uint32_t TimerWheel::TicksToNextEvent()
+{
+    uint32_t best = NO_EVENT;
+    for (uint32_t level = 0; level < mLevels; level++) {
+        const uint64_t occupied = mOccupied[level];
+        if (occupied == 0) {
+            continue;
+        }
+        // First occupied slot after the current one, 64 meaning the current one next lap
+        const uint32_t levelNow = mNow >> (mSlotBits * level);
+        const uint32_t start = (levelNow + 1) & mSlotMask;
+        const uint64_t rotated = (start == 0) ? occupied : ((occupied >> start) | (occupied << (mSlots - start)));
+        const uint32_t steps = __builtin_ctzll(rotated) + 1;
+        const uint32_t due = (levelNow + steps) << (mSlotBits * level);
+        const uint32_t distance = due - mNow;
+        if (distance < best) {
+            best = distance;
+        }
+    }
+    return best;
+}
+
+void TimerWheel::WheelTask(void *arg)
+{
+    (void)arg;
+    while (true)
+    {
+        portENTER_CRITICAL(&mLock);
+        const uint32_t distance = TicksToNextEvent();
+        mWakeAt = (distance == NO_EVENT) ? mNow + mMaxDelta : mNow + distance;
+        const int32_t sleepTicks = static_cast<int32_t>(mWakeAt - Now());
+        portEXIT_CRITICAL(&mLock);
+
+        if (sleepTicks > 0) {
+            // One extra OS tick so we never wake just before the wheel tick boundary
+            ulTaskNotifyTake(pdTRUE, (distance == NO_EVENT) ? portMAX_DELAY :
+                             pdMS_TO_TICKS(sleepTicks * CONFIG_DONE_TIMER_WHEEL_TICK_MS) + 1);
+        }
+        mStats.Wakeups++;
+        AdvanceTo(Now());
+    }
+}
+
+TimerWheel::Stats TimerWheel::GetStats()
+{
+    portENTER_CRITICAL(&mLock);
+    const Stats stats = mStats;
+    portEXIT_CRITICAL(&mLock);
+    return stats;
+}
+
+#endif // CONFIG_DONE_TIMER_WHEEL
@@ -0,0 +1,116 @@
+/**
+ * @file TimerWheel.hpp
+ * @brief Hierarchical timer wheel shared by all periodic work
+ *
+ * Four levels of 64 slots cover 2^24 wheel ticks (CONFIG_DONE_TIMER_WHEEL_TICK_MS
+ * each). Arming and cancelling a timer are O(1) list operations; a timer is
+ * moved one level down each time its slot comes up, so expiring N timers costs
+ * O(N) whatever the number of armed timers. Timers are caller-owned and
+ * intrusive, nothing is allocated at run time.
+ *
+ * An expired timer either runs its callback on the wheel task or, for
+ * services, posts its message to the service's own queue so the work runs in
+ * the service context. A timer armed with slack may fire up to that much
+ * later; its deadline is rounded to a coarse boundary so timers with nearby
+ * deadlines fire on the same tick. The wheel task sleeps until the next
+ * occupied slot, so it does not wake the CPU between deadlines.
+ *
+ * @note Only available when CONFIG_DONE_TIMER_WHEEL is enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+class TimerWheel
+{
+public:
+    using Callback = void (*)(void *arg);
+
+    /**
+     * @brief Timer storage; owned by the caller, must outlive its armed period
+     */
+    struct Timer
+    {
+        Timer *Next;
+        Timer **Link;           ///< Pointer to the pointer that points here, nullptr when idle
+        uint32_t Expiry;        ///< Wheel tick it fires at, Nominal rounded up to Granule
+        uint32_t Nominal;       ///< Wheel tick it was asked to fire at
+        uint32_t Period;        ///< Wheel ticks, 0 for one-shot
+        uint32_t Granule;       ///< Power of two from the slack, 1 without slack
+        Callback Function;
+        void *Arg;
+        QueueHandle_t Queue;
+        const void *Message;
+    };
+
+    struct Stats
+    {
+        uint32_t Armed;
+        uint32_t Fired;
+        uint32_t QueueDrops;    ///< Service queue was full at expiry
+        uint32_t Wakeups;
+        uint32_t MaxLateMs;
+    };
+
+    static esp_err_t Start();
+
+    /**
+     * @brief Prepare a timer that runs callback(arg) on the wheel task
+     */
+    static void Init(Timer &timer, Callback callback, void *arg);
+
+    /**
+     * @brief Prepare a timer that posts message to queue without blocking
+     */
+    static void Init(Timer &timer, QueueHandle_t queue, const void *message);
+
+    /**
+     * @brief Arm or re-arm a timer
+     * @param delayMs first expiry
+     * @param periodMs period after that, 0 for one-shot
+     * @param slackMs how late the timer may fire, used to coalesce nearby deadlines
+     */
+    static void Arm(Timer &timer, uint32_t delayMs, uint32_t periodMs = 0, uint32_t slackMs = 0);
+
+    /**
+     * @brief Disarm a timer
+     * @return false if it was not armed
+     */
+    static bool Cancel(Timer &timer);
+
+    static bool IsArmed(const Timer &timer) { return timer.Link != nullptr; }
+
+    static Stats GetStats();
+
+private:
+    friend class TimerWheelBench;   ///< test/TimerWheelBench.cpp steps the wheel on a frozen clock
+
+    static constexpr uint32_t mLevels = 4;
+    static constexpr uint32_t mSlotBits = 6;
+    static constexpr uint32_t mSlots = 1 << mSlotBits;
+    static constexpr uint32_t mSlotMask = mSlots - 1;
+    static constexpr uint32_t mMaxDelta = (1UL << (mLevels * mSlotBits)) - 1;
+    static constexpr uint16_t mTraceTag = 0x0200;   ///< Dispatch tag in the event trace
+
+    static uint32_t Now();
+    static uint32_t ToTicks(uint32_t ms);
+    static void Insert(Timer &timer, uint32_t base);
+    static void Unlink(Timer &timer);
+    static void Cascade(uint32_t level, uint32_t tick);
+    static void AdvanceTo(uint32_t target);
+    static uint32_t TicksToNextEvent();
+    static void WheelTask(void *arg);
+
+    static Timer *mSlotHeads[mLevels][mSlots];
+    static uint64_t mOccupied[mLevels];
+    static uint32_t mNow;       ///< Last wheel tick processed
+    static uint32_t mWakeAt;    ///< Wheel tick the task sleeps until
+    static TaskHandle_t mTask;
+    static Stats mStats;
+    static portMUX_TYPE mLock;
+};
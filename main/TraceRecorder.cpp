@@ -0,0 +1,122 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_TRACE
+
+#include <cstdio>
+#include <cstring>
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "TraceRecorder.hpp"
+
+static const char *TAG = "TraceRecorder";
+
+TraceRecorder::Slot TraceRecorder::mRing[TraceRecorder::mCapacity];
+std::atomic<uint32_t> TraceRecorder::mHead(0);
+std::atomic<bool> TraceRecorder::mEnabled(true);
+
+void IRAM_ATTR TraceRecorder::Add(Event type, uint16_t arg0, uint32_t arg1)
+{
+    if (!mEnabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    const uint32_t ticket = mHead.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = mRing[ticket & (mCapacity - 1)];
+    // Sequence lock: readers that see 0, or another ticket, skip the slot
+    slot.Sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    Record &record = slot.Data;
+    record.TimestampUs = static_cast<uint32_t>(esp_timer_get_time());
+    record.Type = type;
+    record.Core = static_cast<uint8_t>(esp_cpu_get_core_id());
+    record.Arg0 = arg0;
+    record.Arg1 = arg1;
+    slot.Sequence.store(ticket + 1, std::memory_order_release);
+}
+
+void TraceRecorder::Clear()
+{
+    const bool wasEnabled = mEnabled.exchange(false);
+    for (Slot &slot : mRing) {
+        slot.Sequence.store(0, std::memory_order_relaxed);
+    }
+    mHead.store(0);
+    mEnabled.store(wasEnabled);
+}
+
+void TraceRecorder::Dump()
+{
+    const bool wasEnabled = mEnabled.exchange(false);
+    // Let writers that already passed the enabled check finish their record; any
+    // still writing are caught by the sequence check below
+    vTaskDelay(1);
+
+    const uint32_t head = mHead.load();
+    const uint32_t count = (head < mCapacity) ? head : mCapacity;
+    // Plain printf: the host tool parses these lines, log prefixes would get in the way
+    printf("DONE_TRACE_BEGIN %lu\n", static_cast<unsigned long>(count));
+    uint32_t skipped = 0;
+    for (uint32_t i = head - count; i != head; i++) {
+        const Slot &slot = mRing[i & (mCapacity - 1)];
+        if (slot.Sequence.load(std::memory_order_acquire) != i + 1) {
+            skipped++;
+            continue;
+        }
+        const Record record = slot.Data;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.Sequence.load(std::memory_order_relaxed) != i + 1) {
+            skipped++;
+            continue;
+        }
+        printf("DT,%lu,%u,%u,%u,%lu\n",
+               static_cast<unsigned long>(record.TimestampUs),
+               record.Core, static_cast<unsigned>(record.Type), record.Arg0,
+               static_cast<unsigned long>(record.Arg1));
+    }
+    if (skipped != 0) {
+        printf("skipped %lu records still being written\n", static_cast<unsigned long>(skipped));
+    }
+    printf("DONE_TRACE_END\n");
+    fflush(stdout);
+
+    mEnabled.store(wasEnabled);
+}
+
+static int TraceCommand(int argc, char **argv)
+{
+    if (argc != 2) {
+        printf("usage: trace dump|clear|on|off\n");
+        return 1;
+    }
+    if (strcmp(argv[1], "dump") == 0) {
+        TraceRecorder::Dump();
+    } else if (strcmp(argv[1], "clear") == 0) {
+        TraceRecorder::Clear();
+    } else if (strcmp(argv[1], "on") == 0) {
+        TraceRecorder::Enable(true);
+    } else if (strcmp(argv[1], "off") == 0) {
+        TraceRecorder::Enable(false);
+    } else {
+        printf("usage: trace dump|clear|on|off\n");
+        return 1;
+    }
+    return 0;
+}
+
+esp_err_t TraceRecorder::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "trace",
+        .help = "Event trace: dump | clear | on | off",
+        .hint = nullptr,
+        .func = &TraceCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_TRACE
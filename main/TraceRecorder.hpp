@@ -0,0 +1,117 @@
+/**
+ * @file TraceRecorder.hpp
+ * @brief Fixed-size, lock-free event trace for SharedBus and service dispatch
+ *
+ * Events are 12-byte records written into a power-of-two ring with a single atomic
+ * increment, so recording is safe from any task on either core and costs a few dozen
+ * cycles. Each slot carries a sequence word: 0 while a record is being written, the
+ * record's ticket + 1 once it is complete. Dump() skips slots whose sequence is not
+ * the one it expects before and after copying, so it never prints a half-written or
+ * overwritten record. It prints the ring as text lines which
+ * tools/trace_to_perfetto.py turns into Chrome trace / Perfetto JSON.
+ *
+ * Recorded in main: timer wheel callbacks (tag 0x200, Arg1 = ms late), jobs (0x300,
+ * Arg1 = job class), flow steps (0x400, Arg1 = resume line) and UI frames (0x100).
+ * SharedBus is in the Utilities component, which is not in this tree. To get bus
+ * events, its send has to call DONE_TRACE(BusEnqueue, destination, messageId). Its
+ * receive loop has to call DONE_TRACE(BusDequeue, service, messageId) and wrap the
+ * handler in DONE_TRACE_SCOPE(service, messageType).
+ *
+ * Use the DONE_TRACE* macros: they compile to nothing unless CONFIG_DONE_TRACE is set.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+class TraceRecorder
+{
+public:
+    enum class Event : uint8_t
+    {
+        BusEnqueue   = 1,   ///< Arg0 = destination ServiceID, Arg1 = message ID
+        BusDequeue   = 2,   ///< Arg0 = receiving ServiceID, Arg1 = message ID
+        HandlerEnter = 3,   ///< Arg0 = ServiceID (or a tag >= 0x100), Arg1 = message type
+        HandlerExit  = 4,   ///< Arg0 = ServiceID (or a tag >= 0x100), Arg1 = message type
+        Mark         = 5,   ///< Free-form instant event
+    };
+
+    struct Record
+    {
+        uint32_t TimestampUs;
+        Event Type;
+        uint8_t Core;
+        uint16_t Arg0;
+        uint32_t Arg1;
+    };
+    static_assert(sizeof(Record) == 12, "trace record layout");
+
+#ifdef CONFIG_DONE_TRACE
+    static void Add(Event type, uint16_t arg0, uint32_t arg1);
+
+    static void Enable(bool enable) { mEnabled.store(enable, std::memory_order_relaxed); }
+
+    static void Clear();
+
+    /**
+     * @brief Print the ring oldest first; recording is paused meanwhile
+     */
+    static void Dump();
+
+    /**
+     * @brief Register the `trace` console command (dump | clear | on | off)
+     * @note The console itself is brought up by the Matter shell
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+    static constexpr uint32_t mCapacity = CONFIG_DONE_TRACE_BUFFER_EVENTS;
+    static_assert((mCapacity & (mCapacity - 1)) == 0, "trace buffer size must be a power of two");
+
+    struct Slot
+    {
+        std::atomic<uint32_t> Sequence;     ///< 0 while written, ticket + 1 when complete
+        Record Data;
+    };
+
+    static Slot mRing[mCapacity];
+    static std::atomic<uint32_t> mHead;
+    static std::atomic<bool> mEnabled;
+#endif
+};
+
+#ifdef CONFIG_DONE_TRACE
+/**
+ * @brief Records HandlerEnter on construction and HandlerExit on destruction
+ */
+class TraceScope
+{
+public:
+    TraceScope(uint16_t serviceId, uint32_t messageType) :
+        mServiceId(serviceId), mMessageType(messageType)
+    {
+        TraceRecorder::Add(TraceRecorder::Event::HandlerEnter, mServiceId, mMessageType);
+    }
+    ~TraceScope()
+    {
+        TraceRecorder::Add(TraceRecorder::Event::HandlerExit, mServiceId, mMessageType);
+    }
+
+private:
+    uint16_t mServiceId;
+    uint32_t mMessageType;
+};
+
+#define DONE_TRACE_CONCAT_(a, b) a##b
+#define DONE_TRACE_CONCAT(a, b) DONE_TRACE_CONCAT_(a, b)
+#define DONE_TRACE(type, arg0, arg1) \
+    TraceRecorder::Add(TraceRecorder::Event::type, (arg0), (arg1))
+#define DONE_TRACE_SCOPE(serviceId, messageType) \
+    TraceScope DONE_TRACE_CONCAT(traceScope, __LINE__)((serviceId), (messageType))
+#else
+#define DONE_TRACE(type, arg0, arg1) do { } while (0)
+#define DONE_TRACE_SCOPE(serviceId, messageType) do { } while (0)
+#endif
@@ -0,0 +1,177 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_UI_ASSET_PACK
+
+#include <cstdio>
+#include <cstring>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_console.h"
+#include "UIAssetPack.hpp"
+
+static const char *TAG = "UIAssetPack";
+
+// Custom data subtype of the `assets` partition, see partitions_s3_16m.csv
+static constexpr esp_partition_subtype_t ASSETS_PARTITION_SUBTYPE =
+    static_cast<esp_partition_subtype_t>(0x40);
+
+const uint8_t *UIAssetPack::mBase = nullptr;
+const UIAssetPack::Header *UIAssetPack::mHeader = nullptr;
+const UIAssetPack::Entry *UIAssetPack::mEntries = nullptr;
+esp_partition_mmap_handle_t UIAssetPack::mMmapHandle = 0;
+
+esp_err_t UIAssetPack::Open()
+{
+    if (mBase != nullptr) {
+        return ESP_OK;
+    }
+
+    const esp_partition_t *partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ASSETS_PARTITION_SUBTYPE, "assets");
+    if (partition == nullptr) {
+        ESP_LOGW(TAG, "no assets partition");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const int64_t startUs = esp_timer_get_time();
+    const size_t freeHeapBefore = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+
+    // Header first, so only the pack is mapped and not the whole partition
+    Header header;
+    esp_err_t err = esp_partition_read(partition, 0, &header, sizeof(header));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "header read failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    if (memcmp(header.Magic, "DUAP", sizeof(header.Magic)) != 0 ||
+        header.Version != mVersion ||
+        header.TotalSize > partition->size ||
+        sizeof(Header) + header.Count * sizeof(Entry) > header.TotalSize) {
+        ESP_LOGE(TAG, "assets partition holds no valid pack");
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    const void *mapped = nullptr;
+    err = esp_partition_mmap(partition, 0, header.TotalSize, ESP_PARTITION_MMAP_DATA, &mapped, &mMmapHandle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mmap failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    mBase = static_cast<const uint8_t *>(mapped);
+    mHeader = reinterpret_cast<const Header *>(mBase);
+    mEntries = reinterpret_cast<const Entry *>(mBase + sizeof(Header));
+
+    ESP_LOGI(TAG, "%u assets, %lu bytes mapped in %lld us, heap used %d bytes",
+             mHeader->Count,
+             static_cast<unsigned long>(mHeader->TotalSize),
+             static_cast<long long>(esp_timer_get_time() - startUs),
+             static_cast<int>(freeHeapBefore - heap_caps_get_free_size(MALLOC_CAP_DEFAULT)));
+    return ESP_OK;
+}
+
+void UIAssetPack::Close()
+{
+    if (mBase == nullptr) {
+        return;
+    }
+    esp_partition_munmap(mMmapHandle);
+    mMmapHandle = 0;
+    mBase = nullptr;
+    mHeader = nullptr;
+    mEntries = nullptr;
+}
+
+bool UIAssetPack::Find(const char *name, Image &image)
+{
+    if (mBase == nullptr || name == nullptr) {
+        return false;
+    }
+
+    // Entries are sorted by name by the pack tool
+    int low = 0;
+    int high = static_cast<int>(mHeader->Count) - 1;
+    while (low <= high) {
+        const int mid = (low + high) / 2;
+        const Entry &entry = mEntries[mid];
+        const int cmp = strncmp(name, entry.Name, sizeof(entry.Name));
+        if (cmp == 0) {
+            // Not Offset + Size, which can wrap
+            if (entry.Offset > mHeader->TotalSize || entry.Size > mHeader->TotalSize - entry.Offset) {
+                ESP_LOGE(TAG, "asset %s out of bounds", name);
+                return false;
+            }
+            image.Width = entry.Width;
+            image.Height = entry.Height;
+            image.PixelFormat = static_cast<Format>(entry.Format);
+            image.Size = entry.Size;
+            image.Pixels = mBase + entry.Offset;
+            return true;
+        }
+        if (cmp < 0) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return false;
+}
+
+uint16_t UIAssetPack::Count()
+{
+    return (mHeader != nullptr) ? mHeader->Count : 0;
+}
+
+int UIAssetPack::ConsoleCommand(int argc, char **argv)
+{
+    if (mBase == nullptr) {
+        printf("no asset pack\n");
+        return 1;
+    }
+    if (argc < 2) {
+        printf("%u assets, %lu bytes mapped\n", Count(), static_cast<unsigned long>(mHeader->TotalSize));
+        for (uint16_t i = 0; i < Count(); i++) {
+            const Entry &entry = mEntries[i];
+            printf("  %-32.32s %4ux%-4u %7lu bytes\n", entry.Name, entry.Width, entry.Height,
+                   static_cast<unsigned long>(entry.Size));
+        }
+        return 0;
+    }
+
+    // A screen switch: look up each asset and read all its pixels, as the first flush does
+    uint32_t bytes = 0;
+    uint32_t sum = 0;
+    const int64_t startUs = esp_timer_get_time();
+    for (int arg = 1; arg < argc; arg++) {
+        Image image;
+        if (!Find(argv[arg], image)) {
+            printf("no asset %s\n", argv[arg]);
+            return 1;
+        }
+        const uint32_t *words = reinterpret_cast<const uint32_t *>(image.Pixels);
+        for (uint32_t i = 0; i < image.Size / sizeof(uint32_t); i++) {
+            sum += words[i];
+        }
+        bytes += image.Size;
+    }
+    const int64_t elapsedUs = esp_timer_get_time() - startUs;
+    printf("%d assets, %lu bytes in %lld us (%.1f MB/s from flash), checksum %08lx\n", argc - 1,
+           static_cast<unsigned long>(bytes), static_cast<long long>(elapsedUs),
+           (elapsedUs > 0) ? static_cast<double>(bytes) / elapsedUs : 0.0, static_cast<unsigned long>(sum));
+    return 0;
+}
+
+esp_err_t UIAssetPack::RegisterConsoleCommand()
+{
+    const esp_console_cmd_t command = {
+        .command = "assets",
+        .help = "List the UI asset pack, or time a screen switch from it: assets [name...]",
+        .hint = nullptr,
+        .func = &ConsoleCommand,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&command);
+}
+
+#endif // CONFIG_DONE_UI_ASSET_PACK
@@ -0,0 +1,119 @@
+/**
+ * @file UIAssetPack.hpp
+ * @brief Pre-decoded UI image pack mapped directly from flash
+ *
+ * The pack is produced at build time by tools/pack_ui_assets.py and flashed to the
+ * `assets` partition. Open() reads the pack header and maps only the pack, not the
+ * whole partition, with esp_partition_mmap. Find() then hands out pointers into
+ * flash: no JPEG decode, no heap copy. Pixels are byte-swapped at build time when
+ * CONFIG_LV_COLOR_16_SWAP is set, so they can go to the LCD as they are.
+ *
+ * The screens are built in the UserInterface2 component, which has to draw
+ * from the pack instead of decoding, e.g.:
+ * @code
+ * UIAssetPack::Image image;
+ * if (UIAssetPack::Find("bake", image)) {
+ *     // Static or member: LVGL keeps the pointer
+ *     sBake.header.cf = (image.PixelFormat == UIAssetPack::Format::RGB565) ? LV_IMG_CF_TRUE_COLOR
+ *                                                                           : LV_IMG_CF_TRUE_COLOR_ALPHA;
+ *     sBake.header.w = image.Width;
+ *     sBake.header.h = image.Height;
+ *     sBake.data_size = image.Size;
+ *     sBake.data = image.Pixels;
+ *     lv_img_set_src(icon, &sBake);
+ * }
+ * @endcode
+ * `assets <name>...` times a screen switch from the pack: looking up the named
+ * assets and reading all their pixels, as the first flush of the screen does.
+ *
+ * @note Only available when CONFIG_DONE_UI_ASSET_PACK is enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+class UIAssetPack
+{
+public:
+    /**
+     * @brief Pixel layouts, identical to LVGL v8 LV_IMG_CF_TRUE_COLOR(_ALPHA) at 16 bpp
+     */
+    enum class Format : uint8_t
+    {
+        RGB565    = 0,
+        RGB565_A8 = 1,
+    };
+
+    struct Image
+    {
+        uint16_t Width;
+        uint16_t Height;
+        Format PixelFormat;
+        uint32_t Size;
+        const uint8_t *Pixels;   ///< Points into memory-mapped flash
+    };
+
+    /**
+     * @brief Map the assets partition and validate the pack header
+     * @return ESP_OK, ESP_ERR_NOT_FOUND if there is no partition or
+     *         ESP_ERR_INVALID_VERSION if the partition holds no valid pack
+     */
+    static esp_err_t Open();
+
+    /**
+     * @brief Unmap the assets partition
+     */
+    static void Close();
+
+    /**
+     * @brief Look up an asset by name (file name without extension)
+     * @param name asset name
+     * @param image filled with a view of the mapped pixels
+     * @return true if the asset exists
+     */
+    static bool Find(const char *name, Image &image);
+
+    static uint16_t Count();
+
+    /**
+     * @brief Register the `assets` console command
+     */
+    static esp_err_t RegisterConsoleCommand();
+
+private:
+    struct __attribute__((packed)) Header
+    {
+        char Magic[4];
+        uint16_t Version;
+        uint16_t Count;
+        uint32_t TotalSize;
+        uint32_t Reserved;
+    };
+
+    struct __attribute__((packed)) Entry
+    {
+        char Name[32];
+        uint16_t Width;
+        uint16_t Height;
+        uint8_t Format;
+        uint8_t Reserved[3];
+        uint32_t Offset;
+        uint32_t Size;
+    };
+
+    static_assert(sizeof(Header) == 16, "asset pack header layout");
+    static_assert(sizeof(Entry) == 48, "asset pack entry layout");
+
+    static constexpr uint16_t mVersion = 1;
+
+    static int ConsoleCommand(int argc, char **argv);
+
+    static const uint8_t *mBase;
+    static const Header *mHeader;
+    static const Entry *mEntries;
+    static esp_partition_mmap_handle_t mMmapHandle;
+};
@@ -0,0 +1,169 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_UI_RENDER_TASK
+
+#include <cstring>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "CpuLoadMeter.hpp"
+#include "TraceRecorder.hpp"
+#include "TaskPlan.hpp"
+#ifdef CONFIG_DONE_POWER_MANAGER
+#include "PowerManager.hpp"
+#endif
+#include "UIFramePacer.hpp"
+
+static const char *TAG = "UIFramePacer";
+#ifdef CONFIG_DONE_POWER_MANAGER
+static PowerManager::Owner sPmOwner = PowerManager::mInvalidOwner;
+#endif
+
+UIFramePacer::RenderCallback UIFramePacer::mRender = nullptr;
+void *UIFramePacer::mRenderArg = nullptr;
+TaskHandle_t UIFramePacer::mTask = nullptr;
+std::atomic<uint32_t> UIFramePacer::mPendingMask(0);
+std::atomic<uint32_t> UIFramePacer::mPendingCount(0);
+portMUX_TYPE UIFramePacer::mStatsLock = portMUX_INITIALIZER_UNLOCKED;
+UIFramePacer::Stats UIFramePacer::mStats = {};
+
+esp_err_t UIFramePacer::Start(RenderCallback render, void *arg)
+{
+    if (render == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (mTask != nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    mRender = render;
+    mRenderArg = arg;
+#ifdef CONFIG_DONE_POWER_MANAGER
+    sPmOwner = PowerManager::RegisterOwner("UIRender");
+#endif
+    mTask = TaskPlan::Create(TaskPlan::UI_RENDER, RenderTask, nullptr);
+    if (mTask == nullptr) {
+        ESP_LOGE(TAG, "failed to create render task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void UIFramePacer::RequestUpdate(uint32_t dirtyMask)
+{
+    mPendingMask.fetch_or(dirtyMask, std::memory_order_release);
+    mPendingCount.fetch_add(1, std::memory_order_relaxed);
+    if (mTask != nullptr) {
+        xTaskNotifyGive(mTask);
+    }
+}
+
+UIFramePacer::Stats UIFramePacer::GetStats()
+{
+    Stats stats;
+    portENTER_CRITICAL(&mStatsLock);
+    stats = mStats;
+    portEXIT_CRITICAL(&mStatsLock);
+    return stats;
+}
+
+void UIFramePacer::RenderTask(void *arg)
+{
+    (void)arg;
+    const TickType_t framePeriod = (pdMS_TO_TICKS(1000 / CONFIG_DONE_UI_FPS) > 0) ?
+                                   pdMS_TO_TICKS(1000 / CONFIG_DONE_UI_FPS) : 1;
+    TickType_t lastFrame = xTaskGetTickCount();
+    TickType_t lastReport = lastFrame;
+
+    ESP_LOGI(TAG, "render loop at %d fps on core %d", CONFIG_DONE_UI_FPS, CONFIG_DONE_UI_RENDER_CORE);
+
+    while (true)
+    {
+        // Sleep until something changes, but wake up for the periodic report
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(mReportPeriodMs));
+#ifdef CONFIG_DONE_POWER_MANAGER
+        // No light sleep until the frame is out, the display transfer needs its clocks
+        PowerManager::Hold hold(sPmOwner);
+#endif
+
+        // Hold the frame until its slot so updates arriving meanwhile join this pass
+        const TickType_t now = xTaskGetTickCount();
+        const TickType_t nextFrame = lastFrame + framePeriod;
+        if (static_cast<int32_t>(nextFrame - now) > 0) {
+            vTaskDelay(nextFrame - now);
+        }
+
+        // Clear the notification before taking the mask, so an update racing
+        // with the swap wakes up the next iteration instead of getting lost
+        ulTaskNotifyTake(pdTRUE, 0);
+        const uint32_t dirtyMask = mPendingMask.exchange(0, std::memory_order_acquire);
+        const uint32_t batched = mPendingCount.exchange(0, std::memory_order_relaxed);
+
+        if (dirtyMask != 0) {
+            DONE_TRACE_SCOPE(mTraceTag, dirtyMask);
+            const int64_t startUs = esp_timer_get_time();
+            mRender(dirtyMask, mRenderArg);
+            RecordFrame(static_cast<uint32_t>(esp_timer_get_time() - startUs), batched);
+            lastFrame = xTaskGetTickCount();
+        }
+
+        if (xTaskGetTickCount() - lastReport >= pdMS_TO_TICKS(mReportPeriodMs)) {
+            lastReport = xTaskGetTickCount();
+            Report();
+        }
+    }
+}
+
+void UIFramePacer::RecordFrame(uint32_t frameTimeUs, uint32_t batched)
+{
+    const uint32_t frameTimeMs = frameTimeUs / 1000;
+    int bucket = 0;
+    while (bucket < mHistogramSize - 1 && frameTimeMs >= mHistogramBucketsMs[bucket]) {
+        bucket++;
+    }
+
+    portENTER_CRITICAL(&mStatsLock);
+    mStats.Frames++;
+    mStats.BatchedUpdates += batched;
+    mStats.Histogram[bucket]++;
+    if (frameTimeUs > mStats.MaxFrameTimeUs) {
+        mStats.MaxFrameTimeUs = frameTimeUs;
+    }
+    portEXIT_CRITICAL(&mStatsLock);
+}
+
+void UIFramePacer::Report()
+{
+    static CpuLoadMeter cpuLoad;
+    static uint32_t lastFrames = 0;
+
+    // The maximum covers one report window, the other counters keep running
+    portENTER_CRITICAL(&mStatsLock);
+    const Stats stats = mStats;
+    mStats.MaxFrameTimeUs = 0;
+    portEXIT_CRITICAL(&mStatsLock);
+    const uint32_t frames = stats.Frames - lastFrames;
+    lastFrames = stats.Frames;
+
+    char histogram[96];
+    int len = 0;
+    for (int i = 0; i < mHistogramSize && len < static_cast<int>(sizeof(histogram)); i++) {
+        len += snprintf(histogram + len, sizeof(histogram) - len, "%s%lu",
+                        (i == 0) ? "" : "/", static_cast<unsigned long>(stats.Histogram[i]));
+    }
+
+    char cpu[32] = "";
+    uint8_t load[portNUM_PROCESSORS] = {};
+    if (cpuLoad.Sample(load)) {
+        int cpuLen = 0;
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            cpuLen += snprintf(cpu + cpuLen, sizeof(cpu) - cpuLen, ", cpu%d %u%%", core, load[core]);
+        }
+    }
+
+    ESP_LOGI(TAG, "%lu.%lu fps, max frame %lu us, frame ms <2/4/8/16/33/66/+ %s%s",
+             static_cast<unsigned long>(frames * 1000 / mReportPeriodMs),
+             static_cast<unsigned long>((frames * 10000 / mReportPeriodMs) % 10),
+             static_cast<unsigned long>(stats.MaxFrameTimeUs), histogram, cpu);
+}
+
+#endif // CONFIG_DONE_UI_RENDER_TASK
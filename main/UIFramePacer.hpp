@@ -0,0 +1,81 @@
+/**
+ * @file UIFramePacer.hpp
+ * @brief Frame-paced UI render loop pinned to one core
+ *
+ * SharedBus handlers no longer redraw directly: they call RequestUpdate() with a
+ * bitmask of what changed. The render task wakes up at most once per frame period,
+ * takes every update requested since the previous frame and runs a single render
+ * pass for all of them. With nothing pending the task stays blocked, so an idle
+ * screen costs no CPU.
+ *
+ * The UI service (UserInterface2, not in this tree) has to start the task once
+ * LVGL is set up and redraw from the callback, e.g.:
+ * @code
+ * UIFramePacer::Start([](uint32_t dirtyMask, void *arg) {
+ *     UpdateWidgets(dirtyMask);   // set the labels and images marked dirty
+ *     lv_timer_handler();         // one render pass for all of them
+ * }, nullptr);
+ * @endcode
+ * Until it does, nothing is rendered by this task and CONFIG_DONE_UI_RENDER_TASK
+ * stays off.
+ *
+ * @note Only available when CONFIG_DONE_UI_RENDER_TASK is enabled.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+class UIFramePacer
+{
+public:
+    /**
+     * @brief Render callback, runs on the render task
+     * @param dirtyMask OR of all masks passed to RequestUpdate() since the last frame
+     */
+    using RenderCallback = void (*)(uint32_t dirtyMask, void *arg);
+
+    /// Frame-time histogram bucket upper bounds in ms, last bucket is open-ended
+    static constexpr uint8_t mHistogramBucketsMs[] = {2, 4, 8, 16, 33, 66};
+    static constexpr int mHistogramSize = sizeof(mHistogramBucketsMs) + 1;
+
+    struct Stats
+    {
+        uint32_t Frames;
+        uint32_t BatchedUpdates;    ///< RequestUpdate() calls folded into a frame
+        uint32_t MaxFrameTimeUs;    ///< Longest frame since the last report
+        uint32_t Histogram[mHistogramSize];
+    };
+
+    /**
+     * @brief Create the render task on CONFIG_DONE_UI_RENDER_CORE
+     */
+    static esp_err_t Start(RenderCallback render, void *arg);
+
+    /**
+     * @brief Mark parts of the UI dirty, callable from any task
+     */
+    static void RequestUpdate(uint32_t dirtyMask);
+
+    static Stats GetStats();
+
+private:
+    static void RenderTask(void *arg);
+    static void RecordFrame(uint32_t frameTimeUs, uint32_t batched);
+    static void Report();
+
+    static constexpr uint32_t mReportPeriodMs = 10000;
+    static constexpr uint16_t mTraceTag = 0x0100;   ///< Dispatch tag in the event trace
+
+    static RenderCallback mRender;
+    static void *mRenderArg;
+    static TaskHandle_t mTask;
+    static std::atomic<uint32_t> mPendingMask;
+    static std::atomic<uint32_t> mPendingCount;
+    static portMUX_TYPE mStatsLock;
+    static Stats mStats;
+};
@@ -0,0 +1,201 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_DONE_UI_IMAGE_CACHE
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "jpeg_decoder.h"
+#include "UIImageCache.hpp"
+
+static const char *TAG = "UIImageCache";
+
+UIImageCache::UIImageCache(size_t budgetBytes) :
+    mMutex(xSemaphoreCreateMutex()),
+    mStats(),
+    mPublisher(nullptr),
+    mPublisherArg(nullptr)
+{
+    mStats.BudgetBytes = budgetBytes;
+}
+
+UIImageCache::~UIImageCache()
+{
+    Clear();
+    vSemaphoreDelete(mMutex);
+}
+
+UIImageCache::ImagePtr UIImageCache::Get(uint32_t assetId, uint8_t scale,
+                                         const uint8_t *jpeg, size_t jpegSize)
+{
+    const uint64_t key = MakeKey(assetId, scale);
+
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    auto found = mIndex.find(key);
+    if (found != mIndex.end()) {
+        mLru.splice(mLru.begin(), mLru, found->second);
+        mStats.Hits++;
+        mStats.DecodeTimeSavedUs += found->second->DecodeTimeUs;
+        ImagePtr image = found->second->Image;
+        xSemaphoreGive(mMutex);
+        return image;
+    }
+    mStats.Misses++;
+    xSemaphoreGive(mMutex);
+
+    // Decode outside the lock, other screens may hit the cache meanwhile
+    uint32_t decodeTimeUs = 0;
+    ImagePtr image = Decode(scale, jpeg, jpegSize, decodeTimeUs);
+
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    if (image == nullptr) {
+        mStats.DecodeErrors++;
+        xSemaphoreGive(mMutex);
+        return nullptr;
+    }
+    mStats.DecodeTimeUs += decodeTimeUs;
+
+    found = mIndex.find(key);
+    if (found != mIndex.end()) {
+        // Another task decoded the same image while we were decoding
+        mLru.splice(mLru.begin(), mLru, found->second);
+        image = found->second->Image;
+    } else if (image->Size <= mStats.BudgetBytes) {
+        mLru.push_front({key, image, decodeTimeUs});
+        mIndex[key] = mLru.begin();
+        mStats.BytesUsed += image->Size;
+        EvictToBudget();
+    }
+    xSemaphoreGive(mMutex);
+    return image;
+}
+
+void UIImageCache::Invalidate(uint32_t assetId)
+{
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    for (auto it = mLru.begin(); it != mLru.end();) {
+        if ((it->Key >> 8) == assetId) {
+            mStats.BytesUsed -= it->Image->Size;
+            mIndex.erase(it->Key);
+            it = mLru.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    xSemaphoreGive(mMutex);
+}
+
+void UIImageCache::Clear()
+{
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    mLru.clear();
+    mIndex.clear();
+    mStats.BytesUsed = 0;
+    xSemaphoreGive(mMutex);
+}
+
+UIImageCache::Stats UIImageCache::GetStats() const
+{
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    Stats stats = mStats;
+    xSemaphoreGive(mMutex);
+    return stats;
+}
+
+void UIImageCache::LogStats() const
+{
+    const Stats stats = GetStats();
+    const uint32_t lookups = stats.Hits + stats.Misses;
+    ESP_LOGI(TAG, "hits %lu/%lu (%lu%%), evictions %lu, errors %lu, %u/%u bytes, "
+                  "decode %llu ms, saved %llu ms",
+             static_cast<unsigned long>(stats.Hits),
+             static_cast<unsigned long>(lookups),
+             static_cast<unsigned long>(lookups ? (stats.Hits * 100) / lookups : 0),
+             static_cast<unsigned long>(stats.Evictions),
+             static_cast<unsigned long>(stats.DecodeErrors),
+             static_cast<unsigned>(stats.BytesUsed),
+             static_cast<unsigned>(stats.BudgetBytes),
+             static_cast<unsigned long long>(stats.DecodeTimeUs / 1000),
+             static_cast<unsigned long long>(stats.DecodeTimeSavedUs / 1000));
+}
+
+void UIImageCache::SetPublisher(Publisher publisher, void *arg)
+{
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    mPublisher = publisher;
+    mPublisherArg = arg;
+    xSemaphoreGive(mMutex);
+}
+
+void UIImageCache::Publish() const
+{
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    const Stats stats = mStats;
+    const Publisher publisher = mPublisher;
+    void *arg = mPublisherArg;
+    xSemaphoreGive(mMutex);
+    if (publisher != nullptr) {
+        publisher(stats, arg);
+    }
+}
+
+UIImageCache::ImagePtr UIImageCache::Decode(uint8_t scale, const uint8_t *jpeg,
+                                            size_t jpegSize, uint32_t &decodeTimeUs)
+{
+    if (jpeg == nullptr || jpegSize == 0 || scale > JPEG_IMAGE_SCALE_1_8) {
+        return nullptr;
+    }
+
+    esp_jpeg_image_cfg_t config = {};
+    config.indata = const_cast<uint8_t *>(jpeg);
+    config.indata_size = jpegSize;
+    config.out_format = JPEG_IMAGE_FORMAT_RGB565;
+    config.out_scale = static_cast<esp_jpeg_image_scale_t>(scale);
+#ifdef CONFIG_LV_COLOR_16_SWAP
+    config.flags.swap_color_bytes = 1;
+#endif
+
+    esp_jpeg_image_output_t info = {};
+    if (esp_jpeg_get_image_info(&config, &info) != ESP_OK) {
+        return nullptr;
+    }
+
+    // Round up, the decoder emits whole MCUs at reduced scales
+    const uint32_t divider = 1u << scale;
+    const size_t size = static_cast<size_t>((info.width + divider - 1) / divider) *
+                        ((info.height + divider - 1) / divider) * 2;
+    uint8_t *pixels = static_cast<uint8_t *>(heap_caps_malloc(size, MALLOC_CAP_SPIRAM));
+    if (pixels == nullptr) {
+        ESP_LOGW(TAG, "no PSRAM for a %u byte image", static_cast<unsigned>(size));
+        return nullptr;
+    }
+
+    config.outbuf = pixels;
+    config.outbuf_size = size;
+    const int64_t startUs = esp_timer_get_time();
+    esp_jpeg_image_output_t output = {};
+    if (esp_jpeg_decode(&config, &output) != ESP_OK) {
+        heap_caps_free(pixels);
+        return nullptr;
+    }
+    decodeTimeUs = static_cast<uint32_t>(esp_timer_get_time() - startUs);
+
+    Image *image = new Image{output.width, output.height, size, pixels};
+    return ImagePtr(image, [](const Image *img) {
+        heap_caps_free(img->Pixels);
+        delete img;
+    });
+}
+
+void UIImageCache::EvictToBudget()
+{
+    while (mStats.BytesUsed > mStats.BudgetBytes && !mLru.empty()) {
+        const Entry &victim = mLru.back();
+        mStats.BytesUsed -= victim.Image->Size;
+        mStats.Evictions++;
+        mIndex.erase(victim.Key);
+        mLru.pop_back();
+    }
+}
+
+#endif // CONFIG_DONE_UI_IMAGE_CACHE
@@ -0,0 +1,117 @@
+/**
+ * @file UIImageCache.hpp
+ * @brief LRU cache of decoded JPEG images with a PSRAM byte budget
+ *
+ * For images that have to stay JPEG (e.g. recipe photos downloaded from the cloud).
+ * Decoded RGB565 pixels are kept in PSRAM keyed by asset ID and scale, and the least
+ * recently used ones are evicted once the budget is exceeded. Images handed out are
+ * reference counted, so an evicted image stays valid until the UI drops it.
+ *
+ * The UI service owns the cache and routes its image decodes through Get(). That
+ * service is in the UserInterface2 component, which is not in this tree. It also
+ * sets a publisher and calls Publish() from its report timer, so the hit, miss and
+ * eviction counters reach SharedBus (and MQTT) like the other service statistics.
+ *
+ * @note Only available when CONFIG_DONE_UI_IMAGE_CACHE is enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+class UIImageCache
+{
+public:
+    struct Image
+    {
+        uint16_t Width;
+        uint16_t Height;
+        size_t Size;
+        uint8_t *Pixels;    ///< RGB565, allocated in PSRAM
+    };
+    using ImagePtr = std::shared_ptr<const Image>;
+
+    struct Stats
+    {
+        uint32_t Hits;
+        uint32_t Misses;
+        uint32_t Evictions;
+        uint32_t DecodeErrors;
+        size_t BytesUsed;
+        size_t BudgetBytes;
+        uint64_t DecodeTimeUs;      ///< Time spent decoding on misses
+        uint64_t DecodeTimeSavedUs; ///< Decode time avoided by hits
+    };
+
+    using Publisher = void (*)(const Stats &stats, void *arg);
+
+    /**
+     * @param budgetBytes maximum PSRAM held by cached (not in-use) images
+     */
+    explicit UIImageCache(size_t budgetBytes = CONFIG_DONE_UI_IMAGE_CACHE_BUDGET_KB * 1024);
+    ~UIImageCache();
+
+    UIImageCache(const UIImageCache &) = delete;
+    UIImageCache &operator=(const UIImageCache &) = delete;
+
+    /**
+     * @brief Get a decoded image, decoding it on a miss
+     * @param assetId caller defined asset ID
+     * @param scale esp_jpeg scale (0 = 1:1, 1 = 1:2, 2 = 1:4, 3 = 1:8)
+     * @param jpeg encoded data, only read on a miss
+     * @param jpegSize size of the encoded data
+     * @return the decoded image, or nullptr if decoding failed
+     */
+    ImagePtr Get(uint32_t assetId, uint8_t scale, const uint8_t *jpeg, size_t jpegSize);
+
+    /**
+     * @brief Drop all scales of an asset, e.g. when the cloud sends a new photo
+     */
+    void Invalidate(uint32_t assetId);
+
+    void Clear();
+
+    Stats GetStats() const;
+
+    void LogStats() const;
+
+    /**
+     * @brief Set the callback Publish() hands the counters to, e.g. a SharedBus message
+     */
+    void SetPublisher(Publisher publisher, void *arg);
+
+    /**
+     * @brief Hand the current counters to the publisher, from the owner's report timer
+     */
+    void Publish() const;
+
+private:
+    struct Entry
+    {
+        uint64_t Key;
+        ImagePtr Image;
+        uint32_t DecodeTimeUs;
+    };
+
+    static uint64_t MakeKey(uint32_t assetId, uint8_t scale)
+    {
+        return (static_cast<uint64_t>(assetId) << 8) | scale;
+    }
+
+    ImagePtr Decode(uint8_t scale, const uint8_t *jpeg, size_t jpegSize, uint32_t &decodeTimeUs);
+    void EvictToBudget();
+
+    SemaphoreHandle_t mMutex;
+    std::list<Entry> mLru;      ///< Front is most recently used
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> mIndex;
+    Stats mStats;
+    Publisher mPublisher;
+    void *mPublisherArg;
+};
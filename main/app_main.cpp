@@ -5,12 +5,73 @@
 #include "esp_heap_caps.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#ifdef CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+#ifdef CONFIG_DONE_POWER_MANAGER
+#include "PowerManager.hpp"
+#endif
+#ifdef CONFIG_DONE_FAST_BOOT
+#include "FastBoot.hpp"
+#endif
+#ifdef CONFIG_DONE_COOK_CHECKPOINT
+#include "CookCheckpoint.hpp"
+#include "OvenState.hpp"
+#endif
 
 #include "ServiceMngr.hpp"  // Automatically selects Generalized or Legacy based on Kconfig
 #include "Singleton.hpp"
 #include "BSP.h"
 
 #include "ServiceRegistration.hpp"
+#include "TaskPlan.hpp"
+#ifdef CONFIG_DONE_UI_ASSET_PACK
+#include "UIAssetPack.hpp"
+#endif
+#ifdef CONFIG_DONE_SYSTEM_MONITOR
+#include "SystemMonitor.hpp"
+#endif
+#ifdef CONFIG_DONE_TRACE
+#include "TraceRecorder.hpp"
+#endif
+#ifdef CONFIG_DONE_LATENCY_MONITOR
+#include "LatencyMonitor.hpp"
+#endif
+#ifdef CONFIG_DONE_NVS_WRITE_CACHE
+#include "NvsWriteCache.hpp"
+#endif
+#ifdef CONFIG_DONE_COMPRESSED_OTA
+#include "CompressedOta.hpp"
+#endif
+#ifdef CONFIG_DONE_DELTA_OTA
+#include "DeltaOta.hpp"
+#endif
+#ifdef CONFIG_DONE_TIMER_WHEEL
+#include "TimerWheel.hpp"
+#endif
+#ifdef CONFIG_DONE_JOB_EXECUTOR
+#include "JobExecutor.hpp"
+#endif
+#ifdef CONFIG_DONE_FLOWS
+#include "Flow.hpp"
+#endif
+#ifdef CONFIG_DONE_HOT_PATHS_BENCH
+#include "HotPath.hpp"
+#endif
+#ifdef CONFIG_DONE_ICACHE_PROFILER
+#include "ICacheProfiler.hpp"
+#endif
+#ifdef CONFIG_DONE_LAZY_MQTT
+#include "esp_netif.h"
+#endif
+#ifdef CONFIG_DONE_LOCAL_API
+#include "LocalApi.hpp"
+#endif
+#ifdef CONFIG_DONE_LIVE_STREAM
+#include "LiveStream.hpp"
+#endif
+
+static const char *TAG = "main";
 
 static std::shared_ptr<ServiceMngr> serviceMngr;
 // Define the heartbeat pattern in milliseconds
@@ -21,18 +82,149 @@ const int HeartbeatPattern[] = {
     1000 // Rest time before the next heartbeat
 };
 const int HeartbeatPatternLength = sizeof(HeartbeatPattern) / sizeof(HeartbeatPattern[0]);
+#ifdef CONFIG_DONE_POWER_MANAGER
+const int HeartbeatPeriodMs = HeartbeatPattern[0] + HeartbeatPattern[1] + HeartbeatPattern[2] + HeartbeatPattern[3];
+#endif
+
+#ifdef CONFIG_DONE_NETWORK_THREAD_SED
+// On a sleepy end device the heartbeat is a single short blink per poll window,
+// so the LED never wakes the CPU between two polls of the parent.
+const int HeartbeatBlinkMs = 20;
+#elif defined(CONFIG_DONE_FLOWS)
+// The rest phase may stretch by this much so the beat shares a wheel tick with other periodic work
+const uint32_t HeartbeatRestSlackMs = 250;
+
+/**
+ * @brief The heartbeat pattern as a flow, it no longer needs the main task
+ */
+class HeartbeatFlow : public Flow
+{
+public:
+    HeartbeatFlow() : Flow("heartbeat") {}
+
+protected:
+    void Run() override
+    {
+        FLOW_BEGIN();
+        while (true) {
+            for (mPhase = 0; mPhase < HeartbeatPatternLength; mPhase++) {
+                gpio_set_level(BSP_HEARTBEAT_GPIO, mPhase % 2);
+#ifdef CONFIG_DONE_POWER_MANAGER
+                if (mPhase == HeartbeatPatternLength - 1) {
+                    // Rest until the next wake window, so every beat shares a wake-up
+                    FLOW_AWAIT_TIMER(PowerManager::DelayToWindow(HeartbeatPattern[mPhase]));
+                    continue;
+                }
+#endif
+                FLOW_AWAIT_TIMER(HeartbeatPattern[mPhase],
+                                 (mPhase == HeartbeatPatternLength - 1) ? HeartbeatRestSlackMs : 0);
+            }
+        }
+        FLOW_END();
+    }
+
+private:
+    int mPhase = 0;
+};
+
+static HeartbeatFlow heartbeatFlow;
+#endif
+
+#ifdef CONFIG_PM_ENABLE
+/**
+ * @brief Enable DFS and automatic light sleep
+ */
+static void ConfigurePowerManagement()
+{
+    esp_pm_config_t pmConfig = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_XTAL_FREQ,
+        .light_sleep_enable = true
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pmConfig));
+}
+#endif
+
+/**
+ * @brief Log a startup step that failed; the appliance starts without it
+ */
+static void CheckStarted(esp_err_t err, const char *what)
+{
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s failed: %s", what, esp_err_to_name(err));
+    }
+}
 
 /**
  * @brief Function to change colors based on a timer callback
  */
 extern "C" void app_main()
 {        
+#ifdef CONFIG_DONE_FAST_BOOT
+    // Warm or cold boot, before anything else runs
+    FastBoot::Begin();
+#endif
+#ifdef CONFIG_DONE_COOK_CHECKPOINT
+    // Before any service starts; a resumed cook goes back into OvenState for the cook control
+    if (CookCheckpoint::Restore()) {
+        OvenState::ResumeCook();
+    }
+#endif
+#if defined(CONFIG_DONE_SYSTEM_MONITOR) && !defined(CONFIG_DONE_FAST_BOOT)
+    // Print what the tasks were doing before a watchdog reset, before it is overwritten
+    SystemMonitor::ReportPostMortem();
+#endif
+
+    // Reserve the long-lived task stacks before anything else fragments the heap
+    CheckStarted(TaskPlan::Init(), "TaskPlan::Init");
+
+#ifdef CONFIG_DONE_FAST_BOOT
+    // On a warm boot control resumes here, ahead of everything below that can wait; UI and
+    // networking are only built once init is done (StartDeferredServices())
+    FastBoot::Resume();
+#ifdef CONFIG_DONE_SYSTEM_MONITOR
+    SystemMonitor::ReportPostMortem();
+#endif
+#endif
+
     // Ensure services are registered before creating ServiceMngr
     // Note: __attribute__((constructor)) may not execute reliably in ESP-IDF/Xtensa GCC,
     // so this manual call ensures registration happens. Registration is idempotent,
     // so it's safe to call even if constructor already executed.
     RegisterServices();
-    
+
+#ifdef CONFIG_PM_ENABLE
+    ConfigurePowerManagement();
+#endif
+#ifdef CONFIG_DONE_POWER_MANAGER
+    CheckStarted(PowerManager::Init(), "PowerManager::Init");
+#endif
+
+#ifdef CONFIG_DONE_NVS_WRITE_CACHE
+    // Before any service persists state
+    CheckStarted(NvsWriteCache::Init(), "NvsWriteCache::Init");
+#endif
+#if defined(CONFIG_DONE_POWER_MANAGER) && defined(CONFIG_DONE_NVS_WRITE_CACHE)
+    // Pending settings reach flash when the appliance goes idle, not only after the delay
+    PowerManager::SetStandbyHook(&NvsWriteCache::RequestFlush);
+#endif
+#ifdef CONFIG_DONE_TIMER_WHEEL
+    // Before any service arms a timer
+    CheckStarted(TimerWheel::Start(), "TimerWheel::Start");
+#endif
+#ifdef CONFIG_DONE_JOB_EXECUTOR
+    CheckStarted(JobExecutor::Start(), "JobExecutor::Start");
+#endif
+#ifdef CONFIG_DONE_FLOWS
+    CheckStarted(FlowScheduler::Start(), "FlowScheduler::Start");
+#endif
+
+
+#ifdef CONFIG_DONE_UI_ASSET_PACK
+    // Map the asset pack before the UI service starts drawing
+    CheckStarted(UIAssetPack::Open(), "UIAssetPack::Open");
+#endif
+
     Log_RamOccupy("main", "service manager");        
     serviceMngr = Singleton<ServiceMngr, const char*, SharedBus::ServiceID>::
                     GetInstance(static_cast<const char*>
@@ -40,6 +232,82 @@ extern "C" void app_main()
                         SharedBus::ServiceID::SERVICE_MANAGER);     
     Log_RamOccupy("main", "service manager");        
 
+#ifdef CONFIG_DONE_LAZY_MQTT
+    {
+        // The default event loop exists once the network services are up, but by then WiFi
+        // may have its address already and the event will not come again
+        const esp_err_t err = LazyServices::TouchOn(SharedBus::ServiceID::MQTT, IP_EVENT, IP_EVENT_STA_GOT_IP);
+        esp_netif_t *sta = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+        esp_netif_ip_info_t ip = {};
+        if (err != ESP_OK ||
+            (sta != nullptr && esp_netif_get_ip_info(sta, &ip) == ESP_OK && ip.ip.addr != 0)) {
+            LazyServices::Touch(SharedBus::ServiceID::MQTT);
+        }
+    }
+#endif
+#ifdef CONFIG_DONE_LIVE_STREAM
+    // Its URI is registered when the API server starts
+    CheckStarted(LiveStream::Start(), "LiveStream::Start");
+#endif
+#ifdef CONFIG_DONE_LOCAL_API
+    // Listens once WiFi has an address, like MQTT
+    CheckStarted(LocalApi::Start(), "LocalApi::Start");
+#endif
+#ifdef CONFIG_DONE_UI_ASSET_PACK
+    CheckStarted(UIAssetPack::RegisterConsoleCommand(), "UIAssetPack console command");
+#endif
+#ifdef CONFIG_DONE_LAZY_SERVICES
+    CheckStarted(LazyServices::RegisterConsoleCommand(), "LazyServices console command");
+#endif
+#ifdef CONFIG_DONE_SYSTEM_MONITOR
+    CheckStarted(SystemMonitor::Start(), "SystemMonitor::Start");
+#endif
+#ifdef CONFIG_DONE_TRACE
+    CheckStarted(TraceRecorder::RegisterConsoleCommand(), "TraceRecorder console command");
+#endif
+#ifdef CONFIG_DONE_LATENCY_MONITOR
+    CheckStarted(LatencyMonitor::Start(), "LatencyMonitor::Start");
+#endif
+#ifdef CONFIG_DONE_COMPRESSED_OTA
+    CheckStarted(CompressedOta::RegisterConsoleCommand(), "CompressedOta console command");
+#endif
+#ifdef CONFIG_DONE_DELTA_OTA
+    CheckStarted(DeltaOta::RegisterConsoleCommand(), "DeltaOta console command");
+#endif
+#ifdef CONFIG_DONE_POWER_MANAGER
+    CheckStarted(PowerManager::RegisterConsoleCommand(), "PowerManager console command");
+#endif
+#ifdef CONFIG_DONE_JOB_EXECUTOR
+    CheckStarted(JobExecutor::RegisterConsoleCommand(), "JobExecutor console command");
+#endif
+#ifdef CONFIG_DONE_FLOWS
+    CheckStarted(FlowScheduler::RegisterConsoleCommand(), "FlowScheduler console command");
+#endif
+#ifdef CONFIG_DONE_HOT_PATHS_BENCH
+    CheckStarted(HotPath::RegisterConsoleCommand(), "HotPath console command");
+#endif
+#ifdef CONFIG_DONE_ICACHE_PROFILER
+    CheckStarted(ICacheProfiler::RegisterConsoleCommand(), "ICacheProfiler console command");
+#endif
+#ifdef CONFIG_DONE_FAST_BOOT
+    CheckStarted(FastBoot::RegisterConsoleCommand(), "FastBoot console command");
+#endif
+#ifdef CONFIG_DONE_COOK_CHECKPOINT
+    CheckStarted(CookCheckpoint::RegisterConsoleCommand(), "CookCheckpoint console command");
+#endif
+#ifdef CONFIG_DONE_LOCAL_API
+    CheckStarted(LocalApi::RegisterConsoleCommand(), "LocalApi console command");
+#endif
+#ifdef CONFIG_DONE_LIVE_STREAM
+    CheckStarted(LiveStream::RegisterConsoleCommand(), "LiveStream console command");
+#endif
+    TaskPlan::Report();
+#ifdef CONFIG_DONE_FAST_BOOT
+    FastBoot::Ready();
+#endif
+    // Services RegisterServices() left out of a warm boot
+    StartDeferredServices();
+
     gpio_config_t heartBeatConf;
     heartBeatConf.intr_type = GPIO_INTR_DISABLE;
     heartBeatConf.mode = GPIO_MODE_OUTPUT;
@@ -48,12 +316,36 @@ extern "C" void app_main()
     heartBeatConf.pull_up_en = GPIO_PULLUP_DISABLE;
     gpio_config(&heartBeatConf);    
 
+#ifdef CONFIG_DONE_NETWORK_THREAD_SED
+    TickType_t lastWake = xTaskGetTickCount();
+    while (true)
+    {
+        gpio_set_level(BSP_HEARTBEAT_GPIO, 1);
+        vTaskDelay(pdMS_TO_TICKS(HeartbeatBlinkMs));
+        gpio_set_level(BSP_HEARTBEAT_GPIO, 0);
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(CONFIG_DONE_THREAD_POLL_PERIOD_MS));
+    }
+#elif defined(CONFIG_DONE_FLOWS)
+    // The heartbeat runs as a flow; returning frees the main task stack
+    CheckStarted(FlowScheduler::Spawn(heartbeatFlow), "heartbeat flow");
+#else
+#ifdef CONFIG_DONE_POWER_MANAGER
+    TickType_t lastBeat = xTaskGetTickCount();
+#endif
     while (true)
     {
         for (int i = 0; i < HeartbeatPatternLength; i++) 
         {            
             gpio_set_level(BSP_HEARTBEAT_GPIO, i % 2);            
+#ifdef CONFIG_DONE_POWER_MANAGER
+            if (i == HeartbeatPatternLength - 1) {
+                // Rest until the next wake window, so every beat shares a wake-up
+                PowerManager::DelayUntilWindow(&lastBeat, HeartbeatPeriodMs);
+                continue;
+            }
+#endif
             vTaskDelay(pdMS_TO_TICKS(HeartbeatPattern[i]));
         }
     }
+#endif
 }
\ No newline at end of file
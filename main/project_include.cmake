@@ -0,0 +1,33 @@
+# Included by ESP-IDF in project scope, so every component can use these helpers.
+
+# done_hot_sources(<ldfragments_var> [IRAM] SOURCES <file>...)
+#
+# Build the listed sources of the calling component at -O2 while the rest of the
+# project stays at -Os. With IRAM (and CONFIG_DONE_HOT_PATHS_IRAM) their code is
+# also placed in IRAM: a linker fragment is generated and appended to
+# <ldfragments_var>, which the caller passes to idf_component_register(LDFRAGMENTS).
+# Call it before idf_component_register(). For single functions use DONE_HOT
+# (main/HotPath.hpp) instead.
+function(done_hot_sources ldfragments_var)
+    cmake_parse_arguments(HOT "IRAM" "" "SOURCES" ${ARGN})
+    if(NOT CONFIG_DONE_HOT_PATHS OR NOT HOT_SOURCES)
+        return()
+    endif()
+
+    if(HOT_IRAM AND CONFIG_DONE_HOT_PATHS_IRAM)
+        # The fragment places them by object file, which LTO (CONFIG_DONE_LTO) would not keep
+        set_source_files_properties(${HOT_SOURCES} PROPERTIES COMPILE_OPTIONS "-O2;-fno-lto")
+        set(fragment "${CMAKE_CURRENT_BINARY_DIR}/${COMPONENT_NAME}_hot_paths.lf")
+        set(content "[mapping:${COMPONENT_NAME}_hot_paths]\narchive: lib${COMPONENT_NAME}.a\nentries:\n")
+        foreach(source ${HOT_SOURCES})
+            get_filename_component(object "${source}" NAME_WE)
+            string(APPEND content "    ${object} (noflash_text)\n")
+        endforeach()
+        # Copied only when changed, so ldgen does not rerun on every configure
+        file(WRITE "${fragment}.in" "${content}")
+        configure_file("${fragment}.in" "${fragment}" COPYONLY)
+        set(${ldfragments_var} ${${ldfragments_var}} "${fragment}" PARENT_SCOPE)
+    else()
+        set_source_files_properties(${HOT_SOURCES} PROPERTIES COMPILE_OPTIONS "-O2")
+    endif()
+endfunction()
@@ -0,0 +1,242 @@
+// Installs images compressed by tools/compress_ota.py with the firmware's CompressedOta
+//
+// CompressedOta::Download() runs its real decode and flash tasks on host
+// threads, reading from the HTTP shim and writing the emulated ota_1 slot
+// through esp_ota_write(). A code-like image and one that does not compress
+// are installed; a download that drops, an image without the app magic byte
+// and a plain http:// URL are refused.
+//
+// The last run gives the link and the flash chip their speed on the device,
+// then prints the end-to-end time, the flash throughput and the peak heap,
+// as measured by CompressedOta and by the heap shim. The flash timings are
+// datasheet figures of a W25Q-class chip, not measured on a board.
+
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "HostSim.hpp"
+#include "CompressedOta.hpp"
+
+static constexpr uint32_t SLOT_SIZE = 1024 * 1024;
+static constexpr uint32_t IMAGE_SIZE = 512 * 1024;
+static constexpr uint32_t CODE_BASE = 0x42000000;
+static constexpr uint8_t IMAGE_MAGIC = 0xE9;
+static constexpr const char *URL = "https://ota/app.dhz";
+
+// Link and flash of the timed run
+static constexpr uint32_t LINK_BYTES_PER_S = 600 * 1024;
+static constexpr uint32_t SECTOR_ERASE_US = 45000;
+static constexpr uint32_t PAGE_PROGRAM_US = 400;
+
+static int sFailures = 0;
+
+static void Fail(const char *what, unsigned a = 0)
+{
+    printf("FAIL: %s (%u)\n", what, a);
+    sFailures++;
+}
+
+/**
+ * @brief Code-like image: instructions from a small vocabulary and absolute addresses into itself
+ */
+static std::vector<uint8_t> MakeImage(std::mt19937 &random)
+{
+    std::vector<uint32_t> vocabulary(512);
+    for (uint32_t &word : vocabulary) {
+        word = random();
+    }
+    std::vector<uint8_t> image(IMAGE_SIZE);
+    for (uint32_t offset = 0; offset < IMAGE_SIZE; offset += 4) {
+        const uint32_t word = (random() % 8 == 0) ? CODE_BASE + (random() % IMAGE_SIZE & ~3u)
+                                                   : vocabulary[random() % vocabulary.size()];
+        memcpy(&image[offset], &word, sizeof(word));
+    }
+    image[0] = IMAGE_MAGIC;
+    return image;
+}
+
+/**
+ * @brief An image that does not compress, as an encrypted one would be
+ */
+static std::vector<uint8_t> MakeRandomImage(std::mt19937 &random)
+{
+    std::vector<uint8_t> image(IMAGE_SIZE / 4);
+    for (uint8_t &byte : image) {
+        byte = static_cast<uint8_t>(random());
+    }
+    image[0] = IMAGE_MAGIC;
+    return image;
+}
+
+/**
+ * @brief Run tools/compress_ota.py on the image
+ */
+static std::vector<uint8_t> Compress(const std::vector<uint8_t> &image)
+{
+    char dir[] = "/tmp/compressed_ota_XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+        return {};
+    }
+    const std::string base(dir);
+    FILE *file = fopen((base + "/app.bin").c_str(), "wb");
+    if (file != nullptr) {
+        fwrite(image.data(), 1, image.size(), file);
+        fclose(file);
+    }
+    const std::string command = std::string(PYTHON_EXECUTABLE) + " " + COMPRESS_OTA + " " + base + "/app.bin " +
+                                base + "/app.dhz > /dev/null";
+    std::vector<uint8_t> compressed;
+    if (system(command.c_str()) == 0 && (file = fopen((base + "/app.dhz").c_str(), "rb")) != nullptr) {
+        uint8_t buffer[4096];
+        size_t got;
+        while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            compressed.insert(compressed.end(), buffer, buffer + got);
+        }
+        fclose(file);
+    }
+    unlink((base + "/app.bin").c_str());
+    unlink((base + "/app.dhz").c_str());
+    rmdir(dir);
+    return compressed;
+}
+
+static bool Installed(const std::vector<uint8_t> &image)
+{
+    return HostFlash::BootSlot() == 1 && memcmp(HostFlash::App(1), image.data(), image.size()) == 0;
+}
+
+/**
+ * @brief Let the tasks of the last update end; they free their stacks after Download() returns
+ */
+static void Settle()
+{
+    vTaskDelay(pdMS_TO_TICKS(50));
+}
+
+static void Prepare(const std::vector<uint8_t> &body)
+{
+    HostFlash::Reset(SLOT_SIZE);
+    HostHttp::Serve(body, true);
+}
+
+static void TestInstall(const char *name, const std::vector<uint8_t> &image, const std::vector<uint8_t> &compressed)
+{
+    Prepare(compressed);
+    const esp_err_t err = CompressedOta::Download(URL);
+    if (err != ESP_OK || !Installed(image)) {
+        Fail(name, err);
+    }
+    printf("%s: %u byte image from %u bytes (%.1f%%), %u sector erases\n", name,
+           static_cast<unsigned>(image.size()), static_cast<unsigned>(compressed.size()),
+           100.0 * compressed.size() / image.size(), static_cast<unsigned>(HostFlash::SectorErases()));
+}
+
+static void TestRefused(const std::vector<uint8_t> &image, const std::vector<uint8_t> &compressed)
+{
+    Settle();
+    const size_t heapBefore = HostHeap::InUse();
+
+    // The connection drops two thirds in
+    Prepare(compressed);
+    HostHttp::DropAfter(compressed.size() * 2 / 3);
+    esp_err_t err = CompressedOta::Download(URL);
+    if (err == ESP_OK || HostFlash::BootSlot() != 0) {
+        Fail("dropped download installed", err);
+    }
+    const esp_err_t dropped = err;
+
+    // Not an app image
+    std::vector<uint8_t> notApp(image);
+    notApp[0] = 0x00;
+    Prepare(Compress(notApp));
+    err = CompressedOta::Download(URL);
+    if (err != ESP_ERR_OTA_VALIDATE_FAILED || HostFlash::BootSlot() != 0) {
+        Fail("image without the app magic installed", err);
+    }
+
+    // Neither signed nor sent over TLS
+    Prepare(compressed);
+    err = CompressedOta::Download("http://ota/app.dhz");
+    if (err != ESP_ERR_NOT_SUPPORTED || HostHttp::Requests() != 0) {
+        Fail("plain http accepted", err);
+    }
+
+    Settle();
+    if (HostHeap::InUse() != heapBefore) {
+        Fail("refused updates leaked heap", static_cast<unsigned>(HostHeap::InUse() - heapBefore));
+    }
+    printf("refused: dropped download (%s), no app magic (%s), plain http (%s)\n", esp_err_to_name(dropped),
+           esp_err_to_name(ESP_ERR_OTA_VALIDATE_FAILED), esp_err_to_name(ESP_ERR_NOT_SUPPORTED));
+}
+
+/**
+ * @brief The link and the flash at device speed: end-to-end time, flash throughput, peak heap
+ */
+static void TestTimed(const std::vector<uint8_t> &image, const std::vector<uint8_t> &compressed)
+{
+    Settle();
+    Prepare(compressed);
+    HostHttp::SetRate(LINK_BYTES_PER_S);
+    HostFlash::SetTiming(SECTOR_ERASE_US, PAGE_PROGRAM_US);
+    const size_t heapBefore = HostHeap::InUse();
+    HostHeap::ResetPeak();
+    CompressedOta::Stats stats = {};
+    const esp_err_t err = CompressedOta::Download(URL, &stats);
+    const size_t peakHeap = HostHeap::Peak() - heapBefore;
+    HostHttp::SetRate(0);
+    HostFlash::SetTiming(0, 0);
+    if (err != ESP_OK || !Installed(image)) {
+        Fail("timed update not installed", err);
+        return;
+    }
+
+    const uint32_t linkMs = static_cast<uint32_t>(compressed.size() * 1000ULL / LINK_BYTES_PER_S);
+    const uint32_t serialMs = linkMs + stats.DecodeBusyMs + stats.FlashBusyMs;
+    printf("timed: %u byte image in %u ms end to end (%u KB/s of image); one stage after the other: %u ms\n",
+           static_cast<unsigned>(stats.ImageBytes), static_cast<unsigned>(stats.TotalMs),
+           static_cast<unsigned>(stats.ImageBytes * 1000ULL / 1024 / stats.TotalMs),
+           static_cast<unsigned>(serialMs));
+    printf("timed: link %u ms at %u KB/s, decode busy %u ms, flash busy %u ms (%u KB/s), receive stalled %u ms\n",
+           static_cast<unsigned>(linkMs), static_cast<unsigned>(LINK_BYTES_PER_S / 1024),
+           static_cast<unsigned>(stats.DecodeBusyMs), static_cast<unsigned>(stats.FlashBusyMs),
+           static_cast<unsigned>(stats.ImageBytes * 1000ULL / 1024 / stats.FlashBusyMs),
+           static_cast<unsigned>(stats.ReceiveStallMs));
+    printf("timed: peak heap %u bytes measured by CompressedOta, %u by the heap shim (with the HTTP buffer), "
+           "%u planned\n", static_cast<unsigned>(stats.PeakHeapBytes), static_cast<unsigned>(peakHeap),
+           static_cast<unsigned>(stats.PipelineBytes));
+
+    // The stages overlap: the download hides behind the flash writes
+    if (stats.TotalMs >= serialMs) {
+        Fail("stages did not overlap", stats.TotalMs);
+    }
+    if (stats.PeakHeapBytes < stats.PipelineBytes || stats.PeakHeapBytes > peakHeap) {
+        Fail("measured peak heap", stats.PeakHeapBytes);
+    }
+}
+
+int main()
+{
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    std::mt19937 random(36);
+    const std::vector<uint8_t> image = MakeImage(random);
+    const std::vector<uint8_t> compressed = Compress(image);
+    const std::vector<uint8_t> noise = MakeRandomImage(random);
+    const std::vector<uint8_t> stored = Compress(noise);
+    if (compressed.empty() || stored.empty()) {
+        printf("FAIL: compress_ota.py\n");
+        return 1;
+    }
+
+    TestInstall("compressed", image, compressed);
+    TestInstall("stored", noise, stored);
+    TestRefused(image, compressed);
+    TestTimed(image, compressed);
+    return (sFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,326 @@
+// Resets the board in the middle of every CookCheckpoint write
+//
+// A cook control loop writes a checkpoint on every tick of a long run of
+// cooks: programs start, stages advance, doors open, cooks end and are
+// cancelled. Every few ticks the write is torn: RTC memory is put back to what
+// it held before the write, with the target slot's CRC cleared and any subset
+// of its words already stored, or with the slot complete but the FastBoot flag
+// not yet updated. The board then boots again after a panic, a watchdog, a
+// software reset, a brownout or a power-on, through FastBoot::Begin() and
+// CookCheckpoint::Restore().
+//
+// After each reset the cook must continue from the new checkpoint or the one
+// before it, never from a mix of the two, and only across a reset that may
+// resume a cook. The sequence starts just below its wrap.
+//
+// Last, a cook runs through OvenState, which writes the checkpoints, and the
+// board resets instead of stopping it: OvenState::ResumeCook() must put the
+// cook back as it was.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "HostSim.hpp"
+#include "FastBoot.hpp"
+#include "CookCheckpoint.hpp"
+#include "OvenState.hpp"
+
+static constexpr uint32_t TICKS = 200000;
+static constexpr uint32_t RESET_EVERY = 7;     ///< A torn write every this many ticks on average
+static constexpr uint32_t TICK_MS = 100;
+
+static int sFailures = 0;
+
+static void Fail(const char *what, unsigned a = 0, unsigned b = 0)
+{
+    printf("FAIL: %s (%u, %u)\n", what, a, b);
+    sFailures++;
+}
+
+static bool Equal(const CookCheckpoint::Session &a, const CookCheckpoint::Session &b)
+{
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+enum class Tear
+{
+    Before,         ///< Reset before the write touched the slot
+    Torn,           ///< CRC cleared, some of the words stored
+    NoFlag,         ///< Slot complete, FastBoot flag not yet updated
+    After,          ///< Write complete
+    Count
+};
+
+static const char *TEAR_NAMES[] = { "before", "torn", "no flag", "after" };
+
+static const esp_reset_reason_t REASONS[] = { ESP_RST_PANIC, ESP_RST_TASK_WDT, ESP_RST_INT_WDT, ESP_RST_SW,
+                                              ESP_RST_BROWNOUT, ESP_RST_POWERON };
+
+static bool MayResume(esp_reset_reason_t reason)
+{
+    return reason != ESP_RST_BROWNOUT && reason != ESP_RST_POWERON;
+}
+
+class CookCheckpointTest
+{
+public:
+    static void Run();
+    static void RunOvenState();
+
+private:
+    static CookCheckpoint::Session NextTick(const CookCheckpoint::Session &session, std::mt19937 &random);
+    static void Reboot(esp_reset_reason_t reason, bool &recovered, CookCheckpoint::Session &session);
+
+    static uint32_t mResets[static_cast<int>(Tear::Count)];
+    static uint32_t mResumed;
+    static uint32_t mClosed;
+};
+
+uint32_t CookCheckpointTest::mResets[static_cast<int>(Tear::Count)] = {};
+uint32_t CookCheckpointTest::mResumed = 0;
+uint32_t CookCheckpointTest::mClosed = 0;
+
+/**
+ * @brief What the cook control would checkpoint on the next tick
+ */
+CookCheckpoint::Session CookCheckpointTest::NextTick(const CookCheckpoint::Session &session, std::mt19937 &random)
+{
+    CookCheckpoint::Session next = session;
+    if (next.ProgramId == 0) {
+        if (random() % 50 == 0) {
+            next.ProgramId = static_cast<uint16_t>(1 + random() % 400);
+            next.Flags = CookCheckpoint::FLAG_PREHEATING;
+            next.Actuators = static_cast<uint16_t>(random());
+            next.TargetDeciC = static_cast<int16_t>(1000 + random() % 1500);
+            next.ProbeTargetDeciC = (random() % 3 == 0) ? static_cast<int16_t>(500 + random() % 300) : 0;
+        }
+        return next;
+    }
+    if (random() % 2000 == 0) {
+        // Done or cancelled
+        return CookCheckpoint::Session{};
+    }
+    if ((next.Flags & CookCheckpoint::FLAG_PAUSED) == 0) {
+        next.StageElapsedMs += TICK_MS;
+        next.TotalElapsedMs += TICK_MS;
+    }
+    if (random() % 300 == 0) {
+        next.Stage++;
+        next.StageElapsedMs = 0;
+        next.Flags &= ~CookCheckpoint::FLAG_PREHEATING;
+        next.TargetDeciC = static_cast<int16_t>(1000 + random() % 1500);
+        next.Actuators = static_cast<uint16_t>(random());
+    }
+    if (random() % 500 == 0) {
+        next.Flags ^= CookCheckpoint::FLAG_DOOR_OPEN | CookCheckpoint::FLAG_PAUSED;
+    }
+    return next;
+}
+
+/**
+ * @brief Boot as app_main does, then take the session the cook control would continue
+ */
+void CookCheckpointTest::Reboot(esp_reset_reason_t reason, bool &recovered, CookCheckpoint::Session &session)
+{
+    HostSystem::SetResetReason(reason);
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    FastBoot::Begin();
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    CookCheckpoint::Restore();
+    recovered = CookCheckpoint::TakeRecovered(session);
+    if (CookCheckpoint::TakeRecovered(session)) {
+        Fail("recovered session handed out twice");
+    }
+}
+
+void CookCheckpointTest::Run()
+{
+    using Slot = CookCheckpoint::Slot;
+    static_assert(sizeof(Slot) % sizeof(uint32_t) == 0, "slots are stored word by word");
+    constexpr size_t SLOT_WORDS = sizeof(Slot) / sizeof(uint32_t);
+
+    std::mt19937 random(48);
+    uint8_t *rtc = HostSystem::RtcBegin();
+    const size_t rtcSize = HostSystem::RtcSize();
+    if (rtc == nullptr || rtcSize < sizeof(CookCheckpoint::mSlots)) {
+        Fail("no RTC memory", static_cast<unsigned>(rtcSize));
+        return;
+    }
+    std::vector<uint8_t> before(rtcSize);
+    std::vector<uint8_t> after(rtcSize);
+
+    // Power-on with garbage in RTC memory, then a sequence about to wrap
+    for (size_t i = 0; i < rtcSize; i++) {
+        rtc[i] = static_cast<uint8_t>(random());
+    }
+    bool recovered;
+    CookCheckpoint::Session session;
+    Reboot(ESP_RST_POWERON, recovered, session);
+    if (recovered) {
+        Fail("resumed a cook from garbage");
+    }
+    CookCheckpoint::mSequence = UINT32_MAX - TICKS / 2;
+    CookCheckpoint::Clear();
+
+    CookCheckpoint::Session committed = {};
+    for (uint32_t tick = 0; tick < TICKS; tick++) {
+        const CookCheckpoint::Session next = NextTick(committed, random);
+        if (random() % RESET_EVERY != 0) {
+            CookCheckpoint::Write(next);
+            committed = next;
+            continue;
+        }
+
+        // The reset lands somewhere in this write
+        const uint8_t target = CookCheckpoint::mNext;
+        memcpy(before.data(), rtc, rtcSize);
+        CookCheckpoint::Write(next);
+        memcpy(after.data(), rtc, rtcSize);
+        const size_t slotOffset = reinterpret_cast<uint8_t *>(&CookCheckpoint::mSlots[target]) - rtc;
+
+        const Tear tear = static_cast<Tear>(random() % static_cast<int>(Tear::Count));
+        switch (tear) {
+        case Tear::Before:
+            memcpy(rtc, before.data(), rtcSize);
+            break;
+        case Tear::Torn: {
+            memcpy(rtc, before.data(), rtcSize);
+            Slot &slot = CookCheckpoint::mSlots[target];
+            slot.Crc = 0;
+            uint32_t words[SLOT_WORDS];
+            memcpy(words, &after[slotOffset], sizeof(words));
+            uint32_t *stored = reinterpret_cast<uint32_t *>(&slot);
+            const uint32_t subset = random();
+            for (size_t word = 0; word < SLOT_WORDS - 1; word++) {
+                if ((subset >> word) & 1) {
+                    stored[word] = words[word];
+                }
+            }
+            break;
+        }
+        case Tear::NoFlag:
+            memcpy(rtc, before.data(), rtcSize);
+            memcpy(&rtc[slotOffset], &after[slotOffset], sizeof(Slot));
+            break;
+        default:
+            break;
+        }
+        mResets[static_cast<int>(tear)]++;
+
+        // Torn and earlier writes leave the previous checkpoint and the flag it set
+        const bool slotWritten = (tear == Tear::NoFlag) || (tear == Tear::After);
+        const bool flagWritten = (tear == Tear::After);
+        const CookCheckpoint::Session &latest = slotWritten ? next : committed;
+        const bool flagActive = (flagWritten ? next : committed).ProgramId != 0;
+        const esp_reset_reason_t reason = REASONS[random() % (sizeof(REASONS) / sizeof(REASONS[0]))];
+        const bool expectResume = MayResume(reason) && flagActive && latest.ProgramId != 0;
+
+        Reboot(reason, recovered, session);
+        if (recovered != expectResume) {
+            Fail(recovered ? "resumed a cook that must not be" : "cook not resumed", tick, static_cast<unsigned>(tear));
+        } else if (recovered && !Equal(session, latest)) {
+            Fail("resumed from the wrong checkpoint", tick, static_cast<unsigned>(tear));
+        }
+        if (recovered) {
+            mResumed++;
+            committed = session;
+        } else {
+            // Not resumed: Restore() closed the session, the control starts idle
+            mClosed += (latest.ProgramId != 0) ? 1 : 0;
+            committed = CookCheckpoint::Session{};
+        }
+        if (CookCheckpoint::mActive != (committed.ProgramId != 0)) {
+            Fail("checkpoint and control disagree after the reset", tick);
+        }
+    }
+
+    const int latest = CookCheckpoint::Latest();
+    if (latest < 0 || !Equal(CookCheckpoint::mSlots[latest].Data, committed)) {
+        Fail("final checkpoint", static_cast<unsigned>(latest));
+    }
+    if (static_cast<int32_t>(CookCheckpoint::mSequence - (UINT32_MAX - TICKS / 2)) <= 0) {
+        Fail("sequence did not wrap", CookCheckpoint::mSequence);
+    }
+
+    printf("%u ticks, %u resets: ", static_cast<unsigned>(TICKS),
+           static_cast<unsigned>(mResets[0] + mResets[1] + mResets[2] + mResets[3]));
+    for (int tear = 0; tear < static_cast<int>(Tear::Count); tear++) {
+        printf("%s%s %u", (tear == 0) ? "" : ", ", TEAR_NAMES[tear], static_cast<unsigned>(mResets[tear]));
+    }
+    printf("\ncooks resumed %u times, closed %u times after a brownout, a power-on or a reset with the flag off\n",
+           static_cast<unsigned>(mResumed), static_cast<unsigned>(mClosed));
+}
+
+/**
+ * @brief A cook the sensors and the control drive through OvenState, then a reset instead of the stop
+ */
+void CookCheckpointTest::RunOvenState()
+{
+    const uint32_t sequenceBefore = CookCheckpoint::mSequence;
+    OvenState::Update([](OvenState::Snapshot &state) {
+        state.State = OvenState::Operational::Running;
+        state.ProgramId = 42;
+        state.Stage = 1;
+        state.Actuators = 0x0005;
+        state.TargetDeciC = 1800;
+        state.ProbeTargetDeciC = 650;
+        state.ElapsedS = 600;
+    });
+    OvenState::Update([](OvenState::Snapshot &state) { state.Stage = 2; });
+    OvenState::Update([](OvenState::Snapshot &state) { state.ElapsedS = 725; });
+    const uint32_t written = CookCheckpoint::mSequence - sequenceBefore;
+    for (int16_t cavity = 200; cavity < 1800; cavity += 10) {
+        OvenState::Update([cavity](OvenState::Snapshot &state) { state.CavityDeciC = cavity; });
+    }
+    if (CookCheckpoint::mSequence - sequenceBefore != written || written != 3) {
+        Fail("checkpoints written for the cook", written, CookCheckpoint::mSequence - sequenceBefore);
+    }
+    const OvenState::Snapshot running = OvenState::Get();
+
+    // The stop is written, then the board resets before it: put RTC memory back
+    uint8_t *rtc = HostSystem::RtcBegin();
+    std::vector<uint8_t> saved(rtc, rtc + HostSystem::RtcSize());
+    OvenState::Update([](OvenState::Snapshot &state) {
+        state.State = OvenState::Operational::Stopped;
+        state.ProgramId = 0;
+        state.Stage = 0;
+        state.Actuators = 0;
+        state.ElapsedS = 0;
+    });
+    memcpy(rtc, saved.data(), saved.size());
+
+    HostSystem::SetResetReason(ESP_RST_TASK_WDT);
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    FastBoot::Begin();
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    if (!CookCheckpoint::Restore() || !OvenState::ResumeCook()) {
+        Fail("cook run through OvenState not resumed");
+        return;
+    }
+    const OvenState::Snapshot resumed = OvenState::Get();
+    if (resumed.State != running.State || resumed.ProgramId != running.ProgramId ||
+        resumed.Stage != running.Stage || resumed.Actuators != running.Actuators ||
+        resumed.TargetDeciC != running.TargetDeciC || resumed.ProbeTargetDeciC != running.ProbeTargetDeciC ||
+        resumed.ElapsedS != running.ElapsedS) {
+        Fail("resumed OvenState", resumed.ProgramId, resumed.ElapsedS);
+    }
+    const int latest = CookCheckpoint::Latest();
+    if (latest < 0 || CookCheckpoint::mSlots[latest].Data.StageElapsedMs != 125000) {
+        Fail("stage elapsed time after the resume", static_cast<unsigned>(latest));
+    }
+    printf("cook through OvenState: %u checkpoints for %u updates, resumed program %u stage %u at %u s\n",
+           static_cast<unsigned>(written), static_cast<unsigned>(resumed.Version),
+           resumed.ProgramId, resumed.Stage, static_cast<unsigned>(resumed.ElapsedS));
+}
+
+int main()
+{
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    CookCheckpointTest::Run();
+    CookCheckpointTest::RunOvenState();
+    return (sFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,290 @@
+// Applies patches made by tools/make_delta.py with the firmware's DeltaOta
+//
+// A synthetic app image and a new build of it are run through the real
+// make_delta.py, and the patch is installed into the emulated ota_1 slot:
+// fed in network-sized pieces, downloaded over a connection that drops part
+// way (resumed with a Range request, and started over when the server ignores
+// Range), against the wrong running image, and corrupted.
+//
+// The patch and the full image are also run through tools/compress_ota.py to
+// show what a heatshrink stage in front of DeltaOta would save over the air,
+// and the chunked install is timed. The images are synthetic, so the sizes
+// are for comparing the options, not a prediction for a real build.
+
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "HostSim.hpp"
+#include "TaskPlan.hpp"
+#include "NvsWriteCache.hpp"
+#include "DeltaOta.hpp"
+
+static constexpr uint32_t SLOT_SIZE = 512 * 1024;
+static constexpr uint32_t IMAGE_SIZE = 256 * 1024;
+static constexpr uint32_t INSERT_AT = 64 * 1024;
+static constexpr uint32_t INSERT_SIZE = 1500;
+static constexpr uint32_t CODE_BASE = 0x42000000;
+
+static int sFailures = 0;
+
+static void Fail(const char *what, unsigned a = 0)
+{
+    printf("FAIL: %s (%u)\n", what, a);
+    sFailures++;
+}
+
+/**
+ * @brief Code-like image: instructions from a small vocabulary and absolute addresses into itself
+ */
+static std::vector<uint8_t> MakeImage(std::mt19937 &random)
+{
+    std::vector<uint32_t> vocabulary(512);
+    for (uint32_t &word : vocabulary) {
+        word = random();
+    }
+    std::vector<uint8_t> image(IMAGE_SIZE);
+    for (uint32_t offset = 0; offset < IMAGE_SIZE; offset += 4) {
+        const uint32_t word = (random() % 8 == 0) ? CODE_BASE + (random() % IMAGE_SIZE & ~3u)
+                                                   : vocabulary[random() % vocabulary.size()];
+        memcpy(&image[offset], &word, sizeof(word));
+    }
+    return image;
+}
+
+/**
+ * @brief The next build: a function inserted, every address behind it moved, a table changed, data appended
+ */
+static std::vector<uint8_t> MakeNewBuild(const std::vector<uint8_t> &old, std::mt19937 &random)
+{
+    std::vector<uint8_t> image(old);
+    for (uint32_t offset = 0; offset < image.size(); offset += 4) {
+        uint32_t word;
+        memcpy(&word, &image[offset], sizeof(word));
+        if (word >= CODE_BASE + INSERT_AT && word < CODE_BASE + IMAGE_SIZE) {
+            word += INSERT_SIZE;
+            memcpy(&image[offset], &word, sizeof(word));
+        }
+    }
+    std::vector<uint8_t> function(INSERT_SIZE);
+    for (uint8_t &byte : function) {
+        byte = static_cast<uint8_t>(random());
+    }
+    image.insert(image.begin() + INSERT_AT, function.begin(), function.end());
+    for (uint32_t offset = 150 * 1024; offset < 150 * 1024 + 300; offset++) {
+        image[offset] = static_cast<uint8_t>(random());
+    }
+    for (uint32_t i = 0; i < 4096; i++) {
+        image.push_back(static_cast<uint8_t>(random()));
+    }
+    return image;
+}
+
+static void WriteFile(const std::string &path, const std::vector<uint8_t> &data)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+}
+
+static std::vector<uint8_t> ReadFile(const std::string &path)
+{
+    std::vector<uint8_t> data;
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return data;
+    }
+    uint8_t buffer[4096];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + got);
+    }
+    fclose(file);
+    return data;
+}
+
+/**
+ * @brief Run a tool from tools/ on one or two input files and read back its output file
+ */
+static std::vector<uint8_t> RunTool(const char *tool, const std::vector<uint8_t> &first,
+                                    const std::vector<uint8_t> *second = nullptr)
+{
+    char dir[] = "/tmp/delta_ota_XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+        return {};
+    }
+    const std::string base(dir);
+    std::string command = std::string(PYTHON_EXECUTABLE) + " " + tool + " " + base + "/first.bin ";
+    WriteFile(base + "/first.bin", first);
+    if (second != nullptr) {
+        WriteFile(base + "/second.bin", *second);
+        command += base + "/second.bin ";
+    }
+    command += base + "/out.bin > /dev/null";
+    std::vector<uint8_t> output;
+    if (system(command.c_str()) == 0) {
+        output = ReadFile(base + "/out.bin");
+    }
+    unlink((base + "/first.bin").c_str());
+    unlink((base + "/second.bin").c_str());
+    unlink((base + "/out.bin").c_str());
+    rmdir(dir);
+    return output;
+}
+
+/**
+ * @brief Run tools/make_delta.py on the two images
+ */
+static std::vector<uint8_t> MakeDelta(const std::vector<uint8_t> &old, const std::vector<uint8_t> &image)
+{
+    return RunTool(MAKE_DELTA, old, &image);
+}
+
+static bool Installed(const std::vector<uint8_t> &image)
+{
+    return HostFlash::BootSlot() == 1 && memcmp(HostFlash::App(1), image.data(), image.size()) == 0;
+}
+
+static void Prepare(const std::vector<uint8_t> &running)
+{
+    HostFlash::Reset(SLOT_SIZE);
+    HostFlash::LoadApp(0, running);
+    DeltaOta().Abort();
+}
+
+/**
+ * @brief Feed the patch in pieces of 1..1460 bytes, as they come off the network
+ */
+static void TestChunked(const std::vector<uint8_t> &old, const std::vector<uint8_t> &image,
+                        const std::vector<uint8_t> &patch)
+{
+    Prepare(old);
+    std::mt19937 random(35);
+    const auto start = std::chrono::steady_clock::now();
+    DeltaOta ota;
+    esp_err_t err = ota.Begin();
+    for (size_t offset = 0; offset < patch.size() && err == ESP_OK;) {
+        const size_t length = std::min<size_t>(1 + random() % 1460, patch.size() - offset);
+        err = ota.Write(patch.data() + offset, length);
+        offset += length;
+    }
+    if (err == ESP_OK) {
+        err = ota.End();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (err != ESP_OK || !Installed(image)) {
+        Fail("chunked patch not installed", err);
+    }
+    printf("chunked: %u byte image from a %u byte patch (%.1f%%), %u sector erases\n",
+           static_cast<unsigned>(image.size()), static_cast<unsigned>(patch.size()),
+           100.0 * patch.size() / image.size(), static_cast<unsigned>(HostFlash::SectorErases()));
+    // Flash erases and writes are free here, so this is the decoder and hashing only
+    printf("chunked: applied %.0f KB/s of patch, %.0f KB/s of image on the host (flash not timed)\n",
+           patch.size() / seconds / 1024, image.size() / seconds / 1024);
+}
+
+/**
+ * @brief Bytes over the air: full image, the image as ota_z sends it, the patch, and the patch compressed
+ */
+static void TestCompressedSizes(const std::vector<uint8_t> &image, const std::vector<uint8_t> &patch)
+{
+    const std::vector<uint8_t> compressedImage = RunTool(COMPRESS_OTA, image);
+    const std::vector<uint8_t> compressedPatch = RunTool(COMPRESS_OTA, patch);
+    if (compressedImage.empty() || compressedPatch.empty()) {
+        Fail("compress_ota.py");
+        return;
+    }
+    if (compressedPatch.size() > patch.size() + 12) {
+        Fail("compressed patch larger than stored", static_cast<unsigned>(compressedPatch.size()));
+    }
+    printf("over the air: image %u, compressed image %u (%.1f%%), patch %u (%.1f%%), "
+           "compressed patch %u (%.1f%%) bytes\n",
+           static_cast<unsigned>(image.size()), static_cast<unsigned>(compressedImage.size()),
+           100.0 * compressedImage.size() / image.size(), static_cast<unsigned>(patch.size()),
+           100.0 * patch.size() / image.size(), static_cast<unsigned>(compressedPatch.size()),
+           100.0 * compressedPatch.size() / image.size());
+}
+
+/**
+ * @brief A download that drops is finished by the next one
+ */
+static void TestResume(const std::vector<uint8_t> &old, const std::vector<uint8_t> &image,
+                       const std::vector<uint8_t> &patch, bool ranges)
+{
+    Prepare(old);
+    HostHttp::Serve(patch, ranges);
+    HostHttp::DropAfter(patch.size() * 2 / 3);
+    if (DeltaOta::Download("http://ota/patch") == ESP_OK) {
+        Fail("dropped download reported success");
+    }
+    DeltaOta probe;
+    probe.Begin();
+    const uint32_t resumeOffset = probe.ResumeOffset();
+    if (resumeOffset == 0) {
+        Fail("no checkpoint saved before the drop");
+    }
+    const uint32_t erasesBefore = HostFlash::SectorErases();
+    const esp_err_t err = DeltaOta::Download("http://ota/patch");
+    if (err != ESP_OK || !Installed(image) || HostHttp::Requests() != 2) {
+        Fail(ranges ? "resumed download not installed" : "restarted download not installed", err);
+    }
+    printf("%s: dropped at %u of %u patch bytes, %s %u, %u sector erases after the drop\n",
+           ranges ? "resume" : "no range", static_cast<unsigned>(patch.size() * 2 / 3),
+           static_cast<unsigned>(patch.size()), ranges ? "resumed at" : "checkpoint at",
+           static_cast<unsigned>(resumeOffset), static_cast<unsigned>(HostFlash::SectorErases() - erasesBefore));
+}
+
+static void TestRejected(const std::vector<uint8_t> &old, const std::vector<uint8_t> &image,
+                         const std::vector<uint8_t> &patch)
+{
+    // Made against a different image than the one running
+    std::vector<uint8_t> other(old);
+    other[1000] ^= 0xFF;
+    Prepare(other);
+    HostHttp::Serve(patch, true);
+    esp_err_t err = DeltaOta::Download("http://ota/patch");
+    if (err != ESP_ERR_INVALID_VERSION || HostFlash::BootSlot() != 0) {
+        Fail("patch for another image accepted", err);
+    }
+
+    // One byte of the new function damaged in transit
+    std::vector<uint8_t> damaged(patch);
+    damaged[damaged.size() / 2] ^= 0x01;
+    Prepare(old);
+    HostHttp::Serve(damaged, true);
+    err = DeltaOta::Download("http://ota/patch");
+    if (err == ESP_OK || HostFlash::BootSlot() != 0 || Installed(image)) {
+        Fail("damaged patch installed", err);
+    }
+    printf("rejected: patch for another image (%s), damaged patch (%s)\n", esp_err_to_name(ESP_ERR_INVALID_VERSION),
+           esp_err_to_name(err));
+}
+
+int main()
+{
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    std::mt19937 random(35);
+    const std::vector<uint8_t> old = MakeImage(random);
+    const std::vector<uint8_t> image = MakeNewBuild(old, random);
+    const std::vector<uint8_t> patch = MakeDelta(old, image);
+    if (patch.empty()) {
+        printf("FAIL: make_delta.py\n");
+        return 1;
+    }
+
+    HostNvs::Erase();
+    TaskPlan::Init();
+    NvsWriteCache::Init();
+    TestChunked(old, image, patch);
+    TestCompressedSizes(image, patch);
+    TestResume(old, image, patch, true);
+    TestResume(old, image, patch, false);
+    TestRejected(old, image, patch);
+    return (sFailures == 0) ? 0 : 1;
+}
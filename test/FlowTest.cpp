@@ -0,0 +1,346 @@
+// Runs flows on the real FlowScheduler, TimerWheel and JobExecutor
+//
+// Checks the protothread state machine: a reconnect flow that times out once
+// and then gets its message, a message of another type that must not wake it,
+// a timeout left armed by a message that must not cut the next timer short,
+// jobs and their results, FLOW_YIELD() ordering and restarting a done flow.
+//
+// Then compares RAM: the size of each flow object against the stack the same
+// reconnect logic uses as a FreeRTOS task, both measured on the host by
+// painting the stacks. Host pointers are 8 bytes, so both sides are larger
+// than on the ESP32-S3.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "HostSim.hpp"
+#include "TaskPlan.hpp"
+#include "Flow.hpp"
+
+static constexpr uint16_t MSG_CONNECTED = 7;
+static constexpr uint16_t MSG_OTHER = 8;
+static constexpr uint32_t TIMEOUT_MS = 50;
+static constexpr uint32_t BACKOFF_MS = 20;
+
+static int sFailures = 0;
+
+static void Fail(const char *what, unsigned a = 0, unsigned b = 0)
+{
+    printf("FAIL: %s (%u, %u)\n", what, a, b);
+    sFailures++;
+}
+
+template <typename Condition>
+static bool WaitFor(Condition condition, uint32_t timeoutMs = 2000)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+class ReconnectFlow : public Flow
+{
+public:
+    ReconnectFlow() : Flow("reconnect") {}
+
+    std::atomic<uint8_t> mWaiting{0};     ///< Attempt + 1 while awaiting the message
+    uint8_t mConnectedAt = 0xFF;
+    uint8_t mTimeouts = 0;
+    uint32_t mValue = 0;
+
+protected:
+    void Run() override
+    {
+        FLOW_BEGIN();
+        mConnectedAt = 0xFF;
+        mTimeouts = 0;
+        for (mAttempt = 0; mAttempt < 5; mAttempt++) {
+            mWaiting = mAttempt + 1;
+            FLOW_AWAIT_MESSAGE(MSG_CONNECTED, TIMEOUT_MS);
+            mWaiting = 0;
+            if (!TimedOut()) {
+                mConnectedAt = mAttempt;
+                mValue = LastMessage().Value;
+                break;
+            }
+            mTimeouts++;
+            FLOW_AWAIT_TIMER(BACKOFF_MS);
+        }
+        FLOW_END();
+    }
+
+private:
+    uint8_t mAttempt = 0;
+};
+
+/**
+ * @brief Gets its message at once, then sleeps; the unused timeout must not wake it
+ */
+class StaleTimeoutFlow : public Flow
+{
+public:
+    StaleTimeoutFlow() : Flow("stale") {}
+
+    std::atomic<bool> mWaiting{false};
+    int64_t mSleptUs = 0;
+
+protected:
+    void Run() override
+    {
+        FLOW_BEGIN();
+        mWaiting = true;
+        FLOW_AWAIT_MESSAGE(MSG_OTHER, 30);
+        mWaiting = false;
+        mStartUs = esp_timer_get_time();
+        FLOW_AWAIT_TIMER(200);
+        mSleptUs = esp_timer_get_time() - mStartUs;
+        FLOW_END();
+    }
+
+private:
+    int64_t mStartUs = 0;
+};
+
+static esp_err_t SumJob(void *arg)
+{
+    uint32_t &value = *static_cast<uint32_t *>(arg);
+    const uint32_t count = value;
+    value = 0;
+    for (uint32_t i = 1; i <= count; i++) {
+        value += i;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t FailingJob(void *arg)
+{
+    (void)arg;
+    return ESP_ERR_INVALID_CRC;
+}
+
+class JobFlow : public Flow
+{
+public:
+    JobFlow() : Flow("job") {}
+
+    uint32_t mSum = 0;
+    esp_err_t mFirst = ESP_FAIL;
+    esp_err_t mSecond = ESP_OK;
+
+protected:
+    void Run() override
+    {
+        FLOW_BEGIN();
+        mSum = 1000;
+        FLOW_AWAIT_JOB(SumJob, &mSum);
+        mFirst = JobResult();
+        FLOW_AWAIT_JOB(FailingJob, nullptr);
+        mSecond = JobResult();
+        FLOW_END();
+    }
+};
+
+static std::string sYieldLog;
+
+class YieldFlow : public Flow
+{
+public:
+    explicit YieldFlow(const char *name) : Flow(name) {}
+
+protected:
+    void Run() override
+    {
+        FLOW_BEGIN();
+        for (mStep = 0; mStep < 3; mStep++) {
+            sYieldLog += Name();
+            FLOW_YIELD();
+        }
+        FLOW_END();
+    }
+
+private:
+    uint8_t mStep = 0;
+};
+
+/**
+ * @brief Records the scheduler task's stack use from inside a flow step
+ */
+class StackProbeFlow : public Flow
+{
+public:
+    StackProbeFlow() : Flow("probe") {}
+
+    std::atomic<uint32_t> mUsed{0};
+
+protected:
+    void Run() override
+    {
+        FLOW_BEGIN();
+        mUsed = TaskPlan::mSpecs[TaskPlan::FLOWS].StackSize - uxTaskGetStackHighWaterMark(nullptr);
+        FLOW_END();
+    }
+};
+
+static ReconnectFlow sReconnect;
+static StaleTimeoutFlow sStale;
+static JobFlow sJob;
+static YieldFlow sYieldA("A");
+static YieldFlow sYieldB("B");
+static StackProbeFlow sProbe;
+
+static void TestReconnect()
+{
+    if (FlowScheduler::Spawn(sReconnect) != ESP_OK) {
+        Fail("spawn reconnect");
+        return;
+    }
+    if (!WaitFor([] { return sReconnect.mWaiting == 1; })) {
+        Fail("reconnect never awaited its message");
+    }
+    // Another type must not wake it, nor a message that nobody awaits
+    FlowScheduler::Deliver({ MSG_OTHER, 1, 0 });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (sReconnect.mWaiting != 1) {
+        Fail("woken by a message of another type");
+    }
+    if (FlowScheduler::Spawn(sReconnect) != ESP_ERR_INVALID_STATE) {
+        Fail("spawned a flow that is still running");
+    }
+    // First attempt times out, the second gets the message
+    if (!WaitFor([] { return sReconnect.mWaiting == 2; })) {
+        Fail("reconnect did not retry after the timeout");
+    }
+    FlowScheduler::Deliver({ MSG_CONNECTED, 3, 42 });
+    if (!WaitFor([] { return sReconnect.IsDone(); })) {
+        Fail("reconnect not done");
+        return;
+    }
+    if (sReconnect.mTimeouts != 1 || sReconnect.mConnectedAt != 1 || sReconnect.mValue != 42) {
+        Fail("reconnect state", sReconnect.mTimeouts, sReconnect.mConnectedAt);
+    }
+
+    // Done flows restart from the top
+    if (FlowScheduler::Spawn(sReconnect) != ESP_OK || !WaitFor([] { return sReconnect.mWaiting == 1; })) {
+        Fail("restart of a done flow");
+    }
+    FlowScheduler::Deliver({ MSG_CONNECTED, 3, 43 });
+    if (!WaitFor([] { return sReconnect.IsDone(); }) || sReconnect.mConnectedAt != 0 || sReconnect.mValue != 43) {
+        Fail("restarted reconnect state", sReconnect.mConnectedAt, sReconnect.mValue);
+    }
+}
+
+static void TestStaleTimeout()
+{
+    FlowScheduler::Spawn(sStale);
+    if (!WaitFor([] { return sStale.mWaiting.load(); })) {
+        Fail("stale flow never awaited its message");
+    }
+    FlowScheduler::Deliver({ MSG_OTHER, 2, 0 });
+    if (!WaitFor([] { return sStale.IsDone(); })) {
+        Fail("stale flow not done");
+        return;
+    }
+    if (sStale.mSleptUs < 200000 - CONFIG_DONE_TIMER_WHEEL_TICK_MS * 1000) {
+        Fail("the old timeout cut the timer short", static_cast<unsigned>(sStale.mSleptUs / 1000));
+    }
+}
+
+static void TestJobs()
+{
+    FlowScheduler::Spawn(sJob);
+    if (!WaitFor([] { return sJob.IsDone(); })) {
+        Fail("job flow not done");
+        return;
+    }
+    if (sJob.mSum != 500500 || sJob.mFirst != ESP_OK || sJob.mSecond != ESP_ERR_INVALID_CRC) {
+        Fail("job results", sJob.mSum, static_cast<unsigned>(sJob.mSecond));
+    }
+}
+
+/**
+ * @brief The reconnect flow as a task, to measure the stack it needs
+ */
+static QueueHandle_t sConnected;
+static std::atomic<bool> sTaskDone(false);
+
+static void ReconnectTask(void *arg)
+{
+    (void)arg;
+    for (uint8_t attempt = 0; attempt < 5; attempt++) {
+        Flow::Message message;
+        if (xQueueReceive(sConnected, &message, pdMS_TO_TICKS(TIMEOUT_MS)) == pdTRUE) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(BACKOFF_MS));
+    }
+    sTaskDone = true;
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
+static void CompareRam()
+{
+    const uint32_t stackSize = TaskPlan::mSpecs[TaskPlan::FLOWS].StackSize;
+    sConnected = xQueueCreate(1, sizeof(Flow::Message));
+    TaskHandle_t task = nullptr;
+    xTaskCreatePinnedToCore(ReconnectTask, "reconnect", stackSize, nullptr, 3, &task, tskNO_AFFINITY);
+    std::this_thread::sleep_for(std::chrono::milliseconds(TIMEOUT_MS + BACKOFF_MS + 10));
+    const Flow::Message message = { MSG_CONNECTED, 3, 42 };
+    xQueueSend(sConnected, &message, 0);
+    if (!WaitFor([] { return sTaskDone.load(); })) {
+        Fail("reconnect task not done");
+    }
+    const uint32_t taskUsed = stackSize - HostSystem::StackUnused(task);
+
+    FlowScheduler::Spawn(sProbe);
+    if (!WaitFor([] { return sProbe.IsDone(); })) {
+        Fail("probe flow not done");
+    }
+    const uint32_t schedulerUsed = sProbe.mUsed;
+
+    printf("%-24s %8s %12s\n", "reconnect logic as", "bytes", "stack used");
+    printf("%-24s %8u %12s\n", "flow (object)", static_cast<unsigned>(sizeof(ReconnectFlow)), "-");
+    printf("%-24s %8u %12u\n", "task (planned stack)", static_cast<unsigned>(stackSize),
+           static_cast<unsigned>(taskUsed));
+    printf("all flows share the scheduler stack: %u bytes, %u used so far\n", static_cast<unsigned>(stackSize),
+           static_cast<unsigned>(schedulerUsed));
+    printf("flow objects: reconnect %u, stale %u, job %u, yield %u bytes\n",
+           static_cast<unsigned>(sizeof(ReconnectFlow)), static_cast<unsigned>(sizeof(StaleTimeoutFlow)),
+           static_cast<unsigned>(sizeof(JobFlow)), static_cast<unsigned>(sizeof(YieldFlow)));
+    if (sizeof(ReconnectFlow) >= taskUsed) {
+        Fail("flow not smaller than the task stack it replaces", sizeof(ReconnectFlow), taskUsed);
+    }
+}
+
+int main()
+{
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    TaskPlan::Init();
+    TimerWheel::Start();
+    JobExecutor::Start();
+
+    // Spawned before the scheduler runs, so the ready list decides the order
+    FlowScheduler::Spawn(sYieldA);
+    FlowScheduler::Spawn(sYieldB);
+    FlowScheduler::Start();
+    if (!WaitFor([] { return sYieldA.IsDone() && sYieldB.IsDone(); }) || sYieldLog != "ABABAB") {
+        Fail("yield order");
+        printf("  yield log: %s\n", sYieldLog.c_str());
+    }
+
+    TestReconnect();
+    TestStaleTimeout();
+    TestJobs();
+    CompareRam();
+    FlowScheduler::Report();
+    return (sFailures == 0) ? 0 : 1;
+}
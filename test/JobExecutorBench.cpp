@@ -0,0 +1,408 @@
+// Job wait times on two cores: work stealing, one shared queue, one task per service
+//
+// Six services post bursts of jobs for a minute: photo decodes for a recipe
+// page, recipe compiles, cloud syncs (long jobs), and JSON encodes, Matter
+// reports and monitor samples (short jobs). The trace is replayed on a
+// simulated dual-core ESP32-S3 in 10 us steps through:
+// - JobExecutor's rules: deque per core, placement on the hinted or less
+//   loaded core, owner takes the oldest job, an idle core steals the newest;
+//   once without hints and once with long jobs hinted at core 1 as
+//   JobExecutor.hpp recommends;
+// - one FIFO queue served by two workers;
+// - one task per service, round-robin time slicing on the 1 ms tick.
+// Wait is from Post() to the job starting. Context switches and cache effects
+// are not modelled.
+//
+// The trace is then run through the real JobExecutor on host threads to check
+// that every job runs once and is counted in its class, and that an idle
+// worker steals a job queued behind pinned ones.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <random>
+#include <thread>
+#include <vector>
+#include "HostSim.hpp"
+#include "TaskPlan.hpp"
+#include "JobExecutor.hpp"
+
+static constexpr uint32_t RUN_US = 60 * 1000 * 1000;
+static constexpr uint32_t STEP_US = 10;
+static constexpr uint32_t TICK_US = 1000;
+static constexpr uint32_t CORES = 2;
+static constexpr uint32_t STACK_SIZE = CONFIG_DONE_JOB_EXECUTOR_STACK_SIZE;
+
+static int sFailures = 0;
+
+static void Fail(const char *what, unsigned a = 0, unsigned b = 0)
+{
+    printf("FAIL: %s (%u, %u)\n", what, a, b);
+    sFailures++;
+}
+
+struct Service
+{
+    const char *Name;
+    uint32_t PeriodUs;
+    uint32_t Burst;
+    uint32_t RunUs;
+    bool Long;
+};
+
+static const Service SERVICES[] = {
+    { "decode", 200000, 6, 8000, true },
+    { "recipe", 250000, 1, 3000, true },
+    { "cloud", 100000, 1, 1500, true },
+    { "json", 20000, 1, 400, false },
+    { "matter", 10000, 1, 150, false },
+    { "monitor", 50000, 1, 100, false },
+};
+static constexpr uint32_t SERVICE_COUNT = sizeof(SERVICES) / sizeof(SERVICES[0]);
+
+struct Job
+{
+    uint32_t PostUs;
+    uint32_t RunUs;
+    uint8_t Service;
+    uint8_t Poster;     ///< Core the posting service runs on
+    uint32_t StartUs;
+    uint32_t LeftUs;
+};
+
+static std::vector<Job> MakeTrace()
+{
+    std::mt19937 random(41);
+    std::vector<Job> trace;
+    for (uint32_t service = 0; service < SERVICE_COUNT; service++) {
+        const Service &spec = SERVICES[service];
+        uint32_t postUs = random() % spec.PeriodUs;
+        while (postUs < RUN_US) {
+            for (uint32_t i = 0; i < spec.Burst; i++) {
+                // Run time varies by +-25%
+                const uint32_t runUs = spec.RunUs * 3 / 4 + random() % (spec.RunUs / 2 + 1);
+                trace.push_back({ postUs, runUs, static_cast<uint8_t>(service),
+                                  static_cast<uint8_t>(service % CORES), UINT32_MAX, 0 });
+            }
+            postUs += spec.PeriodUs / 2 + random() % spec.PeriodUs;
+        }
+    }
+    std::stable_sort(trace.begin(), trace.end(), [](const Job &a, const Job &b) { return a.PostUs < b.PostUs; });
+    return trace;
+}
+
+struct Result
+{
+    uint32_t ShortP50;
+    uint32_t ShortP99;
+    uint32_t ShortMax;
+    uint32_t LongP50;
+    uint32_t LongP99;
+    uint32_t Tasks;
+};
+
+static uint32_t Percentile(std::vector<uint32_t> &values, uint32_t permille)
+{
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min<size_t>(values.size() - 1, values.size() * permille / 1000)];
+}
+
+static Result Summarize(const std::vector<Job> &jobs, uint32_t tasks, const char *model)
+{
+    std::vector<uint32_t> shortWaits;
+    std::vector<uint32_t> longWaits;
+    for (const Job &job : jobs) {
+        if (job.LeftUs != 0) {
+            Fail(model, job.Service, job.PostUs);
+            continue;
+        }
+        (SERVICES[job.Service].Long ? longWaits : shortWaits).push_back(job.StartUs - job.PostUs);
+    }
+    Result result;
+    result.ShortP50 = Percentile(shortWaits, 500);
+    result.ShortP99 = Percentile(shortWaits, 990);
+    result.ShortMax = shortWaits.empty() ? 0 : shortWaits.back();
+    result.LongP50 = Percentile(longWaits, 500);
+    result.LongP99 = Percentile(longWaits, 990);
+    result.Tasks = tasks;
+    return result;
+}
+
+/**
+ * @brief JobExecutor's placement and stealing rules
+ */
+static Result RunStealing(std::vector<Job> jobs, bool hinted)
+{
+    std::deque<Job *> deques[CORES];
+    Job *running[CORES] = {};
+    size_t next = 0;
+    for (uint32_t now = 0; next < jobs.size() || running[0] != nullptr || running[1] != nullptr; now += STEP_US) {
+        for (; next < jobs.size() && jobs[next].PostUs <= now; next++) {
+            Job &job = jobs[next];
+            job.LeftUs = job.RunUs;
+            uint32_t core;
+            if (hinted) {
+                core = SERVICES[job.Service].Long ? 1 : 0;
+            } else {
+                core = job.Poster;
+                for (uint32_t other = 0; other < CORES; other++) {
+                    if (deques[other].size() + (running[other] != nullptr) <
+                        deques[core].size() + (running[core] != nullptr)) {
+                        core = other;
+                    }
+                }
+            }
+            deques[core].push_back(&job);
+        }
+        for (uint32_t core = 0; core < CORES; core++) {
+            if (running[core] == nullptr) {
+                if (!deques[core].empty()) {
+                    running[core] = deques[core].front();
+                    deques[core].pop_front();
+                } else if (!deques[1 - core].empty()) {
+                    running[core] = deques[1 - core].back();
+                    deques[1 - core].pop_back();
+                }
+                if (running[core] != nullptr) {
+                    running[core]->StartUs = now;
+                }
+            }
+        }
+        for (Job *&job : running) {
+            if (job != nullptr) {
+                job->LeftUs -= std::min(job->LeftUs, STEP_US);
+                if (job->LeftUs == 0) {
+                    job = nullptr;
+                }
+            }
+        }
+    }
+    return Summarize(jobs, CORES, "stealing left a job");
+}
+
+static Result RunSharedQueue(std::vector<Job> jobs)
+{
+    std::deque<Job *> queue;
+    Job *running[CORES] = {};
+    size_t next = 0;
+    for (uint32_t now = 0; next < jobs.size() || running[0] != nullptr || running[1] != nullptr; now += STEP_US) {
+        for (; next < jobs.size() && jobs[next].PostUs <= now; next++) {
+            jobs[next].LeftUs = jobs[next].RunUs;
+            queue.push_back(&jobs[next]);
+        }
+        for (Job *&job : running) {
+            if (job == nullptr && !queue.empty()) {
+                job = queue.front();
+                queue.pop_front();
+                job->StartUs = now;
+            }
+            if (job != nullptr) {
+                job->LeftUs -= std::min(job->LeftUs, STEP_US);
+                if (job->LeftUs == 0) {
+                    job = nullptr;
+                }
+            }
+        }
+    }
+    return Summarize(jobs, CORES, "shared queue left a job");
+}
+
+/**
+ * @brief A task per service; equal priorities share the cores in 1 ms slices
+ */
+static Result RunTaskPerService(std::vector<Job> jobs)
+{
+    std::deque<Job *> queues[SERVICE_COUNT];
+    std::deque<uint32_t> ready;     // Services with work that are not running
+    int32_t running[CORES] = { -1, -1 };
+    size_t next = 0;
+    size_t done = 0;
+    for (uint32_t now = 0; done < jobs.size(); now += STEP_US) {
+        for (; next < jobs.size() && jobs[next].PostUs <= now; next++) {
+            Job &job = jobs[next];
+            job.LeftUs = job.RunUs;
+            const uint32_t service = job.Service;
+            const bool idle = queues[service].empty();
+            queues[service].push_back(&job);
+            if (idle && running[0] != static_cast<int32_t>(service) && running[1] != static_cast<int32_t>(service)) {
+                ready.push_back(service);
+            }
+        }
+        if (now % TICK_US == 0 && !ready.empty()) {
+            // Tick: running tasks go to the back of the ready list
+            for (int32_t &service : running) {
+                if (service >= 0) {
+                    ready.push_back(service);
+                    service = -1;
+                }
+            }
+        }
+        for (int32_t &service : running) {
+            if (service < 0 && !ready.empty()) {
+                service = ready.front();
+                ready.pop_front();
+            }
+            if (service < 0) {
+                continue;
+            }
+            Job *job = queues[service].front();
+            if (job->StartUs == UINT32_MAX) {
+                job->StartUs = now;
+            }
+            job->LeftUs -= std::min(job->LeftUs, STEP_US);
+            if (job->LeftUs == 0) {
+                queues[service].pop_front();
+                done++;
+                if (queues[service].empty()) {
+                    service = -1;
+                }
+            }
+        }
+    }
+    return Summarize(jobs, SERVICE_COUNT, "task per service left a job");
+}
+
+static std::atomic<uint32_t> sRan[SERVICE_COUNT];
+
+static void CountJob(void *arg)
+{
+    sRan[reinterpret_cast<uintptr_t>(arg)]++;
+}
+
+/**
+ * @brief The first ten seconds of the trace through the real JobExecutor
+ */
+static void RunFirmware(const std::vector<Job> &trace)
+{
+    TaskPlan::Init();
+    if (JobExecutor::Start() != ESP_OK) {
+        Fail("JobExecutor::Start");
+        return;
+    }
+    JobExecutor::JobClass classes[SERVICE_COUNT];
+    for (uint32_t service = 0; service < SERVICE_COUNT; service++) {
+        classes[service] = JobExecutor::RegisterClass(SERVICES[service].Name);
+    }
+    uint32_t posted[SERVICE_COUNT] = {};
+    for (const Job &job : trace) {
+        if (job.PostUs > 10 * 1000 * 1000) {
+            break;
+        }
+        const BaseType_t core = SERVICES[job.Service].Long ? 1 : 0;
+        while (JobExecutor::Post(classes[job.Service], CountJob, reinterpret_cast<void *>(job.Service), core) !=
+               ESP_OK) {
+            std::this_thread::yield();
+        }
+        posted[job.Service]++;
+    }
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    for (uint32_t service = 0; service < SERVICE_COUNT; service++) {
+        while (sRan[service] < posted[service] && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (sRan[service] != posted[service]) {
+            Fail("jobs lost or run twice", sRan[service], posted[service]);
+        }
+    }
+    JobExecutor::Report();
+}
+
+static std::atomic<uint32_t> sBlocked;
+static std::atomic<bool> sRelease[CORES];
+static std::atomic<uint32_t> sPinnedRan;
+static std::atomic<bool> sLooseRan;
+
+static void BlockWorker(void *arg)
+{
+    sBlocked++;
+    while (!sRelease[reinterpret_cast<uintptr_t>(arg)]) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static void RunPinned(void *)
+{
+    sPinnedRan++;
+}
+
+static void RunLoose(void *)
+{
+    sLooseRan = true;
+}
+
+/**
+ * @brief A job that may move, queued on core 0 before pinned ones, is stolen by core 1 once it is idle
+ */
+static void TestStealPastPinned()
+{
+    static constexpr uint32_t PINNED = 3;
+    const JobExecutor::JobClass jobClass = JobExecutor::RegisterClass("pinned");
+
+    // Both workers busy, so the jobs below queue up on core 0 in order
+    for (uintptr_t core = 0; core < CORES; core++) {
+        JobExecutor::Post(jobClass, BlockWorker, reinterpret_cast<void *>(core), core, true);
+    }
+    while (sBlocked < CORES) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    JobExecutor::Post(jobClass, RunLoose, nullptr, 0);
+    for (uint32_t i = 0; i < PINNED; i++) {
+        JobExecutor::Post(jobClass, RunPinned, nullptr, 0, true);
+    }
+
+    // Core 0 stays blocked: only core 1 can run the loose job, and only by stealing it
+    sRelease[1] = true;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (!sLooseRan && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!sLooseRan || sPinnedRan != 0) {
+        Fail("job behind pinned ones not stolen", sLooseRan, sPinnedRan);
+    }
+
+    sRelease[0] = true;
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (sPinnedRan < PINNED && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (sPinnedRan != PINNED) {
+        Fail("pinned jobs lost", sPinnedRan, PINNED);
+        return;
+    }
+    printf("a job queued before %u pinned ones on a busy core was stolen by the idle core\n",
+           static_cast<unsigned>(PINNED));
+}
+
+static void Print(const char *model, const Result &result)
+{
+    printf("%-30s %7u %7u %7u %9u %9u %6u %7u\n", model, result.ShortP50, result.ShortP99, result.ShortMax,
+           result.LongP50, result.LongP99, result.Tasks, result.Tasks * STACK_SIZE);
+}
+
+int main()
+{
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    const std::vector<Job> trace = MakeTrace();
+    printf("%u jobs from %u services in %u s, 2 cores, wait in us\n", static_cast<unsigned>(trace.size()),
+           static_cast<unsigned>(SERVICE_COUNT), static_cast<unsigned>(RUN_US / 1000000));
+    printf("%-30s %7s %7s %7s %9s %9s %6s %7s\n", "model", "short", "p99", "max", "long p50", "long p99",
+           "tasks", "stacks");
+    const Result stealing = RunStealing(trace, false);
+    const Result hinted = RunStealing(trace, true);
+    const Result shared = RunSharedQueue(trace);
+    const Result perService = RunTaskPerService(trace);
+    Print("work stealing", stealing);
+    Print("work stealing, long on core 1", hinted);
+    Print("one shared queue", shared);
+    Print("one task per service", perService);
+
+    RunFirmware(trace);
+    TestStealPastPinned();
+    return (sFailures == 0) ? 0 : 1;
+}
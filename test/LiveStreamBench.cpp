@@ -0,0 +1,545 @@
+// Streams OvenState updates through the firmware's LiveStream and LocalApi to WebSocket clients on loopback
+//
+// The server is the esp_http_server shim: one httpd task on POSIX sockets,
+// with lwIP's send buffer and the firmware's real limits, 2 API connections
+// of which CONFIG_DONE_LIVE_STREAM_CLIENTS may stream. The test is built
+// twice: with the Kconfig defaults (1 stream client, updates at least 100 ms
+// apart) and with both connections streaming and no pacing, the most the
+// Kconfig ranges allow.
+//
+// All stream slots are taken, then updates are made at 1000, 5000 and 20000
+// per second. Reported per rate: the share of updates each client got as a
+// frame, the latency from OvenState::Update() to the frame arriving (paced,
+// up to one interval of it is the pacing), and the CPU time of the httpd
+// task. Then one client reads 512 bytes every 50 ms while the updates go on.
+// Unpaced it falls behind and must skip to the full state; either way it
+// ends on the final version without holding back a fast one. Every delta
+// must apply to the version the client has. Streams from a foreign Origin, and beyond
+// the client limit, are refused; a REST request still gets a connection.
+// httpd's send warnings are quiet only while clients are connected.
+//
+// Loopback on a host is not WiFi on an ESP32-S3: the latencies and the CPU
+// time rank load levels against each other, they are not device figures.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "HostSim.hpp"
+#include "LiveStream.hpp"
+#include "LocalApi.hpp"
+#include "OvenState.hpp"
+#include "TaskPlan.hpp"
+#include "TimerWheel.hpp"
+
+static constexpr int PORT = CONFIG_DONE_LOCAL_API_PORT;
+static constexpr uint32_t STREAM_CLIENTS = CONFIG_DONE_LIVE_STREAM_CLIENTS;
+static constexpr uint32_t INTERVAL_MS = CONFIG_DONE_LIVE_STREAM_INTERVAL_MS;
+static constexpr uint32_t RUN_MS = 1000;
+static constexpr uint32_t DRAIN_MS = 5000;
+static constexpr size_t SLOW_READ_BYTES = 512;
+static constexpr uint32_t SLOW_READ_EVERY_MS = 50;
+static constexpr int SLOW_RECEIVE_BUFFER = 2048;
+static constexpr size_t VERSIONS = 1 << 17;
+static constexpr const char *TXRX_TAG = "httpd_txrx";
+
+static int sFailures = 0;
+
+// When each version was made, by version modulo VERSIONS
+static std::atomic<int64_t> sUpdateUs[VERSIONS];
+static std::atomic<uint32_t> sFinalVersion{UINT32_MAX};
+static uint32_t sSequence = 0;
+
+static void Fail(const char *what, unsigned a = 0, unsigned b = 0)
+{
+    printf("FAIL: %s (%u, %u)\n", what, a, b);
+    sFailures++;
+}
+
+struct Client
+{
+    int Fd;
+    bool Slow;
+    std::string In;                 ///< Received and not parsed yet
+    uint32_t Version;               ///< Latest version it has
+    uint32_t Frames;
+    uint32_t Resyncs;               ///< Full states after the first one
+    uint32_t Gaps;                  ///< Deltas that did not apply to Version
+    std::vector<uint32_t> LatencyUs;
+};
+
+static uint32_t Percentile(std::vector<uint32_t> &values, uint32_t permille)
+{
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min<size_t>(values.size() - 1, values.size() * permille / 1000)];
+}
+
+static int Dial(int receiveBuffer)
+{
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (receiveBuffer != 0) {
+        // Before connecting, so the window is small from the start
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    }
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(PORT);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Read the response head; what came after it is left in rest
+ */
+static std::string ReadHead(int fd, std::string &rest)
+{
+    std::string in;
+    char buffer[1024];
+    while (in.find("\r\n\r\n") == std::string::npos) {
+        pollfd waiting = { fd, POLLIN, 0 };
+        if (poll(&waiting, 1, 1000) <= 0) {
+            return std::string();
+        }
+        const ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if (got <= 0) {
+            return std::string();
+        }
+        in.append(buffer, static_cast<size_t>(got));
+    }
+    const size_t end = in.find("\r\n\r\n") + 4;
+    rest = in.substr(end);
+    return in.substr(0, end);
+}
+
+/**
+ * @brief WebSocket upgrade of /api/v1/stream, Host naming the device
+ * @return the socket once the upgrade was answered, -1 otherwise
+ */
+static int OpenStream(Client &client, const char *origin, bool slow)
+{
+    client = Client();
+    client.Fd = -1;
+    client.Slow = slow;
+    const int fd = Dial(slow ? SLOW_RECEIVE_BUFFER : 0);
+    if (fd < 0) {
+        return -1;
+    }
+    char request[320];
+    const int length = snprintf(request, sizeof(request),
+                                "GET /api/v1/stream HTTP/1.1\r\nHost: 127.0.0.1:%d\r\nUpgrade: websocket\r\n"
+                                "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                                "Sec-WebSocket-Version: 13\r\n%s%s%s\r\n", PORT,
+                                (origin != nullptr) ? "Origin: " : "", (origin != nullptr) ? origin : "",
+                                (origin != nullptr) ? "\r\n" : "");
+    if (send(fd, request, static_cast<size_t>(length), MSG_NOSIGNAL) != length ||
+        ReadHead(fd, client.In).compare(0, 12, "HTTP/1.1 101") != 0) {
+        close(fd);
+        return -1;
+    }
+    client.Fd = fd;
+    return fd;
+}
+
+static void OnFrame(Client &client, const char *json, int64_t nowUs)
+{
+    const char *version = strstr(json, "\"version\":");
+    const char *base = strstr(json, "\"base\":");
+    if (version == nullptr) {
+        client.Gaps++;
+        return;
+    }
+    const uint32_t next = static_cast<uint32_t>(strtoul(version + 10, nullptr, 10));
+    if (base != nullptr) {
+        if (client.Frames == 0 || static_cast<uint32_t>(strtoul(base + 7, nullptr, 10)) != client.Version) {
+            client.Gaps++;
+        }
+    } else if (client.Frames != 0) {
+        client.Resyncs++;
+    }
+    const int64_t madeUs = sUpdateUs[next % VERSIONS].load();
+    if (client.Frames != 0 && madeUs != 0) {
+        client.LatencyUs.push_back(static_cast<uint32_t>(nowUs - madeUs));
+    }
+    client.Version = next;
+    client.Frames++;
+}
+
+/**
+ * @brief Parse the server frames in client.In: unmasked, one text frame per update
+ */
+static void ParseFrames(Client &client)
+{
+    const int64_t nowUs = esp_timer_get_time();
+    while (client.In.size() >= 2) {
+        size_t length = static_cast<uint8_t>(client.In[1]) & 0x7F;
+        size_t offset = 2;
+        if (length == 126) {
+            if (client.In.size() < 4) {
+                return;
+            }
+            length = (static_cast<size_t>(static_cast<uint8_t>(client.In[2])) << 8) |
+                     static_cast<uint8_t>(client.In[3]);
+            offset = 4;
+        }
+        if (client.In.size() < offset + length) {
+            return;
+        }
+        if ((static_cast<uint8_t>(client.In[0]) & 0x0F) == 0x1) {
+            OnFrame(client, client.In.substr(offset, length).c_str(), nowUs);
+        }
+        client.In.erase(0, offset + length);
+    }
+}
+
+/**
+ * @brief Read at most limit bytes, waiting up to timeoutMs
+ * @return false once the server closed the connection
+ */
+static bool Read(Client &client, size_t limit, int timeoutMs)
+{
+    pollfd waiting = { client.Fd, POLLIN, 0 };
+    if (poll(&waiting, 1, timeoutMs) <= 0) {
+        return true;
+    }
+    char buffer[8192];
+    const ssize_t got = recv(client.Fd, buffer, std::min(limit, sizeof(buffer)), 0);
+    if (got <= 0) {
+        return false;
+    }
+    client.In.append(buffer, static_cast<size_t>(got));
+    ParseFrames(client);
+    return true;
+}
+
+/**
+ * @brief Wait for the first frame, the full state
+ */
+static bool ReadFirst(Client &client)
+{
+    ParseFrames(client);
+    for (int i = 0; i < 100 && client.Frames == 0; i++) {
+        if (!Read(client, SIZE_MAX, 10)) {
+            return false;
+        }
+    }
+    return client.Frames != 0;
+}
+
+/**
+ * @brief Reader thread: a slow client reads little and seldom while updates are made, then all of it
+ */
+static void Receive(Client &client)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(RUN_MS + DRAIN_MS);
+    while (client.Version != sFinalVersion.load() && std::chrono::steady_clock::now() < deadline) {
+        const bool draining = sFinalVersion.load() != UINT32_MAX;
+        if (client.Slow && !draining) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(SLOW_READ_EVERY_MS));
+            if (!Read(client, SLOW_READ_BYTES, 0)) {
+                return;
+            }
+        } else if (!Read(client, SIZE_MAX, 10)) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Read whatever arrives within timeoutMs
+ * @return true when the server closed the connection
+ */
+static bool Closed(Client &client, int timeoutMs)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (!Read(client, SIZE_MAX, 10)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Refused after the upgrade: closed without a frame
+ */
+static bool Refused(Client &client)
+{
+    return client.Fd < 0 || (Closed(client, 1000) && client.Frames == 0);
+}
+
+static void CloseAll(std::vector<Client> &clients)
+{
+    for (Client &client : clients) {
+        if (client.Fd >= 0) {
+            close(client.Fd);
+            client.Fd = -1;
+        }
+    }
+}
+
+/**
+ * @brief Wait for httpd to close the sessions; the send warnings come back with the last one
+ */
+static bool WaitLogLevel(esp_log_level_t level)
+{
+    for (int i = 0; i < 200; i++) {
+        if (esp_log_level_get(TXRX_TAG) == level) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return false;
+}
+
+static void Update()
+{
+    sSequence++;
+    // Stamped before the change can reach the stream; only this thread updates
+    sUpdateUs[(OvenState::Version() + 1) % VERSIONS].store(esp_timer_get_time());
+    OvenState::Update([](OvenState::Snapshot &state) {
+        state.State = OvenState::Operational::Running;
+        state.ElapsedS = sSequence;
+        state.CavityDeciC = static_cast<int16_t>(1800 + sSequence % 64);
+    });
+}
+
+struct Run
+{
+    uint32_t Updates;
+    uint32_t WallUs;
+    uint32_t CpuUs;
+};
+
+/**
+ * @brief Updates at this rate for RUN_MS, then wait until every client has the final version
+ */
+static Run MakeUpdates(uint32_t perSecond, std::vector<Client> &clients)
+{
+    sFinalVersion.store(UINT32_MAX);
+    std::vector<std::thread> readers;
+    for (Client &client : clients) {
+        readers.emplace_back(&Receive, std::ref(client));
+    }
+
+    Run run = {};
+    const int64_t cpuBefore = HostHttpd::CpuUs();
+    const int64_t start = esp_timer_get_time();
+    int64_t elapsed = 0;
+    while ((elapsed = esp_timer_get_time() - start) < RUN_MS * 1000) {
+        const uint32_t due = static_cast<uint32_t>(elapsed * perSecond / 1000000);
+        while (run.Updates < due) {
+            Update();
+            run.Updates++;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    sFinalVersion.store(OvenState::Version());
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+    run.WallUs = static_cast<uint32_t>(esp_timer_get_time() - start);
+    run.CpuUs = static_cast<uint32_t>(HostHttpd::CpuUs() - cpuBefore);
+
+    for (const Client &client : clients) {
+        if (client.Version != sFinalVersion.load()) {
+            Fail("client did not get the final version", client.Version, sFinalVersion.load());
+        }
+        if (client.Gaps != 0) {
+            Fail("delta did not apply to the client's version", client.Gaps);
+        }
+        // Paced: one frame per interval, plus the first one and a late timer
+        if (INTERVAL_MS != 0 && client.Frames > 2 + (RUN_MS + INTERVAL_MS - 1) / INTERVAL_MS) {
+            Fail("updates closer than the interval", client.Frames);
+        }
+    }
+    return run;
+}
+
+static bool OpenClients(std::vector<Client> &clients, uint32_t slow)
+{
+    clients.assign(STREAM_CLIENTS, Client());
+    for (uint32_t i = 0; i < STREAM_CLIENTS; i++) {
+        if (OpenStream(clients[i], nullptr, i >= STREAM_CLIENTS - slow) < 0 || !ReadFirst(clients[i])) {
+            Fail("stream not opened", i);
+            CloseAll(clients);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void TestRates()
+{
+    static const uint32_t RATES[] = { 1000, 5000, 20000 };
+    for (const uint32_t rate : RATES) {
+        std::vector<Client> clients;
+        if (!OpenClients(clients, 0)) {
+            return;
+        }
+        const Run run = MakeUpdates(rate, clients);
+        std::vector<uint32_t> latency;
+        uint32_t frames = 0;
+        for (Client &client : clients) {
+            latency.insert(latency.end(), client.LatencyUs.begin(), client.LatencyUs.end());
+            frames += client.Frames - 1;
+        }
+        CloseAll(clients);
+        WaitLogLevel(ESP_LOG_WARN);
+
+        printf("%5u updates/s: %u client%s got %.1f%% of %u updates as frames, latency p50 %u us p99 %u us, "
+               "httpd CPU %.1f%%\n", static_cast<unsigned>(rate), static_cast<unsigned>(clients.size()),
+               (clients.size() == 1) ? "" : "s",
+               100.0 * frames / clients.size() / run.Updates, static_cast<unsigned>(run.Updates),
+               static_cast<unsigned>(Percentile(latency, 500)), static_cast<unsigned>(Percentile(latency, 990)),
+               100.0 * run.CpuUs / run.WallUs);
+    }
+}
+
+static void TestSlowClient()
+{
+    std::vector<Client> clients;
+    if (!OpenClients(clients, 1)) {
+        return;
+    }
+    const Run run = MakeUpdates(2000, clients);
+    CloseAll(clients);
+    WaitLogLevel(ESP_LOG_WARN);
+
+    const Client &slow = clients.back();
+    // Unpaced, the slow reader falls behind and has to skip; paced, the updates are few enough to keep up
+    if (INTERVAL_MS == 0 && slow.Resyncs == 0) {
+        Fail("slow client never skipped to the full state", slow.Frames);
+    }
+    printf("slow client (%u bytes per %u ms): %u frames, %u resyncs, ended on version %u of %u\n",
+           static_cast<unsigned>(SLOW_READ_BYTES), static_cast<unsigned>(SLOW_READ_EVERY_MS),
+           static_cast<unsigned>(slow.Frames), static_cast<unsigned>(slow.Resyncs),
+           static_cast<unsigned>(slow.Version), static_cast<unsigned>(sFinalVersion.load()));
+    if (clients.size() > 1) {
+        std::vector<uint32_t> latency(clients[0].LatencyUs);
+        printf("fast client next to it: %u of %u updates, latency p50 %u us p99 %u us\n",
+               static_cast<unsigned>(clients[0].Frames - 1), static_cast<unsigned>(run.Updates),
+               static_cast<unsigned>(Percentile(latency, 500)), static_cast<unsigned>(Percentile(latency, 990)));
+    }
+}
+
+/**
+ * @brief GET /api/v1/state on a connection of its own
+ * @return the status line
+ */
+static std::string GetState(int &fd)
+{
+    fd = Dial(0);
+    char request[96];
+    const int length = snprintf(request, sizeof(request), "GET /api/v1/state HTTP/1.1\r\nHost: 127.0.0.1:%d\r\n\r\n",
+                                PORT);
+    std::string rest;
+    if (fd < 0 || send(fd, request, static_cast<size_t>(length), MSG_NOSIGNAL) != length) {
+        return std::string();
+    }
+    const std::string head = ReadHead(fd, rest);
+    return head.substr(0, head.find("\r\n"));
+}
+
+static void TestRefused()
+{
+    std::vector<Client> clients(1);
+    OpenStream(clients[0], "http://evil.example", false);
+    if (!Refused(clients[0])) {
+        Fail("stream from a foreign origin");
+    }
+    CloseAll(clients);
+
+    if (!OpenClients(clients, 0)) {
+        return;
+    }
+    const bool spare = STREAM_CLIENTS < CONFIG_DONE_LOCAL_API_CLIENTS;
+    if (spare) {
+        Client extra;
+        OpenStream(extra, nullptr, false);
+        if (!Refused(extra)) {
+            Fail("stream beyond the client limit");
+        }
+        if (extra.Fd >= 0) {
+            close(extra.Fd);
+        }
+    }
+
+    // On the spare connection, or in place of the oldest stream when all of them stream
+    int fd = -1;
+    const std::string status = GetState(fd);
+    if (status.compare(0, 12, "HTTP/1.1 200") != 0) {
+        Fail("state request while streaming");
+    }
+    const bool purged = Closed(clients[0], 200);
+    if (purged == spare) {
+        Fail(spare ? "a stream was closed for a REST request" : "no stream was closed for a REST request");
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    CloseAll(clients);
+    WaitLogLevel(ESP_LOG_WARN);
+    printf("refused: foreign origin, %s; GET /api/v1/state while streaming: %s%s\n",
+           spare ? "a stream beyond the limit" : "no spare connection to stream on", status.c_str(),
+           purged ? ", the oldest stream was closed for it" : "");
+}
+
+static void TestLogLevel()
+{
+    std::vector<Client> clients;
+    if (!OpenClients(clients, 0)) {
+        return;
+    }
+    const esp_log_level_t streaming = esp_log_level_get(TXRX_TAG);
+    if (streaming != ESP_LOG_ERROR) {
+        Fail("send warnings while streaming", streaming);
+    }
+    if (esp_log_level_get("LocalApi") != CONFIG_LOG_DEFAULT_LEVEL) {
+        Fail("LocalApi log level changed", esp_log_level_get("LocalApi"));
+    }
+    CloseAll(clients);
+    if (!WaitLogLevel(ESP_LOG_WARN)) {
+        Fail("send warnings not restored", esp_log_level_get(TXRX_TAG));
+    }
+}
+
+int main()
+{
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    TaskPlan::Init();
+    TimerWheel::Start();
+    // The level the stream must leave in place once its clients are gone
+    esp_log_level_set(TXRX_TAG, ESP_LOG_WARN);
+    if (LiveStream::Start() != ESP_OK || LocalApi::Start() != ESP_OK) {
+        printf("FAIL: start\n");
+        return 1;
+    }
+    printf("%u of %u API connections stream, updates at least %u ms apart\n",
+           static_cast<unsigned>(STREAM_CLIENTS), static_cast<unsigned>(CONFIG_DONE_LOCAL_API_CLIENTS),
+           static_cast<unsigned>(INTERVAL_MS));
+
+    TestLogLevel();
+    TestRates();
+    TestSlowClient();
+    TestRefused();
+    return (sFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,410 @@
+// Crash consistency, flush scheduling and flash write counts of NvsWriteCache
+//
+// Crash consistency: a child process runs a cook workload against an NVS
+// partition emulated on a log file and loses power half way through flash
+// write K, for every K until the workload completes. The parent replays the
+// log the way NVS mounts after a reset and checks that no value is torn, that
+// nothing acknowledged by a Flush::Now write is lost, and that no key went
+// back to an older value.
+//
+// Write counts: a 20 minute bake is replayed on simulated time once through
+// the cache and once written through, as the services did before the cache.
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "HostSim.hpp"
+#include "TaskPlan.hpp"
+#include "NvsWriteCache.hpp"
+
+static const char *NAMESPACE = "cook";
+static constexpr uint32_t STEPS = 300;
+static constexpr uint32_t PROGRAM_BYTES = 40;
+static constexpr uint32_t DURABLE_EVERY = 25;
+
+static int sFailures = 0;
+
+static void Fail(const char *what, unsigned a = 0, unsigned b = 0)
+{
+    printf("FAIL: %s (%u, %u)\n", what, a, b);
+    sFailures++;
+}
+
+static bool ReadU32(const char *key, uint32_t &value)
+{
+    nvs_handle_t handle;
+    if (nvs_open(NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    const bool found = nvs_get_u32(handle, key, &value) == ESP_OK;
+    nvs_close(handle);
+    return found;
+}
+
+/**
+ * @brief The program blob of step n: the step followed by its low byte repeated
+ */
+static void MakeProgram(uint32_t step, uint8_t (&program)[PROGRAM_BYTES])
+{
+    memcpy(program, &step, sizeof(step));
+    memset(program + sizeof(step), static_cast<int>(step & 0xFF), PROGRAM_BYTES - sizeof(step));
+}
+
+/**
+ * @brief Step at which each key was last set, as seen by the workload
+ */
+struct Snapshot
+{
+    uint32_t Elapsed;
+    uint32_t Temperature;
+    uint32_t Program;
+    uint32_t Stage;
+};
+
+static Snapshot AfterStep(uint32_t step)
+{
+    return Snapshot{ step, step - step % 2, step - step % 3, step - step % DURABLE_EVERY };
+}
+
+/**
+ * @brief Cook workload; every Flush::Now write that returns is acknowledged on ackFd
+ */
+static void CookWorkload(int ackFd)
+{
+    for (uint32_t step = 0; step < STEPS; step++) {
+        NvsWriteCache::SetU32(NAMESPACE, "elapsed", step);
+        if (step % 2 == 0) {
+            NvsWriteCache::SetU32(NAMESPACE, "temp", step);
+        }
+        if (step % 3 == 0) {
+            uint8_t program[PROGRAM_BYTES];
+            MakeProgram(step, program);
+            NvsWriteCache::SetBlob(NAMESPACE, "program", program, sizeof(program));
+        }
+        if (step % DURABLE_EVERY == 0) {
+            if (NvsWriteCache::SetU32(NAMESPACE, "stage", step, NvsWriteCache::Flush::Now) == ESP_OK) {
+                ssize_t written = write(ackFd, &step, sizeof(step));
+                (void)written;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Check what a reset left in the partition against the last acknowledged step
+ */
+static void CheckRecovered(uint32_t cut, bool acked, uint32_t ackedStep)
+{
+    uint32_t elapsed = 0;
+    uint32_t temperature = 0;
+    uint32_t stage = 0;
+    const bool hasElapsed = ReadU32("elapsed", elapsed);
+    const bool hasTemperature = ReadU32("temp", temperature);
+    const bool hasStage = ReadU32("stage", stage);
+
+    uint8_t program[PROGRAM_BYTES];
+    size_t length = sizeof(program);
+    nvs_handle_t handle;
+    bool hasProgram = false;
+    if (nvs_open(NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        hasProgram = nvs_get_blob(handle, "program", program, &length) == ESP_OK;
+        nvs_close(handle);
+    }
+    if (hasProgram) {
+        uint32_t step = 0;
+        memcpy(&step, program, sizeof(step));
+        uint8_t expected[PROGRAM_BYTES];
+        MakeProgram(step, expected);
+        if (length != PROGRAM_BYTES || memcmp(program, expected, PROGRAM_BYTES) != 0 || step % 3 != 0) {
+            Fail("torn program blob", cut, step);
+        }
+    }
+    if ((hasElapsed && elapsed >= STEPS) || (hasTemperature && temperature % 2 != 0) ||
+        (hasStage && stage % DURABLE_EVERY != 0)) {
+        Fail("value never written", cut);
+    }
+    if (!acked) {
+        return;
+    }
+    // Flush::Now wrote everything set before it, so nothing can be older than at that step
+    const Snapshot durable = AfterStep(ackedStep);
+    uint32_t programStep = 0;
+    memcpy(&programStep, program, sizeof(programStep));
+    if (!hasStage || stage < durable.Stage) {
+        Fail("acknowledged stage lost", cut, ackedStep);
+    }
+    if (!hasElapsed || elapsed < durable.Elapsed || !hasTemperature || temperature < durable.Temperature ||
+        !hasProgram || programStep < durable.Program) {
+        Fail("key older than its acknowledged flush", cut, ackedStep);
+    }
+}
+
+/**
+ * @brief Cut the power at every flash write of the workload in turn
+ * @note Runs before anything starts a thread in this process, so fork() is safe
+ */
+static void TestCrashConsistency()
+{
+    char path[] = "/tmp/nvs_write_cache_XXXXXX";
+    const int fd = mkstemp(path);
+    close(fd);
+
+    uint32_t cut = 1;
+    uint32_t completedWrites = 0;
+    for (; completedWrites == 0; cut++) {
+        unlink(path);
+        int acks[2];
+        if (pipe(acks) != 0) {
+            Fail("pipe");
+            return;
+        }
+        const pid_t child = fork();
+        if (child == 0) {
+            close(acks[0]);
+            HostNvs::Mount(path);
+            HostNvs::CutPowerAt(cut);
+            TaskPlan::Init();
+            NvsWriteCache::Init();
+            CookWorkload(acks[1]);
+            NvsWriteCache::FlushAll();
+            // The whole workload took fewer writes than the cut
+            _exit(3);
+        }
+        close(acks[1]);
+        bool acked = false;
+        uint32_t ackedStep = 0;
+        uint32_t step;
+        while (read(acks[0], &step, sizeof(step)) == sizeof(step)) {
+            acked = true;
+            ackedStep = step;
+        }
+        close(acks[0]);
+        int status = 0;
+        waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0 && WEXITSTATUS(status) != 3)) {
+            Fail("workload crashed", cut, static_cast<unsigned>(status));
+            break;
+        }
+        if (WEXITSTATUS(status) == 3) {
+            completedWrites = cut - 1;
+        }
+        HostNvs::Mount(path);
+        CheckRecovered(cut, acked, ackedStep);
+    }
+    HostNvs::Erase();
+    unlink(path);
+    printf("crash consistency: power cut at each of %u flash writes, every reset recovered\n",
+           static_cast<unsigned>(completedWrites));
+}
+
+/**
+ * @brief A Set() racing a flush must still be written within the flush delay
+ */
+static void TestSetDuringFlush()
+{
+    static constexpr uint32_t WRITERS = 4;
+    static constexpr uint32_t SETS = 3000;
+    std::atomic<bool> done(false);
+    std::thread flusher([&done]() {
+        while (!done) {
+            NvsWriteCache::FlushAll();
+        }
+    });
+    std::vector<std::thread> writers;
+    for (uint32_t writer = 0; writer < WRITERS; writer++) {
+        writers.emplace_back([writer]() {
+            char key[8];
+            snprintf(key, sizeof(key), "w%u", static_cast<unsigned>(writer));
+            for (uint32_t value = 1; value <= SETS; value++) {
+                NvsWriteCache::SetU32(NAMESPACE, key, value);
+            }
+        });
+    }
+    for (std::thread &writer : writers) {
+        writer.join();
+    }
+    done = true;
+    flusher.join();
+
+    // Nobody flushes from here on; only the timer armed by the last writes can
+    vTaskDelay(pdMS_TO_TICKS(3 * CONFIG_DONE_NVS_FLUSH_DELAY_MS));
+    for (uint32_t writer = 0; writer < WRITERS; writer++) {
+        char key[8];
+        snprintf(key, sizeof(key), "w%u", static_cast<unsigned>(writer));
+        uint32_t value = 0;
+        if (!ReadU32(key, value) || value != SETS) {
+            Fail("write racing a flush left pending", writer, value);
+        }
+    }
+    printf("set during flush: last of %u racing writes flushed by the timer\n",
+           static_cast<unsigned>(WRITERS * SETS));
+}
+
+/**
+ * @brief A key that failed to write is retried without another Set(), unless it never can be
+ */
+static void TestRetryFailedKeys()
+{
+    const NvsWriteCache::Stats before = NvsWriteCache::GetStats();
+    HostNvs::FailSets(1);
+    NvsWriteCache::SetU32(NAMESPACE, "retry", 7);
+    vTaskDelay(pdMS_TO_TICKS(3 * CONFIG_DONE_NVS_FLUSH_DELAY_MS));
+    uint32_t value = 0;
+    if (!ReadU32("retry", value) || value != 7) {
+        Fail("failed key not retried", value);
+    }
+    if (NvsWriteCache::GetStats().Errors - before.Errors != 1) {
+        Fail("failed set counted wrong", NvsWriteCache::GetStats().Errors - before.Errors);
+    }
+
+    // A namespace that cannot be opened counts each of its keys once
+    const NvsWriteCache::Stats opened = NvsWriteCache::GetStats();
+    HostNvs::FailOpens(1);
+    NvsWriteCache::SetU32("settings", "a", 1);
+    NvsWriteCache::SetU32("settings", "b", 2);
+    NvsWriteCache::SetU32("settings", "c", 3);
+    const esp_err_t err = NvsWriteCache::FlushAll();
+    if (err == ESP_OK || NvsWriteCache::GetStats().Errors - opened.Errors != 3) {
+        Fail("failed open counted wrong", NvsWriteCache::GetStats().Errors - opened.Errors);
+    }
+    if (NvsWriteCache::FlushAll() != ESP_OK) {
+        Fail("keys of a failed open not retried");
+    }
+
+    // A full partition or a bad length does not go away by writing again
+    for (esp_err_t permanent : { ESP_ERR_NVS_NOT_ENOUGH_SPACE, ESP_ERR_NVS_INVALID_LENGTH }) {
+        const NvsWriteCache::Stats full = NvsWriteCache::GetStats();
+        HostNvs::FailSets(1, permanent);
+        NvsWriteCache::SetU32(NAMESPACE, "full", 9);
+        if (NvsWriteCache::FlushAll() == ESP_OK) {
+            Fail("permanent failure not reported", static_cast<unsigned>(permanent));
+        }
+        const NvsWriteCache::Stats after = NvsWriteCache::GetStats();
+        if (after.Dropped - full.Dropped != 1 || after.Errors - full.Errors != 1) {
+            Fail("permanent failure counted wrong", after.Dropped - full.Dropped, after.Errors - full.Errors);
+        }
+        const uint32_t sets = HostNvs::GetCounters().Sets;
+        if (NvsWriteCache::FlushAll() != ESP_OK || HostNvs::GetCounters().Sets != sets) {
+            Fail("permanent failure retried", static_cast<unsigned>(permanent));
+        }
+    }
+    printf("retry: failed keys rewritten by the re-armed timer, one error per key, "
+           "no space and bad length dropped\n");
+}
+
+/**
+ * @brief Writes of a bake as the services make them, on simulated time
+ */
+struct BakeEvent
+{
+    uint32_t TimeMs;
+    const char *Key;
+    uint32_t Value;
+};
+
+static std::vector<BakeEvent> MakeBake()
+{
+    std::vector<BakeEvent> events;
+    for (uint32_t ms = 0; ms < 20 * 60 * 1000; ms += 250) {
+        // Cavity temperature in 0.1 °C at 4 Hz, settling at 180 °C after 8 minutes
+        const uint32_t temperature = (ms < 480000) ? 200 + ms / 300 : 1800 + (ms / 250) % 3;
+        events.push_back({ ms, "temp", temperature });
+        if (ms % 1000 == 0) {
+            events.push_back({ ms, "elapsed", ms / 1000 });
+            events.push_back({ ms, "remaining", 1200 - ms / 1000 });
+        }
+        // The user turns the target knob twice, 6 detents 30 ms apart
+        if (ms == 60000 || ms == 600000) {
+            for (uint32_t detent = 1; detent <= 6; detent++) {
+                events.push_back({ ms + detent * 30, "target", 1700 + detent * 50 });
+            }
+        }
+    }
+    return events;
+}
+
+static void PrintCounters(const char *name, const HostNvs::Counters &counters)
+{
+    printf("%-30s %10u  %7u  %11u  %7u\n", name, static_cast<unsigned>(counters.Writes),
+           static_cast<unsigned>(counters.Entries), static_cast<unsigned>(counters.Entries / HostNvs::mEntriesPerPage),
+           static_cast<unsigned>(counters.Commits));
+}
+
+/**
+ * @brief Replay the bake through the cache, flushing when the delay after the first pending write passes
+ *
+ * Flushes are driven from the simulated time stamps, so delays other than the
+ * configured one can be compared in the same run.
+ */
+static HostNvs::Counters BakeThroughCache(const std::vector<BakeEvent> &bake, uint32_t delayMs)
+{
+    HostNvs::Erase();
+    bool pending = false;
+    uint32_t deadlineMs = 0;
+    for (const BakeEvent &event : bake) {
+        if (pending && event.TimeMs >= deadlineMs) {
+            NvsWriteCache::FlushAll();
+            pending = false;
+        }
+        NvsWriteCache::SetU32(NAMESPACE, event.Key, event.Value);
+        if (!pending) {
+            pending = true;
+            deadlineMs = event.TimeMs + delayMs;
+        }
+    }
+    NvsWriteCache::FlushAll();
+    return HostNvs::GetCounters();
+}
+
+static void TestWriteCounts()
+{
+    const std::vector<BakeEvent> bake = MakeBake();
+
+    // Written through: every update opens, sets and commits
+    HostNvs::Erase();
+    for (const BakeEvent &event : bake) {
+        nvs_handle_t handle;
+        nvs_open(NAMESPACE, NVS_READWRITE, &handle);
+        nvs_set_u32(handle, event.Key, event.Value);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+    const HostNvs::Counters direct = HostNvs::GetCounters();
+
+    printf("20 min bake, %u updates       nvs writes  entries  page erases  commits\n",
+           static_cast<unsigned>(bake.size()));
+    PrintCounters("written through", direct);
+    for (uint32_t delayMs : { CONFIG_DONE_NVS_FLUSH_DELAY_MS, 1000, 5000 }) {
+        const HostNvs::Counters cached = BakeThroughCache(bake, delayMs);
+        char name[40];
+        snprintf(name, sizeof(name), "cache, %u ms delay%s", static_cast<unsigned>(delayMs),
+                 (delayMs == CONFIG_DONE_NVS_FLUSH_DELAY_MS) ? " (host)" :
+                 (delayMs == 5000) ? " (default)" : "");
+        PrintCounters(name, cached);
+        if (cached.Writes > direct.Writes || cached.Commits >= direct.Commits) {
+            Fail("cache writes more than writing through", cached.Writes, direct.Writes);
+        }
+    }
+}
+
+int main()
+{
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    TestCrashConsistency();
+
+    HostNvs::Erase();
+    TaskPlan::Init();
+    if (NvsWriteCache::Init() != ESP_OK) {
+        printf("FAIL: init\n");
+        return 1;
+    }
+    TestSetDuringFlush();
+    TestRetryFailedKeys();
+    TestWriteCounts();
+    return (sFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,179 @@
+// Radio scheduler model of the Thread sleepy end device profile
+//
+// Runs one simulated hour of a cook twice: with the services behaving as on
+// always-on WiFi (reports sent when they happen, 1.5 s heartbeat pattern) and
+// as a SED that batches reports into the parent poll windows (one blink per
+// window). Prints radio-on duty cycle and CPU wake-ups of both.
+// The poll period and blink length come from sdkconfig.defaults.thread and
+// app_main.cpp (see CMakeLists.txt).
+//
+// This is a model, not a measurement. The firmware does not batch Matter
+// reports yet, so the SED line is what batching would reach, an upper bound.
+// On target, the radio time comes from the OpenThread counters (`ot counters
+// mac` before and after an hour of cooking) and the wake-ups from
+// `pm` (CONFIG_DONE_POWER_MANAGER).
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+
+// 802.15.4 at 250 kbit/s
+static constexpr int64_t POLL_US = 6000;        ///< Data request, ack and receive window
+static constexpr int64_t FRAME_US = 3000;       ///< CSMA, report frame and ack
+static constexpr int64_t RAMP_US = 1000;        ///< Radio start-up before a transmission of its own
+static constexpr int64_t CPU_WAKE_US = 1000;    ///< Wake-up, run the task, go back to light sleep
+
+static constexpr int64_t SIM_US = 3600LL * 1000 * 1000;
+static constexpr int64_t TEMPERATURE_REPORT_US = 1000 * 1000;
+static constexpr int64_t STATE_EVENT_MEAN_US = 60LL * 1000 * 1000;
+
+/**
+ * @brief Merges overlapping on-intervals, counting how often a resource is switched on
+ */
+class Activity
+{
+public:
+    void On(int64_t startUs, int64_t durationUs)
+    {
+        mIntervals.emplace(startUs, startUs + durationUs);
+    }
+
+    void Finish()
+    {
+        int64_t end = -1;
+        for (const auto &interval : mIntervals) {
+            if (interval.first > end) {
+                mWakeups++;
+                mOnUs += interval.second - interval.first;
+                end = interval.second;
+            } else if (interval.second > end) {
+                mOnUs += interval.second - end;
+                end = interval.second;
+            }
+        }
+    }
+
+    uint64_t Wakeups() const { return mWakeups; }
+    double Duty() const { return 100.0 * mOnUs / SIM_US; }
+
+private:
+    std::multimap<int64_t, int64_t> mIntervals;
+    uint64_t mWakeups = 0;
+    int64_t mOnUs = 0;
+};
+
+struct Result
+{
+    double RadioDuty;
+    double CpuDuty;
+    uint64_t RadioWakeups;
+    uint64_t CpuWakeups;
+    uint64_t Frames;
+};
+
+static std::vector<int64_t> StateEvents()
+{
+    std::mt19937_64 random(26);
+    std::exponential_distribution<double> gap(1.0 / STATE_EVENT_MEAN_US);
+    std::vector<int64_t> events;
+    for (int64_t at = static_cast<int64_t>(gap(random)); at < SIM_US; at += static_cast<int64_t>(gap(random))) {
+        events.push_back(at);
+    }
+    return events;
+}
+
+static Result Simulate(bool sleepyProfile)
+{
+    Activity radio;
+    Activity cpu;
+    uint64_t frames = 0;
+    const int64_t pollUs = THREAD_POLL_PERIOD_MS * 1000LL;
+
+    // The parent is polled in both cases, SED children must poll to receive anything
+    for (int64_t at = 0; at < SIM_US; at += pollUs) {
+        radio.On(at, POLL_US);
+        cpu.On(at, POLL_US + CPU_WAKE_US);
+    }
+
+    std::vector<int64_t> reports;
+    for (int64_t at = 0; at < SIM_US; at += TEMPERATURE_REPORT_US) {
+        reports.push_back(at + 137 * 1000);     // not in phase with the polls
+    }
+    for (int64_t at : StateEvents()) {
+        reports.push_back(at);
+    }
+
+    if (sleepyProfile) {
+        // Changes wait for the next poll window; all of a window's changes go in one report
+        std::map<int64_t, int> windows;
+        for (int64_t at : reports) {
+            const int64_t window = (at / pollUs + 1) * pollUs;
+            if (window < SIM_US) {
+                windows[window]++;
+            }
+        }
+        for (const auto &window : windows) {
+            radio.On(window.first + POLL_US, FRAME_US);
+            cpu.On(window.first + POLL_US, FRAME_US + CPU_WAKE_US);
+            frames++;
+        }
+        // One blink per window, switched on by the poll wake-up
+        for (int64_t at = 0; at < SIM_US; at += pollUs) {
+            cpu.On(at, CPU_WAKE_US);
+            cpu.On(at + HEARTBEAT_BLINK_MS * 1000LL, CPU_WAKE_US);
+        }
+    } else {
+        for (int64_t at : reports) {
+            radio.On(at, RAMP_US + FRAME_US);
+            cpu.On(at, RAMP_US + FRAME_US + CPU_WAKE_US);
+            frames++;
+        }
+        // lub 200 ms, pause 100 ms, dub 200 ms, rest 1000 ms: four edges per beat
+        static const int64_t pattern[] = { 200, 100, 200, 1000 };
+        int64_t at = 0;
+        for (int phase = 0; at < SIM_US; phase = (phase + 1) % 4) {
+            cpu.On(at, CPU_WAKE_US);
+            at += pattern[phase] * 1000;
+        }
+    }
+
+    radio.Finish();
+    cpu.Finish();
+    return Result{ radio.Duty(), cpu.Duty(), radio.Wakeups(), cpu.Wakeups(), frames };
+}
+
+static void Print(const char *name, const Result &result)
+{
+    printf("%-22s radio on %6.3f %%  radio wake-ups %6llu  frames %6llu  CPU awake %6.3f %%  CPU wake-ups/min %6.1f\n",
+           name, result.RadioDuty, static_cast<unsigned long long>(result.RadioWakeups),
+           static_cast<unsigned long long>(result.Frames), result.CpuDuty, result.CpuWakeups / 60.0);
+}
+
+int main()
+{
+    printf("model, not a measurement: poll period %d ms, heartbeat blink %d ms, one simulated hour of cooking\n",
+           THREAD_POLL_PERIOD_MS, HEARTBEAT_BLINK_MS);
+    const Result alwaysOn = Simulate(false);
+    const Result sleepy = Simulate(true);
+    Print("WiFi-style services", alwaysOn);
+    Print("SED, batched reports", sleepy);
+
+    const uint64_t polls = (SIM_US + THREAD_POLL_PERIOD_MS * 1000LL - 1) / (THREAD_POLL_PERIOD_MS * 1000LL);
+    int failures = 0;
+    if (sleepy.RadioWakeups != polls) {
+        printf("FAIL: the radio woke up %llu times for %llu polls\n",
+               static_cast<unsigned long long>(sleepy.RadioWakeups), static_cast<unsigned long long>(polls));
+        failures++;
+    }
+    if (sleepy.CpuWakeups > 2 * polls) {
+        printf("FAIL: more than two CPU wake-ups per poll window\n");
+        failures++;
+    }
+    if (sleepy.RadioDuty >= alwaysOn.RadioDuty || sleepy.CpuWakeups >= alwaysOn.CpuWakeups) {
+        printf("FAIL: the SED profile does not save radio time or wake-ups\n");
+        failures++;
+    }
+    return (failures == 0) ? 0 : 1;
+}
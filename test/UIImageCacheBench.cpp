@@ -0,0 +1,170 @@
+// Replays a UI navigation trace through UIImageCache and reports hit rate and decode time saved
+//
+// The trace is generated from a fixed seed: home screen with featured recipes,
+// a paged recipe list, recipe details and the cooking screen, with popular
+// recipes opened more often and now and then a photo replaced by the cloud.
+// Decode times are the ESP32-S3 model of the esp_jpeg stand-in, on a frozen
+// clock, so the numbers are the same on every run.
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "HostSim.hpp"
+#include "jpeg_decoder.h"
+#include "UIImageCache.hpp"
+
+static constexpr uint32_t RECIPES = 30;
+static constexpr uint32_t FEATURED = 4;
+static constexpr uint32_t PAGE_SIZE = 6;
+static constexpr uint32_t STEPS = 5000;
+static constexpr uint16_t PHOTO_WIDTH = 320;
+static constexpr uint16_t PHOTO_HEIGHT = 240;
+
+enum class Screen { Home, List, Detail, Cooking };
+
+struct Lookup
+{
+    uint32_t AssetId;
+    uint8_t Scale;
+    bool Invalidate;    ///< The cloud replaced the photo before this lookup
+};
+
+static std::vector<Lookup> MakeTrace()
+{
+    std::mt19937 random(29);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    // A few recipes are opened far more often than the rest
+    std::vector<double> weights;
+    for (uint32_t recipe = 1; recipe <= RECIPES; recipe++) {
+        weights.push_back(1.0 / recipe);
+    }
+    std::discrete_distribution<uint32_t> popular(weights.begin(), weights.end());
+
+    std::vector<Lookup> trace;
+    Screen screen = Screen::Home;
+    uint32_t page = 0;
+    uint32_t recipe = 1;
+    for (uint32_t step = 0; step < STEPS; step++) {
+        const bool invalidate = chance(random) < 0.005;
+        switch (screen) {
+        case Screen::Home:
+            for (uint32_t id = 1; id <= FEATURED; id++) {
+                trace.push_back({ id, JPEG_IMAGE_SCALE_1_4, false });
+            }
+            if (chance(random) < 0.6) {
+                screen = Screen::List;
+                page = 0;
+            } else {
+                recipe = 1 + random() % FEATURED;
+                screen = Screen::Detail;
+            }
+            break;
+        case Screen::List: {
+            for (uint32_t id = 1 + page * PAGE_SIZE; id <= (page + 1) * PAGE_SIZE; id++) {
+                trace.push_back({ id, JPEG_IMAGE_SCALE_1_4, false });
+            }
+            const double next = chance(random);
+            if (next < 0.3 && (page + 1) * PAGE_SIZE < RECIPES) {
+                page++;
+            } else if (next < 0.5 && page > 0) {
+                page--;
+            } else if (next < 0.9) {
+                recipe = 1 + popular(random);
+                screen = Screen::Detail;
+            } else {
+                screen = Screen::Home;
+            }
+            break;
+        }
+        case Screen::Detail:
+            trace.push_back({ recipe, JPEG_IMAGE_SCALE_0, invalidate });
+            screen = (chance(random) < 0.3) ? Screen::Cooking : ((chance(random) < 0.7) ? Screen::List : Screen::Home);
+            break;
+        case Screen::Cooking:
+            trace.push_back({ recipe, JPEG_IMAGE_SCALE_1_2, false });
+            screen = Screen::Home;
+            break;
+        }
+    }
+    return trace;
+}
+
+struct Result
+{
+    UIImageCache::Stats Stats;
+    int64_t UncachedUs;     ///< Decode time of every lookup without a cache
+};
+
+static void Published(const UIImageCache::Stats &stats, void *arg)
+{
+    *static_cast<UIImageCache::Stats *>(arg) = stats;
+}
+
+static Result Replay(const std::vector<Lookup> &trace, size_t budgetBytes)
+{
+    UIImageCache cache(budgetBytes);
+    UIImageCache::Stats published = {};
+    cache.SetPublisher(&Published, &published);
+    std::vector<uint8_t> version(RECIPES + 1, 0);
+    int64_t uncachedUs = 0;
+    for (const Lookup &lookup : trace) {
+        if (lookup.Invalidate) {
+            version[lookup.AssetId]++;
+            cache.Invalidate(lookup.AssetId);
+        }
+        uint8_t jpeg[12];
+        const size_t size = HostJpeg::Make(PHOTO_WIDTH, PHOTO_HEIGHT,
+                                           static_cast<uint8_t>(lookup.AssetId * 8 + version[lookup.AssetId]), jpeg);
+        UIImageCache::ImagePtr image = cache.Get(lookup.AssetId, lookup.Scale, jpeg, size);
+        if (image == nullptr || image->Pixels[0] != jpeg[8]) {
+            printf("FAIL: asset %lu scale %u decoded wrong\n", static_cast<unsigned long>(lookup.AssetId), lookup.Scale);
+            return Result{ cache.GetStats(), -1 };
+        }
+        uncachedUs += HostJpeg::DecodeUs(PHOTO_WIDTH, PHOTO_HEIGHT, lookup.Scale);
+    }
+    // What the UI service's report timer sends on the bus
+    cache.Publish();
+    const UIImageCache::Stats stats = cache.GetStats();
+    if (published.Hits != stats.Hits || published.Misses != stats.Misses || published.Evictions != stats.Evictions) {
+        printf("FAIL: published counters differ from the cache's\n");
+        return Result{ stats, -1 };
+    }
+    return Result{ stats, uncachedUs };
+}
+
+int main()
+{
+    HostClock::Freeze();
+    const std::vector<Lookup> trace = MakeTrace();
+    printf("%u navigation steps, %u image lookups, %lux%lu photos\n", static_cast<unsigned>(STEPS),
+           static_cast<unsigned>(trace.size()), static_cast<unsigned long>(PHOTO_WIDTH),
+           static_cast<unsigned long>(PHOTO_HEIGHT));
+    printf("budget KB  hit rate  evictions  decode ms  saved ms  saved\n");
+
+    int failures = 0;
+    for (size_t budgetKb : { 128, 256, 512, CONFIG_DONE_UI_IMAGE_CACHE_BUDGET_KB, 2048 }) {
+        const Result result = Replay(trace, budgetKb * 1024);
+        if (result.UncachedUs < 0) {
+            return 1;
+        }
+        const UIImageCache::Stats &stats = result.Stats;
+        const uint32_t lookups = stats.Hits + stats.Misses;
+        printf("%9u  %7.1f%%  %9lu  %9.0f  %8.0f  %4.1f%%%s\n", static_cast<unsigned>(budgetKb),
+               100.0 * stats.Hits / lookups, static_cast<unsigned long>(stats.Evictions),
+               stats.DecodeTimeUs / 1000.0, stats.DecodeTimeSavedUs / 1000.0,
+               100.0 * stats.DecodeTimeSavedUs / result.UncachedUs,
+               (budgetKb == CONFIG_DONE_UI_IMAGE_CACHE_BUDGET_KB) ? "  (default)" : "");
+        // Every lookup is either decoded or saved a decode
+        if (lookups != trace.size() || stats.DecodeErrors != 0 ||
+            static_cast<int64_t>(stats.DecodeTimeUs + stats.DecodeTimeSavedUs) != result.UncachedUs) {
+            printf("FAIL: decode time does not add up\n");
+            failures++;
+        }
+        if (stats.BytesUsed > stats.BudgetBytes) {
+            printf("FAIL: %u bytes cached over the budget\n", static_cast<unsigned>(stats.BytesUsed));
+            failures++;
+        }
+    }
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+/**
+ * @file HostSim.hpp
+ * @brief Controls of the host simulation behind the ESP-IDF and FreeRTOS shims
+ *
+ * Lets a test freeze the clock, pick the reset reason of the next boot, tear
+ * RTC memory, decode test images with a modelled decode time, emulate the NVS
+ * partition on a log file and inject faults into it, emulate the two app
+ * slots and serve HTTP downloads that drop part way, account the heap the
+ * firmware takes, and measure the CPU time of the HTTP server task.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "esp_system.h"
+
+class HostClock
+{
+public:
+    /**
+     * @brief Stop esp_timer_get_time() at its current value; only for single-task tests
+     */
+    static void Freeze();
+
+    /**
+     * @brief Move a frozen clock forward
+     */
+    static void Advance(int64_t us);
+};
+
+class HostSystem
+{
+public:
+    /**
+     * @brief Reason esp_reset_reason() returns from now on
+     */
+    static void SetResetReason(esp_reset_reason_t reason);
+
+    /**
+     * @brief RTC_NOINIT_ATTR / RTC_DATA_ATTR variables, which survive a simulated reset
+     */
+    static uint8_t *RtcBegin();
+    static size_t RtcSize();
+
+    /**
+     * @brief Unused bytes of a task stack, measured by painting it at creation
+     */
+    static size_t StackUnused(void *task);
+};
+
+/**
+ * @brief Heap the firmware would take on target: heap_caps_* blocks, task stacks and queue storage
+ *
+ * heap_caps_get_free_size() of internal RAM reports the fixed total minus what is in use.
+ */
+class HostHeap
+{
+public:
+    static size_t InUse();
+
+    /**
+     * @brief Most in use since the last ResetPeak()
+     */
+    static size_t Peak();
+    static void ResetPeak();
+
+    /**
+     * @brief For the shims: account memory FreeRTOS takes from the heap on target
+     */
+    static void Add(int64_t bytes);
+};
+
+/**
+ * @brief Test images for the esp_jpeg stand-in
+ */
+class HostJpeg
+{
+public:
+    /**
+     * @brief Encode an image of the given size; seed is the value of every pixel byte
+     */
+    static size_t Make(uint16_t width, uint16_t height, uint8_t seed, uint8_t (&out)[12]);
+
+    /**
+     * @brief Time the ESP32-S3 needs to decode it; a frozen clock advances by this much
+     */
+    static int64_t DecodeUs(uint16_t width, uint16_t height, uint8_t scale);
+};
+
+/**
+ * @brief NVS partition emulated as an append-only log of 32-byte entries
+ *
+ * Like NVS, a set writes its entries immediately and is skipped when the key
+ * already holds the same value; a record whose CRC does not match (a write
+ * torn by a reset) is ignored when the log is read back.
+ */
+class HostNvs
+{
+public:
+    static constexpr uint32_t mEntrySize = 32;
+    static constexpr uint32_t mEntriesPerPage = 126;
+
+    struct Counters
+    {
+        uint32_t Sets;          ///< nvs_set_* calls
+        uint32_t Skipped;       ///< Sets that found the same value in flash
+        uint32_t Writes;        ///< Sets that wrote flash
+        uint32_t Entries;       ///< 32-byte entries written
+        uint32_t Commits;
+        uint32_t Opens;
+    };
+
+    /**
+     * @brief Empty the partition, keep it in RAM only
+     */
+    static void Erase();
+
+    /**
+     * @brief Back the partition with a log file and replay what it holds
+     */
+    static void Mount(const char *path);
+
+    static Counters GetCounters();
+
+    /**
+     * @brief Page erases the written entries cost once the partition wraps
+     */
+    static uint32_t PageErases() { return GetCounters().Entries / mEntriesPerPage; }
+
+    /**
+     * @brief Make the next count nvs_open(NVS_READWRITE) calls fail with err
+     */
+    static void FailOpens(uint32_t count, esp_err_t err = ESP_FAIL);
+
+    /**
+     * @brief Make the next count nvs_set_* calls fail with err
+     */
+    static void FailSets(uint32_t count, esp_err_t err = ESP_FAIL);
+
+    /**
+     * @brief Cut the power half way through flash write number `write` (1-based)
+     *
+     * The process exits with status 0 leaving half of that record in the log.
+     */
+    static void CutPowerAt(uint32_t write);
+};
+
+/**
+ * @brief The ota_0 (running) and ota_1 app slots in NOR flash
+ *
+ * Like flash, a write can only clear bits; what was not erased first reads
+ * back as the AND of old and new data. esp_ota_begin/write/end write the
+ * inactive slot the way ESP-IDF does, erasing sector by sector with
+ * OTA_WITH_SEQUENTIAL_WRITES; esp_ota_end() only checks the image magic byte.
+ */
+class HostFlash
+{
+public:
+    static constexpr uint32_t mSectorSize = 4096;
+
+    /**
+     * @brief Two erased slots of the given size, booting from ota_0
+     */
+    static void Reset(uint32_t slotSize);
+
+    static void LoadApp(uint8_t slot, const std::vector<uint8_t> &image);
+    static const uint8_t *App(uint8_t slot);
+
+    /**
+     * @brief Run the slot esp_ota_set_boot_partition() selected
+     */
+    static void Restart();
+
+    static int BootSlot();
+    static uint32_t SectorErases();
+
+    /**
+     * @brief Make erases and writes take as long as on the chip; 0 (the default) makes them instant
+     */
+    static void SetTiming(uint32_t sectorEraseUs, uint32_t pageProgramUs);
+};
+
+/**
+ * @brief Server behind esp_http_client: the same body at every URL
+ */
+class HostHttp
+{
+public:
+    /**
+     * @param ranges Answer Range requests with 206, otherwise ignore them like some servers do
+     */
+    static void Serve(const std::vector<uint8_t> &body, bool ranges);
+
+    /**
+     * @brief Close the next connection after this many body bytes; 0 never does
+     */
+    static void DropAfter(size_t bytes);
+
+    /**
+     * @brief Deliver the body at this many bytes per second; 0 (the default) as fast as it is read
+     */
+    static void SetRate(uint32_t bytesPerSecond);
+
+    static uint32_t Requests();
+};
+
+/**
+ * @brief The esp_http_server task on loopback sockets
+ */
+class HostHttpd
+{
+public:
+    /**
+     * @brief CPU time the httpd task has used, handlers and queued work included
+     */
+    static int64_t CpuUs();
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+// The memory the bootloader keeps at the top of RTC fast memory; on the host it is RTC_NOINIT_ATTR memory
+typedef struct
+{
+    uint32_t partition[2];
+    uint16_t reboot_counter;
+    uint16_t reserve;
+    uint8_t custom[CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE];
+    uint32_t crc;
+} rtc_retain_mem_t;
+
+rtc_retain_mem_t *bootloader_common_get_rtc_retain_mem(void);
@@ -0,0 +1,7 @@
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+// RTC memory survives a simulated reset: tests snapshot and tear this section
+#define RTC_NOINIT_ATTR __attribute__((section("host_rtc_noinit")))
+#define RTC_DATA_ATTR __attribute__((section("host_rtc_noinit")))
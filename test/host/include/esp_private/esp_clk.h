@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdint.h>
+
+uint64_t esp_clk_rtc_time(void);
@@ -0,0 +1,62 @@
+/**
+ * @file FreeRTOS.h
+ * @brief FreeRTOS on host threads: tasks are std::threads, ticks are milliseconds
+ *
+ * Critical sections are recursive mutexes, one per portMUX_TYPE. They exclude
+ * the other tasks touching the same lock, as on the SMP ESP32-S3, but do not
+ * stop the scheduler.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint8_t StackType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define errQUEUE_FULL 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define pdTICKS_TO_MS(ticks) ((TickType_t)(((uint64_t)(ticks) * 1000) / configTICK_RATE_HZ))
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define tskIDLE_PRIORITY 0
+#define configMAX_PRIORITIES 25
+#define portNUM_PROCESSORS 2
+
+struct portMUX_TYPE
+{
+    std::recursive_mutex Mutex;
+};
+
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portMUX_INITIALIZE(mux) ((void)(mux))
+#define portENTER_CRITICAL(mux) (mux)->Mutex.lock()
+#define portEXIT_CRITICAL(mux) (mux)->Mutex.unlock()
+#define portENTER_CRITICAL_ISR(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux) portEXIT_CRITICAL(mux)
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+
+typedef struct
+{
+    uint8_t Opaque[352];
+} StaticTask_t;
+
+typedef struct
+{
+    uint8_t Opaque[80];
+} StaticQueue_t;
+
+typedef StaticQueue_t StaticSemaphore_t;
+
+BaseType_t xPortGetCoreID(void);
@@ -0,0 +1,41 @@
+/**
+ * @file jpeg_decoder.h
+ * @brief esp_jpeg on the host: decodes the test image format of HostJpeg
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+    JPEG_IMAGE_FORMAT_RGB888,
+    JPEG_IMAGE_FORMAT_RGB565,
+} esp_jpeg_image_format_t;
+
+typedef enum {
+    JPEG_IMAGE_SCALE_0,
+    JPEG_IMAGE_SCALE_1_2,
+    JPEG_IMAGE_SCALE_1_4,
+    JPEG_IMAGE_SCALE_1_8,
+} esp_jpeg_image_scale_t;
+
+typedef struct {
+    uint8_t *indata;
+    uint32_t indata_size;
+    uint8_t *outbuf;
+    uint32_t outbuf_size;
+    esp_jpeg_image_format_t out_format;
+    esp_jpeg_image_scale_t out_scale;
+    struct {
+        uint8_t swap_color_bytes : 1;
+    } flags;
+} esp_jpeg_image_cfg_t;
+
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+} esp_jpeg_image_output_t;
+
+esp_err_t esp_jpeg_get_image_info(esp_jpeg_image_cfg_t *config, esp_jpeg_image_output_t *info);
+esp_err_t esp_jpeg_decode(esp_jpeg_image_cfg_t *config, esp_jpeg_image_output_t *output);
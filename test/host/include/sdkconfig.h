@@ -0,0 +1,64 @@
+/**
+ * @file sdkconfig.h
+ * @brief Configuration the host tests build the firmware modules with
+ *
+ * Kconfig defaults for every module under test, which is enabled here even
+ * where it defaults to off (timer wheel, job executor, flows, OTA, UI cache,
+ * local API), except where a test needs a shorter delay to run quickly or
+ * a port it can bind without root. Values a test target overrides on the
+ * command line are guarded with #ifndef.
+ */
+
+#pragma once
+
+#define CONFIG_FREERTOS_HZ 1000
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+
+#define CONFIG_DONE_NVS_WRITE_CACHE 1
+#define CONFIG_DONE_NVS_FLUSH_DELAY_MS 100
+#define CONFIG_DONE_NVS_WRITE_CACHE_MAX_BYTES 2048
+
+#define CONFIG_DONE_TIMER_WHEEL 1
+#define CONFIG_DONE_TIMER_WHEEL_TICK_MS 10
+
+#define CONFIG_DONE_JOB_EXECUTOR 1
+#define CONFIG_DONE_JOB_EXECUTOR_STACK_SIZE 4096
+#define CONFIG_DONE_JOB_EXECUTOR_DEPTH 32
+#define CONFIG_DONE_JOB_EXECUTOR_CLASSES 8
+
+#define CONFIG_DONE_FLOWS 1
+
+#define CONFIG_DONE_FAST_BOOT 1
+#define CONFIG_DONE_COOK_CHECKPOINT 1
+#define CONFIG_DONE_OVEN_STATE 1
+#define CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC 1
+#define CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE 0x38
+
+#define CONFIG_DONE_UI_IMAGE_CACHE 1
+#define CONFIG_DONE_UI_IMAGE_CACHE_BUDGET_KB 1024
+#define CONFIG_LV_COLOR_16_SWAP 1
+
+#define CONFIG_DONE_DELTA_OTA 1
+#define CONFIG_DONE_DELTA_OTA_CHECKPOINT_SECTORS 8
+
+#define CONFIG_DONE_COMPRESSED_OTA 1
+#define CONFIG_DONE_COMPRESSED_OTA_BLOCKS 4
+
+#define CONFIG_LWIP_MAX_SOCKETS 10
+#define CONFIG_LWIP_LOCAL_HOSTNAME "espressif"
+#define CONFIG_LWIP_TCP_SND_BUF_DEFAULT 5744
+#define CONFIG_HTTPD_WS_SUPPORT 1
+
+#define CONFIG_DONE_LOCAL_API 1
+#ifndef CONFIG_DONE_LOCAL_API_PORT
+#define CONFIG_DONE_LOCAL_API_PORT 18080
+#endif
+#define CONFIG_DONE_LOCAL_API_CLIENTS 2
+
+#define CONFIG_DONE_LIVE_STREAM 1
+#ifndef CONFIG_DONE_LIVE_STREAM_CLIENTS
+#define CONFIG_DONE_LIVE_STREAM_CLIENTS 1
+#endif
+#ifndef CONFIG_DONE_LIVE_STREAM_INTERVAL_MS
+#define CONFIG_DONE_LIVE_STREAM_INTERVAL_MS 100
+#endif
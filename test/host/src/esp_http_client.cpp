@@ -0,0 +1,126 @@
+// esp_http_client serving one body from memory, with Range support and dropped connections
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "esp_http_client.h"
+#include "HostSim.hpp"
+
+struct esp_http_client
+{
+    size_t Offset;      ///< Next body byte to send
+    size_t End;         ///< Connection closes here
+    int Status;
+    std::string Range;
+};
+
+static std::mutex sLock;
+static std::vector<uint8_t> *sBody = new std::vector<uint8_t>;
+static bool sRanges = true;
+static size_t sDropAfter = 0;
+static uint32_t sRequests = 0;
+static uint32_t sRate = 0;
+
+void HostHttp::Serve(const std::vector<uint8_t> &body, bool ranges)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    *sBody = body;
+    sRanges = ranges;
+    sDropAfter = 0;
+    sRequests = 0;
+}
+
+void HostHttp::DropAfter(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    sDropAfter = bytes;
+}
+
+void HostHttp::SetRate(uint32_t bytesPerSecond)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    sRate = bytesPerSecond;
+}
+
+uint32_t HostHttp::Requests()
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    return sRequests;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    return (config != nullptr && config->url != nullptr) ? new esp_http_client{ 0, 0, 0, "" } : nullptr;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    if (strcmp(key, "Range") == 0) {
+        client->Range = value;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    (void)write_len;
+    std::lock_guard<std::mutex> lock(sLock);
+    sRequests++;
+    client->Status = 200;
+    client->Offset = 0;
+    if (sRanges && client->Range.compare(0, 6, "bytes=") == 0) {
+        client->Offset = std::min<size_t>(strtoul(client->Range.c_str() + 6, nullptr, 10), sBody->size());
+        client->Status = 206;
+    }
+    client->End = sBody->size();
+    if (sDropAfter > 0) {
+        client->End = std::min(client->End, client->Offset + sDropAfter);
+        sDropAfter = 0;
+    }
+    return ESP_OK;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    return static_cast<int64_t>(sBody->size() - client->Offset);
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->Status;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+    size_t take = 0;
+    uint32_t rate = 0;
+    {
+        std::lock_guard<std::mutex> lock(sLock);
+        take = std::min<size_t>(len, client->End - client->Offset);
+        memcpy(buffer, sBody->data() + client->Offset, take);
+        client->Offset += take;
+        rate = sRate;
+    }
+    if (rate > 0 && take > 0) {
+        // The bytes arrive at the link rate
+        std::this_thread::sleep_for(std::chrono::microseconds(take * 1000000ULL / rate));
+    }
+    return static_cast<int>(take);
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    return client->Offset == sBody->size();
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    delete client;
+    return ESP_OK;
+}
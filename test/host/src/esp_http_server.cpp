@@ -0,0 +1,562 @@
+// esp_http_server on POSIX sockets: one httpd task, kept-alive sessions, LRU purging and WebSockets
+//
+// Listens on the loopback interface. Like httpd, the task polls the listening
+// socket, its work queue and every session, and runs all URI handlers and
+// httpd_queue_work() jobs itself. Accepted sockets get lwIP's TCP send buffer
+// (CONFIG_LWIP_TCP_SND_BUF_DEFAULT), so a slow reader fills it about as soon
+// as on the device. A send that would block is logged under "httpd_txrx" as
+// httpd does. The WebSocket upgrade is answered without a Sec-WebSocket-Accept
+// key, which the test clients do not check.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "sdkconfig.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "HostSim.hpp"
+
+static const char *TAG = "httpd_txrx";
+
+struct Session
+{
+    int Fd;
+    std::string In;                 ///< Received and not handled yet
+    uint64_t LastUse;               ///< For LRU purging
+    const httpd_uri_t *WebSocket;   ///< Handler of the frames once upgraded
+    void *Ctx;
+    httpd_free_ctx_fn_t FreeCtx;
+    bool Closing;
+};
+
+/**
+ * @brief What httpd_req_t::aux points to
+ */
+struct Request
+{
+    Session *Owner;
+    std::string Uri;
+    std::string Headers;            ///< Header lines, each ending in \r\n
+    const char *Status;
+    const char *Type;
+    std::string ExtraHeaders;
+    httpd_ws_type_t FrameType;
+    std::string FramePayload;
+};
+
+struct Server
+{
+    httpd_config_t Config;
+    int Listen;
+    int WakeRead;
+    int WakeWrite;
+    std::vector<httpd_uri_t> Uris;
+    std::vector<Session *> Sessions;
+    uint64_t Clock;
+    std::mutex WorkLock;
+    std::vector<std::pair<httpd_work_fn_t, void *>> Work;
+};
+
+static std::atomic<bool> sHaveCpuClock{false};
+static clockid_t sCpuClock;
+
+int64_t HostHttpd::CpuUs()
+{
+    timespec time = {};
+    if (!sHaveCpuClock.load() || clock_gettime(sCpuClock, &time) != 0) {
+        return 0;
+    }
+    return static_cast<int64_t>(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
+static void Wake(Server &server)
+{
+    const char byte = 1;
+    (void)!write(server.WakeWrite, &byte, 1);
+}
+
+static bool SendAll(int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        const ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        length -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+static void FreeCtx(Session &session)
+{
+    if (session.Ctx != nullptr) {
+        if (session.FreeCtx != nullptr) {
+            session.FreeCtx(session.Ctx);
+        } else {
+            free(session.Ctx);
+        }
+        session.Ctx = nullptr;
+    }
+}
+
+static void CloseSession(Server &server, Session *session)
+{
+    FreeCtx(*session);
+    close(session->Fd);
+    for (size_t i = 0; i < server.Sessions.size(); i++) {
+        if (server.Sessions[i] == session) {
+            server.Sessions.erase(server.Sessions.begin() + static_cast<long>(i));
+            break;
+        }
+    }
+    delete session;
+}
+
+static bool FindHeader(const std::string &headers, const char *field, std::string &value)
+{
+    const size_t fieldLength = strlen(field);
+    for (size_t line = 0; line < headers.size();) {
+        const size_t end = headers.find("\r\n", line);
+        if (end == std::string::npos) {
+            break;
+        }
+        if (end - line > fieldLength && headers[line + fieldLength] == ':' &&
+            strncasecmp(headers.c_str() + line, field, fieldLength) == 0) {
+            size_t start = line + fieldLength + 1;
+            while (start < end && headers[start] == ' ') {
+                start++;
+            }
+            value = headers.substr(start, end - start);
+            return true;
+        }
+        line = end + 2;
+    }
+    return false;
+}
+
+static esp_err_t CopyTruncated(const std::string &value, char *out, size_t size)
+{
+    if (size == 0) {
+        return ESP_ERR_HTTPD_RESULT_TRUNC;
+    }
+    snprintf(out, size, "%s", value.c_str());
+    return (value.size() < size) ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+/**
+ * @brief Run a handler the way httpd does: session context in, changes to it kept, false to close
+ */
+static bool RunHandler(Server &server, Session &session, const httpd_uri_t &uri, Request &request, int method)
+{
+    httpd_req_t req = {};
+    req.handle = &server;
+    req.method = method;
+    // As httpd fills it in
+    snprintf(const_cast<char *>(req.uri), sizeof(req.uri), "%s", request.Uri.c_str());
+    req.aux = &request;
+    req.user_ctx = uri.user_ctx;
+    req.sess_ctx = session.Ctx;
+    req.free_ctx = session.FreeCtx;
+    request.Owner = &session;
+    request.Status = HTTPD_200;
+    request.Type = "text/html";
+
+    const bool keep = uri.handler(&req) == ESP_OK;
+    if (req.sess_ctx != session.Ctx && !req.ignore_sess_ctx_changes) {
+        FreeCtx(session);
+        session.Ctx = req.sess_ctx;
+    }
+    session.FreeCtx = req.free_ctx;
+    return keep;
+}
+
+static bool HandleRequest(Server &server, Session &session, const std::string &head)
+{
+    const size_t methodEnd = head.find(' ');
+    const size_t uriEnd = head.find(' ', methodEnd + 1);
+    const size_t lineEnd = head.find("\r\n");
+    if (methodEnd == std::string::npos || uriEnd == std::string::npos || lineEnd == std::string::npos) {
+        return false;
+    }
+    const std::string method = head.substr(0, methodEnd);
+    Request request;
+    request.Uri = head.substr(methodEnd + 1, uriEnd - methodEnd - 1);
+    request.Headers = head.substr(lineEnd + 2);
+    const std::string path = request.Uri.substr(0, request.Uri.find('?'));
+    const int methodId = (method == "GET") ? HTTP_GET : (method == "POST") ? HTTP_POST : -1;
+
+    for (const httpd_uri_t &uri : server.Uris) {
+        if (static_cast<int>(uri.method) != methodId || path != uri.uri) {
+            continue;
+        }
+        if (uri.is_websocket) {
+            std::string upgrade;
+            if (!FindHeader(request.Headers, "Upgrade", upgrade) || strcasecmp(upgrade.c_str(), "websocket") != 0) {
+                return false;
+            }
+            static const char SWITCHING[] =
+                "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n";
+            if (!SendAll(session.Fd, SWITCHING, sizeof(SWITCHING) - 1)) {
+                return false;
+            }
+            session.WebSocket = &uri;
+        }
+        return RunHandler(server, session, uri, request, methodId);
+    }
+    static const char NOT_FOUND[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    return SendAll(session.Fd, NOT_FOUND, sizeof(NOT_FOUND) - 1);
+}
+
+/**
+ * @brief Hand one masked client frame to the handler
+ * @return bytes it took from session.In, 0 while incomplete, -1 to close
+ */
+static long HandleFrame(Server &server, Session &session)
+{
+    const std::string &in = session.In;
+    if (in.size() < 2) {
+        return 0;
+    }
+    const uint8_t opcode = static_cast<uint8_t>(in[0]) & 0x0F;
+    size_t length = static_cast<uint8_t>(in[1]) & 0x7F;
+    size_t offset = 2;
+    if (length == 127 || (static_cast<uint8_t>(in[1]) & 0x80) == 0) {
+        // Client frames are masked, and never this long here
+        return -1;
+    }
+    if (length == 126) {
+        if (in.size() < 4) {
+            return 0;
+        }
+        length = (static_cast<size_t>(static_cast<uint8_t>(in[2])) << 8) | static_cast<uint8_t>(in[3]);
+        offset = 4;
+    }
+    if (in.size() < offset + 4 + length) {
+        return 0;
+    }
+    const char *mask = in.data() + offset;
+    offset += 4;
+
+    Request request;
+    request.FrameType = static_cast<httpd_ws_type_t>(opcode);
+    request.FramePayload.resize(length);
+    for (size_t i = 0; i < length; i++) {
+        request.FramePayload[i] = static_cast<char>(in[offset + i] ^ mask[i & 3]);
+    }
+    const long used = static_cast<long>(offset + length);
+
+    const bool control = opcode == HTTPD_WS_TYPE_PING || opcode == HTTPD_WS_TYPE_CLOSE;
+    if (control && !session.WebSocket->handle_ws_control_frames) {
+        if (opcode == HTTPD_WS_TYPE_CLOSE) {
+            return -1;
+        }
+        std::string pong;
+        pong.push_back(static_cast<char>(0x80 | HTTPD_WS_TYPE_PONG));
+        pong.push_back(static_cast<char>(length));
+        pong += request.FramePayload;
+        return SendAll(session.Fd, pong.data(), pong.size()) ? used : -1;
+    }
+    // Frames reach the handler with a method other than HTTP_GET, which is the upgrade
+    return RunHandler(server, session, *session.WebSocket, request, 0) ? used : -1;
+}
+
+static void Receive(Server &server, Session &session)
+{
+    char buffer[4096];
+    const ssize_t received = recv(session.Fd, buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+        session.Closing = true;
+        return;
+    }
+    session.In.append(buffer, static_cast<size_t>(received));
+    session.LastUse = ++server.Clock;
+
+    while (!session.Closing) {
+        if (session.WebSocket != nullptr) {
+            const long used = HandleFrame(server, session);
+            if (used < 0) {
+                session.Closing = true;
+            } else if (used == 0) {
+                break;
+            } else {
+                session.In.erase(0, static_cast<size_t>(used));
+            }
+            continue;
+        }
+        const size_t end = session.In.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            break;
+        }
+        const std::string head = session.In.substr(0, end + 2);
+        std::string contentLength;
+        const size_t body = FindHeader(head, "Content-Length", contentLength) ? strtoul(contentLength.c_str(), nullptr, 10) : 0;
+        if (session.In.size() < end + 4 + body) {
+            break;
+        }
+        // No handler here reads a body
+        session.In.erase(0, end + 4 + body);
+        if (!HandleRequest(server, session, head)) {
+            session.Closing = true;
+        }
+    }
+}
+
+static void Accept(Server &server)
+{
+    const int fd = accept(server.Listen, nullptr, nullptr);
+    if (fd < 0) {
+        return;
+    }
+    const int sendBuffer = CONFIG_LWIP_TCP_SND_BUF_DEFAULT;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+    if (server.Sessions.size() >= server.Config.max_open_sockets) {
+        if (!server.Config.lru_purge_enable) {
+            close(fd);
+            return;
+        }
+        Session *oldest = server.Sessions[0];
+        for (Session *session : server.Sessions) {
+            if (session->LastUse < oldest->LastUse) {
+                oldest = session;
+            }
+        }
+        CloseSession(server, oldest);
+    }
+    server.Sessions.push_back(new Session{ fd, std::string(), ++server.Clock, nullptr, nullptr, nullptr, false });
+}
+
+static void ServerTask(void *arg)
+{
+    Server &server = *static_cast<Server *>(arg);
+    if (pthread_getcpuclockid(pthread_self(), &sCpuClock) == 0) {
+        sHaveCpuClock.store(true);
+    }
+
+    std::vector<pollfd> fds;
+    std::vector<Session *> polled;
+    while (true) {
+        fds.clear();
+        fds.push_back({ server.Listen, POLLIN, 0 });
+        fds.push_back({ server.WakeRead, POLLIN, 0 });
+        polled = server.Sessions;
+        for (Session *session : polled) {
+            fds.push_back({ session->Fd, POLLIN, 0 });
+        }
+        if (poll(fds.data(), fds.size(), -1) <= 0) {
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char drain[64];
+            while (read(server.WakeRead, drain, sizeof(drain)) > 0) {
+            }
+            std::vector<std::pair<httpd_work_fn_t, void *>> work;
+            {
+                std::lock_guard<std::mutex> lock(server.WorkLock);
+                work.swap(server.Work);
+            }
+            for (const auto &job : work) {
+                job.first(job.second);
+            }
+        }
+        for (size_t i = 0; i < polled.size(); i++) {
+            if (!polled[i]->Closing && (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+                Receive(server, *polled[i]);
+            }
+        }
+        for (Session *session : std::vector<Session *>(server.Sessions)) {
+            if (session->Closing) {
+                CloseSession(server, session);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            Accept(server);
+        }
+    }
+}
+
+static Request &Aux(httpd_req_t *r)
+{
+    return *static_cast<Request *>(r->aux);
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    Server *server = new Server();
+    server->Config = *config;
+    server->Clock = 0;
+    server->Listen = socket(AF_INET, SOCK_STREAM, 0);
+    const int one = 1;
+    setsockopt(server->Listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(config->server_port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int wake[2];
+    if (bind(server->Listen, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(server->Listen, 8) != 0 || pipe(wake) != 0) {
+        close(server->Listen);
+        delete server;
+        return ESP_ERR_HTTPD_TASK;
+    }
+    fcntl(wake[0], F_SETFL, O_NONBLOCK);
+    server->WakeRead = wake[0];
+    server->WakeWrite = wake[1];
+    xTaskCreate(&ServerTask, "httpd", 4096, server, tskIDLE_PRIORITY + 5, nullptr);
+    *handle = server;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    Server &server = *static_cast<Server *>(handle);
+    if (server.Uris.size() >= server.Config.max_uri_handlers) {
+        return ESP_ERR_HTTPD_HANDLERS_FULL;
+    }
+    server.Uris.push_back(*uri_handler);
+    return ESP_OK;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg)
+{
+    Server &server = *static_cast<Server *>(handle);
+    {
+        std::lock_guard<std::mutex> lock(server.WorkLock);
+        server.Work.emplace_back(work, arg);
+    }
+    Wake(server);
+    return ESP_OK;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    // Only from the httpd task, like every caller in the firmware
+    Server &server = *static_cast<Server *>(handle);
+    for (Session *session : server.Sessions) {
+        if (session->Fd == sockfd) {
+            session->Closing = true;
+            Wake(server);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+int httpd_socket_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags)
+{
+    (void)hd;
+    const ssize_t sent = send(sockfd, buf, buf_len, flags | MSG_NOSIGNAL);
+    if (sent >= 0) {
+        return static_cast<int>(sent);
+    }
+    const int error = errno;
+    ESP_LOGW(TAG, "error in send : %d", error);
+    return (error == EAGAIN || error == EWOULDBLOCK || error == EINTR) ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+    return Aux(r).Owner->Fd;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+    std::string value;
+    return FindHeader(Aux(r).Headers, field, value) ? value.size() : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+    std::string value;
+    if (!FindHeader(Aux(r).Headers, field, value)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return CopyTruncated(value, val, val_size);
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    const size_t query = Aux(r).Uri.find('?');
+    if (query == std::string::npos) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return CopyTruncated(Aux(r).Uri.substr(query + 1), buf, buf_len);
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+    const size_t keyLength = strlen(key);
+    for (const char *pair = qry; pair != nullptr && *pair != '\0';) {
+        const char *next = strchr(pair, '&');
+        const size_t pairLength = (next != nullptr) ? static_cast<size_t>(next - pair) : strlen(pair);
+        if (pairLength > keyLength && pair[keyLength] == '=' && strncmp(pair, key, keyLength) == 0) {
+            return CopyTruncated(std::string(pair + keyLength + 1, pairLength - keyLength - 1), val, val_size);
+        }
+        pair = (next != nullptr) ? next + 1 : nullptr;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    Aux(r).Status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    Aux(r).Type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    Aux(r).ExtraHeaders += std::string(field) + ": " + value + "\r\n";
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    const Request &request = Aux(r);
+    const size_t length = (buf == nullptr) ? 0 : (buf_len == HTTPD_RESP_USE_STRLEN) ? strlen(buf) : static_cast<size_t>(buf_len);
+    std::string response = std::string("HTTP/1.1 ") + request.Status + "\r\nContent-Type: " + request.Type +
+                           "\r\nContent-Length: " + std::to_string(length) + "\r\n" + request.ExtraHeaders + "\r\n";
+    response.append(buf, length);
+    return SendAll(request.Owner->Fd, response.data(), response.size()) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *pkt, size_t max_len)
+{
+    const Request &request = Aux(req);
+    pkt->final = true;
+    pkt->fragmented = false;
+    pkt->type = request.FrameType;
+    pkt->len = request.FramePayload.size();
+    if (max_len == 0) {
+        return ESP_OK;
+    }
+    if (max_len < pkt->len || pkt->payload == nullptr) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(pkt->payload, request.FramePayload.data(), pkt->len);
+    return ESP_OK;
+}
@@ -0,0 +1,39 @@
+// The WiFi station interface, already up: no event loop, the LWIP hostname
+
+#include "sdkconfig.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+
+struct esp_netif_obj
+{
+    const char *Hostname;
+};
+
+static esp_netif_obj sStation = { CONFIG_LWIP_LOCAL_HOSTNAME };
+
+const esp_event_base_t IP_EVENT = "IP_EVENT";
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id,
+                                     esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    (void)event_base;
+    (void)event_id;
+    (void)event_handler;
+    (void)event_handler_arg;
+    // As before esp_event_loop_create_default(); network services start at once
+    return ESP_ERR_INVALID_STATE;
+}
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key)
+{
+    return (if_key != nullptr) ? &sStation : nullptr;
+}
+
+esp_err_t esp_netif_get_hostname(esp_netif_t *esp_netif, const char **hostname)
+{
+    if (esp_netif == nullptr || hostname == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *hostname = esp_netif->Hostname;
+    return ESP_OK;
+}
@@ -0,0 +1,278 @@
+// Logging, error names, CRC, heap, console, random numbers, reset and RTC memory
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sdkconfig.h"
+#include "bootloader_common.h"
+#include "esp_attr.h"
+#include "esp_console.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_private/esp_clk.h"
+#include "nvs.h"
+#include "HostSim.hpp"
+
+// Linker-provided bounds of the RTC_NOINIT_ATTR section
+extern uint8_t __start_host_rtc_noinit[] __attribute__((weak));
+extern uint8_t __stop_host_rtc_noinit[] __attribute__((weak));
+
+static esp_log_level_t sLogLevel = static_cast<esp_log_level_t>(CONFIG_LOG_DEFAULT_LEVEL);
+static std::unordered_map<std::string, esp_log_level_t> sLogLevels;
+static std::mutex sLogLock;
+static esp_reset_reason_t sResetReason = ESP_RST_POWERON;
+static std::vector<shutdown_handler_t> *sShutdownHandlers = new std::vector<shutdown_handler_t>;
+static RTC_NOINIT_ATTR rtc_retain_mem_t sRetainMem;
+
+static esp_log_level_t LevelOf(const char *tag)
+{
+    const auto level = sLogLevels.find(tag);
+    return (level != sLogLevels.end()) ? level->second : sLogLevel;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    std::lock_guard<std::mutex> lock(sLogLock);
+    if (strcmp(tag, "*") == 0) {
+        // Like IDF, the default level replaces every tag level set before
+        sLogLevel = level;
+        sLogLevels.clear();
+    } else {
+        sLogLevels[tag] = level;
+    }
+}
+
+esp_log_level_t esp_log_level_get(const char *tag)
+{
+    std::lock_guard<std::mutex> lock(sLogLock);
+    return LevelOf(tag);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    std::lock_guard<std::mutex> lock(sLogLock);
+    if (level > LevelOf(tag)) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_TYPE_MISMATCH: return "ESP_ERR_NVS_TYPE_MISMATCH";
+    case ESP_ERR_NVS_NOT_ENOUGH_SPACE: return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+    case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_OTA_VALIDATE_FAILED: return "ESP_ERR_OTA_VALIDATE_FAILED";
+    default: return "ESP_ERR_UNKNOWN";
+    }
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    static uint32_t table[256];
+    static std::once_flag once;
+    std::call_once(once, [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) {
+                value = (value & 1) ? (value >> 1) ^ 0xEDB88320u : (value >> 1);
+            }
+            table[i] = value;
+        }
+    });
+    crc = ~crc;
+    while (len-- > 0) {
+        crc = table[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static constexpr size_t INTERNAL_FREE_AT_BOOT = 256 * 1024;
+
+static std::mutex sHeapLock;
+static std::unordered_map<void *, size_t> *sHeapBlocks = new std::unordered_map<void *, size_t>;
+static size_t sHeapInUse = 0;
+static size_t sHeapPeak = 0;
+
+size_t HostHeap::InUse()
+{
+    std::lock_guard<std::mutex> lock(sHeapLock);
+    return sHeapInUse;
+}
+
+size_t HostHeap::Peak()
+{
+    std::lock_guard<std::mutex> lock(sHeapLock);
+    return sHeapPeak;
+}
+
+void HostHeap::ResetPeak()
+{
+    std::lock_guard<std::mutex> lock(sHeapLock);
+    sHeapPeak = sHeapInUse;
+}
+
+void HostHeap::Add(int64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(sHeapLock);
+    sHeapInUse += bytes;
+    sHeapPeak = std::max(sHeapPeak, sHeapInUse);
+}
+
+static void *Track(void *ptr, size_t size)
+{
+    if (ptr != nullptr) {
+        std::lock_guard<std::mutex> lock(sHeapLock);
+        (*sHeapBlocks)[ptr] = size;
+        sHeapInUse += size;
+        sHeapPeak = std::max(sHeapPeak, sHeapInUse);
+    }
+    return ptr;
+}
+
+// One heap for all capabilities; the sizes below report no PSRAM, so nothing tests or plans for it
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    (void)caps;
+    return Track(malloc(size), size);
+}
+
+void *heap_caps_calloc(size_t count, size_t size, uint32_t caps)
+{
+    (void)caps;
+    return Track(calloc(count, size), count * size);
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    (void)caps;
+    void *ptr = nullptr;
+    return Track((posix_memalign(&ptr, alignment, size) == 0) ? ptr : nullptr, size);
+}
+
+void heap_caps_free(void *ptr)
+{
+    if (ptr != nullptr) {
+        std::lock_guard<std::mutex> lock(sHeapLock);
+        auto found = sHeapBlocks->find(ptr);
+        if (found != sHeapBlocks->end()) {
+            sHeapInUse -= found->second;
+            sHeapBlocks->erase(found);
+        }
+    }
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    if ((caps & MALLOC_CAP_SPIRAM) != 0) {
+        return 0;
+    }
+    const size_t inUse = HostHeap::InUse();
+    return (inUse < INTERNAL_FREE_AT_BOOT) ? INTERNAL_FREE_AT_BOOT - inUse : 0;
+}
+
+size_t heap_caps_get_total_size(uint32_t caps)
+{
+    return ((caps & MALLOC_CAP_SPIRAM) != 0) ? 0 : 320 * 1024;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return ((caps & MALLOC_CAP_SPIRAM) != 0) ? 0 : 128 * 1024;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return static_cast<uint32_t>(heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+}
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd)
+{
+    return (cmd != nullptr && cmd->func != nullptr) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+void esp_fill_random(void *buf, size_t len)
+{
+    static std::mt19937 random(std::random_device{}());
+    static std::mutex lock;
+    std::lock_guard<std::mutex> guard(lock);
+    uint8_t *bytes = static_cast<uint8_t *>(buf);
+    for (size_t i = 0; i < len; i++) {
+        bytes[i] = static_cast<uint8_t>(random());
+    }
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return sResetReason;
+}
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler)
+{
+    sShutdownHandlers->push_back(handler);
+    return ESP_OK;
+}
+
+void esp_restart(void)
+{
+    for (shutdown_handler_t handler : *sShutdownHandlers) {
+        handler();
+    }
+    fflush(stdout);
+    exit(0);
+}
+
+uint64_t esp_clk_rtc_time(void)
+{
+    return static_cast<uint64_t>(esp_timer_get_time());
+}
+
+void HostSystem::SetResetReason(esp_reset_reason_t reason)
+{
+    sResetReason = reason;
+}
+
+rtc_retain_mem_t *bootloader_common_get_rtc_retain_mem(void)
+{
+    return &sRetainMem;
+}
+
+uint8_t *HostSystem::RtcBegin()
+{
+    return __start_host_rtc_noinit;
+}
+
+size_t HostSystem::RtcSize()
+{
+    return (__start_host_rtc_noinit != nullptr) ? static_cast<size_t>(__stop_host_rtc_noinit - __start_host_rtc_noinit) : 0;
+}
@@ -0,0 +1,147 @@
+// esp_timer on one dispatch thread, like the ESP_TIMER_TASK dispatch method
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "esp_timer.h"
+#include "HostSim.hpp"
+
+struct esp_timer
+{
+    esp_timer_cb_t Callback;
+    void *Arg;
+    int64_t PeriodUs;
+    std::multimap<int64_t, esp_timer *>::iterator Position;
+    bool Armed;
+};
+
+static std::mutex sLock;
+// Never destroyed: the dispatch thread still waits on it when the test exits
+static std::condition_variable &sChanged = *new std::condition_variable;
+static std::multimap<int64_t, esp_timer *> *sArmed = new std::multimap<int64_t, esp_timer *>;
+static bool sStarted = false;
+static std::atomic<bool> sFrozen(false);
+static std::atomic<int64_t> sFrozenUs(0);
+
+static int64_t RealNowUs()
+{
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return sFrozen ? sFrozenUs.load() : RealNowUs();
+}
+
+void HostClock::Freeze()
+{
+    sFrozenUs = RealNowUs();
+    sFrozen = true;
+}
+
+void HostClock::Advance(int64_t us)
+{
+    sFrozenUs += us;
+}
+
+static void Arm(esp_timer *timer, int64_t expiryUs)
+{
+    timer->Position = sArmed->emplace(expiryUs, timer);
+    timer->Armed = true;
+}
+
+static void DispatchThread()
+{
+    std::unique_lock<std::mutex> lock(sLock);
+    while (true)
+    {
+        if (sArmed->empty()) {
+            sChanged.wait(lock);
+            continue;
+        }
+        const int64_t nowUs = RealNowUs();
+        auto first = sArmed->begin();
+        if (first->first > nowUs) {
+            sChanged.wait_for(lock, std::chrono::microseconds(first->first - nowUs));
+            continue;
+        }
+        esp_timer *timer = first->second;
+        sArmed->erase(first);
+        timer->Armed = false;
+        if (timer->PeriodUs > 0) {
+            Arm(timer, nowUs + timer->PeriodUs);
+        }
+        lock.unlock();
+        timer->Callback(timer->Arg);
+        lock.lock();
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+    if (args == nullptr || args->callback == nullptr || handle == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(sLock);
+    if (!sStarted) {
+        std::thread(DispatchThread).detach();
+        sStarted = true;
+    }
+    *handle = new esp_timer{ args->callback, args->arg, 0, {}, false };
+    return ESP_OK;
+}
+
+static esp_err_t Start(esp_timer_handle_t timer, uint64_t delayUs, int64_t periodUs)
+{
+    {
+        std::lock_guard<std::mutex> lock(sLock);
+        if (timer->Armed) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        timer->PeriodUs = periodUs;
+        Arm(timer, RealNowUs() + static_cast<int64_t>(delayUs));
+    }
+    sChanged.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutUs)
+{
+    return Start(timer, timeoutUs, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodUs)
+{
+    return Start(timer, periodUs, static_cast<int64_t>(periodUs));
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    if (!timer->Armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sArmed->erase(timer->Position);
+    timer->Armed = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    if (timer->Armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    delete timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    return timer->Armed;
+}
@@ -0,0 +1,255 @@
+// App slots in emulated NOR flash, and the OTA calls that pick between them
+
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "HostSim.hpp"
+
+static constexpr uint32_t SLOT_BASE = 0x10000;
+static constexpr uint32_t PAGE_SIZE = 256;
+static constexpr uint8_t IMAGE_MAGIC = 0xE9;
+
+static std::mutex sLock;
+static esp_partition_t sSlots[2];
+static std::vector<uint8_t> *sData = new std::vector<uint8_t>[2];
+static int sBoot = 0;
+static int sRunning = 0;
+static uint32_t sErases = 0;
+static uint32_t sEraseUs = 0;
+static uint32_t sPageUs = 0;
+
+struct OtaSession
+{
+    esp_ota_handle_t Handle;
+    const esp_partition_t *Partition;
+    size_t Written;
+    size_t Erased;      ///< Sectors below this offset are erased
+};
+
+static OtaSession sOta = {};
+static esp_ota_handle_t sLastHandle = 0;
+
+/**
+ * @brief The chip is busy; slept without the lock, like the caller waiting on the SPI flash driver
+ */
+static void Busy(uint64_t us)
+{
+    if (us > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+}
+
+void HostFlash::Reset(uint32_t slotSize)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    for (uint8_t slot = 0; slot < 2; slot++) {
+        sSlots[slot] = {};
+        sSlots[slot].address = SLOT_BASE + slot * slotSize;
+        sSlots[slot].size = slotSize;
+        sSlots[slot].erase_size = mSectorSize;
+        strcpy(sSlots[slot].label, (slot == 0) ? "ota_0" : "ota_1");
+        sData[slot].assign(slotSize, 0xFF);
+    }
+    sBoot = 0;
+    sRunning = 0;
+    sErases = 0;
+    sOta = {};
+}
+
+void HostFlash::LoadApp(uint8_t slot, const std::vector<uint8_t> &image)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    std::fill(sData[slot].begin(), sData[slot].end(), 0xFF);
+    std::copy(image.begin(), image.end(), sData[slot].begin());
+}
+
+const uint8_t *HostFlash::App(uint8_t slot)
+{
+    return sData[slot].data();
+}
+
+void HostFlash::Restart()
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    sRunning = sBoot;
+}
+
+int HostFlash::BootSlot()
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    return sBoot;
+}
+
+uint32_t HostFlash::SectorErases()
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    return sErases;
+}
+
+void HostFlash::SetTiming(uint32_t sectorEraseUs, uint32_t pageProgramUs)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    sEraseUs = sectorEraseUs;
+    sPageUs = pageProgramUs;
+}
+
+static int SlotOf(const esp_partition_t *partition)
+{
+    return (partition == &sSlots[0]) ? 0 : ((partition == &sSlots[1]) ? 1 : -1);
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    const int slot = SlotOf(partition);
+    if (slot < 0 || src_offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(dst, sData[slot].data() + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    uint64_t busyUs = 0;
+    {
+        std::lock_guard<std::mutex> lock(sLock);
+        const int slot = SlotOf(partition);
+        if (slot < 0 || dst_offset + size > partition->size) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        const uint8_t *bytes = static_cast<const uint8_t *>(src);
+        for (size_t i = 0; i < size; i++) {
+            sData[slot][dst_offset + i] &= bytes[i];
+        }
+        const size_t pages = (dst_offset + size + PAGE_SIZE - 1) / PAGE_SIZE - dst_offset / PAGE_SIZE;
+        busyUs = static_cast<uint64_t>(pages) * sPageUs;
+    }
+    Busy(busyUs);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    uint64_t busyUs = 0;
+    {
+        std::lock_guard<std::mutex> lock(sLock);
+        const int slot = SlotOf(partition);
+        if (slot < 0 || offset + size > partition->size || offset % HostFlash::mSectorSize != 0 ||
+            size % HostFlash::mSectorSize != 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        std::fill(sData[slot].begin() + offset, sData[slot].begin() + offset + size, 0xFF);
+        sErases += size / HostFlash::mSectorSize;
+        busyUs = static_cast<uint64_t>(size / HostFlash::mSectorSize) * sEraseUs;
+    }
+    Busy(busyUs);
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    return (sSlots[0].size != 0) ? &sSlots[sRunning] : nullptr;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+    (void)start_from;
+    std::lock_guard<std::mutex> lock(sLock);
+    return (sSlots[0].size != 0) ? &sSlots[1 - sRunning] : nullptr;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    const int slot = SlotOf(partition);
+    if (slot < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sBoot = slot;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle)
+{
+    {
+        std::lock_guard<std::mutex> lock(sLock);
+        const int slot = SlotOf(partition);
+        if (slot < 0 || slot == sRunning || out_handle == nullptr) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        sOta = { ++sLastHandle, partition, 0, 0 };
+        *out_handle = sOta.Handle;
+    }
+    if (image_size != OTA_WITH_SEQUENTIAL_WRITES) {
+        const size_t size = (image_size == OTA_SIZE_UNKNOWN) ? partition->size :
+                            (image_size + HostFlash::mSectorSize - 1) / HostFlash::mSectorSize * HostFlash::mSectorSize;
+        const esp_err_t err = esp_partition_erase_range(partition, 0, size);
+        if (err != ESP_OK) {
+            return err;
+        }
+        std::lock_guard<std::mutex> lock(sLock);
+        sOta.Erased = size;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+    const esp_partition_t *partition = nullptr;
+    size_t offset = 0;
+    size_t eraseFrom = 0;
+    size_t eraseTo = 0;
+    {
+        std::lock_guard<std::mutex> lock(sLock);
+        if (handle == 0 || handle != sOta.Handle) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        partition = sOta.Partition;
+        offset = sOta.Written;
+        if (offset + size > partition->size) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (offset == 0 && size > 0 && static_cast<const uint8_t *>(data)[0] != IMAGE_MAGIC) {
+            return ESP_ERR_OTA_VALIDATE_FAILED;
+        }
+        eraseFrom = sOta.Erased;
+        eraseTo = std::max(eraseFrom, (offset + size + HostFlash::mSectorSize - 1) / HostFlash::mSectorSize *
+                                      HostFlash::mSectorSize);
+        sOta.Erased = eraseTo;
+        sOta.Written += size;
+    }
+    if (eraseTo > eraseFrom) {
+        const esp_err_t err = esp_partition_erase_range(partition, eraseFrom, eraseTo - eraseFrom);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return esp_partition_write(partition, offset, data, size);
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    if (handle == 0 || handle != sOta.Handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const bool valid = sOta.Written > 0;
+    sOta = {};
+    return valid ? ESP_OK : ESP_ERR_OTA_VALIDATE_FAILED;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    if (handle == 0 || handle != sOta.Handle) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    sOta = {};
+    return ESP_OK;
+}
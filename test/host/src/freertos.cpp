@@ -0,0 +1,367 @@
+// FreeRTOS tasks, notifications, semaphores and queues on host threads
+
+#include <pthread.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "HostSim.hpp"
+
+static constexpr uint8_t STACK_PAINT = 0xA5;
+// glibc and the sanitizers need more than a FreeRTOS stack; the planned size is painted on top
+static constexpr size_t HOST_STACK_EXTRA = 256 * 1024;
+
+struct tskTaskControlBlock
+{
+    std::string Name;
+    TaskFunction_t Function = nullptr;
+    void *Arg = nullptr;
+    BaseType_t Core = 0;
+    std::mutex Lock;
+    std::condition_variable Notified;
+    uint32_t Notifications = 0;
+    uint8_t *Stack = nullptr;
+    size_t StackSize = 0;       ///< Planned size, at the top of the host stack
+};
+
+struct TaskExit
+{
+};
+
+static thread_local tskTaskControlBlock *tCurrent = nullptr;
+
+static std::chrono::steady_clock::time_point Epoch()
+{
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return epoch;
+}
+
+static std::chrono::steady_clock::time_point Deadline(TickType_t ticks)
+{
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(ticks * portTICK_PERIOD_MS);
+}
+
+static void *TaskEntry(void *arg)
+{
+    tCurrent = static_cast<tskTaskControlBlock *>(arg);
+    try {
+        tCurrent->Function(tCurrent->Arg);
+    } catch (const TaskExit &) {
+    }
+    HostHeap::Add(-static_cast<int64_t>(tCurrent->StackSize));
+    return nullptr;
+}
+
+static tskTaskControlBlock *StartTask(TaskFunction_t function, const char *name, uint32_t stackBytes, void *arg,
+                                      BaseType_t core)
+{
+    tskTaskControlBlock *task = new tskTaskControlBlock;
+    task->Name = (name != nullptr) ? name : "";
+    task->Function = function;
+    task->Arg = arg;
+    task->Core = (core == tskNO_AFFINITY) ? 0 : core;
+    task->StackSize = stackBytes;
+
+    const size_t total = stackBytes + HOST_STACK_EXTRA;
+    void *stack = nullptr;
+    if (posix_memalign(&stack, 64, total) != 0) {
+        delete task;
+        return nullptr;
+    }
+    // Stacks grow down: the planned part is the top, whatever reaches below it would overflow on target
+    task->Stack = static_cast<uint8_t *>(stack) + HOST_STACK_EXTRA;
+    memset(stack, STACK_PAINT, total);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, total);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    // Counted before the task can run and end
+    HostHeap::Add(stackBytes);
+    const int err = pthread_create(&thread, &attr, TaskEntry, task);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        HostHeap::Add(-static_cast<int64_t>(stackBytes));
+        free(stack);
+        delete task;
+        return nullptr;
+    }
+    return task;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackBytes, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    (void)priority;
+    // Handle first: the task may be notified by the time pthread_create returns
+    tskTaskControlBlock *task = StartTask(function, name, stackBytes, arg, core);
+    if (handle != nullptr) {
+        *handle = task;
+    }
+    return (task != nullptr) ? pdPASS : pdFAIL;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t function, const char *name, uint32_t stackBytes,
+                                           void *arg, UBaseType_t priority, StackType_t *stack,
+                                           StaticTask_t *buffer, BaseType_t core)
+{
+    (void)priority;
+    (void)stack;
+    (void)buffer;
+    return StartTask(function, name, stackBytes, arg, core);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Only self-deletion, the way the firmware tasks end
+    if (task == nullptr || task == tCurrent) {
+        throw TaskExit();
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    const auto elapsed = std::chrono::steady_clock::now() - Epoch();
+    return static_cast<TickType_t>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() /
+                                   portTICK_PERIOD_MS);
+}
+
+BaseType_t xTaskDelayUntil(TickType_t *previousWake, TickType_t period)
+{
+    *previousWake += period;
+    const int32_t remaining = static_cast<int32_t>(*previousWake - xTaskGetTickCount());
+    if (remaining <= 0) {
+        return pdFALSE;
+    }
+    vTaskDelay(static_cast<TickType_t>(remaining));
+    return pdTRUE;
+}
+
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t period)
+{
+    xTaskDelayUntil(previousWake, period);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (tCurrent == nullptr) {
+        // main() and other plain threads get a control block on first use
+        tCurrent = new tskTaskControlBlock;
+        tCurrent->Name = "main";
+    }
+    return tCurrent;
+}
+
+const char *pcTaskGetName(TaskHandle_t task)
+{
+    return ((task != nullptr) ? task : xTaskGetCurrentTaskHandle())->Name.c_str();
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return xTaskGetCurrentTaskHandle()->Core;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return static_cast<UBaseType_t>(HostSystem::StackUnused((task != nullptr) ? task : xTaskGetCurrentTaskHandle()));
+}
+
+size_t HostSystem::StackUnused(void *handle)
+{
+    const tskTaskControlBlock *task = static_cast<const tskTaskControlBlock *>(handle);
+    if (task->Stack == nullptr) {
+        return 0;
+    }
+    size_t unused = 0;
+    while (unused < task->StackSize && task->Stack[unused] == STACK_PAINT) {
+        unused++;
+    }
+    return unused;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+    tskTaskControlBlock *task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->Lock);
+    if (ticks == portMAX_DELAY) {
+        task->Notified.wait(lock, [task] { return task->Notifications > 0; });
+    } else {
+        task->Notified.wait_until(lock, Deadline(ticks), [task] { return task->Notifications > 0; });
+    }
+    const uint32_t value = task->Notifications;
+    if (value > 0) {
+        task->Notifications = (clearOnExit != pdFALSE) ? 0 : value - 1;
+    }
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    {
+        std::lock_guard<std::mutex> lock(task->Lock);
+        task->Notifications++;
+    }
+    task->Notified.notify_all();
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    xTaskNotifyGive(task);
+    if (woken != nullptr) {
+        *woken = pdTRUE;
+    }
+}
+
+struct HostSemaphore
+{
+    std::mutex Lock;
+    std::condition_variable Given;
+    UBaseType_t Count;
+    UBaseType_t Max;
+};
+
+static SemaphoreHandle_t NewSemaphore(UBaseType_t max, UBaseType_t initial)
+{
+    HostSemaphore *semaphore = new HostSemaphore;
+    semaphore->Count = initial;
+    semaphore->Max = max;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return NewSemaphore(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer)
+{
+    (void)buffer;
+    return NewSemaphore(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return NewSemaphore(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+    return NewSemaphore(max, initial);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(semaphore->Lock);
+    const auto available = [semaphore] { return semaphore->Count > 0; };
+    if (ticks == portMAX_DELAY) {
+        semaphore->Given.wait(lock, available);
+    } else if (!semaphore->Given.wait_until(lock, Deadline(ticks), available)) {
+        return pdFALSE;
+    }
+    semaphore->Count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    {
+        std::lock_guard<std::mutex> lock(semaphore->Lock);
+        if (semaphore->Count >= semaphore->Max) {
+            return pdFALSE;
+        }
+        semaphore->Count++;
+    }
+    semaphore->Given.notify_one();
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    delete semaphore;
+}
+
+struct HostQueue
+{
+    std::mutex Lock;
+    std::condition_variable Changed;
+    std::deque<std::vector<uint8_t>> Items;
+    UBaseType_t Length;
+    UBaseType_t ItemSize;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    HostQueue *queue = new HostQueue;
+    queue->Length = length;
+    queue->ItemSize = itemSize;
+    HostHeap::Add(static_cast<int64_t>(length) * itemSize);
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(queue->Lock);
+    const auto space = [queue] { return queue->Items.size() < queue->Length; };
+    if (ticks == portMAX_DELAY) {
+        queue->Changed.wait(lock, space);
+    } else if (!queue->Changed.wait_until(lock, Deadline(ticks), space)) {
+        return errQUEUE_FULL;
+    }
+    const uint8_t *bytes = static_cast<const uint8_t *>(item);
+    queue->Items.emplace_back(bytes, bytes + queue->ItemSize);
+    lock.unlock();
+    queue->Changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+{
+    if (woken != nullptr) {
+        *woken = pdFALSE;
+    }
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(queue->Lock);
+    const auto available = [queue] { return !queue->Items.empty(); };
+    if (ticks == portMAX_DELAY) {
+        queue->Changed.wait(lock, available);
+    } else if (!queue->Changed.wait_until(lock, Deadline(ticks), available)) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->Items.front().data(), queue->ItemSize);
+    queue->Items.pop_front();
+    lock.unlock();
+    queue->Changed.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    std::lock_guard<std::mutex> lock(queue->Lock);
+    return static_cast<UBaseType_t>(queue->Items.size());
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    HostHeap::Add(-static_cast<int64_t>(queue->Length) * queue->ItemSize);
+    delete queue;
+}
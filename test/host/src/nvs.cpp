@@ -0,0 +1,304 @@
+// NVS partition emulated as an append-only log, with write counters and fault injection
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "nvs.h"
+#include "esp_rom_crc.h"
+#include "HostSim.hpp"
+
+enum class ItemType : uint8_t { U32, I32, U64, Str, Blob };
+
+struct Item
+{
+    ItemType Type;
+    std::vector<uint8_t> Value;
+};
+
+static constexpr uint32_t RECORD_MAGIC = 0x4E565331; // "NVS1"
+
+static std::mutex sLock;
+static std::map<std::string, Item> *sItems = new std::map<std::string, Item>;
+static std::vector<std::string> *sHandles = new std::vector<std::string>;
+static HostNvs::Counters sCounters = {};
+static int sLogFd = -1;
+static uint32_t sFailOpens = 0;
+static uint32_t sFailSets = 0;
+static esp_err_t sOpenError = ESP_FAIL;
+static esp_err_t sSetError = ESP_FAIL;
+static uint32_t sCutPowerAt = 0;
+
+static std::string FullKey(const std::string &nameSpace, const char *key)
+{
+    return nameSpace + '\0' + key;
+}
+
+/**
+ * @brief One log record: magic, length, type, full key, value, CRC of everything before
+ */
+static std::vector<uint8_t> Encode(const std::string &fullKey, const Item &item)
+{
+    const uint32_t length = static_cast<uint32_t>(10 + fullKey.size() + item.Value.size() + 4);
+    uint8_t header[10];
+    memcpy(header, &RECORD_MAGIC, 4);
+    memcpy(header + 4, &length, 4);
+    header[8] = static_cast<uint8_t>(item.Type);
+    header[9] = static_cast<uint8_t>(fullKey.size());
+
+    std::vector<uint8_t> record(header, header + sizeof(header));
+    record.reserve(length);
+    record.insert(record.end(), fullKey.begin(), fullKey.end());
+    record.insert(record.end(), item.Value.begin(), item.Value.end());
+    const uint32_t crc = esp_rom_crc32_le(0, record.data(), static_cast<uint32_t>(record.size()));
+    record.resize(length);
+    memcpy(record.data() + length - 4, &crc, 4);
+    return record;
+}
+
+static void Replay(const std::vector<uint8_t> &log)
+{
+    size_t offset = 0;
+    while (offset + 14 <= log.size())
+    {
+        uint32_t magic = 0;
+        uint32_t length = 0;
+        memcpy(&magic, &log[offset], 4);
+        memcpy(&length, &log[offset + 4], 4);
+        if (magic != RECORD_MAGIC || length < 14 || offset + length > log.size()) {
+            break;
+        }
+        uint32_t crc = 0;
+        memcpy(&crc, &log[offset + length - 4], 4);
+        if (crc == esp_rom_crc32_le(0, &log[offset], length - 4)) {
+            const ItemType type = static_cast<ItemType>(log[offset + 8]);
+            const size_t keyLength = log[offset + 9];
+            const uint8_t *key = &log[offset + 10];
+            const uint8_t *value = key + keyLength;
+            const uint8_t *end = &log[offset + length - 4];
+            (*sItems)[std::string(reinterpret_cast<const char *>(key), keyLength)] = Item{ type, { value, end } };
+        }
+        offset += length;
+    }
+}
+
+void HostNvs::Erase()
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    sItems->clear();
+    sCounters = {};
+    if (sLogFd >= 0) {
+        close(sLogFd);
+        sLogFd = -1;
+    }
+}
+
+void HostNvs::Mount(const char *path)
+{
+    Erase();
+    std::lock_guard<std::mutex> lock(sLock);
+    sLogFd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (sLogFd < 0) {
+        perror(path);
+        abort();
+    }
+    std::vector<uint8_t> log;
+    uint8_t buffer[4096];
+    ssize_t got;
+    while ((got = pread(sLogFd, buffer, sizeof(buffer), static_cast<off_t>(log.size()))) > 0) {
+        log.insert(log.end(), buffer, buffer + got);
+    }
+    Replay(log);
+}
+
+HostNvs::Counters HostNvs::GetCounters()
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    return sCounters;
+}
+
+void HostNvs::FailOpens(uint32_t count, esp_err_t err)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    sFailOpens = count;
+    sOpenError = err;
+}
+
+void HostNvs::FailSets(uint32_t count, esp_err_t err)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    sFailSets = count;
+    sSetError = err;
+}
+
+void HostNvs::CutPowerAt(uint32_t write)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    sCutPowerAt = write;
+}
+
+esp_err_t nvs_open(const char *nameSpace, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    if (nameSpace == nullptr || strlen(nameSpace) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (mode == NVS_READWRITE && sFailOpens > 0) {
+        sFailOpens--;
+        return sOpenError;
+    }
+    sCounters.Opens++;
+    sHandles->push_back(nameSpace);
+    *handle = static_cast<nvs_handle_t>(sHandles->size());
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void)handle;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    (void)handle;
+    // Like NVS, entries are on flash once set returns; commit only counts
+    std::lock_guard<std::mutex> lock(sLock);
+    sCounters.Commits++;
+    return ESP_OK;
+}
+
+static esp_err_t Set(nvs_handle_t handle, const char *key, ItemType type, const void *value, size_t length)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    if (handle == 0 || handle > sHandles->size()) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (key == nullptr || strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sCounters.Sets++;
+    if (sFailSets > 0) {
+        sFailSets--;
+        return sSetError;
+    }
+    const std::string fullKey = FullKey((*sHandles)[handle - 1], key);
+    const uint8_t *bytes = static_cast<const uint8_t *>(value);
+    Item item{ type, { bytes, bytes + length } };
+    auto found = sItems->find(fullKey);
+    if (found != sItems->end() && found->second.Type == type && found->second.Value == item.Value) {
+        sCounters.Skipped++;
+        return ESP_OK;
+    }
+
+    sCounters.Writes++;
+    // Primitives take one entry, strings and blobs a header entry plus their data
+    const bool variable = (type == ItemType::Str) || (type == ItemType::Blob);
+    sCounters.Entries += 1 + (variable ? (length + HostNvs::mEntrySize - 1) / HostNvs::mEntrySize : 0);
+    if (sLogFd >= 0) {
+        const std::vector<uint8_t> record = Encode(fullKey, item);
+        if (sCounters.Writes == sCutPowerAt) {
+            // Power fails half way through the record
+            ssize_t written = write(sLogFd, record.data(), record.size() / 2);
+            (void)written;
+            _exit(0);
+        }
+        if (write(sLogFd, record.data(), record.size()) != static_cast<ssize_t>(record.size())) {
+            return ESP_FAIL;
+        }
+    }
+    (*sItems)[fullKey] = std::move(item);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    if (handle == 0 || handle > sHandles->size()) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    return (sItems->erase(FullKey((*sHandles)[handle - 1], key)) > 0) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return Set(handle, key, ItemType::U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value)
+{
+    return Set(handle, key, ItemType::I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u64(nvs_handle_t handle, const char *key, uint64_t value)
+{
+    return Set(handle, key, ItemType::U64, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return Set(handle, key, ItemType::Str, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return Set(handle, key, ItemType::Blob, value, length);
+}
+
+static esp_err_t Get(nvs_handle_t handle, const char *key, ItemType type, void *value, size_t *length)
+{
+    std::lock_guard<std::mutex> lock(sLock);
+    if (handle == 0 || handle > sHandles->size()) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    auto found = sItems->find(FullKey((*sHandles)[handle - 1], key));
+    if (found == sItems->end()) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    const Item &item = found->second;
+    if (item.Type != type) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    if (value == nullptr) {
+        *length = item.Value.size();
+        return ESP_OK;
+    }
+    if (*length < item.Value.size()) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(value, item.Value.data(), item.Value.size());
+    *length = item.Value.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value)
+{
+    size_t length = sizeof(*value);
+    return Get(handle, key, ItemType::U32, value, &length);
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *value)
+{
+    size_t length = sizeof(*value);
+    return Get(handle, key, ItemType::I32, value, &length);
+}
+
+esp_err_t nvs_get_u64(nvs_handle_t handle, const char *key, uint64_t *value)
+{
+    size_t length = sizeof(*value);
+    return Get(handle, key, ItemType::U64, value, &length);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *length)
+{
+    return Get(handle, key, ItemType::Str, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length)
+{
+    return Get(handle, key, ItemType::Blob, value, length);
+}
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+#
+# api_load.py
+#
+# Load test for the local HTTP API (CONFIG_DONE_LOCAL_API). It keeps
+# --connections connections alive and sends requests back to back on each one
+# for --duration seconds. Then it prints requests/s, the latency percentiles
+# and the status codes seen.
+#
+# Usage:
+#   ./tools/api_load.py <host> [--port 80] [--path /api/v1/state] [--connections 2]
+#                       [--duration 10] [--etag] [--post]
+#
+# --etag sends back the last ETag as If-None-Match, the way a polling dashboard
+# does, so unchanged state is answered with 304. --post sends the path as a
+# POST, e.g. --post --path "/api/v1/command?action=light&on=1". The connection
+# count should not exceed CONFIG_DONE_LOCAL_API_CLIENTS, otherwise httpd
+# closes the least recently used connection and the client reconnects.
+#
+
+import argparse
+import asyncio
+import sys
+import time
+
+
+class Stats:
+    def __init__(self):
+        self.latencies = []
+        self.statuses = {}
+        self.reconnects = 0
+
+
+async def read_response(reader):
+    head = await reader.readuntil(b"\r\n\r\n")
+    lines = head.decode("latin-1").split("\r\n")
+    status = int(lines[0].split(" ", 2)[1])
+    headers = {}
+    for line in lines[1:]:
+        if ":" in line:
+            key, value = line.split(":", 1)
+            headers[key.strip().lower()] = value.strip()
+    length = int(headers.get("content-length", "0"))
+    if length:
+        await reader.readexactly(length)
+    return status, headers
+
+
+async def worker(args, stats, deadline):
+    method = "POST" if args.post else "GET"
+    etag = None
+    reader = writer = None
+    while time.monotonic() < deadline:
+        if writer is None:
+            reader, writer = await asyncio.open_connection(args.host, args.port)
+        extra = f"If-None-Match: {etag}\r\n" if etag else ""
+        body = "Content-Length: 0\r\n" if args.post else ""
+        request = f"{method} {args.path} HTTP/1.1\r\nHost: {args.host}\r\n{extra}{body}\r\n"
+        start = time.perf_counter()
+        try:
+            writer.write(request.encode())
+            status, headers = await read_response(reader)
+        except (asyncio.IncompleteReadError, ConnectionError):
+            # Purged by httpd or closed after an error; not a sample
+            writer.close()
+            writer = None
+            stats.reconnects += 1
+            continue
+        stats.latencies.append(time.perf_counter() - start)
+        stats.statuses[status] = stats.statuses.get(status, 0) + 1
+        if args.etag:
+            etag = headers.get("etag", etag)
+    if writer is not None:
+        writer.close()
+
+
+def percentile(values, fraction):
+    if not values:
+        return 0.0
+    index = min(len(values) - 1, max(0, int(round(fraction * len(values) + 0.5)) - 1))
+    return values[index]
+
+
+async def run(args):
+    stats = Stats()
+    deadline = time.monotonic() + args.duration
+    start = time.monotonic()
+    await asyncio.gather(*(worker(args, stats, deadline) for _ in range(args.connections)))
+    elapsed = time.monotonic() - start
+    return stats, elapsed
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Keep-alive load test for the local HTTP API")
+    parser.add_argument("host")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--path", default="/api/v1/state")
+    parser.add_argument("--connections", type=int, default=2)
+    parser.add_argument("--duration", type=float, default=10.0)
+    parser.add_argument("--etag", action="store_true", help="send If-None-Match with the last ETag")
+    parser.add_argument("--post", action="store_true", help="send POST instead of GET")
+    args = parser.parse_args()
+
+    try:
+        stats, elapsed = asyncio.run(run(args))
+    except OSError as err:
+        print(f"api_load: {err}", file=sys.stderr)
+        return 1
+
+    latencies = sorted(stats.latencies)
+    count = len(latencies)
+    print(f"{count} requests on {args.connections} connections in {elapsed:.1f} s: {count / elapsed:.0f} req/s")
+    if count:
+        ms = [1000 * percentile(latencies, f) for f in (0.5, 0.9, 0.99)]
+        print(f"latency ms: p50 {ms[0]:.2f}  p90 {ms[1]:.2f}  p99 {ms[2]:.2f}  max {1000 * latencies[-1]:.2f}")
+    print("status: " + ", ".join(f"{code} x{n}" for code, n in sorted(stats.statuses.items())) +
+          (f", {stats.reconnects} reconnects" if stats.reconnects else ""))
+    return 0 if count else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
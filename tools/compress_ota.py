@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+#
+# compress_ota.py
+#
+# Compresses an app image for the pipelined OTA path (see main/CompressedOta.hpp)
+# with a heatshrink-compatible LZSS encoder, and optionally serves it over HTTPS
+# so a device can fetch it with `ota_z https://<host>:<port>/<file>`.
+#
+# Usage:
+#   ./tools/compress_ota.py <app.bin> <app.dhz> [-w 12] [-l 5] [--verify]
+#                           [--serve 8070 --cert cert.pem --key key.pem]
+#
+# The device checks the server against its certificate bundle. Without --cert the
+# image is served over plain HTTP, which only firmware that verifies app
+# signatures on update (CONFIG_SECURE_SIGNED_ON_UPDATE) accepts.
+#
+# The window size sets the decoder RAM on the device (2^w bytes); the lookahead
+# sets the longest match. The defaults suit ESP32 firmware images. An image that
+# does not compress (already compressed or encrypted) is stored as is behind the
+# header instead, with window and lookahead bits 0.
+#
+
+import argparse
+import functools
+import http.server
+import os
+import ssl
+import struct
+import sys
+import time
+
+MAGIC = b"DHSZ"
+HEADER_FMT = "<4sBBHI"
+MAX_CHAIN = 48      # candidates tried per position
+
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.bits = 0
+        self.count = 0
+
+    def write(self, value, count):
+        self.bits = (self.bits << count) | value
+        self.count += count
+        while self.count >= 8:
+            self.count -= 8
+            self.out.append((self.bits >> self.count) & 0xFF)
+        self.bits &= (1 << self.count) - 1
+
+    def finish(self):
+        if self.count:
+            self.out.append((self.bits << (8 - self.count)) & 0xFF)
+            self.count = 0
+        return bytes(self.out)
+
+
+def compress(data, window_bits, lookahead_bits):
+    window = 1 << window_bits
+    max_len = 1 << lookahead_bits
+    # A backref must be cheaper than the literals it replaces
+    min_len = (1 + window_bits + lookahead_bits) // 9 + 1
+    writer = BitWriter()
+    heads = {}
+    chain = [-1] * len(data)
+    n = len(data)
+
+    def insert(pos):
+        if pos + 3 <= n:
+            key = data[pos:pos + 3]
+            chain[pos] = heads.get(key, -1)
+            heads[key] = pos
+
+    pos = 0
+    while pos < n:
+        best_len = 0
+        best_off = 0
+        if pos + 3 <= n:
+            candidate = heads.get(data[pos:pos + 3], -1)
+            limit = min(max_len, n - pos)
+            tries = MAX_CHAIN
+            while candidate >= 0 and pos - candidate <= window and tries:
+                if data[candidate + best_len:candidate + best_len + 1] == data[pos + best_len:pos + best_len + 1]:
+                    length = 3
+                    while length < limit and data[candidate + length] == data[pos + length]:
+                        length += 1
+                    if length > best_len:
+                        best_len = length
+                        best_off = pos - candidate
+                        if length == limit:
+                            break
+                candidate = chain[candidate]
+                tries -= 1
+
+        if best_len >= min_len:
+            writer.write(0, 1)
+            writer.write(best_off - 1, window_bits)
+            writer.write(best_len - 1, lookahead_bits)
+            for p in range(pos, pos + best_len):
+                insert(p)
+            pos += best_len
+        else:
+            writer.write(1, 1)
+            writer.write(data[pos], 8)
+            insert(pos)
+            pos += 1
+
+    body = writer.finish()
+    if len(body) >= n:
+        return struct.pack(HEADER_FMT, MAGIC, 0, 0, 0, n) + bytes(data)
+    return struct.pack(HEADER_FMT, MAGIC, window_bits, lookahead_bits, 0, n) + body
+
+
+def decompress(blob):
+    """Reference decoder, mirrors CompressedOta::Decode()."""
+    magic, window_bits, lookahead_bits, _, size = struct.unpack_from(HEADER_FMT, blob)
+    if magic != MAGIC:
+        raise ValueError("not a compressed image")
+    if window_bits == 0:
+        return bytes(blob[struct.calcsize(HEADER_FMT):struct.calcsize(HEADER_FMT) + size])
+    mask = (1 << window_bits) - 1
+    window = bytearray(mask + 1)
+    out = bytearray()
+    stream = iter(blob[struct.calcsize(HEADER_FMT):])
+    bits = 0
+    held = 0
+
+    def read(count):
+        nonlocal bits, held
+        while held < count:
+            byte = next(stream, None)
+            if byte is None:
+                raise ValueError("truncated stream")
+            bits = (bits << 8) | byte
+            held += 8
+        held -= count
+        value = bits >> held
+        bits &= (1 << held) - 1
+        return value
+
+    while len(out) < size:
+        if read(1):
+            byte = read(8)
+            window[len(out) & mask] = byte
+            out.append(byte)
+        else:
+            offset = read(window_bits) + 1
+            count = min(read(lookahead_bits) + 1, size - len(out))
+            for _ in range(count):
+                byte = window[(len(out) - offset) & mask]
+                window[len(out) & mask] = byte
+                out.append(byte)
+    return bytes(out)
+
+
+def serve(path, port, cert, key):
+    directory, name = os.path.split(os.path.abspath(path))
+    handler = functools.partial(http.server.SimpleHTTPRequestHandler, directory=directory)
+    with http.server.ThreadingHTTPServer(("", port), handler) as server:
+        scheme = "http"
+        if cert:
+            context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+            context.load_cert_chain(cert, key)
+            server.socket = context.wrap_socket(server.socket, server_side=True)
+            scheme = "https"
+        print(f"serving {name}: ota_z {scheme}://<this host>:{port}/{name}")
+        server.serve_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compress an app image for OTA")
+    parser.add_argument("image")
+    parser.add_argument("output")
+    parser.add_argument("-w", "--window-bits", type=int, default=12, choices=range(4, 16))
+    parser.add_argument("-l", "--lookahead-bits", type=int, default=5, choices=range(3, 15))
+    parser.add_argument("--verify", action="store_true", help="decode the result and compare")
+    parser.add_argument("--serve", type=int, metavar="PORT", help="serve the output over HTTPS")
+    parser.add_argument("--cert", help="server certificate (PEM) for --serve")
+    parser.add_argument("--key", help="private key (PEM) of --cert")
+    args = parser.parse_args()
+    if args.cert and not args.key:
+        parser.error("--cert needs --key")
+    if args.lookahead_bits >= args.window_bits:
+        parser.error("lookahead must be smaller than the window")
+
+    with open(args.image, "rb") as f:
+        data = f.read()
+    start = time.monotonic()
+    blob = compress(data, args.window_bits, args.lookahead_bits)
+    elapsed = time.monotonic() - start
+    with open(args.output, "wb") as f:
+        f.write(blob)
+    stored = blob[4] == 0
+    print(f"{len(data)} -> {len(blob)} bytes ({100.0 * len(blob) / max(len(data), 1):.1f}%), "
+          + ("stored uncompressed" if stored else f"window {1 << args.window_bits} bytes")
+          + f", {elapsed:.1f} s")
+
+    if args.verify:
+        if decompress(blob) != data:
+            print("verify: MISMATCH", file=sys.stderr)
+            return 1
+        print("verify: OK")
+
+    if args.serve:
+        serve(args.output, args.serve, args.cert, args.key)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+#
+# icache_report.py
+#
+# Attributes the output of the `icache dump` console command (see
+# main/ICacheProfiler.hpp) to functions and components. It ranks the flash
+# functions that miss most as candidates for IRAM (DONE_HOT, main/HotPath.hpp).
+#
+# Usage:
+#   ./tools/icache_report.py <serial_log.txt> <build/project.elf> [--map build/project.map]
+#                            [--top 25] [--iram-budget 8192] [--nm xtensa-esp32s3-elf-nm]
+#
+# Functions come from the ELF symbol table (nm). Components come from the
+# archive each input section was linked from in the map file. Without --map
+# the component column is left empty. The dump holds 32-byte code lines, so a
+# line shared by two functions is charged to the one it starts in.
+#
+
+import argparse
+import bisect
+import re
+import shutil
+import subprocess
+import sys
+from collections import defaultdict
+
+# Code address ranges of the ESP32-S3 and ESP32
+REGIONS = [
+    (0x40000000, 0x40060000, "ROM"),
+    (0x40370000, 0x403E0000, "IRAM"),
+    (0x42000000, 0x44000000, "flash"),
+    (0x40080000, 0x400A0000, "IRAM"),
+    (0x400D0000, 0x40400000, "flash"),
+]
+ARCHIVE_RE = re.compile(r"(?:^|/)lib([\w\-]+)\.a\(")
+NM_TOOLS = ("xtensa-esp32s3-elf-nm", "xtensa-esp32-elf-nm", "nm")
+
+
+def parse_dump(lines):
+    """Return (event, dropped, cores, entries) of the last complete dump in the log."""
+    event, dropped, cores, entries = None, 0, [], []
+    current = None
+    for line in lines:
+        if "DONE_ICACHE_BEGIN" in line:
+            fields = line[line.find("DONE_ICACHE_BEGIN"):].split()
+            current = (fields[1], int(fields[3]), [], [])
+            continue
+        if current is None:
+            continue
+        if "DONE_ICACHE_END" in line:
+            event, dropped, cores, entries = current
+            current = None
+            continue
+        start = line.find("IC_CORE,")
+        if start >= 0:
+            fields = line[start:].strip().split(",")
+            current[2].append(tuple(int(f) for f in fields[1:5]))
+            continue
+        start = line.find("IC,")
+        if start >= 0:
+            fields = line[start:].strip().split(",")
+            if len(fields) == 5:
+                current[3].append((int(fields[1], 16), int(fields[2]), int(fields[3]), int(fields[4])))
+    if event is None:
+        sys.exit("no complete DONE_ICACHE_BEGIN ... DONE_ICACHE_END block in the log")
+    return event, dropped, cores, entries
+
+
+def read_symbols(elf, nm):
+    """Sorted (address, size, name) of the functions in the ELF."""
+    tool = nm or next((t for t in NM_TOOLS if shutil.which(t)), None)
+    if tool is None:
+        sys.exit("no nm found, pass --nm")
+    out = subprocess.run([tool, "-S", "-C", "-n", "--defined-only", elf],
+                         capture_output=True, text=True, check=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        fields = line.split(None, 3)
+        if len(fields) == 4 and fields[2] in "TtWw":
+            symbols.append((int(fields[0], 16), int(fields[1], 16), fields[3]))
+    return symbols
+
+
+def read_components(path):
+    """Sorted (address, size, component) of every input section in the map file."""
+    ranges = []
+    pending = None
+    with open(path, errors="replace") as f:
+        for raw in f:
+            fields = raw.split()
+            if len(fields) == 1 and fields[0].startswith("."):
+                pending = fields[0]
+                continue
+            if pending and len(fields) >= 3 and fields[0].startswith("0x"):
+                fields = [pending] + fields
+            pending = None
+            if len(fields) >= 4 and fields[0].startswith(".") and fields[1].startswith("0x") \
+                    and fields[2].startswith("0x"):
+                match = ARCHIVE_RE.search(fields[3])
+                size = int(fields[2], 16)
+                if match and size:
+                    ranges.append((int(fields[1], 16), size, match.group(1)))
+    ranges.sort()
+    return ranges
+
+
+def lookup(table, starts, address):
+    index = bisect.bisect_right(starts, address) - 1
+    if index >= 0:
+        start, size, value = table[index]
+        if address < start + max(size, 1):
+            return table[index]
+    return None
+
+
+def region_of(address):
+    for start, end, name in REGIONS:
+        if start <= address < end:
+            return name
+    return "other"
+
+
+def per_thousand(events, instructions):
+    return events * 1000.0 / instructions if instructions else 0.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Attribute an icache dump to functions and components")
+    parser.add_argument("log", help="serial log holding the `icache dump` output")
+    parser.add_argument("elf", help="application ELF, build/<project>.elf")
+    parser.add_argument("--map", help="linker map file, for the component of each function")
+    parser.add_argument("--nm", help="nm of the toolchain (default: found on PATH)")
+    parser.add_argument("--top", type=int, default=25, help="functions to list")
+    parser.add_argument("--iram-budget", type=int, default=8192,
+                        help="bytes of IRAM to fill with candidates (CONFIG_DONE_HOT_PATHS_IRAM_BUDGET)")
+    args = parser.parse_args()
+
+    with open(args.log, errors="replace") as f:
+        event, dropped, cores, entries = parse_dump(f)
+    symbols = read_symbols(args.elf, args.nm)
+    symbol_starts = [s[0] for s in symbols]
+    components = read_components(args.map) if args.map else []
+    component_starts = [c[0] for c in components]
+
+    # function name -> [events, samples, instructions, address, size, component]
+    functions = {}
+    by_component = defaultdict(lambda: [0, 0, 0])
+    for address, samples, events, instructions in entries:
+        symbol = lookup(symbols, symbol_starts, address)
+        owner = lookup(components, component_starts, address)
+        component = owner[2] if owner else ""
+        if symbol:
+            key, start, size = symbol[2], symbol[0], symbol[1]
+        else:
+            key, start, size = "?@%08x" % address, address, 0
+        entry = functions.setdefault(key, [0, 0, 0, start, size, component])
+        entry[0] += events
+        entry[1] += samples
+        entry[2] += instructions
+        totals = by_component[component or "?"]
+        totals[0] += events
+        totals[1] += samples
+        totals[2] += instructions
+
+    unit = "misses" if event == "miss" else "stall cycles"
+    total_events = sum(c[2] for c in cores) or 1
+    total_instructions = sum(c[3] for c in cores)
+    print("%d %s over %d samples, %.2f per 1000 instructions" % (
+        sum(c[2] for c in cores), unit, sum(c[1] for c in cores),
+        per_thousand(sum(c[2] for c in cores), total_instructions)))
+    for core, samples, events, instructions in cores:
+        print("  core %d: %d %s, %.2f per 1000 instructions" % (
+            core, events, unit, per_thousand(events, instructions)))
+    if dropped:
+        print("  %d samples dropped: the line table was full, raise CONFIG_DONE_ICACHE_PROFILER_LINES" % dropped)
+
+    print("\nBy component:")
+    print("  %12s %6s %8s %8s  %s" % (unit, "share", "samples", "per-1k", "component"))
+    for name, (events, samples, instructions) in sorted(by_component.items(), key=lambda i: -i[1][0]):
+        print("  %12d %5.1f%% %8d %8.2f  %s" % (
+            events, events * 100.0 / total_events, samples, per_thousand(events, instructions), name))
+
+    ranked = sorted(functions.items(), key=lambda i: -i[1][0])
+    print("\nBy function:")
+    print("  %12s %6s %8s %6s %6s  %s" % (unit, "share", "per-1k", "region", "size", "function [component]"))
+    for name, (events, samples, instructions, start, size, component) in ranked[:args.top]:
+        print("  %12d %5.1f%% %8.2f %6s %6d  %s%s" % (
+            events, events * 100.0 / total_events, per_thousand(events, instructions),
+            region_of(start), size, name, " [%s]" % component if component else ""))
+
+    print("\nIRAM candidates within %d bytes:" % args.iram_budget)
+    used = 0
+    covered = 0
+    for name, (events, samples, instructions, start, size, component) in ranked:
+        if region_of(start) != "flash" or size == 0 or events == 0 or used + size > args.iram_budget:
+            continue
+        used += size
+        covered += events
+        print("  %6d B  %5.1f%%  %s%s" % (size, events * 100.0 / total_events, name,
+                                          " [%s]" % component if component else ""))
+    print("  %d bytes would take %.1f%% of the %s off the flash cache" % (
+        used, covered * 100.0 / total_events, unit))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
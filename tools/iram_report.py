@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+#
+# iram_report.py
+#
+# Reports the IRAM taken by the hot paths (see main/HotPath.hpp) from the
+# linker map file: DONE_HOT functions (.iram1.hot.* sections) and the code of
+# sources placed in IRAM with done_hot_sources(... IRAM ...), whose generated
+# *_hot_paths.lf fragments are read from the build directory.
+#
+# Usage:
+#   ./tools/iram_report.py <build/project.map> [--fragments build] [--budget 8192] [--top 20]
+#
+# Exits non-zero when the hot paths exceed the budget. Run through the
+# iram_report build target, which passes CONFIG_DONE_HOT_PATHS_IRAM_BUDGET.
+#
+
+import argparse
+import glob
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+IRAM_TEXT = ".iram0.text"
+HOT_SECTION = ".iram1.hot."
+OBJECT_RE = re.compile(r"(?:^|/)lib([\w\-]+)\.a\(([\w\-]+)\.[\w.]*o(?:bj)?\)$")
+
+
+def read_fragments(build_dir):
+    """(component, object) pairs placed in IRAM by done_hot_sources()."""
+    objects = set()
+    for path in glob.glob(os.path.join(build_dir, "**", "*_hot_paths.lf"), recursive=True):
+        component = None
+        with open(path) as f:
+            for line in f:
+                line = line.strip()
+                if line.startswith("archive:"):
+                    component = line.split(":", 1)[1].strip()[len("lib"):-len(".a")]
+                elif line.endswith("(noflash_text)") and component:
+                    objects.add((component, line.split()[0]))
+    return objects
+
+
+def parse_map(path):
+    """Input sections of the .iram0.text output section: (name, size, archive member, symbol)."""
+    sections = []
+    in_iram = False
+    pending = None
+    with open(path, errors="replace") as f:
+        for raw in f:
+            line = raw.rstrip("\n")
+            if line and not line[0].isspace():
+                # A new output section starts at column 0
+                in_iram = line.split()[0] == IRAM_TEXT
+                pending = None
+                continue
+            if not in_iram:
+                continue
+            fields = line.split()
+            if not fields:
+                continue
+            if fields[0].startswith(".") and len(fields) == 1:
+                # Long input section name, address and size follow on the next line
+                pending = fields[0]
+                continue
+            if pending and len(fields) >= 3 and fields[0].startswith("0x"):
+                fields = [pending] + fields
+            pending = None
+            if len(fields) >= 4 and fields[0].startswith(".") and fields[2].startswith("0x"):
+                sections.append([fields[0], int(fields[2], 16), fields[3], None])
+            elif len(fields) == 2 and fields[0].startswith("0x") and sections and sections[-1][3] is None:
+                # First symbol listed after an input section names it
+                sections[-1][3] = fields[1]
+    return sections
+
+
+def demangle(names):
+    tool = next((t for t in ("xtensa-esp32s3-elf-c++filt", "riscv32-esp-elf-c++filt", "c++filt")
+                 if shutil.which(t)), None)
+    if not tool or not names:
+        return names
+    result = subprocess.run([tool], input="\n".join(names), capture_output=True, text=True)
+    out = result.stdout.splitlines()
+    return out if len(out) == len(names) else names
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Report the IRAM used by DONE hot paths")
+    parser.add_argument("map", help="linker map file, build/<project>.map")
+    parser.add_argument("--fragments", help="build directory holding the *_hot_paths.lf fragments")
+    parser.add_argument("--budget", type=int, default=0, help="fail above this many bytes, 0 for no limit")
+    parser.add_argument("--top", type=int, default=20, help="largest entries to list")
+    args = parser.parse_args()
+
+    iram_objects = read_fragments(args.fragments) if args.fragments else set()
+    sections = parse_map(args.map)
+
+    total_iram = sum(size for _, size, _, _ in sections)
+    hot = []
+    for name, size, member, symbol in sections:
+        if size == 0:
+            continue
+        match = OBJECT_RE.search(member)
+        owner = (match.group(1), match.group(2)) if match else None
+        if HOT_SECTION in name:
+            kind = "DONE_HOT"
+        elif owner in iram_objects:
+            kind = "source"
+        else:
+            continue
+        where = "%s/%s" % owner if owner else member
+        hot.append((size, kind, where, symbol or name))
+
+    hot.sort(reverse=True)
+    used = sum(entry[0] for entry in hot)
+    names = demangle([entry[3] for entry in hot[:args.top]])
+
+    print("Hot paths in IRAM: %d bytes in %d sections (%s total %d bytes)"
+          % (used, len(hot), IRAM_TEXT, total_iram))
+    for (size, kind, where, _), name in zip(hot, names):
+        print("  %6d  %-8s  %-32s %s" % (size, kind, where, name))
+    if len(hot) > args.top:
+        print("  ... %d more" % (len(hot) - args.top))
+
+    if args.budget:
+        print("Budget: %d of %d bytes (%d%%)" % (used, args.budget, used * 100 // args.budget))
+        if used > args.budget:
+            print("error: hot paths exceed CONFIG_DONE_HOT_PATHS_IRAM_BUDGET", file=sys.stderr)
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
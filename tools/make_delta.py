@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+#
+# make_delta.py
+#
+# Builds a delta OTA patch (see main/DeltaOta.hpp) turning the firmware image that is
+# running on the devices into a new build, and optionally verifies it by applying it.
+#
+# Usage:
+#   ./tools/make_delta.py <old.bin> <new.bin> <patch.bin> [--verify]
+#
+# --verify only runs the Python reference decoder below; the firmware applier itself
+# is tested on this script's output by delta_ota_test (see test/).
+#
+# Matching is bsdiff-like: exact matches are found through an index of the old
+# image, then extended with mismatches allowed and encoded as ADD (bytewise
+# difference), which stays small when only addresses inside the code moved.
+#
+
+import argparse
+import hashlib
+import struct
+import sys
+import time
+
+MAGIC = b"DDLT"
+VERSION = 1
+HEADER_FMT = "<4sHHII32s32s"
+
+OP_COPY = 0x01
+OP_ADD = 0x02
+OP_INSERT = 0x03
+
+KEY_LEN = 12        # bytes hashed per index entry
+INDEX_STEP = 4      # index every 4th offset of the old image
+MIN_MATCH = 24      # shorter exact matches are cheaper as literals
+MAX_CANDIDATES = 16
+FUZZ_WINDOW = 64    # stop extending after this many bytes without improvement
+MIN_ZERO_RUN = 16   # unchanged bytes inside an ADD worth a COPY op (9 byte header)
+
+
+def build_index(old):
+    index = {}
+    for offset in range(0, len(old) - KEY_LEN + 1, INDEX_STEP):
+        index.setdefault(old[offset:offset + KEY_LEN], []).append(offset)
+    return index
+
+
+def exact_forward(old, new, s, t):
+    length = 0
+    limit = min(len(old) - s, len(new) - t)
+    step = 64
+    while length < limit:
+        n = min(step, limit - length)
+        if old[s + length:s + length + n] == new[t + length:t + length + n]:
+            length += n
+            continue
+        while length < limit and old[s + length] == new[t + length]:
+            length += 1
+        break
+    return length
+
+
+def fuzzy_forward(old, new, s, t):
+    """Length of the region after (s, t) worth encoding as ADD rather than literals"""
+    limit = min(len(old) - s, len(new) - t)
+    score = best_score = best_len = 0
+    i = 0
+    while i < limit and i - best_len <= FUZZ_WINDOW:
+        score += 1 if old[s + i] == new[t + i] else -1
+        i += 1
+        if score > best_score:
+            best_score, best_len = score, i
+    return best_len
+
+
+def split_add(src, delta):
+    """The patch is not compressed, so long zero runs inside an ADD go out as COPY"""
+    pos = 0
+    add_start = 0
+    while pos < len(delta):
+        if delta[pos] != 0:
+            pos += 1
+            continue
+        run_end = pos
+        while run_end < len(delta) and delta[run_end] == 0:
+            run_end += 1
+        if run_end - pos >= MIN_ZERO_RUN:
+            if pos > add_start:
+                yield OP_ADD, src + add_start, delta[add_start:pos]
+            yield OP_COPY, src + pos, run_end - pos
+            add_start = run_end
+        pos = run_end
+    if add_start < len(delta):
+        yield OP_ADD, src + add_start, delta[add_start:]
+
+
+def diff(old, new):
+    """Yield (op, src, data_or_length)"""
+    index = build_index(old)
+    t = 0
+    literal_start = 0
+    while t <= len(new) - KEY_LEN:
+        candidates = index.get(new[t:t + KEY_LEN])
+        if not candidates:
+            t += 1
+            continue
+
+        best_s, best_len = 0, 0
+        for s in candidates[-MAX_CANDIDATES:]:
+            length = exact_forward(old, new, s, t)
+            if length > best_len:
+                best_s, best_len = s, length
+        if best_len < MIN_MATCH:
+            t += 1
+            continue
+
+        # Grow backwards into the pending literal bytes
+        back = 0
+        while (t - back > literal_start and best_s - back > 0 and
+               old[best_s - back - 1] == new[t - back - 1]):
+            back += 1
+        s, start = best_s - back, t - back
+        length = best_len + back
+
+        # Keep going with mismatches while it pays off
+        length += fuzzy_forward(old, new, s + length, start + length)
+
+        if start > literal_start:
+            yield OP_INSERT, 0, new[literal_start:start]
+        chunk_new = new[start:start + length]
+        chunk_old = old[s:s + length]
+        if chunk_new == chunk_old:
+            yield OP_COPY, s, length
+        else:
+            delta = bytes((a - b) & 0xFF for a, b in zip(chunk_new, chunk_old))
+            yield from split_add(s, delta)
+        t = literal_start = start + length
+
+    if literal_start < len(new):
+        yield OP_INSERT, 0, new[literal_start:]
+
+
+def encode(old, new):
+    header = struct.pack(HEADER_FMT, MAGIC, VERSION, 0, len(old), len(new),
+                         hashlib.sha256(old).digest(), hashlib.sha256(new).digest())
+    out = bytearray(header)
+    counts = {OP_COPY: 0, OP_ADD: 0, OP_INSERT: 0}
+    for op, src, payload in diff(old, new):
+        counts[op] += 1
+        if op == OP_COPY:
+            out += struct.pack("<BII", op, src, payload)
+        elif op == OP_ADD:
+            out += struct.pack("<BII", op, src, len(payload)) + payload
+        else:
+            out += struct.pack("<BI", op, len(payload)) + payload
+    return bytes(out), counts
+
+
+def apply(old, patch):
+    """Reference decoder, mirrors DeltaOta::Write()"""
+    header_len = struct.calcsize(HEADER_FMT)
+    magic, version, _, old_size, new_size, old_sha, new_sha = struct.unpack_from(HEADER_FMT, patch)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a delta patch")
+    if len(old) < old_size or hashlib.sha256(old[:old_size]).digest() != old_sha:
+        raise ValueError("patch was made against a different image")
+
+    out = bytearray()
+    pos = header_len
+    while pos < len(patch):
+        op = patch[pos]
+        if op == OP_COPY:
+            src, length = struct.unpack_from("<II", patch, pos + 1)
+            out += old[src:src + length]
+            pos += 9
+        elif op == OP_ADD:
+            src, length = struct.unpack_from("<II", patch, pos + 1)
+            data = patch[pos + 9:pos + 9 + length]
+            out += bytes((a + b) & 0xFF for a, b in zip(old[src:src + length], data))
+            pos += 9 + length
+        elif op == OP_INSERT:
+            (length,) = struct.unpack_from("<I", patch, pos + 1)
+            out += patch[pos + 5:pos + 5 + length]
+            pos += 5 + length
+        else:
+            raise ValueError("bad op 0x%02x at %d" % (op, pos))
+    if len(out) != new_size or hashlib.sha256(out).digest() != new_sha:
+        raise ValueError("reconstructed image does not match the target hash")
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a delta OTA patch")
+    parser.add_argument("old", help="image currently running on the devices")
+    parser.add_argument("new", help="new image")
+    parser.add_argument("patch", help="output patch")
+    parser.add_argument("--verify", action="store_true",
+                        help="apply the patch and check the result against the new image")
+    args = parser.parse_args()
+
+    with open(args.old, "rb") as f:
+        old = f.read()
+    with open(args.new, "rb") as f:
+        new = f.read()
+
+    start = time.monotonic()
+    patch, counts = encode(old, new)
+    elapsed = time.monotonic() - start
+    with open(args.patch, "wb") as f:
+        f.write(patch)
+
+    print("patch: %d bytes for a %d byte image (%.1f%%), copy %d add %d insert %d, %.1f s" %
+          (len(patch), len(new), 100.0 * len(patch) / max(len(new), 1),
+           counts[OP_COPY], counts[OP_ADD], counts[OP_INSERT], elapsed))
+
+    if args.verify:
+        start = time.monotonic()
+        rebuilt = apply(old, patch)
+        elapsed = time.monotonic() - start
+        if rebuilt != new:
+            sys.stderr.write("verification failed\n")
+            return 1
+        print("verified: rebuilt %d bytes in %.2f s (%.0f KB/s)" %
+              (len(rebuilt), elapsed, len(rebuilt) / 1024 / max(elapsed, 1e-6)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
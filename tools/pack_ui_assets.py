@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+#
+# pack_ui_assets.py
+#
+# Converts UI images (PNG/JPEG/BMP) into a pre-decoded asset pack that the firmware
+# maps straight from flash (see main/UIAssetPack.hpp), so nothing is decoded at runtime.
+#
+# Pixels are stored in the LVGL v8 native layouts for LV_COLOR_DEPTH=16:
+#   format 0 = LV_IMG_CF_TRUE_COLOR        (RGB565, 2 bytes/px)
+#   format 1 = LV_IMG_CF_TRUE_COLOR_ALPHA  (RGB565 + A8 interleaved, 3 bytes/px)
+#
+# Usage:
+#   ./tools/pack_ui_assets.py <assets_dir> <output.bin> [--max-size BYTES] [--swap16]
+#
+
+import argparse
+import os
+import struct
+import sys
+
+try:
+    from PIL import Image
+except ImportError:
+    sys.stderr.write("pack_ui_assets.py: Pillow is required (pip install pillow)\n")
+    sys.exit(1)
+
+PACK_MAGIC = b"DUAP"
+PACK_VERSION = 1
+HEADER_FMT = "<4sHHII"      # magic, version, count, total size, reserved
+ENTRY_FMT = "<32sHHB3xII"   # name, width, height, format, offset, size
+NAME_LEN = 32
+DATA_ALIGN = 4
+
+FORMAT_RGB565 = 0
+FORMAT_RGB565_A8 = 1
+
+IMAGE_EXTENSIONS = (".png", ".jpg", ".jpeg", ".bmp")
+
+
+def rgb565(r, g, b, swap):
+    value = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3)
+    return struct.pack(">H" if swap else "<H", value)
+
+
+def convert(path, swap):
+    image = Image.open(path)
+    has_alpha = image.mode in ("RGBA", "LA") or "transparency" in image.info
+    image = image.convert("RGBA" if has_alpha else "RGB")
+    raw = image.tobytes()
+    out = bytearray()
+    if has_alpha:
+        for i in range(0, len(raw), 4):
+            out += rgb565(raw[i], raw[i + 1], raw[i + 2], swap)
+            out.append(raw[i + 3])
+        fmt = FORMAT_RGB565_A8
+    else:
+        for i in range(0, len(raw), 3):
+            out += rgb565(raw[i], raw[i + 1], raw[i + 2], swap)
+        fmt = FORMAT_RGB565
+    return image.width, image.height, fmt, bytes(out)
+
+
+def align(value):
+    return (value + DATA_ALIGN - 1) & ~(DATA_ALIGN - 1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build the UI asset pack")
+    parser.add_argument("assets_dir")
+    parser.add_argument("output")
+    parser.add_argument("--max-size", type=lambda v: int(v, 0), default=0,
+                        help="fail if the pack is larger than the target partition")
+    parser.add_argument("--swap16", action="store_true",
+                        help="byte-swap RGB565 pixels (LV_COLOR_16_SWAP)")
+    args = parser.parse_args()
+
+    files = sorted(f for f in os.listdir(args.assets_dir)
+                   if f.lower().endswith(IMAGE_EXTENSIONS))
+
+    # Entries are sorted by name so the firmware can binary-search them
+    assets = []
+    for name in files:
+        key = os.path.splitext(name)[0]
+        if len(key.encode()) >= NAME_LEN:
+            sys.stderr.write("asset name too long: %s\n" % key)
+            return 1
+        assets.append((key,) + convert(os.path.join(args.assets_dir, name), args.swap16))
+    assets.sort(key=lambda a: a[0].encode())
+
+    offset = align(struct.calcsize(HEADER_FMT) + struct.calcsize(ENTRY_FMT) * len(assets))
+    table = bytearray()
+    blob = bytearray()
+    for key, width, height, fmt, pixels in assets:
+        table += struct.pack(ENTRY_FMT, key.encode(), width, height, fmt,
+                             offset + len(blob), len(pixels))
+        blob += pixels
+        blob += b"\0" * (align(len(blob)) - len(blob))
+
+    total = offset + len(blob)
+    header = struct.pack(HEADER_FMT, PACK_MAGIC, PACK_VERSION, len(assets), total, 0)
+    pack = header + table
+    pack += b"\0" * (offset - len(pack)) + blob
+
+    if args.max_size and total > args.max_size:
+        sys.stderr.write("asset pack is %d bytes, partition holds %d\n" % (total, args.max_size))
+        return 1
+
+    with open(args.output, "wb") as f:
+        f.write(pack)
+
+    print("UI asset pack: %d assets, %d bytes -> %s" % (len(assets), total, args.output))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
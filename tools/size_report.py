@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+#
+# size_report.py
+#
+# Reports the app image size by component from the linker map file. It checks
+# the free space left in the app partition.
+#
+# Usage:
+#   ./tools/size_report.py <build/project.map> [--bin build/project.bin] [--partition-size 0x2E0000]
+#                          [--margin 64] [--json size.json] [--baseline previous.json] [--top 25]
+#
+# The sizes are the bytes each component's input sections take in the output
+# sections of the image: flash code, flash data, IRAM, DRAM and RTC. A
+# component is the archive (lib<component>.a) its sections were linked from.
+# With CONFIG_DONE_LTO the code optimized across components comes from the LTO
+# partitions and is reported as "(lto)".
+#
+# Exits non-zero when less than --margin KB of the partition is left free. Run
+# through the size_report build target, which passes the boot app partition
+# size and CONFIG_DONE_APP_SIZE_MARGIN_KB. --json and --baseline track growth
+# between CI runs.
+#
+
+import argparse
+import json
+import os
+import re
+import sys
+from collections import defaultdict
+
+COLUMNS = ("flash code", "flash data", "IRAM", "DRAM", "RTC")
+# Output section prefix -> column, longest prefix first
+SECTIONS = (
+    (".flash.text", "flash code"),
+    (".flash.", "flash data"),
+    (".eh_frame", "flash data"),
+    (".iram0.", "IRAM"),
+    (".dram0.", "DRAM"),
+    (".noinit", "DRAM"),
+    (".rtc", "RTC"),
+)
+# Output sections that take RAM but are not stored in the image
+NOT_IN_IMAGE_RE = re.compile(r"bss|noinit|noload|heap_start")
+ARCHIVE_RE = re.compile(r"(?:^|/)lib([\w\-+]+)\.a\(")
+LTO_RE = re.compile(r"\.ltrans\d*\.ltrans\.o$|\.ltrans\.o$")
+
+
+def column_of(section):
+    for prefix, column in SECTIONS:
+        if section.startswith(prefix):
+            return column
+    return None
+
+
+def owner_of(member):
+    match = ARCHIVE_RE.search(member)
+    if match:
+        return match.group(1)
+    if LTO_RE.search(member):
+        return "(lto)"
+    return "(objects)"
+
+
+def parse_map(path):
+    """component -> {column: bytes, "image": bytes}"""
+    sizes = defaultdict(lambda: defaultdict(int))
+    started = False
+    column = None
+    in_image = False
+    pending = None
+    with open(path, errors="replace") as f:
+        for raw in f:
+            line = raw.rstrip("\n")
+            if not started:
+                # Skips the discarded input sections listed before the memory map
+                started = line.startswith("Linker script and memory map")
+                continue
+            if line and not line[0].isspace():
+                output = line.split()[0]
+                column = column_of(output)
+                in_image = column is not None and not NOT_IN_IMAGE_RE.search(output)
+                pending = None
+                continue
+            if column is None:
+                continue
+            fields = line.split()
+            if not fields:
+                continue
+            if fields[0].startswith(".") and len(fields) == 1:
+                # Long input section name, address and size follow on the next line
+                pending = fields[0]
+                continue
+            if pending and len(fields) >= 3 and fields[0].startswith("0x"):
+                fields = [pending] + fields
+            pending = None
+            if len(fields) >= 4 and fields[1].startswith("0x") and fields[2].startswith("0x") \
+                    and (fields[0].startswith(".") or fields[0] == "COMMON"):
+                size = int(fields[2], 16)
+                if size:
+                    component = sizes[owner_of(fields[3])]
+                    component[column] += size
+                    if in_image:
+                        component["image"] += size
+    return sizes
+
+
+def parse_size(text):
+    return int(text, 0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Report the app image size by component")
+    parser.add_argument("map", help="linker map file, build/<project>.map")
+    parser.add_argument("--bin", help="app binary, build/<project>.bin, for the exact image size")
+    parser.add_argument("--partition-size", type=parse_size, default=0, help="size of the app partition in bytes")
+    parser.add_argument("--margin", type=int, default=0, help="fail with less than this many KB free in the partition")
+    parser.add_argument("--json", help="write the sizes to this file")
+    parser.add_argument("--baseline", help="sizes written by --json of an earlier build, to print the growth")
+    parser.add_argument("--top", type=int, default=25, help="components to list")
+    args = parser.parse_args()
+
+    sizes = parse_map(args.map)
+    baseline = {}
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f).get("components", {})
+
+    ranked = sorted(sizes.items(), key=lambda i: -i[1]["image"])
+    header = "".join("%11s" % c for c in COLUMNS)
+    print("%-28s%s%11s%s" % ("component", header, "image", "     growth" if baseline else ""))
+    for name, columns in ranked[:args.top]:
+        line = "%-28s%s%11d" % (name[:27], "".join("%11d" % columns[c] for c in COLUMNS), columns["image"])
+        if baseline:
+            line += "%+11d" % (columns["image"] - baseline.get(name, {}).get("image", 0))
+        print(line)
+    if len(ranked) > args.top:
+        rest = ranked[args.top:]
+        print("%-28s%s%11d" % ("... %d more" % len(rest),
+                               "".join("%11d" % sum(c[col] for _, c in rest) for col in COLUMNS),
+                               sum(c["image"] for _, c in rest)))
+    totals = {c: sum(columns[c] for columns in sizes.values()) for c in COLUMNS + ("image",)}
+    line = "%-28s%s%11d" % ("total", "".join("%11d" % totals[c] for c in COLUMNS), totals["image"])
+    if baseline:
+        line += "%+11d" % (totals["image"] - sum(c.get("image", 0) for c in baseline.values()))
+    print(line)
+    if baseline:
+        gone = sorted(set(baseline) - set(sizes))
+        if gone:
+            print("no longer linked: %s" % ", ".join(gone))
+
+    image = os.path.getsize(args.bin) if args.bin else totals["image"]
+    status = 0
+    if args.partition_size:
+        free = args.partition_size - image
+        print("\nImage %d of %d bytes in the app partition, %d bytes (%d%%) free" % (
+            image, args.partition_size, free, free * 100 // args.partition_size))
+        if free < args.margin * 1024:
+            print("error: less than CONFIG_DONE_APP_SIZE_MARGIN_KB (%d KB) free in the app partition"
+                  % args.margin, file=sys.stderr)
+            status = 1
+    else:
+        print("\nImage %d bytes" % image)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"image": image, "partition_size": args.partition_size,
+                       "components": {name: dict(columns) for name, columns in sizes.items()}},
+                      f, indent=1, sort_keys=True)
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
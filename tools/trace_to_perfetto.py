@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+#
+# trace_to_perfetto.py
+#
+# Converts the output of the `trace dump` console command (see main/TraceRecorder.hpp)
+# into Chrome trace JSON, which opens in chrome://tracing and https://ui.perfetto.dev.
+#
+# Usage:
+#   ./tools/trace_to_perfetto.py <serial_log.txt> <trace.json> [--names names.json]
+#
+# names.json optionally maps ServiceIDs / dispatch tags to names, e.g. {"2": "MATTER"}.
+#
+
+import argparse
+import json
+import sys
+
+EVENT_BUS_ENQUEUE = 1
+EVENT_BUS_DEQUEUE = 2
+EVENT_HANDLER_ENTER = 3
+EVENT_HANDLER_EXIT = 4
+EVENT_MARK = 5
+
+TIMESTAMP_WRAP = 1 << 32
+
+
+def parse(lines):
+    """Yield (timestamp_us, core, event, arg0, arg1), unwrapping the 32-bit timestamp"""
+    last = None
+    offset = 0
+    for line in lines:
+        start = line.find("DT,")
+        if start < 0:
+            continue
+        fields = line[start:].strip().split(",")
+        if len(fields) != 6:
+            continue
+        try:
+            ts, core, event, arg0, arg1 = (int(f) for f in fields[1:])
+        except ValueError:
+            continue
+        if last is not None and ts + offset < last - TIMESTAMP_WRAP // 2:
+            offset += TIMESTAMP_WRAP
+        last = ts + offset
+        yield last, core, event, arg0, arg1
+
+
+# Dispatch tags recorded by main, see main/TraceRecorder.hpp
+TAG_NAMES = {0x100: "UI frame", 0x200: "timer", 0x300: "job", 0x400: "flow step"}
+
+
+def convert(records, names):
+    def name_of(ident):
+        default = "service %d" % ident if ident < 0x100 else TAG_NAMES.get(ident, "tag 0x%x" % ident)
+        return names.get(str(ident), default)
+
+    events = [{"ph": "M", "pid": 0, "tid": core, "name": "thread_name",
+               "args": {"name": "core %d" % core}} for core in (0, 1)]
+    for ts, core, event, arg0, arg1 in records:
+        base = {"pid": 0, "tid": core, "ts": ts}
+        if event == EVENT_HANDLER_ENTER:
+            events.append(dict(base, ph="B", name=name_of(arg0), args={"type": arg1}))
+        elif event == EVENT_HANDLER_EXIT:
+            events.append(dict(base, ph="E", name=name_of(arg0)))
+        elif event == EVENT_BUS_ENQUEUE:
+            events.append(dict(base, ph="i", s="t", name="enqueue -> " + name_of(arg0),
+                               args={"msg": arg1}))
+            events.append(dict(base, ph="s", id=arg1, cat="bus", name="bus"))
+        elif event == EVENT_BUS_DEQUEUE:
+            events.append(dict(base, ph="i", s="t", name="dequeue @ " + name_of(arg0),
+                               args={"msg": arg1}))
+            events.append(dict(base, ph="f", bp="e", id=arg1, cat="bus", name="bus"))
+        elif event == EVENT_MARK:
+            events.append(dict(base, ph="i", s="t", name="mark %d" % arg0, args={"value": arg1}))
+    return {"traceEvents": events, "displayTimeUnit": "us"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert a DONE trace dump to Perfetto JSON")
+    parser.add_argument("log")
+    parser.add_argument("output")
+    parser.add_argument("--names", help="JSON map of ServiceID/tag to display name")
+    args = parser.parse_args()
+
+    names = {}
+    if args.names:
+        with open(args.names) as f:
+            names = json.load(f)
+
+    with open(args.log, errors="replace") as f:
+        records = list(parse(f))
+    if not records:
+        sys.stderr.write("no trace records found in %s\n" % args.log)
+        return 1
+
+    with open(args.output, "w") as f:
+        json.dump(convert(records, names), f)
+    print("%d events -> %s" % (len(records), args.output))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())